@@ -0,0 +1,300 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#if !defined(_WIN32) && !defined(__ANDROID__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "SDL.h"
+#include "file_view.h"
+
+#define FILE_PACK_MAGIC "FILEPAK"
+#define FILE_PACK_ALIGN 16
+
+static_assert(sizeof(file_pack_header) == 24, "file_pack_header must not be padded");
+static_assert(sizeof(file_pack_entry) == 32, "file_pack_entry must not be padded");
+
+/* A pack opened with file_pack_open(), its index pointing in its view */
+struct file_pack {
+	std::string filename;
+	file_view view;
+	const file_pack_header* header;
+	const file_pack_entry* entries;
+	const char* names;
+};
+
+static std::vector<file_pack*> packs;
+
+static int compare_name(const file_pack* pack, const file_pack_entry& entry, const char* name, size_t name_size) {
+	int res = memcmp(pack->names + entry.name_offset, name, std::min((size_t)entry.name_size, name_size));
+	if (res != 0)
+		return res;
+	return (entry.name_size < name_size) ? -1 : (entry.name_size > name_size);
+}
+
+/* Binary search in the packs, the last opened first */
+static bool find_packed(const char* filename, const char** data, size_t* size) {
+	size_t name_size = strlen(filename);
+	for (int p = (int)packs.size() - 1; p >= 0; p--) {
+		const file_pack* pack = packs[p];
+		uint32_t first = 0, last = pack->header->nb_files;
+		while (first < last) {
+			uint32_t middle = first + (last - first) / 2;
+			int res = compare_name(pack, pack->entries[middle], filename, name_size);
+			if (res == 0) {
+				*data = pack->view.data() + pack->entries[middle].offset;
+				*size = pack->entries[middle].size;
+				return true;
+			}
+			if (res < 0)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+	}
+	return false;
+}
+
+file_view::file_view() : kind(VIEW_NONE), bytes(NULL), length(0) {
+}
+
+file_view::file_view(const char* filename, int flags) : kind(VIEW_NONE), bytes(NULL), length(0) {
+	open(filename, flags);
+}
+
+file_view::~file_view() {
+	close();
+}
+
+/* Files that can't be mapped, and empty ones, which mmap() refuses */
+static char* read_rwops(const char* filename, size_t* size) {
+	SDL_RWops *rw = SDL_RWFromFile(filename, "rb");
+	if (rw == NULL)
+		return NULL;
+	Sint64 res_size = SDL_RWsize(rw);
+	char* res = (char*)malloc(res_size + 1);
+
+	Sint64 nb_read_total = 0, nb_read = 1;
+	char* buf = res;
+	while (nb_read_total < res_size && nb_read != 0) {
+		nb_read = SDL_RWread(rw, buf, 1, (res_size - nb_read_total));
+		nb_read_total += nb_read;
+		buf += nb_read;
+	}
+	SDL_RWclose(rw);
+	if (nb_read_total != res_size) {
+		free(res);
+		return NULL;
+	}
+	*size = nb_read_total;
+	return res;
+}
+
+/**
+ * View filename's content, from a pack if one has it.  Returns false,
+ * with SDL_GetError() telling why, if the file can't be read.
+ */
+bool file_view::open(const char* filename, int flags) {
+	close();
+	if (!(flags & FILE_VIEW_NO_PACK) && find_packed(filename, &bytes, &length)) {
+		kind = VIEW_BORROWED;
+		return true;
+	}
+#if !defined(_WIN32) && !defined(__ANDROID__)
+	int fd = ::open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		SDL_SetError("%s", strerror(errno));
+		if (fd >= 0)
+			::close(fd);
+		return false;
+	}
+	if (st.st_size > 0) {
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED) {
+			SDL_SetError("cannot map: %s", strerror(errno));
+			return false;
+		}
+		if (flags & FILE_VIEW_SEQUENTIAL)
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+		if (flags & FILE_VIEW_WILLNEED)
+			madvise(data, st.st_size, MADV_WILLNEED);
+		kind = VIEW_MAPPED;
+		bytes = (const char*)data;
+		length = st.st_size;
+		return true;
+	}
+	::close(fd);
+#endif
+	bytes = read_rwops(filename, &length);
+	if (bytes == NULL)
+		return false;
+	kind = VIEW_ALLOCATED;
+	return true;
+}
+
+void file_view::close() {
+#if !defined(_WIN32) && !defined(__ANDROID__)
+	if (kind == VIEW_MAPPED)
+		munmap((void*)bytes, length);
+#endif
+	if (kind == VIEW_ALLOCATED)
+		free((void*)bytes);
+	kind = VIEW_NONE;
+	bytes = NULL;
+	length = 0;
+}
+
+SDL_RWops* file_view::rwops() const {
+	return SDL_RWFromConstMem(bytes, length);
+}
+
+static uint64_t align(uint64_t offset) {
+	return (offset + FILE_PACK_ALIGN - 1) & ~(uint64_t)(FILE_PACK_ALIGN - 1);
+}
+
+/**
+ * Pack files under their names as given, which file_view::open() will
+ * look for.  Written under another name first, not to leave a
+ * truncated pack behind.
+ */
+bool file_pack_write(const char* filename, const std::vector<std::string>& files) {
+	std::vector<std::string> sorted(files);
+	std::sort(sorted.begin(), sorted.end());
+
+	file_pack_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FILE_PACK_MAGIC, sizeof(FILE_PACK_MAGIC));
+	header.version = FILE_PACK_VERSION;
+	header.nb_files = sorted.size();
+	std::string names;
+	std::vector<file_pack_entry> entries(sorted.size());
+	std::vector<file_view*> views(sorted.size());
+	for (size_t i = 0; i < sorted.size(); i++) {
+		if (i > 0 && sorted[i] == sorted[i-1]) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+				"%s: %s given twice", filename, sorted[i].c_str());
+			for (size_t j = 0; j < i; j++)
+				delete views[j];
+			return false;
+		}
+		memset(&entries[i], 0, sizeof(entries[i]));
+		entries[i].name_offset = names.size();
+		entries[i].name_size = sorted[i].size();
+		names += sorted[i];
+		views[i] = new file_view(sorted[i].c_str(), FILE_VIEW_NO_PACK | FILE_VIEW_SEQUENTIAL);
+		if (!views[i]->is_open()) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+				"Cannot open %s: %s", sorted[i].c_str(), SDL_GetError());
+			for (size_t j = 0; j <= i; j++)
+				delete views[j];
+			return false;
+		}
+		entries[i].size = views[i]->size();
+	}
+	header.names_size = names.size();
+	uint64_t offset = sizeof(header) + entries.size() * sizeof(file_pack_entry) + names.size();
+	for (size_t i = 0; i < entries.size(); i++) {
+		entries[i].offset = align(offset);
+		offset = entries[i].offset + entries[i].size;
+	}
+
+	std::string tmp = std::string(filename) + ".tmp";
+	FILE* out = fopen(tmp.c_str(), "wb");
+	bool ok = out != NULL
+		&& fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(entries.data(), sizeof(file_pack_entry), entries.size(), out) == entries.size()
+		&& fwrite(names.data(), 1, names.size(), out) == names.size();
+	static const char padding[FILE_PACK_ALIGN] = { 0 };
+	offset = sizeof(header) + entries.size() * sizeof(file_pack_entry) + names.size();
+	for (size_t i = 0; i < entries.size() && ok; i++) {
+		size_t pad = entries[i].offset - offset;
+		ok = fwrite(padding, 1, pad, out) == pad
+			&& fwrite(views[i]->data(), 1, views[i]->size(), out) == views[i]->size();
+		offset = entries[i].offset + entries[i].size;
+	}
+	for (size_t i = 0; i < views.size(); i++)
+		delete views[i];
+	if (out != NULL)
+		ok = (fclose(out) == 0) && ok;
+#ifdef _WIN32
+	if (ok)
+		remove(filename);  // rename() doesn't replace
+#endif
+	if (!ok || rename(tmp.c_str(), filename) != 0) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"Cannot write %s", filename);
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+/* NULL if the pack can be used */
+static const char* check_pack(const file_pack* pack) {
+	size_t size = pack->view.size();
+	const file_pack_header* h = pack->header;
+	if (size < sizeof(file_pack_header) || memcmp(h->magic, FILE_PACK_MAGIC, sizeof(FILE_PACK_MAGIC)) != 0)
+		return "not a pack file";
+	if (h->version != FILE_PACK_VERSION)
+		return "other version";
+	uint64_t index_size = (uint64_t)h->nb_files * sizeof(file_pack_entry);
+	if (index_size > size - sizeof(file_pack_header)
+		|| h->names_size > size - sizeof(file_pack_header) - index_size)
+		return "truncated";
+	for (uint32_t i = 0; i < h->nb_files; i++) {
+		const file_pack_entry& e = pack->entries[i];
+		if ((uint64_t)e.name_offset + e.name_size > h->names_size || e.offset > size || e.size > size - e.offset)
+			return "truncated";
+		if (i > 0 && compare_name(pack, pack->entries[i-1], pack->names + e.name_offset, e.name_size) >= 0)
+			return "index not sorted";
+	}
+	return NULL;
+}
+
+/**
+ * Open a pack made by file_pack_write(): file_view::open() looks there
+ * first, then on disk.  The views of packed files point in the pack,
+ * which stays open until file_pack_close().  Silently returns false
+ * when there is no such file, with SDL_GetError() telling why.
+ */
+bool file_pack_open(const char* filename) {
+	file_pack* pack = new file_pack;
+	pack->filename = filename;
+	if (!pack->view.open(filename, FILE_VIEW_NO_PACK)) {
+		delete pack;
+		return false;
+	}
+	pack->header = (const file_pack_header*)pack->view.data();
+	pack->entries = (const file_pack_entry*)(pack->header + 1);
+	pack->names = NULL;
+	if (pack->view.size() >= sizeof(file_pack_header))
+		pack->names = (const char*)(pack->entries + pack->header->nb_files);
+	const char* error = check_pack(pack);
+	if (error != NULL) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"Not using %s: %s", filename, error);
+		delete pack;
+		return false;
+	}
+	packs.push_back(pack);
+	return true;
+}
+
+/* All of them: the views in them are no longer valid */
+void file_pack_close() {
+	for (unsigned int i = 0; i < packs.size(); i++)
+		delete packs[i];
+	packs.clear();
+}
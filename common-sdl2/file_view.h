@@ -0,0 +1,72 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _FILE_VIEW_H
+#define _FILE_VIEW_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SDL.h"
+
+/* How a view is about to be read, see file_view::open() */
+enum FILE_VIEW_FLAGS {
+	FILE_VIEW_SEQUENTIAL = 1,  // once from start to end, e.g. parsed
+	FILE_VIEW_WILLNEED   = 2,  // all of it, soon: start reading ahead now
+	FILE_VIEW_NO_PACK    = 4,  // on disk only, e.g. caches written while running
+};
+
+/**
+ * Read-only content of a file, valid as long as the view: mapped in
+ * memory on desktop systems, so that its pages go straight from the
+ * page cache to the reader, read through SDL_RWops where files can't
+ * be mapped (Android assets), or a span of a pack file opened with
+ * file_pack_open().  Not NUL-terminated.
+ */
+class file_view {
+public:
+	file_view();
+	explicit file_view(const char* filename, int flags = 0);
+	~file_view();
+	bool open(const char* filename, int flags = 0);
+	void close();
+	bool is_open() const { return bytes != NULL; }
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+	/* For SDL loaders, e.g. IMG_Load_RW(view.rwops(), 1) */
+	SDL_RWops* rwops() const;
+private:
+	enum { VIEW_NONE, VIEW_MAPPED, VIEW_ALLOCATED, VIEW_BORROWED } kind;
+	const char* bytes;
+	size_t length;
+	file_view(const file_view&) = delete;
+	file_view& operator=(const file_view&) = delete;
+};
+
+/* Bump when the layout changes */
+#define FILE_PACK_VERSION 1
+
+/**
+ * Pack file: shaders, models and textures in one file, mapped once
+ * when the demo starts, rather than opened one by one:
+ *   header | entries, sorted by name | names | data, each aligned to 16
+ */
+struct file_pack_header {
+	char magic[8];        // "FILEPAK\0"
+	uint32_t version;     // FILE_PACK_VERSION
+	uint32_t nb_files;
+	uint64_t names_size;  // bytes of the names that follow the entries
+};
+
+struct file_pack_entry {
+	uint64_t offset, size;  // from the start of the pack
+	uint32_t name_offset, name_size;  // in the names, without a NUL
+	uint32_t reserved[2];
+};
+
+bool file_pack_write(const char* filename, const std::vector<std::string>& files);
+bool file_pack_open(const char* filename);
+void file_pack_close();
+#endif
@@ -0,0 +1,265 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+#include <algorithm>
+#include "SDL.h"
+#include "shader_utils.h"
+#include "file_watch.h"
+
+using namespace std;
+
+/*
+ * A change is a file written and closed, or renamed over: editors
+ * that save to a temporary file first would otherwise be seen half
+ * way.  The directories are watched rather than the files, since a
+ * rename replaces the file that a watch would follow.
+ */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct watched_file {
+	string name;
+	int64_t mtime, size;  // where there is no inotify
+};
+
+static vector<watched_file> watched_files;
+static int inotify_fd = -1;
+/* Directory of each inotify watch, as the watched files spell it; a directory may be spelled several ways */
+static vector<pair<int, string> > directory_watches;
+static time_t last_check = 0;
+
+/* The size too, for the edits in the same second */
+static void file_stamp(const char* filename, int64_t* mtime, int64_t* size) {
+	struct stat st;
+	bool ok = stat(filename, &st) == 0;
+	*mtime = ok ? (int64_t)st.st_mtime : 0;
+	*size = ok ? (int64_t)st.st_size : -1;
+}
+
+static watched_file* find_watched_file(const string& name) {
+	for (unsigned int i = 0; i < watched_files.size(); i++)
+		if (watched_files[i].name == name)
+			return &watched_files[i];
+	return NULL;
+}
+
+#ifdef __linux__
+static string file_directory(const string& filename) {
+	size_t slash = filename.find_last_of("/\\");
+	return slash == string::npos ? "" : filename.substr(0, slash + 1);
+}
+
+#endif
+
+bool watch_file(const char* filename) {
+	if (find_watched_file(filename) != NULL)
+		return true;
+	watched_file f;
+	f.name = filename;
+	file_stamp(filename, &f.mtime, &f.size);
+	watched_files.push_back(f);
+#ifdef __linux__
+	if (inotify_fd < 0)
+		inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0)
+		return true;  // modification times then
+	string dir = file_directory(filename);
+	int wd = inotify_add_watch(inotify_fd, dir.empty() ? "." : dir.c_str(), WATCH_EVENTS);
+	if (wd < 0) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+					   "Cannot watch %s", filename);
+		return false;
+	}
+	if (find(directory_watches.begin(), directory_watches.end(), make_pair(wd, dir)) == directory_watches.end())
+		directory_watches.push_back(make_pair(wd, dir));
+#endif
+	return true;
+}
+
+#ifdef __linux__
+static void add_changed(vector<string>* changed, const string& name) {
+	if (find_watched_file(name) != NULL && find(changed->begin(), changed->end(), name) == changed->end())
+		changed->push_back(name);
+}
+
+static void read_events(vector<string>* changed) {
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+		for (char* p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+			const struct inotify_event* event = (const struct inotify_event*)p;
+			if (event->mask & IN_Q_OVERFLOW) {
+				// Events lost: assume the worst
+				for (unsigned int i = 0; i < watched_files.size(); i++)
+					add_changed(changed, watched_files[i].name);
+				continue;
+			}
+			if (event->len == 0)
+				continue;
+			for (unsigned int i = 0; i < directory_watches.size(); i++)
+				if (directory_watches[i].first == event->wd)
+					add_changed(changed, directory_watches[i].second + event->name);
+		}
+	}
+}
+#endif
+
+/* The watched files changed since the last call, if any */
+bool get_changed_files(vector<string>* changed) {
+	changed->clear();
+#ifdef __linux__
+	if (inotify_fd >= 0) {
+		read_events(changed);
+		return !changed->empty();
+	}
+#endif
+	time_t now = time(NULL);
+	if (now == last_check)
+		return false;
+	last_check = now;
+	for (unsigned int i = 0; i < watched_files.size(); i++) {
+		watched_file& f = watched_files[i];
+		int64_t mtime, size;
+		file_stamp(f.name.c_str(), &mtime, &size);
+		if (mtime != f.mtime || size != f.size) {
+			f.mtime = mtime;
+			f.size = size;
+			changed->push_back(f.name);
+		}
+	}
+	return !changed->empty();
+}
+
+void unwatch_files() {
+#ifdef __linux__
+	if (inotify_fd >= 0)
+		close(inotify_fd);
+#endif
+	inotify_fd = -1;
+	directory_watches.clear();
+	watched_files.clear();
+}
+
+struct watched_program {
+	GLuint* program;
+	string files[2], defines;
+	bool has_defines;
+	program_locations_func locations;
+	void* data;
+	vector<string> dependencies;  // the shaders and the files they include
+	GLuint pending;               // rebuilt program being compiled, or 0
+	bool again;                   // changed again while being compiled
+};
+
+static vector<watched_program> watched_programs;
+
+/* Also after a change, which may include other files; those no longer included are harmless */
+static bool watch_dependencies(watched_program* w) {
+	bool ok = true;
+	for (int i = 0; i < 2; i++) {
+		vector<string> files;
+		get_shader_files(w->files[i].c_str(), &files);
+		for (unsigned int j = 0; j < files.size(); j++) {
+			if (find(w->dependencies.begin(), w->dependencies.end(), files[j]) != w->dependencies.end())
+				continue;
+			w->dependencies.push_back(files[j]);
+			ok = watch_file(files[j].c_str()) && ok;
+		}
+	}
+	return ok;
+}
+
+bool watch_program(GLuint* program, const char* vertexfile, const char* fragmentfile,
+				   const char* defines, program_locations_func locations, void* data) {
+	watched_program w;
+	w.program = program;
+	w.files[0] = vertexfile;
+	w.files[1] = fragmentfile;
+	w.has_defines = defines != NULL;
+	w.defines = defines != NULL ? defines : "";
+	w.locations = locations;
+	w.data = data;
+	w.pending = 0;
+	w.again = false;
+	bool ok = watch_dependencies(&w);
+	watched_programs.push_back(w);
+	return ok;
+}
+
+static void start_reload(watched_program* w) {
+	w->again = false;
+	watch_dependencies(w);
+	w->pending = create_program_async(w->files[0].c_str(), w->files[1].c_str(),
+									  w->has_defines ? w->defines.c_str() : NULL);
+	if (w->pending == 0)
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+					   "%s, %s: keeping the last good program", w->files[0].c_str(), w->files[1].c_str());
+}
+
+static bool depends_on(const watched_program& w, const vector<string>& changed) {
+	for (unsigned int i = 0; i < changed.size(); i++)
+		if (find(w.dependencies.begin(), w.dependencies.end(), changed[i]) != w.dependencies.end())
+			return true;
+	return false;
+}
+
+/**
+ * Once per frame: start rebuilding the programs whose files changed,
+ * and swap in those that are ready.  Only the frame that finishes a
+ * program waits for the compiler, and not at all with
+ * GL_KHR_parallel_shader_compile.
+ */
+int reload_programs() {
+	vector<string> changed;
+	if (get_changed_files(&changed)) {
+		for (unsigned int i = 0; i < watched_programs.size(); i++) {
+			watched_program& w = watched_programs[i];
+			if (!depends_on(w, changed))
+				continue;
+			if (w.pending != 0)
+				w.again = true;
+			else
+				start_reload(&w);
+		}
+	}
+
+	int nb_replaced = 0;
+	for (unsigned int i = 0; i < watched_programs.size(); i++) {
+		watched_program& w = watched_programs[i];
+		if (w.pending == 0 || !program_ready(w.pending))
+			continue;
+		GLuint program = finish_program(w.pending);
+		w.pending = 0;
+		if (program != 0 && (w.locations == NULL || w.locations(program, w.data))) {
+			glDeleteProgram(*w.program);
+			*w.program = program;
+			nb_replaced++;
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO,
+						   "Reloaded %s, %s", w.files[0].c_str(), w.files[1].c_str());
+		} else {
+			glDeleteProgram(program);
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+						   "%s, %s: keeping the last good program", w.files[0].c_str(), w.files[1].c_str());
+		}
+		if (w.again)
+			start_reload(&w);
+	}
+	return nb_replaced;
+}
+
+/* The programs themselves stay with the demo */
+void unwatch_programs() {
+	for (unsigned int i = 0; i < watched_programs.size(); i++)
+		glDeleteProgram(finish_program(watched_programs[i].pending));
+	watched_programs.clear();
+	unwatch_files();
+}
@@ -0,0 +1,202 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "geometry_pool.h"
+
+unsigned long gl_buffers_created = 0;
+
+/**
+ * glGenBuffers for a single buffer, counted so that programs can
+ * check that they don't create any while drawing
+ */
+GLuint gen_buffer()
+{
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	gl_buffers_created++;
+	return buffer;
+}
+
+/* Two triangles covering the screen, in clip coordinates (x,y,z,w) */
+const GLfloat shape_screen_quad[6*4] = {
+	-1, -1, 0, 1,
+	 1, -1, 0, 1,
+	-1,  1, 0, 1,
+	-1,  1, 0, 1,
+	 1, -1, 0, 1,
+	 1,  1, 0, 1,
+};
+
+/* Cube 1x1x1, centered on origin (x,y,z,w) */
+const GLfloat shape_unit_cube[8*4] = {
+	-0.5, -0.5, -0.5, 1.0,
+	 0.5, -0.5, -0.5, 1.0,
+	 0.5,  0.5, -0.5, 1.0,
+	-0.5,  0.5, -0.5, 1.0,
+	-0.5, -0.5,  0.5, 1.0,
+	 0.5, -0.5,  0.5, 1.0,
+	 0.5,  0.5,  0.5, 1.0,
+	-0.5,  0.5,  0.5, 1.0,
+};
+
+/* Edges of a cube: two GL_LINE_LOOPs of 4 vertices, then 4 GL_LINES */
+const GLushort shape_cube_lines[16] = {
+	0, 1, 2, 3,
+	4, 5, 6, 7,
+	0, 4, 1, 5, 2, 6, 3, 7
+};
+
+/*
+ * Shapes that never change are uploaded the first time they are
+ * drawn, and then shared.  They are identified by the address of
+ * their data, so it must be static.
+ */
+#define MAX_STATIC_BUFFERS 32
+static struct {
+	const void* data;
+	GLenum target;
+	GLuint buffer;
+} static_buffers[MAX_STATIC_BUFFERS];
+static int nb_static_buffers = 0;
+
+/**
+ * Bind the buffer that holds this static data to target, uploading it
+ * the first time
+ */
+GLuint static_buffer(GLenum target, const void* data, GLsizeiptr size)
+{
+	for (int i = 0; i < nb_static_buffers; i++) {
+		if (static_buffers[i].data == data && static_buffers[i].target == target) {
+			glBindBuffer(target, static_buffers[i].buffer);
+			return static_buffers[i].buffer;
+		}
+	}
+
+	GLuint buffer = gen_buffer();
+	glBindBuffer(target, buffer);
+	glBufferData(target, size, data, GL_STATIC_DRAW);
+	if (nb_static_buffers == MAX_STATIC_BUFFERS) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"static_buffer: more than %d shapes, not kept", MAX_STATIC_BUFFERS);
+		return buffer;
+	}
+	static_buffers[nb_static_buffers].data = data;
+	static_buffers[nb_static_buffers].target = target;
+	static_buffers[nb_static_buffers].buffer = buffer;
+	nb_static_buffers++;
+	return buffer;
+}
+
+/*
+ * Streaming buffer, for vertices that change every time they are
+ * drawn.  It is filled like a ring, split in segments: when writing
+ * moves on to the next segment, a fence is placed after the draws
+ * that read the previous one, and the fence of the next one (placed
+ * one lap earlier) is waited for before overwriting it.  Without
+ * ARB_sync, and on GLES2 which has neither fences nor
+ * glMapBufferRange, the whole buffer is orphaned each time the ring
+ * wraps around instead, and the driver provides fresh storage.
+ */
+#define STREAM_SIZE (1 << 20)
+#define STREAM_SEGMENTS 4
+#define STREAM_SEGMENT_SIZE (STREAM_SIZE / STREAM_SEGMENTS)
+static GLuint stream_buffer = 0;
+static GLintptr stream_offset = 0;
+static int stream_segment = 0;
+static bool stream_synced = false;
+#ifndef GL_ES_VERSION_2_0
+static GLsync stream_fences[STREAM_SEGMENTS];
+#endif
+
+/**
+ * Copy vertices into the streaming buffer.  The buffer is left bound
+ * to GL_ARRAY_BUFFER, and the return value is the offset to pass to
+ * glVertexAttribPointer, or -1 on error.
+ */
+GLintptr stream_vertices(const void* data, GLsizeiptr size)
+{
+	if (size > STREAM_SEGMENT_SIZE) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"stream_vertices: %ld bytes do not fit in a segment", (long)size);
+		return -1;
+	}
+
+	if (stream_buffer == 0) {
+		stream_buffer = gen_buffer();
+		glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+		glBufferData(GL_ARRAY_BUFFER, STREAM_SIZE, NULL, GL_STREAM_DRAW);
+#ifndef GL_ES_VERSION_2_0
+		stream_synced = GLEW_ARB_sync && GLEW_ARB_map_buffer_range;
+#endif
+	} else {
+		glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+	}
+
+	// Aligned offsets, and each upload within a single segment
+	GLintptr offset = (stream_offset + 15) & ~15;
+	if (offset / STREAM_SEGMENT_SIZE != (offset + size - 1) / STREAM_SEGMENT_SIZE)
+		offset = (offset / STREAM_SEGMENT_SIZE + 1) * STREAM_SEGMENT_SIZE;
+	if (offset >= STREAM_SIZE)
+		offset = 0;
+
+	int segment = offset / STREAM_SEGMENT_SIZE;
+	if (segment != stream_segment) {
+#ifndef GL_ES_VERSION_2_0
+		if (stream_synced) {
+			stream_fences[stream_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			if (stream_fences[segment] != 0) {
+				glClientWaitSync(stream_fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);  // 1s
+				glDeleteSync(stream_fences[segment]);
+				stream_fences[segment] = 0;
+			}
+		}
+#endif
+		if (!stream_synced && segment == 0)
+			glBufferData(GL_ARRAY_BUFFER, STREAM_SIZE, NULL, GL_STREAM_DRAW);
+		stream_segment = segment;
+	}
+	stream_offset = offset + size;
+
+#ifndef GL_ES_VERSION_2_0
+	// The fences already guarantee that the GPU is done with this range
+	if (stream_synced) {
+		void* p = glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+									   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (p != NULL) {
+			memcpy(p, data, size);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			return offset;
+		}
+	}
+#endif
+	// without fences, or if the mapping failed
+	glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+	return offset;
+}
+
+void free_geometry_pool()
+{
+	for (int i = 0; i < nb_static_buffers; i++)
+		glDeleteBuffers(1, &static_buffers[i].buffer);
+	nb_static_buffers = 0;
+
+	if (stream_buffer != 0)
+		glDeleteBuffers(1, &stream_buffer);
+	stream_buffer = 0;
+	stream_offset = 0;
+	stream_segment = 0;
+#ifndef GL_ES_VERSION_2_0
+	for (int i = 0; i < STREAM_SEGMENTS; i++) {
+		if (stream_fences[i] != 0)
+			glDeleteSync(stream_fences[i]);
+		stream_fences[i] = 0;
+	}
+#endif
+}
@@ -0,0 +1,22 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _GEOMETRY_POOL_H
+#define _GEOMETRY_POOL_H
+#include <GL/glew.h>
+
+/* Buffer objects created through gen_buffer() since the start */
+extern unsigned long gl_buffers_created;
+GLuint gen_buffer();
+
+/* Helper shapes, see static_buffer() */
+extern const GLfloat shape_screen_quad[6*4];
+extern const GLfloat shape_unit_cube[8*4];
+extern const GLushort shape_cube_lines[16];
+
+GLuint static_buffer(GLenum target, const void* data, GLsizeiptr size);
+GLintptr stream_vertices(const void* data, GLsizeiptr size);
+void free_geometry_pool();
+#endif
@@ -0,0 +1,218 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "SDL.h"
+#include "mesh_cache.h"
+
+/*
+ * Models are parsed, indexed and optimized once, and the result is
+ * kept next to them in a file that the next runs map and hand over to
+ * the GPU as is:
+ *   header | LOD table | vertices (x,y,z,w,nx,ny,nz) | padding to 8 | elements
+ * A cache is used only if it was made from a model of the same size
+ * and modification time, and if its content hash is right; otherwise
+ * it is made again.
+ */
+
+#define MESH_CACHE_MAGIC "MESHBIN"
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static_assert(sizeof(mesh_cache_header) == 96, "mesh_cache_header must not be padded");
+static_assert(sizeof(mesh_cache_lod) == 16, "mesh_cache_lod must not be padded");
+
+/* Cache of the model file source */
+std::string mesh_cache_filename(const char* source) {
+	return std::string(source) + ".mesh";
+}
+
+/**
+ * FNV-1a, on 8 bytes at a time rather than 1, so that checking a cache
+ * costs much less than reading it.  hash: FNV_OFFSET_BASIS, or the
+ * hash of the previous block.
+ */
+uint64_t mesh_cache_hash(const void* data, size_t size, uint64_t hash) {
+	const unsigned char* p = (const unsigned char*)data;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, p + i, 8);
+		hash = (hash ^ word) * FNV_PRIME;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ p[i]) * FNV_PRIME;
+	return hash;
+}
+
+static bool source_stat(const char* source, int64_t* size, int64_t* mtime) {
+	struct stat st;
+	if (stat(source, &st) < 0)
+		return false;
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+	return true;
+}
+
+static uint64_t align8(uint64_t offset) {
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+/**
+ * Write the indexed mesh made from source to filename.  elements holds
+ * all the LODs one after the other, as described by lods, or only the
+ * full mesh when lods is empty.  The file is written under another
+ * name first, so that a run that stops halfway doesn't leave a
+ * truncated cache behind.
+ */
+bool mesh_cache_write(const char* filename, const char* source,
+	const std::vector<glm::vec4>& positions, const std::vector<glm::vec3>& normals,
+	const std::vector<unsigned int>& elements, const std::vector<mesh_cache_lod>& lods) {
+	mesh_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.stride = (4+3) * sizeof(float);
+	header.nb_vertices = positions.size();
+	header.element_size = (positions.size() <= 65536) ? 2 : 4;
+	header.nb_elements = elements.size();
+	std::vector<mesh_cache_lod> table = lods;
+	if (table.empty()) {
+		mesh_cache_lod full = { 0, header.nb_elements, 0, 0 };
+		table.push_back(full);
+	}
+	header.nb_lods = table.size();
+	if (!source_stat(source, &header.source_size, &header.source_mtime)) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"Cannot stat %s", source);
+		return false;
+	}
+
+	bool with_normals = normals.size() == positions.size();
+	std::vector<float> vertices(positions.size() * (4+3), 0);
+	glm::vec3 min_p(0.0), max_p(0.0);
+	for (size_t i = 0; i < positions.size(); i++) {
+		memcpy(&vertices[i*7], &positions[i], 4*sizeof(float));
+		if (with_normals)
+			memcpy(&vertices[i*7 + 4], &normals[i], 3*sizeof(float));
+		glm::vec3 p = glm::vec3(positions[i]);
+		min_p = (i == 0) ? p : glm::min(min_p, p);
+		max_p = (i == 0) ? p : glm::max(max_p, p);
+	}
+	for (int k = 0; k < 3; k++) {
+		header.bounds_min[k] = min_p[k];
+		header.bounds_max[k] = max_p[k];
+	}
+	std::vector<uint16_t> short_elements;
+	const void* element_data = elements.data();
+	if (header.element_size == 2) {
+		short_elements.assign(elements.begin(), elements.end());
+		element_data = short_elements.data();
+	}
+	size_t vertices_size = vertices.size() * sizeof(float);
+	size_t elements_size = (size_t)header.nb_elements * header.element_size;
+	size_t table_size = table.size() * sizeof(table[0]);
+	header.vertices_offset = sizeof(header) + table_size;
+	header.elements_offset = align8(header.vertices_offset + vertices_size);
+	header.hash = mesh_cache_hash(table.data(), table_size, FNV_OFFSET_BASIS);
+	header.hash = mesh_cache_hash(vertices.data(), vertices_size, header.hash);
+	header.hash = mesh_cache_hash(element_data, elements_size, header.hash);
+
+	std::string tmp = std::string(filename) + ".tmp";
+	FILE* out = fopen(tmp.c_str(), "wb");
+	if (out == NULL) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"Cannot write %s", tmp.c_str());
+		return false;
+	}
+	static const char padding[8] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(table.data(), 1, table_size, out) == table_size
+		&& fwrite(vertices.data(), 1, vertices_size, out) == vertices_size
+		&& fwrite(padding, 1, header.elements_offset - header.vertices_offset - vertices_size, out)
+			 == header.elements_offset - header.vertices_offset - vertices_size
+		&& fwrite(element_data, 1, elements_size, out) == elements_size;
+	ok = (fclose(out) == 0) && ok;
+#ifdef _WIN32
+	if (ok)
+		remove(filename);  // rename() doesn't replace
+#endif
+	if (!ok || rename(tmp.c_str(), filename) != 0) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"Cannot write %s", filename);
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+/* Why the cache can't be used, NULL if it can */
+static const char* check_cache(const mesh_cache* cache, const char* source) {
+	const mesh_cache_header* h = cache->header;
+	if (cache->file.size() < sizeof(*h) || memcmp(h->magic, MESH_CACHE_MAGIC, sizeof(h->magic)) != 0)
+		return "not a mesh cache";
+	if (h->version != MESH_CACHE_VERSION || h->stride != (4+3) * sizeof(float)
+			|| (h->element_size != 2 && h->element_size != 4))
+		return "other version";
+	int64_t source_size, source_mtime;
+	if (!source_stat(source, &source_size, &source_mtime)
+			|| source_size != h->source_size || source_mtime != h->source_mtime)
+		return "model changed";
+	uint64_t vertices_size = (uint64_t)h->nb_vertices * h->stride;
+	uint64_t elements_size = (uint64_t)h->nb_elements * h->element_size;
+	uint64_t table_size = (uint64_t)h->nb_lods * sizeof(mesh_cache_lod);
+	if (h->nb_lods == 0 || h->vertices_offset < sizeof(*h) + table_size
+			|| h->vertices_offset + vertices_size > cache->file.size()
+			|| h->elements_offset < h->vertices_offset + vertices_size
+			|| h->elements_offset + elements_size > cache->file.size())
+		return "truncated";
+	uint64_t hash = mesh_cache_hash(cache->lods, table_size, FNV_OFFSET_BASIS);
+	hash = mesh_cache_hash(cache->vertices, vertices_size, hash);
+	if (mesh_cache_hash(cache->elements, elements_size, hash) != h->hash)
+		return "corrupted";
+	for (uint32_t i = 0; i < h->nb_lods; i++)
+		if ((uint64_t)cache->lods[i].first_element + cache->lods[i].nb_elements > h->nb_elements)
+			return "corrupted";
+	return NULL;
+}
+
+/**
+ * Map the cache filename of the model file source, if it is up to
+ * date.  Silently returns false when there is no cache yet.
+ */
+bool mesh_cache_open(const char* filename, const char* source, mesh_cache* cache) {
+	mesh_cache_close(cache);
+	// all of it is about to be read: start reading ahead now; written while running, so never in a pack
+	if (!cache->file.open(filename, FILE_VIEW_WILLNEED | FILE_VIEW_NO_PACK) || cache->file.size() == 0) {
+		cache->file.close();
+		return false;
+	}
+	cache->header = (const mesh_cache_header*)cache->file.data();
+	if (cache->file.size() >= sizeof(mesh_cache_header)) {
+		cache->lods = (const mesh_cache_lod*)(cache->header + 1);
+		cache->vertices = cache->file.data() + cache->header->vertices_offset;
+		cache->elements = cache->file.data() + cache->header->elements_offset;
+	}
+	const char* error = check_cache(cache, source);
+	if (error != NULL) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"Not using %s: %s", filename, error);
+		mesh_cache_close(cache);
+		return false;
+	}
+	return true;
+}
+
+void mesh_cache_close(mesh_cache* cache) {
+	cache->file.close();
+	cache->header = NULL;
+	cache->lods = NULL;
+	cache->vertices = NULL;
+	cache->elements = NULL;
+}
@@ -0,0 +1,297 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "mesh_optimizer.h"
+
+/*
+ * Triangle order for the GPU, after "Fast Triangle Reordering for
+ * Vertex Locality and Reduced Overdraw", Sander, Nehab and Barczak,
+ * SIGGRAPH 2007 (Tipsify):
+ * 1. reorder the triangles so that their vertices are still in the
+ *    post-transform cache when they are used again;
+ * 2. cut the result in clusters where the cache is cold anyway, and
+ *    draw the clusters that face outwards first, so that they hide
+ *    the rest of the mesh behind them from most points of view;
+ * 3. renumber the vertices in the order they are first used, so that
+ *    they are fetched from memory mostly sequentially.
+ */
+
+/* FIFO cache: a vertex is in the cache while less than cache_size
+   others came in after it.  stamp[v] is when it came in, 0: never */
+static inline bool cache_miss(unsigned int v, std::vector<unsigned int>& stamp,
+	unsigned int* time, int cache_size) {
+	if (stamp[v] != 0 && *time - stamp[v] < (unsigned int)cache_size)
+		return false;
+	stamp[v] = ++*time;
+	return true;
+}
+
+/**
+ * Vertex shader runs with a FIFO post-transform cache of cache_size
+ * vertices: per triangle (ACMR) and per vertex used (ATVR).
+ */
+void mesh_cache_stats(const unsigned int* elements, size_t nb_elements, size_t nb_vertices,
+	int cache_size, mesh_stats* stats) {
+	std::vector<unsigned int> stamp(nb_vertices, 0);
+	std::vector<bool> used(nb_vertices, false);
+	unsigned int time = 0;
+	size_t misses = 0, nb_used = 0;
+	for (size_t i = 0; i < nb_elements; i++) {
+		unsigned int v = elements[i];
+		if (cache_miss(v, stamp, &time, cache_size))
+			misses++;
+		if (!used[v]) {
+			used[v] = true;
+			nb_used++;
+		}
+	}
+	stats->acmr = (nb_elements >= 3) ? 1.0f * misses / (nb_elements / 3) : 0;
+	stats->atvr = (nb_used > 0) ? 1.0f * misses / nb_used : 0;
+}
+
+/**
+ * Tipsify: draw all the remaining triangles around a vertex (a fan),
+ * then move to the vertex of that fan that will still be in the cache
+ * after its own remaining triangles are drawn, preferring the oldest
+ * one; if there is none, go back to the last vertex used that still
+ * has triangles, and at worst to the next one in the input.  Linear in
+ * the number of triangles.
+ */
+void mesh_tipsify(unsigned int* elements, size_t nb_elements, size_t nb_vertices, int cache_size) {
+	size_t nb_triangles = nb_elements / 3;
+
+	// Triangles around each vertex: adjacency[offsets[v]..offsets[v+1]-1]
+	std::vector<unsigned int> offsets(nb_vertices + 1, 0);
+	for (size_t i = 0; i < nb_triangles * 3; i++)
+		offsets[elements[i] + 1]++;
+	for (size_t v = 0; v < nb_vertices; v++)
+		offsets[v + 1] += offsets[v];
+	std::vector<unsigned int> adjacency(nb_triangles * 3);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < nb_triangles * 3; i++)
+		adjacency[fill[elements[i]]++] = i / 3;
+
+	std::vector<int> live(nb_vertices);  // triangles not drawn yet
+	for (size_t v = 0; v < nb_vertices; v++)
+		live[v] = offsets[v + 1] - offsets[v];
+	std::vector<unsigned int> cache_time(nb_vertices, 0);
+	std::vector<bool> emitted(nb_triangles, false);
+	std::vector<unsigned int> dead_end, candidates;
+	std::vector<unsigned int> res;
+	res.reserve(nb_triangles * 3);
+
+	unsigned int time = cache_size + 1;
+	size_t cursor = 0;
+	long fanning = -1;
+	while (cursor < nb_vertices && live[cursor] == 0)
+		cursor++;
+	if (cursor < nb_vertices)
+		fanning = cursor;
+
+	while (fanning >= 0) {
+		candidates.clear();
+		for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+			unsigned int t = adjacency[a];
+			if (emitted[t])
+				continue;
+			for (int k = 0; k < 3; k++) {
+				unsigned int v = elements[t*3 + k];
+				res.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cache_time[v] > (unsigned int)cache_size)
+					cache_time[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// Next fanning vertex
+		long best = -1;
+		int best_priority = -1;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			unsigned int v = candidates[i];
+			if (live[v] <= 0)
+				continue;
+			int priority = 0;
+			// still in the cache once its own fan is drawn: the older the better
+			if (time - cache_time[v] + 2 * live[v] <= (unsigned int)cache_size)
+				priority = time - cache_time[v];
+			if (priority > best_priority) {
+				best_priority = priority;
+				best = v;
+			}
+		}
+		while (best < 0 && !dead_end.empty()) {
+			unsigned int v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0)
+				best = v;
+		}
+		if (best < 0) {
+			while (cursor < nb_vertices && live[cursor] == 0)
+				cursor++;
+			if (cursor < nb_vertices)
+				best = cursor;
+		}
+		fanning = best;
+	}
+
+	memcpy(elements, res.data(), res.size() * sizeof(res[0]));
+}
+
+struct mesh_cluster {
+	size_t first, end;  // triangles
+	float sort_key;
+};
+
+static bool cluster_order(const mesh_cluster& a, const mesh_cluster& b) {
+	return a.sort_key > b.sort_key;
+}
+
+/**
+ * Reorder the clusters of a cache-optimized triangle order so that
+ * the outer, outward-facing ones come first.
+ *
+ * Clusters start where all three vertices of a triangle miss the cache
+ * (hard boundaries: the order there doesn't matter for the cache), and
+ * are cut again wherever the cache misses so far in the cluster are
+ * within threshold (e.g. 1.05) of the whole cluster's (soft
+ * boundaries), trading a little ACMR for more freedom.
+ */
+void mesh_optimize_overdraw(unsigned int* elements, size_t nb_elements,
+	const glm::vec4* positions, size_t nb_vertices,
+	int cache_size, float threshold) {
+	size_t nb_triangles = nb_elements / 3;
+	if (nb_triangles == 0)
+		return;
+
+	// Hard boundaries
+	std::vector<size_t> hard;
+	std::vector<unsigned int> stamp(nb_vertices, 0);
+	unsigned int time = 0;
+	for (size_t t = 0; t < nb_triangles; t++) {
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+			misses += cache_miss(elements[t*3 + k], stamp, &time, cache_size);
+		if (misses == 3 || t == 0)
+			hard.push_back(t);
+	}
+	hard.push_back(nb_triangles);
+
+	// Soft boundaries, starting each cluster with a cold cache
+	std::vector<mesh_cluster> clusters;
+	for (size_t h = 0; h + 1 < hard.size(); h++) {
+		size_t first = hard[h], end = hard[h+1];
+		std::fill(stamp.begin(), stamp.end(), 0);
+		time = 0;
+		size_t misses = 0;
+		for (size_t t = first; t < end; t++)
+			for (int k = 0; k < 3; k++)
+				misses += cache_miss(elements[t*3 + k], stamp, &time, cache_size);
+		float max_acmr = threshold * misses / (end - first);
+
+		std::fill(stamp.begin(), stamp.end(), 0);
+		time = 0;
+		misses = 0;
+		size_t start = first;
+		for (size_t t = first; t < end; t++) {
+			for (int k = 0; k < 3; k++)
+				misses += cache_miss(elements[t*3 + k], stamp, &time, cache_size);
+			if (t + 1 < end && misses <= max_acmr * (t + 1 - start)) {
+				mesh_cluster c = { start, t + 1, 0 };
+				clusters.push_back(c);
+				start = t + 1;
+				misses = 0;
+				std::fill(stamp.begin(), stamp.end(), 0);
+				time = 0;
+			}
+		}
+		mesh_cluster c = { start, end, 0 };
+		clusters.push_back(c);
+	}
+
+	// Sort by how far out the cluster is along its own normal: dot(cluster
+	// normal, cluster center - mesh center), both weighted by area
+	glm::vec3 mesh_center(0.0);
+	float mesh_area = 0;
+	std::vector<glm::vec3> normals(nb_triangles), centers(nb_triangles);
+	for (size_t t = 0; t < nb_triangles; t++) {
+		glm::vec3 a = glm::vec3(positions[elements[t*3]]);
+		glm::vec3 b = glm::vec3(positions[elements[t*3 + 1]]);
+		glm::vec3 c = glm::vec3(positions[elements[t*3 + 2]]);
+		normals[t] = glm::cross(b - a, c - a);  // length: twice the area
+		centers[t] = (a + b + c) / 3.0f;
+		float area = glm::length(normals[t]);
+		mesh_center += centers[t] * area;
+		mesh_area += area;
+	}
+	if (mesh_area > 0)
+		mesh_center /= mesh_area;
+
+	for (size_t i = 0; i < clusters.size(); i++) {
+		glm::vec3 normal(0.0), center(0.0);
+		float area = 0;
+		for (size_t t = clusters[i].first; t < clusters[i].end; t++) {
+			float a = glm::length(normals[t]);
+			normal += normals[t];
+			center += centers[t] * a;
+			area += a;
+		}
+		if (area > 0)
+			center /= area;
+		float length = glm::length(normal);
+		clusters[i].sort_key = (length > 0) ? glm::dot(normal / length, center - mesh_center) : 0;
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), cluster_order);
+
+	std::vector<unsigned int> res;
+	res.reserve(nb_triangles * 3);
+	for (size_t i = 0; i < clusters.size(); i++)
+		res.insert(res.end(), elements + clusters[i].first * 3, elements + clusters[i].end * 3);
+	memcpy(elements, res.data(), res.size() * sizeof(res[0]));
+}
+
+/**
+ * Number the vertices in the order the triangles use them, so that
+ * they are fetched sequentially.  Unused vertices go last.  Returns
+ * the new number of each vertex in remap, see mesh_remap().
+ */
+void mesh_optimize_vertex_fetch(unsigned int* elements, size_t nb_elements, size_t nb_vertices,
+	std::vector<unsigned int>* remap) {
+	const unsigned int none = 0xffffffffu;
+	remap->assign(nb_vertices, none);
+	unsigned int next = 0;
+	for (size_t i = 0; i < nb_elements; i++) {
+		unsigned int& r = (*remap)[elements[i]];
+		if (r == none)
+			r = next++;
+		elements[i] = r;
+	}
+	for (size_t v = 0; v < nb_vertices; v++)
+		if ((*remap)[v] == none)
+			(*remap)[v] = next++;
+}
+
+/**
+ * The three steps, with the default cache size and overdraw threshold;
+ * apply remap to all the vertex attributes with mesh_remap().  before
+ * and after (may be NULL) get the cache statistics.
+ */
+void mesh_optimize(std::vector<unsigned int>& elements, const std::vector<glm::vec4>& positions,
+	std::vector<unsigned int>* remap, mesh_stats* before, mesh_stats* after) {
+	size_t nb_vertices = positions.size();
+	if (before != NULL)
+		mesh_cache_stats(elements.data(), elements.size(), nb_vertices, MESH_CACHE_SIZE, before);
+	mesh_tipsify(elements.data(), elements.size(), nb_vertices, MESH_CACHE_SIZE);
+	mesh_optimize_overdraw(elements.data(), elements.size(), positions.data(), nb_vertices,
+		MESH_CACHE_SIZE, 1.05);
+	mesh_optimize_vertex_fetch(elements.data(), elements.size(), nb_vertices, remap);
+	if (after != NULL)
+		mesh_cache_stats(elements.data(), elements.size(), nb_vertices, MESH_CACHE_SIZE, after);
+}
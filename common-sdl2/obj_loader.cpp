@@ -0,0 +1,592 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <thread>
+#include "SDL.h"
+#include "file_view.h"
+#include "obj_loader.h"
+
+/*
+ * Wavefront OBJ: the "v", "vt", "vn" and "f" lines, everything else
+ * (groups, materials, smoothing groups, lines...) is skipped.
+ *
+ * The file is parsed in place, line by line, without copying it into
+ * strings or streams: scans are hundreds of MB of "v" and "f" lines
+ * and this is where the loading time goes.
+ */
+
+static inline bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline const char* skip_spaces(const char* p, const char* end) {
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+/* Exactly representable in a double */
+static const double powers_of_ten[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/**
+ * What parse_float() doesn't handle ("nan", "inf", hexadecimal...):
+ * the buffer is not NUL-terminated, so copy the token for strtof.
+ */
+static const char* parse_float_slow(const char* p, const char* end, float* res) {
+	char buf[64];
+	int len = 0;
+	while (p + len < end && !is_space(p[len]) && len < (int)sizeof(buf) - 1) {
+		buf[len] = p[len];
+		len++;
+	}
+	buf[len] = '\0';
+	char* buf_end;
+	*res = strtof(buf, &buf_end);
+	if (buf_end == buf)
+		return NULL;
+	return p + (buf_end - buf);
+}
+
+/**
+ * Decimal number, with optional sign, fraction and exponent.  The
+ * first 19 significant digits are accumulated in an integer and scaled
+ * once by a power of ten, which rounds correctly in double precision
+ * for everything exporters write (up to 15 digits and |exponent| <= 22),
+ * then once more to float.  Returns the end of the number, or NULL.
+ */
+static const char* parse_float(const char* p, const char* end, float* res) {
+	const char* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = (*p++ == '-');
+
+	uint64_t mantissa = 0;
+	int nb_digits = 0, exponent = 0;
+	bool seen_digit = false;
+	for (; p < end && is_digit(*p); p++) {
+		seen_digit = true;
+		if (nb_digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa > 0)
+				nb_digits++;
+		} else {
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && is_digit(*p); p++) {
+			seen_digit = true;
+			if (nb_digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa > 0)
+					nb_digits++;
+				exponent--;
+			}
+		}
+	}
+	if (!seen_digit)
+		return parse_float_slow(start, end, res);
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* q = p + 1;
+		bool exp_negative = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			exp_negative = (*q++ == '-');
+		if (q < end && is_digit(*q)) {
+			int e = 0;
+			for (; q < end && is_digit(*q); q++)
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+			exponent += exp_negative ? -e : e;
+			p = q;
+		}
+	}
+
+	double value = (double)mantissa;
+	if (exponent < 0)
+		value = (exponent >= -22) ? value / powers_of_ten[-exponent] : value * pow(10.0, exponent);
+	else if (exponent > 0)
+		value = (exponent <= 22) ? value * powers_of_ten[exponent] : value * pow(10.0, exponent);
+	*res = (float)(negative ? -value : value);
+	return p;
+}
+
+/**
+ * Numbers up to the end of the line (or a '#' comment), the first max
+ * of them stored in values.  Returns how many there were, -1 on garbage.
+ */
+static int parse_floats(const char* p, const char* eol, float* values, int max) {
+	int n = 0;
+	for (;;) {
+		p = skip_spaces(p, eol);
+		if (p == eol || *p == '#')
+			return n;
+		float f;
+		p = parse_float(p, eol, &f);
+		if (p == NULL || (p < eol && !is_space(*p)))
+			return -1;
+		if (n < max)
+			values[n] = f;
+		n++;
+	}
+}
+
+static const char* parse_int(const char* p, const char* end, int* res) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = (*p++ == '-');
+	if (p == end || !is_digit(*p))
+		return NULL;
+	long long value = 0;
+	for (; p < end && is_digit(*p); p++)
+		if (value <= INT_MAX)
+			value = value * 10 + (*p - '0');
+	if (value > INT_MAX)
+		return NULL;
+	*res = negative ? -(int)value : (int)value;
+	return p;
+}
+
+/**
+ * OBJ indices start at 1, or count back from the last element read
+ * when negative.  Converts to a 0-based index, false if out of range.
+ */
+static inline bool resolve_index(int index, size_t count, int* res) {
+	if (index > 0 && (size_t)index <= count) {
+		*res = index - 1;
+		return true;
+	}
+	if (index < 0 && (size_t)-(long long)index <= count) {
+		*res = (int)(count + index);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * "f v v v...", "f v/vt...", "f v//vn..." or "f v/vt/vn...", any
+ * number of corners.  nb_* are the elements read so far, for relative
+ * indices and range checks.
+ */
+static const char* parse_face(const char* p, const char* eol,
+	size_t nb_vertices, size_t nb_texcoords, size_t nb_normals,
+	std::vector<obj_corner>& face) {
+	face.clear();
+	for (;;) {
+		p = skip_spaces(p, eol);
+		if (p == eol || *p == '#')
+			break;
+		obj_corner c = { -1, -1, -1 };
+		int index;
+		p = parse_int(p, eol, &index);
+		if (p == NULL || !resolve_index(index, nb_vertices, &c.v))
+			return "bad vertex index";
+		if (p < eol && *p == '/') {
+			p++;
+			if (p < eol && *p != '/') {
+				p = parse_int(p, eol, &index);
+				if (p == NULL || !resolve_index(index, nb_texcoords, &c.vt))
+					return "bad texture coordinate index";
+			}
+			if (p < eol && *p == '/') {
+				p = parse_int(p + 1, eol, &index);
+				if (p == NULL || !resolve_index(index, nb_normals, &c.vn))
+					return "bad normal index";
+			}
+		}
+		if (p < eol && !is_space(*p))
+			return "bad face";
+		face.push_back(c);
+	}
+	if (face.size() < 3)
+		return "face with less than 3 corners";
+	return NULL;
+}
+
+enum obj_line_type { OBJ_OTHER, OBJ_VERTEX, OBJ_TEXCOORD, OBJ_NORMAL, OBJ_FACE };
+
+/**
+ * What the line starting at q (after any indentation) holds; *args is
+ * set to what follows the keyword.
+ */
+static inline obj_line_type line_type(const char* q, const char* eol, const char** args) {
+	if (eol - q >= 2 && q[0] == 'v' && is_space(q[1])) {
+		*args = q + 1;
+		return OBJ_VERTEX;
+	} else if (eol - q >= 3 && q[0] == 'v' && q[1] == 't' && is_space(q[2])) {
+		*args = q + 2;
+		return OBJ_TEXCOORD;
+	} else if (eol - q >= 3 && q[0] == 'v' && q[1] == 'n' && is_space(q[2])) {
+		*args = q + 2;
+		return OBJ_NORMAL;
+	} else if (eol - q >= 2 && q[0] == 'f' && is_space(q[1])) {
+		*args = q + 1;
+		return OBJ_FACE;
+	}
+	return OBJ_OTHER;
+}
+
+/* Words up to the end of the line or a comment, like parse_face() sees them */
+static int count_words(const char* p, const char* eol) {
+	int n = 0;
+	for (;;) {
+		p = skip_spaces(p, eol);
+		if (p == eol || *p == '#')
+			return n;
+		n++;
+		while (p < eol && !is_space(*p))
+			p++;
+	}
+}
+
+/*
+ * Large files are parsed by several threads, each one on a range of
+ * whole lines.  A first pass counts the elements in each range, so
+ * that a prefix sum tells each thread where its elements go in the
+ * model, and how many of each there are before its first line: the
+ * second pass then resolves relative indices and checks ranges exactly
+ * like a sequential parse would, and writes in place, with no merging.
+ */
+struct obj_chunk {
+	const char* begin;
+	const char* end;
+	// count_chunk()
+	int nb_lines;
+	size_t nb_vertices, nb_texcoords, nb_normals, nb_corners;
+	// prefix sums
+	int first_line;
+	size_t first_vertex, first_texcoord, first_normal, first_corner;
+	// parse_chunk()
+	const char* error;
+	int error_line;
+};
+
+/* Below this, a thread costs more than it saves */
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+
+static void count_chunk(obj_chunk* chunk) {
+	chunk->nb_lines = 0;
+	chunk->nb_vertices = chunk->nb_texcoords = chunk->nb_normals = chunk->nb_corners = 0;
+	const char* p = chunk->begin;
+	while (p < chunk->end) {
+		chunk->nb_lines++;
+		const char* eol = (const char*)memchr(p, '\n', chunk->end - p);
+		if (eol == NULL)
+			eol = chunk->end;
+		const char* args;
+		switch (line_type(skip_spaces(p, eol), eol, &args)) {
+		case OBJ_VERTEX:   chunk->nb_vertices++;  break;
+		case OBJ_TEXCOORD: chunk->nb_texcoords++; break;
+		case OBJ_NORMAL:   chunk->nb_normals++;   break;
+		case OBJ_FACE: {
+			// triangulated as a fan around the first corner
+			int n = count_words(args, eol);
+			if (n >= 3)
+				chunk->nb_corners += 3 * (n - 2);
+			break;
+		}
+		case OBJ_OTHER:
+			break;
+		}
+		p = eol + 1;
+	}
+}
+
+static void parse_chunk(obj_chunk* chunk, obj_model* model) {
+	size_t nb_vertices = chunk->first_vertex;
+	size_t nb_texcoords = chunk->first_texcoord;
+	size_t nb_normals = chunk->first_normal;
+	size_t nb_corners = chunk->first_corner;
+	std::vector<obj_corner> face;
+	const char* p = chunk->begin;
+	int line = chunk->first_line;
+	chunk->error = NULL;
+	while (p < chunk->end) {
+		line++;
+		const char* eol = (const char*)memchr(p, '\n', chunk->end - p);
+		if (eol == NULL)
+			eol = chunk->end;
+		const char* args;
+		const char* error = NULL;
+		float values[7];
+		int n;
+
+		switch (line_type(skip_spaces(p, eol), eol, &args)) {
+		case OBJ_VERTEX:
+			// "v x y z [w]", or "v x y z r g b" with vertex colors
+			n = parse_floats(args, eol, values, 7);
+			if (n < 3)
+				error = "bad vertex";
+			else
+				model->vertices[nb_vertices++] = glm::vec4(values[0], values[1], values[2],
+					(n == 4 || n == 7) ? values[3] : 1.0f);
+			break;
+		case OBJ_TEXCOORD:
+			n = parse_floats(args, eol, values, 2);
+			if (n < 1)
+				error = "bad texture coordinate";
+			else
+				model->texcoords[nb_texcoords++] = glm::vec2(values[0], (n >= 2) ? values[1] : 0.0f);
+			break;
+		case OBJ_NORMAL:
+			n = parse_floats(args, eol, values, 3);
+			if (n < 3)
+				error = "bad normal";
+			else
+				model->normals[nb_normals++] = glm::vec3(values[0], values[1], values[2]);
+			break;
+		case OBJ_FACE:
+			error = parse_face(args, eol, nb_vertices, nb_texcoords, nb_normals, face);
+			if (error == NULL) {
+				// triangle fan
+				for (size_t i = 1; i + 1 < face.size(); i++) {
+					model->corners[nb_corners++] = face[0];
+					model->corners[nb_corners++] = face[i];
+					model->corners[nb_corners++] = face[i+1];
+				}
+			}
+			break;
+		case OBJ_OTHER:
+			break;
+		}
+
+		if (error != NULL) {
+			chunk->error = error;
+			chunk->error_line = line;
+			return;
+		}
+		p = eol + 1;
+	}
+}
+
+/* Run f on all the chunks, the first one in the calling thread */
+template<class F> static void for_each_chunk(std::vector<obj_chunk>& chunks, F f) {
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < chunks.size(); i++)
+		threads.push_back(std::thread(f, &chunks[i]));
+	f(&chunks[0]);
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+/**
+ * Parse the OBJ file contents data[0..size-1] into model, which is
+ * cleared first, with up to nb_threads threads (0: one per core).  The
+ * result doesn't depend on the number of threads.  vertex_normals is
+ * left empty, see obj_compute_normals().
+ */
+bool obj_parse(const char* data, size_t size, obj_model* model, int nb_threads) {
+	if (nb_threads <= 0)
+		nb_threads = std::thread::hardware_concurrency();
+	if (nb_threads <= 0)
+		nb_threads = 1;
+	size_t nb_chunks = size / OBJ_MIN_CHUNK_SIZE + 1;
+	if (nb_chunks > (size_t)nb_threads)
+		nb_chunks = nb_threads;
+
+	// Cut at the first newline after each 1/nb_chunks of the file
+	std::vector<obj_chunk> chunks(nb_chunks);
+	const char* end = data + size;
+	const char* p = data;
+	for (size_t i = 0; i < nb_chunks; i++) {
+		chunks[i].begin = p;
+		if (i + 1 < nb_chunks) {
+			const char* cut = data + size / nb_chunks * (i + 1);
+			if (cut < p)
+				cut = p;
+			const char* eol = (const char*)memchr(cut, '\n', end - cut);
+			p = (eol == NULL) ? end : eol + 1;
+		} else {
+			p = end;
+		}
+		chunks[i].end = p;
+	}
+
+	for_each_chunk(chunks, count_chunk);
+
+	int nb_lines = 0;
+	size_t nb_vertices = 0, nb_texcoords = 0, nb_normals = 0, nb_corners = 0;
+	for (size_t i = 0; i < nb_chunks; i++) {
+		chunks[i].first_line = nb_lines;
+		chunks[i].first_vertex = nb_vertices;
+		chunks[i].first_texcoord = nb_texcoords;
+		chunks[i].first_normal = nb_normals;
+		chunks[i].first_corner = nb_corners;
+		nb_lines += chunks[i].nb_lines;
+		nb_vertices += chunks[i].nb_vertices;
+		nb_texcoords += chunks[i].nb_texcoords;
+		nb_normals += chunks[i].nb_normals;
+		nb_corners += chunks[i].nb_corners;
+	}
+	model->vertices.resize(nb_vertices);
+	model->texcoords.resize(nb_texcoords);
+	model->normals.resize(nb_normals);
+	model->corners.resize(nb_corners);
+	model->vertex_normals.clear();
+
+	for_each_chunk(chunks, [model](obj_chunk* chunk) { parse_chunk(chunk, model); });
+
+	for (size_t i = 0; i < nb_chunks; i++) {
+		if (chunks[i].error != NULL) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+				"OBJ line %d: %s", chunks[i].error_line, chunks[i].error);
+			model->vertices.clear();
+			model->texcoords.clear();
+			model->normals.clear();
+			model->corners.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * One normal per vertex, the sum of the normals of the triangles
+ * around it weighted by their area: the cross product of two edges is
+ * already that, so it is accumulated as is and normalized once at the
+ * end.  Vertices that are not part of any (non-degenerate) triangle
+ * get (0,0,0).
+ */
+void obj_compute_normals(obj_model* model) {
+	const std::vector<glm::vec4>& vertices = model->vertices;
+	std::vector<glm::vec3>& normals = model->vertex_normals;
+	normals.assign(vertices.size(), glm::vec3(0.0));
+	for (size_t i = 0; i + 2 < model->corners.size(); i += 3) {
+		int ia = model->corners[i].v;
+		int ib = model->corners[i+1].v;
+		int ic = model->corners[i+2].v;
+		glm::vec3 a = glm::vec3(vertices[ia]);
+		glm::vec3 normal = glm::cross(glm::vec3(vertices[ib]) - a, glm::vec3(vertices[ic]) - a);
+		normals[ia] += normal;
+		normals[ib] += normal;
+		normals[ic] += normal;
+	}
+	for (size_t i = 0; i < normals.size(); i++) {
+		float length = glm::length(normals[i]);
+		if (length > 0)
+			normals[i] /= length;
+	}
+}
+
+static inline size_t hash_vertex(const obj_vertex& v) {
+	// FNV-1a, a word at a time
+	uint32_t words[sizeof(obj_vertex) / sizeof(uint32_t)];
+	memcpy(words, &v, sizeof(words));
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+		h = (h ^ words[i]) * 0x100000001b3ULL;
+	return (size_t)(h ^ (h >> 32));
+}
+
+#define OBJ_NO_VERTEX 0xffffffffu
+
+/**
+ * Turn the triangle corners into an indexed mesh: one vertex per
+ * distinct (position, normal, texture coordinate), by value, so that
+ * corners that only differ in their indices are welded too.  Corners
+ * without "vn" get the vertex normal, see obj_compute_normals(), and
+ * without "vt" (0,0).  Vertices are numbered in order of first use.
+ */
+void obj_index_vertices(const obj_model* model, std::vector<obj_vertex>* vertices,
+	std::vector<unsigned int>* elements) {
+	size_t nb_corners = model->corners.size();
+	vertices->clear();
+	elements->resize(nb_corners);
+
+	// Open addressing with linear probing, kept at most half full: the
+	// slots hold indices in vertices
+	size_t table_size = 64;
+	while (table_size < 2 * model->vertices.size())
+		table_size *= 2;
+	std::vector<unsigned int> table(table_size, OBJ_NO_VERTEX);
+	// Shortcut for the usual case, a corner that has the same indices
+	// as the previous one at the same position: same vertex
+	std::vector<obj_corner> last_corner(model->vertices.size());
+	std::vector<unsigned int> last_vertex(model->vertices.size(), OBJ_NO_VERTEX);
+
+	for (size_t i = 0; i < nb_corners; i++) {
+		const obj_corner& c = model->corners[i];
+		unsigned int& last = last_vertex[c.v];
+		if (last != OBJ_NO_VERTEX && last_corner[c.v].vt == c.vt && last_corner[c.v].vn == c.vn) {
+			(*elements)[i] = last;
+			continue;
+		}
+		// 9 floats, no padding: compared with memcmp()
+		obj_vertex v;
+		v.position = model->vertices[c.v];
+		v.normal = glm::vec3(0.0);
+		v.texcoord = glm::vec2(0.0);
+		if (c.vn >= 0)
+			v.normal = model->normals[c.vn];
+		else if ((size_t)c.v < model->vertex_normals.size())
+			v.normal = model->vertex_normals[c.v];
+		if (c.vt >= 0)
+			v.texcoord = model->texcoords[c.vt];
+
+		size_t slot = hash_vertex(v) & (table_size - 1);
+		for (;;) {
+			unsigned int k = table[slot];
+			if (k == OBJ_NO_VERTEX) {
+				table[slot] = (*elements)[i] = vertices->size();
+				vertices->push_back(v);
+				break;
+			}
+			if (memcmp(&(*vertices)[k], &v, sizeof(v)) == 0) {
+				(*elements)[i] = k;
+				break;
+			}
+			slot = (slot + 1) & (table_size - 1);
+		}
+		last = (*elements)[i];
+		last_corner[c.v] = c;
+
+		if (vertices->size() * 2 > table_size) {
+			table_size *= 2;
+			table.assign(table_size, OBJ_NO_VERTEX);
+			for (unsigned int k = 0; k < vertices->size(); k++) {
+				slot = hash_vertex((*vertices)[k]) & (table_size - 1);
+				while (table[slot] != OBJ_NO_VERTEX)
+					slot = (slot + 1) & (table_size - 1);
+				table[slot] = k;
+			}
+		}
+	}
+}
+
+/**
+ * Load an OBJ file and compute its vertex normals.  The file is viewed
+ * rather than read, so that its pages go straight from the page cache
+ * to the parser, see file_view.
+ */
+bool obj_load(const char* filename, obj_model* model, int nb_threads) {
+	file_view view(filename, FILE_VIEW_SEQUENTIAL);
+	if (!view.is_open()) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"Cannot open %s: %s", filename, SDL_GetError());
+		return false;
+	}
+	bool res = obj_parse(view.data(), view.size(), model, nb_threads);
+	if (!res) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+			"Could not load OBJ file %s", filename);
+		return false;
+	}
+	obj_compute_normals(model);
+	return true;
+}
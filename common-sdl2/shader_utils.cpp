@@ -4,39 +4,62 @@
  * Contributors: Sylvain Beucler
  */
 
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <string>
+#include <vector>
 using namespace std;
 
 #include "SDL.h"
 #include <GL/glew.h>
+#include "file_view.h"
+
+/*
+ * Program cache: with GL_ARB_get_program_binary, a linked program is
+ * saved next to its vertex shader, and the next runs hand it back to
+ * the driver with glProgramBinary() instead of compiling its shaders
+ * again.  The file is named after the shader files and holds a hash of
+ * their sources, as given to the compiler, and of the driver strings:
+ * when either changed, or the driver refuses the binary, the program
+ * is compiled as before and the file written again.  Not on GLES2.
+ */
+#define PROGRAM_CACHE_MAGIC "GLPROG"
+#define PROGRAM_CACHE_VERSION 1
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+struct program_cache_header {
+	char magic[8];            // "GLPROG\0\0"
+	uint32_t version;         // PROGRAM_CACHE_VERSION
+	uint32_t format;          // from glGetProgramBinary()
+	uint64_t key;             // of the sources and driver, see program_key()
+	uint64_t size;            // of the binary that follows
+	uint64_t hash;            // of the binary
+};
+
+#define SHADER_MAX_INCLUDE_DEPTH 16
+
+static bool program_cache = false;
+static int program_cache_hits = 0, program_cache_misses = 0;
 
 /**
- * Store all the file's contents in memory, useful to pass shaders
- * source code to OpenGL.  Using SDL_RWops for Android asset support.
+ * Store all the file's contents in memory, NUL-terminated, useful to
+ * pass shaders source code to OpenGL.  See file_view for Android asset
+ * support and pack files, and to read without copying.
  */
 char* file_read(const char* filename, int* size) {
-	SDL_RWops *rw = SDL_RWFromFile(filename, "rb");
-	if (rw == NULL) return NULL;
-	
-	Sint64 res_size = SDL_RWsize(rw);
-	char* res = (char*)malloc(res_size + 1);
-
-	Sint64 nb_read_total = 0, nb_read = 1;
-	char* buf = res;
-	while (nb_read_total < res_size && nb_read != 0) {
-		nb_read = SDL_RWread(rw, buf, 1, (res_size - nb_read_total));
-		nb_read_total += nb_read;
-		buf += nb_read;
-	}
-	SDL_RWclose(rw);
-	if (nb_read_total != res_size) {
-		free(res);
+	file_view view(filename);
+	if (!view.is_open())
 		return NULL;
-	}
-	
-	res[nb_read_total] = '\0';
+	char* res = (char*)malloc(view.size() + 1);
+	memcpy(res, view.data(), view.size());
+	res[view.size()] = '\0';
 	if (size != NULL)
-		*size = nb_read_total;
+		*size = view.size();
 	return res;
 }
 
@@ -66,18 +89,181 @@ void print_log(GLuint object) {
 	free(log);
 }
 
+/* "dir/" for "dir/file", "" for "file" */
+static string file_directory(const string& filename) {
+	size_t slash = filename.find_last_of("/\\");
+	return (slash == string::npos) ? "" : filename.substr(0, slash + 1);
+}
+
+/* FNV-1a, as in mesh_cache.cpp */
+static uint64_t hash_bytes(const void* data, size_t size, uint64_t hash) {
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ p[i]) * FNV_PRIME;
+	return hash;
+}
+
+static uint64_t hash_string(const char* s, uint64_t hash) {
+	// with its terminating 0, so that "ab"+"c" and "a"+"bc" differ
+	return hash_bytes(s, (s != NULL) ? strlen(s) + 1 : 0, hash);
+}
+
+/* Whether a block comment is still open at the end of the line, if it was at its start */
+static bool in_block_comment(const char* line, const char* end_of_line, bool in_comment) {
+	for (const char* p = line; p + 1 < end_of_line; p++) {
+		if (in_comment) {
+			if (p[0] == '*' && p[1] == '/') {
+				in_comment = false;
+				p++;
+			}
+		} else if (p[0] == '/' && p[1] == '/') {
+			break;
+		} else if (p[0] == '/' && p[1] == '*') {
+			in_comment = true;
+			p++;
+		}
+	}
+	return in_comment;
+}
+
 /**
- * Compile the shader from file 'filename', with error handling
+ * Append the file to 'text', with the files it includes in place of
+ * their #include "file" lines, relative to it.  #line directives keep
+ * the compiler's messages pointing at the right file and line: file 0
+ * is the shader itself, then the included files in the order they are
+ * read, as listed in 'files' if not NULL, with the hashes of their
+ * contents in 'hashes'.  #include's in block comments stay as they are.
  */
-GLuint create_shader(const char* filename, GLenum type) {
-	const GLchar* source = file_read(filename, NULL);
-	if (source == NULL) {
+static bool expand_includes(const string& filename, string* text, vector<string>* stack, int* nb_files,
+							vector<string>* files, vector<uint64_t>* hashes) {
+	file_view source(filename.c_str());
+	if (!source.is_open()) {
 		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
-					   "Error opening %s: %s", filename, SDL_GetError());
-		return 0;
+					   "Error opening %s: %s", filename.c_str(), SDL_GetError());
+		return false;
 	}
-	GLuint res = glCreateShader(type);
+	int file_number = (*nb_files)++;
+	if (files != NULL)
+		files->push_back(filename);
+	if (hashes != NULL)
+		hashes->push_back(hash_bytes(source.data(), source.size(), FNV_OFFSET_BASIS));
+	stack->push_back(filename);
+	bool ok = true;
+	bool in_comment = false;
+	// Not NUL-terminated: each search stops at the end of the line
+	const char* line = source.data();
+	const char* end_of_file = line + source.size();
+	for (int line_number = 1; line < end_of_file && ok; line_number++) {
+		const char* end = (const char*)memchr(line, '\n', end_of_file - line);
+		const char* end_of_line = (end != NULL) ? end + 1 : end_of_file;
+		size_t length = end_of_line - line;
+		const char* directive = line;
+		while (directive < end_of_line && (*directive == ' ' || *directive == '\t'))
+			directive++;
+		bool commented = in_comment;
+		in_comment = in_block_comment(line, end_of_line, in_comment);
+		if (commented || end_of_line - directive < 8 || strncmp(directive, "#include", 8) != 0) {
+			text->append(line, length);
+			line += length;
+			continue;
+		}
+		const char* open = (const char*)memchr(directive, '"', end_of_line - directive);
+		const char* close = (open != NULL) ? (const char*)memchr(open + 1, '"', end_of_line - open - 1) : NULL;
+		string name = file_directory(filename);
+		if (close != NULL)
+			name += string(open + 1, close);
+		if (close == NULL) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+						   "%s:%d: #include \"file\" expected", filename.c_str(), line_number);
+			ok = false;
+		} else if (find(stack->begin(), stack->end(), name) != stack->end()) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+						   "%s:%d: %s includes itself", filename.c_str(), line_number, name.c_str());
+			ok = false;
+		} else if (stack->size() >= SHADER_MAX_INCLUDE_DEPTH) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+						   "%s:%d: #include nested too deeply", filename.c_str(), line_number);
+			ok = false;
+		} else {
+			// GLSL 1.20 and ES 1.00: the line after "#line n" is line n+1
+			char number[64];
+			snprintf(number, sizeof(number), "#line 0 %d\n", *nb_files);
+			*text += number;
+			ok = expand_includes(name, text, stack, nb_files, files, hashes);
+			snprintf(number, sizeof(number), "\n#line %d %d\n", line_number, file_number);
+			*text += number;
+		}
+		line += length;
+	}
+	stack->pop_back();
+	return ok;
+}
+
+/* "NAME NAME=VALUE" as "#define NAME\n#define NAME VALUE\n" */
+static string define_lines(const char* defines) {
+	string res;
+	for (const char* p = defines; p != NULL && *p != '\0'; ) {
+		p += strspn(p, " ");
+		size_t length = strcspn(p, " ");
+		if (length == 0)
+			break;
+		string define(p, length);
+		size_t equal = define.find('=');
+		if (equal != string::npos)
+			define[equal] = ' ';
+		res += "#define " + define + "\n";
+		p += length;
+	}
+	return res;
+}
 
+/**
+ * One variant of a shader: the features whose bit is set in mask,
+ * from a NULL-terminated list, as defines for create_program().  e.g.
+ * { "FOG", "SHADOWS", NULL } and 3 give "FOG SHADOWS".
+ */
+string shader_permutation(const char* const* features, unsigned int mask) {
+	string res;
+	for (int i = 0; features[i] != NULL && i < 32; i++) {
+		if (!(mask & (1u << i)))
+			continue;
+		if (!res.empty())
+			res += " ";
+		res += features[i];
+	}
+	return res;
+}
+
+/*
+ * Sources already expanded, by hash of the file name and of what
+ * shader_source() puts before it: the version, precision and defines.
+ * Shaders like a post-processing vertex shader are shared by many
+ * programs; an entry is used again only while the file and its
+ * includes hash as they did, e.g. not after an edit for hot reload.
+ */
+struct expanded_source {
+	vector<string> files;     // the file, then its includes
+	vector<uint64_t> hashes;  // of their contents
+	string text;
+};
+static map<uint64_t, expanded_source> expanded_sources;
+
+/* Whether the files still have these contents */
+static bool files_unchanged(const vector<string>& files, const vector<uint64_t>& hashes) {
+	for (unsigned int i = 0; i < files.size(); i++) {
+		file_view view(files[i].c_str());
+		if (!view.is_open() || hash_bytes(view.data(), view.size(), FNV_OFFSET_BASIS) != hashes[i])
+			return false;
+	}
+	return true;
+}
+
+/**
+ * The source of the shader in file 'filename', as given to the
+ * compiler: with the GLSL version and precision specifiers first, the
+ * defines, then the file with its #include's expanded
+ */
+static bool shader_source(const char* filename, GLenum type, const char* defines, string* text) {
 	// GLSL version
 	const char* version;
 	int profile;
@@ -103,20 +289,47 @@ GLuint create_shader(const char* filename, GLenum type) {
 		"#  define highp                     \n"
 		"#endif                              \n";
 
-	const GLchar* sources[] = {
-		version,
-		precision,
-		source
-	};
-	glShaderSource(res, 3, sources, NULL);
-	free((void*)source);
-	
+	*text = string(version) + precision + define_lines(defines) + "#line 0 0\n";
+	uint64_t key = hash_string(filename, hash_string(text->c_str(), FNV_OFFSET_BASIS));
+	map<uint64_t, expanded_source>::iterator cached = expanded_sources.find(key);
+	if (cached != expanded_sources.end() && files_unchanged(cached->second.files, cached->second.hashes)) {
+		*text = cached->second.text;
+		return true;
+	}
+	expanded_source expanded;
+	vector<string> stack;
+	int nb_files = 0;
+	if (!expand_includes(filename, text, &stack, &nb_files, &expanded.files, &expanded.hashes))
+		return false;
+	expanded.text = *text;
+	expanded_sources[key] = expanded;
+	return true;
+}
+
+/* Hand the shader to the compiler, without waiting for it */
+static GLuint start_shader(const string& text, GLenum type) {
+	GLuint res = glCreateShader(type);
+	const GLchar* source = text.c_str();
+	glShaderSource(res, 1, &source, NULL);
 	glCompileShader(res);
+	return res;
+}
+
+/* Whether the shader compiled, displaying the errors otherwise */
+static bool shader_compiled(const char* filename, GLuint shader) {
 	GLint compile_ok = GL_FALSE;
-	glGetShaderiv(res, GL_COMPILE_STATUS, &compile_ok);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_ok);
 	if (compile_ok == GL_FALSE) {
 		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "%s:\n", filename);
-		print_log(res);
+		print_log(shader);
+		return false;
+	}
+	return true;
+}
+
+static GLuint compile_shader(const char* filename, const string& text, GLenum type) {
+	GLuint res = start_shader(text, type);
+	if (!shader_compiled(filename, res)) {
 		glDeleteShader(res);
 		return 0;
 	}
@@ -124,37 +337,343 @@ GLuint create_shader(const char* filename, GLenum type) {
 	return res;
 }
 
-GLuint create_program(const char *vertexfile, const char *fragmentfile) {
-	GLuint program = glCreateProgram();
-	GLuint shader;
+/**
+ * Compile the shader from file 'filename', with error handling
+ */
+GLuint create_shader(const char* filename, GLenum type) {
+	string text;
+	if (!shader_source(filename, type, NULL, &text))
+		return 0;
+	return compile_shader(filename, text, type);
+}
 
-	if(vertexfile) {
-		shader = create_shader(vertexfile, GL_VERTEX_SHADER);
-		if(!shader)
-			return 0;
-		glAttachShader(program, shader);
+/* The shader file and the files it includes, e.g. to watch them */
+bool get_shader_files(const char* filename, vector<string>* files) {
+	string text;
+	vector<string> stack;
+	int nb_files = 0;
+	files->clear();
+	return expand_includes(filename, &text, &stack, &nb_files, files, NULL);
+}
+
+/**
+ * Save linked programs to disk and load them from there, see
+ * create_program().  Off by default, since it writes next to the
+ * shaders.
+ */
+void enable_program_cache(bool on) {
+	program_cache = on;
+}
+
+/* Programs loaded from the cache, and compiled, so far */
+void get_program_cache_stats(int* hits, int* misses) {
+	*hits = program_cache_hits;
+	*misses = program_cache_misses;
+}
+
+/* What a cached program must have been made from: the sources, and the driver that compiled them */
+static uint64_t program_key(const string* sources, int nb_sources) {
+	uint64_t key = FNV_OFFSET_BASIS;
+	key = hash_string((const char*)glGetString(GL_VENDOR), key);
+	key = hash_string((const char*)glGetString(GL_RENDERER), key);
+	key = hash_string((const char*)glGetString(GL_VERSION), key);
+	for (int i = 0; i < nb_sources; i++)
+		key = hash_string(sources[i].c_str(), key);
+	return key;
+}
+
+/* e.g. "postproc.v.glsl.1f2e3d4c.program", for postproc.v.glsl and copy.f.glsl with these defines */
+static string program_cache_filename(const char* vertexfile, const char* fragmentfile, const char* defines) {
+	uint64_t hash = hash_string(vertexfile, FNV_OFFSET_BASIS);
+	hash = hash_string(fragmentfile, hash);
+	hash = hash_string(defines, hash);
+	char name[32];
+	snprintf(name, sizeof(name), ".%08x.program", (unsigned int)(hash ^ (hash >> 32)));
+	return string(vertexfile != NULL ? vertexfile : fragmentfile) + name;
+}
+
+#ifndef GL_ES_VERSION_2_0
+/* Whether the driver can give back programs in any binary format */
+static bool program_binary_supported() {
+	static int nb_formats = -1;
+	if (nb_formats == -1) {
+		nb_formats = 0;
+		if (GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nb_formats);
 	}
+	return nb_formats > 0;
+}
 
-	if(fragmentfile) {
-		shader = create_shader(fragmentfile, GL_FRAGMENT_SHADER);
-		if(!shader)
+/**
+ * The program in the cache file, if it was made from the same sources
+ * by the same driver, and the driver takes it.  Silently returns 0
+ * when there is no cache yet.
+ */
+static GLuint load_program_binary(const string& filename, uint64_t key) {
+	file_view view(filename.c_str(), FILE_VIEW_NO_PACK);
+	if (!view.is_open())
+		return 0;
+	const char* data = view.data();
+	size_t size = view.size();
+	program_cache_header header;
+	memset(&header, 0, sizeof(header));
+	if (size >= sizeof(header))
+		memcpy(&header, data, sizeof(header));
+	const char* error = NULL;
+	const char* binary = data + sizeof(header);
+	if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0)
+		error = "not a program cache";
+	else if (header.version != PROGRAM_CACHE_VERSION)
+		error = "other version";
+	else if (header.key != key)
+		error = "shaders or driver changed";
+	else if (header.size > size - sizeof(header))
+		error = "truncated";
+	else if (hash_bytes(binary, header.size, FNV_OFFSET_BASIS) != header.hash)
+		error = "corrupted";
+
+	GLuint program = 0;
+	if (error == NULL) {
+		program = glCreateProgram();
+		glProgramBinary(program, header.format, binary, header.size);
+		GLint link_ok = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+		if (!link_ok) {
+			error = "refused by the driver";
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	if (error != NULL)
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO,
+					   "Not using %s: %s", filename.c_str(), error);
+	return program;
+}
+
+/* Written under another name first, not to leave a truncated cache behind */
+static bool save_program_binary(const string& filename, uint64_t key, GLuint program) {
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+		return false;
+	program_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	char* binary = (char*)malloc(size);
+	GLsizei length = 0;
+	GLenum format = 0;
+	glGetProgramBinary(program, size, &length, &format, binary);
+	header.format = format;
+	header.size = length;
+	header.hash = hash_bytes(binary, length, FNV_OFFSET_BASIS);
+
+	string tmp = filename + ".tmp";
+	FILE* out = fopen(tmp.c_str(), "wb");
+	bool ok = out != NULL && length > 0
+		&& fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(binary, 1, length, out) == (size_t)length;
+	free(binary);
+	if (out != NULL)
+		ok = (fclose(out) == 0) && ok;
+#ifdef _WIN32
+	if (ok)
+		remove(filename.c_str());  // rename() doesn't replace
+#endif
+	if (!ok || rename(tmp.c_str(), filename.c_str()) != 0) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+					   "Cannot write %s", filename.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+#else
+/* GLES2 only has GL_OES_get_program_binary, which the glew stubs don't load */
+static bool program_binary_supported() {
+	return false;
+}
+
+static GLuint load_program_binary(const string& filename, uint64_t key) {
+	return 0;
+}
+
+static bool save_program_binary(const string& filename, uint64_t key, GLuint program) {
+	return false;
+}
+#endif
+
+/*
+ * Let the driver compile and link on its own threads, with as many as
+ * it likes.  Not in the GLES2 glew stubs: there, the programs are
+ * ready when finish_program() returns.
+ */
+static bool parallel_compile_supported() {
+	static int supported = -1;
+	if (supported == -1) {
+		supported = 0;
+#ifndef GL_ES_VERSION_2_0
+		supported = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+		if (GLEW_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		else if (GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+#endif
+	}
+	return supported;
+}
+
+/* Started by create_program_async(), until finish_program() */
+struct pending_program {
+	GLuint program;
+	GLuint shaders[2];
+	uint64_t shader_hashes[2];  // of their type and source, see pending_shader()
+	string files[2];
+	string cache_filename;  // empty if the cache is off
+	uint64_t key;
+};
+static vector<pending_program> pending_programs;
+
+static int find_pending_program(GLuint program) {
+	for (unsigned int i = 0; i < pending_programs.size(); i++)
+		if (pending_programs[i].program == program)
+			return i;
+	return -1;
+}
+
+/**
+ * A shader with the same source that another program being made
+ * compiles already, or 0: e.g. a vertex shader for all the
+ * permutations of a fragment shader is compiled once
+ */
+static GLuint pending_shader(uint64_t hash, GLuint except_program) {
+	for (unsigned int i = 0; i < pending_programs.size(); i++)
+		for (int j = 0; j < 2; j++)
+			if (pending_programs[i].program != except_program && pending_programs[i].shaders[j] != 0
+				&& pending_programs[i].shader_hashes[j] == hash)
+				return pending_programs[i].shaders[j];
+	return 0;
+}
+
+/**
+ * Start compiling and linking the shaders, or load the program from
+ * the cache if it is on (see enable_program_cache()) and up to date.
+ * Nothing waits for the compiler: start all the programs first, then
+ * load the rest, and call finish_program() on each.  With
+ * GL_KHR_parallel_shader_compile the driver compiles them on other
+ * threads meanwhile, and program_ready() tells when finish_program()
+ * won't wait, e.g. to keep drawing a loading screen.  Returns 0 if a
+ * file can't be read.  'defines' are added to both shaders, e.g.
+ * "FOG SAMPLES=4" (see shader_permutation()).
+ */
+GLuint create_program_async(const char *vertexfile, const char *fragmentfile, const char* defines) {
+	const char* files[] = { vertexfile, fragmentfile };
+	GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	string sources[2];
+	for (int i = 0; i < 2; i++)
+		if (files[i] && !shader_source(files[i], types[i], defines, &sources[i]))
 			return 0;
-		glAttachShader(program, shader);
+
+	pending_program p;
+	p.key = 0;
+	if (program_cache && program_binary_supported()) {
+		p.key = program_key(sources, 2);
+		p.cache_filename = program_cache_filename(vertexfile, fragmentfile, defines);
+		GLuint program = load_program_binary(p.cache_filename, p.key);
+		if (program != 0) {
+			program_cache_hits++;
+			return program;
+		}
 	}
 
-	glLinkProgram(program);
+	parallel_compile_supported();
+	p.program = glCreateProgram();
+	for (int i = 0; i < 2; i++) {
+		p.shaders[i] = 0;
+		if (!files[i])
+			continue;
+		p.files[i] = files[i];
+		p.shader_hashes[i] = hash_string(sources[i].c_str(), hash_bytes(&types[i], sizeof(types[i]), FNV_OFFSET_BASIS));
+		p.shaders[i] = pending_shader(p.shader_hashes[i], 0);
+		if (p.shaders[i] == 0)
+			p.shaders[i] = start_shader(sources[i], types[i]);
+		glAttachShader(p.program, p.shaders[i]);
+	}
+#ifndef GL_ES_VERSION_2_0
+	if (!p.cache_filename.empty())
+		glProgramParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+
+	// Linking right away: a shader that doesn't compile makes it fail, see finish_program()
+	glLinkProgram(p.program);
+	pending_programs.push_back(p);
+	return p.program;
+}
+
+/**
+ * Whether the driver is done with the program, and finish_program()
+ * won't wait.  Always true without GL_KHR_parallel_shader_compile.
+ */
+bool program_ready(GLuint program) {
+#ifndef GL_ES_VERSION_2_0
+	if (find_pending_program(program) != -1 && parallel_compile_supported()) {
+		GLint done = GL_FALSE;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+		return done;
+	}
+#endif
+	return true;
+}
+
+/**
+ * Wait for a program from create_program_async(), display the errors
+ * and save it to the cache.  Returns the program, or 0 (and deletes
+ * it) if it doesn't compile or link.
+ */
+GLuint finish_program(GLuint program) {
+	int index = find_pending_program(program);
+	if (index == -1)
+		return program;
+	pending_program p = pending_programs[index];
+
 	GLint link_ok = GL_FALSE;
 	glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
 	if (!link_ok) {
-		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "glLinkProgram:");
-		print_log(program);
+		bool compiled = true;
+		for (int i = 0; i < 2; i++)
+			if (p.shaders[i] && !shader_compiled(p.files[i].c_str(), p.shaders[i]))
+				compiled = false;
+		if (compiled) {
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "glLinkProgram:");
+			print_log(program);
+		}
+	}
+	// Freed with the last program, once no other program being made can use them
+	for (int i = 0; i < 2; i++)
+		if (p.shaders[i] && pending_shader(p.shader_hashes[i], program) == 0)
+			glDeleteShader(p.shaders[i]);
+	pending_programs.erase(pending_programs.begin() + index);
+	if (!link_ok) {
 		glDeleteProgram(program);
 		return 0;
 	}
 
+	if (!p.cache_filename.empty()) {
+		program_cache_misses++;
+		save_program_binary(p.cache_filename, p.key, program);
+	}
 	return program;
 }
 
+/**
+ * Compile and link the shaders, or load the program from the cache if
+ * it is on (see enable_program_cache()) and up to date
+ */
+GLuint create_program(const char *vertexfile, const char *fragmentfile, const char* defines) {
+	return finish_program(create_program_async(vertexfile, fragmentfile, defines));
+}
+
 #ifdef GL_GEOMETRY_SHADER
 GLuint create_gs_program(const char *vertexfile, const char *geometryfile, const char *fragmentfile, GLint input, GLint output, GLint vertices) {
 	GLuint program = glCreateProgram();
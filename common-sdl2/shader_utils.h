@@ -5,12 +5,21 @@
  */
 #ifndef _SHADER_UTILS_H
 #define _SHADER_UTILS_H
+#include <string>
+#include <vector>
 #include <GL/glew.h>
 
 extern char* file_read(const char* filename, int* size);
 extern void print_log(GLuint object);
 extern GLuint create_shader(const char* filename, GLenum type);
-extern GLuint create_program(const char* vertexfile, const char *fragmentfile);
+extern bool get_shader_files(const char* filename, std::vector<std::string>* files);
+extern GLuint create_program(const char* vertexfile, const char *fragmentfile, const char* defines = NULL);
+extern GLuint create_program_async(const char* vertexfile, const char *fragmentfile, const char* defines = NULL);
+extern bool program_ready(GLuint program);
+extern GLuint finish_program(GLuint program);
+extern std::string shader_permutation(const char* const* features, unsigned int mask);
+extern void enable_program_cache(bool on);
+extern void get_program_cache_stats(int* hits, int* misses);
 extern GLuint create_gs_program(const char* vertexfile, const char *geometryfile, const char *fragmentfile, GLint input, GLint output, GLint vertices);
 extern GLint get_attrib(GLuint program, const char *name);
 extern GLint get_uniform(GLuint program, const char *name);
@@ -0,0 +1,40 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _FILE_WATCH_H
+#define _FILE_WATCH_H
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+/**
+ * Files watched for changes while the demo runs: inotify on their
+ * directories on Linux, which also sees editors saving to a temporary
+ * file and renaming it; elsewhere their modification time, checked
+ * once per second.  Never blocks: call it once per frame.
+ */
+bool watch_file(const char* filename);
+bool get_changed_files(std::vector<std::string>* changed);
+void unwatch_files();
+
+/**
+ * Called with a program rebuilt by reload_programs(), before it
+ * replaces the old one: resolve the attributes and uniforms there, and
+ * return false to keep the old program, e.g. if one is missing.
+ */
+typedef bool (*program_locations_func)(GLuint program, void* data);
+
+/**
+ * Programs rebuilt when their shaders, or files they include, change.
+ * The new program is compiled in the background where the driver
+ * supports it, and replaces '*program' only once it links and
+ * 'locations' accepts it; after an error, the last good one stays.
+ * reload_programs() returns the number of programs replaced.
+ */
+bool watch_program(GLuint* program, const char* vertexfile, const char* fragmentfile,
+                   const char* defines = NULL, program_locations_func locations = NULL, void* data = NULL);
+int reload_programs();
+void unwatch_programs();
+#endif
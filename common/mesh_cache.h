@@ -0,0 +1,63 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _MESH_CACHE_H
+#define _MESH_CACHE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+/* Bump when the layout changes, or what goes in it (e.g. mesh_optimize()) */
+#define MESH_CACHE_VERSION 2
+
+/**
+ * Binary mesh, made from a model file and stored next to it, in the
+ * native byte order.  The vertex and element blocks are laid out the
+ * way the demos' Mesh::upload() sends them to the GPU, so that they
+ * can go to glBufferData() straight from the mapped file.  The element
+ * block holds the full mesh followed by its LODs, if any, each one
+ * described in the LOD table that follows the header.
+ */
+struct mesh_cache_header {
+  char magic[8];            // "MESHBIN\0"
+  uint32_t version;         // MESH_CACHE_VERSION
+  uint32_t stride;          // bytes per vertex: x,y,z,w,nx,ny,nz floats
+  uint32_t nb_vertices;
+  uint32_t element_size;    // 2 (GLushort) up to 65536 vertices, else 4 (GLuint)
+  uint32_t nb_elements;     // of all the LODs
+  uint32_t nb_lods;         // 1 + the LODs, see mesh_cache_lod
+  uint64_t vertices_offset, elements_offset;  // from the start of the file
+  int64_t source_size, source_mtime;          // model file it was made from
+  float bounds_min[3], bounds_max[3];
+  uint64_t hash;            // of the LOD table and both blocks, see mesh_cache_hash()
+};
+
+/* Elements of one LOD in the element block, the full mesh first */
+struct mesh_cache_lod {
+  uint32_t first_element, nb_elements;
+  float error;              // Hausdorff distance to the full mesh, in object units
+  uint32_t padding;
+};
+
+/* Cache file mapped in memory, see mesh_cache_open() */
+struct mesh_cache {
+  const mesh_cache_header* header;
+  const mesh_cache_lod* lods;   // header->nb_lods of them
+  const void* vertices;
+  const void* elements;
+  void* data;
+  size_t size;
+};
+
+std::string mesh_cache_filename(const char* source);
+uint64_t mesh_cache_hash(const void* data, size_t size, uint64_t hash);
+bool mesh_cache_write(const char* filename, const char* source,
+		      const std::vector<glm::vec4>& positions, const std::vector<glm::vec3>& normals,
+		      const std::vector<unsigned int>& elements, const std::vector<mesh_cache_lod>& lods);
+bool mesh_cache_open(const char* filename, const char* source, mesh_cache* cache);
+void mesh_cache_close(mesh_cache* cache);
+#endif
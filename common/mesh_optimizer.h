@@ -0,0 +1,44 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _MESH_OPTIMIZER_H
+#define _MESH_OPTIMIZER_H
+#include <stddef.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+/* Post-transform cache simulated for the statistics and the reordering */
+#define MESH_CACHE_SIZE 16
+
+/* ACMR: vertex shader runs per triangle, between 0.5 and 3;
+   ATVR: vertex shader runs per vertex, 1 at best */
+struct mesh_stats {
+  float acmr, atvr;
+};
+
+void mesh_cache_stats(const unsigned int* elements, size_t nb_elements, size_t nb_vertices,
+		      int cache_size, mesh_stats* stats);
+void mesh_tipsify(unsigned int* elements, size_t nb_elements, size_t nb_vertices, int cache_size);
+void mesh_optimize_overdraw(unsigned int* elements, size_t nb_elements,
+			    const glm::vec4* positions, size_t nb_vertices,
+			    int cache_size, float threshold);
+void mesh_optimize_vertex_fetch(unsigned int* elements, size_t nb_elements, size_t nb_vertices,
+				std::vector<unsigned int>* remap);
+void mesh_optimize(std::vector<unsigned int>& elements, const std::vector<glm::vec4>& positions,
+		   std::vector<unsigned int>* remap, mesh_stats* before, mesh_stats* after);
+
+/**
+ * Move the vertex attributes where mesh_optimize_vertex_fetch() put
+ * the vertices: data[i] goes to data[remap[i]]
+ */
+template<class T> void mesh_remap(std::vector<T>& data, const std::vector<unsigned int>& remap) {
+  if (data.size() != remap.size())
+    return;
+  std::vector<T> res(data.size());
+  for (size_t i = 0; i < data.size(); i++)
+    res[remap[i]] = data[i];
+  data.swap(res);
+}
+#endif
@@ -0,0 +1,486 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+
+/*
+ * Edge collapses in the order of the quadric error metric, after
+ * "Surface Simplification Using Quadric Error Metrics", Garland and
+ * Heckbert, SIGGRAPH 1997.  The collapses are half-edge collapses: a
+ * vertex moves onto one of its neighbours, so that each LOD uses a
+ * subset of the original vertices, normals included, and all the
+ * LODs of a mesh share one vertex buffer.
+ *
+ * Vertices on a border are never moved: the open edges of the model,
+ * and the seams where obj_index_vertices() split a vertex because of
+ * its normals or texture coordinates, which look like borders here.
+ */
+
+/* Sum of squared distances to planes, as a symmetric 4x4 matrix */
+struct quadric {
+  double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+};
+
+static void quadric_add_plane(quadric* q, const glm::dvec3& n, double d, double weight) {
+  q->a2 += weight * n.x * n.x;  q->ab += weight * n.x * n.y;  q->ac += weight * n.x * n.z;
+  q->ad += weight * n.x * d;    q->b2 += weight * n.y * n.y;  q->bc += weight * n.y * n.z;
+  q->bd += weight * n.y * d;    q->c2 += weight * n.z * n.z;  q->cd += weight * n.z * d;
+  q->d2 += weight * d * d;
+}
+
+static void quadric_add(quadric* q, const quadric& o) {
+  q->a2 += o.a2;  q->ab += o.ab;  q->ac += o.ac;  q->ad += o.ad;  q->b2 += o.b2;
+  q->bc += o.bc;  q->bd += o.bd;  q->c2 += o.c2;  q->cd += o.cd;  q->d2 += o.d2;
+}
+
+static double quadric_error(const quadric& q, const glm::dvec3& p) {
+  return q.a2*p.x*p.x + 2*q.ab*p.x*p.y + 2*q.ac*p.x*p.z + 2*q.ad*p.x
+    + q.b2*p.y*p.y + 2*q.bc*p.y*p.z + 2*q.bd*p.y
+    + q.c2*p.z*p.z + 2*q.cd*p.z
+    + q.d2;
+}
+
+/* Candidate collapse; outdated when either vertex changed since */
+struct collapse {
+  double cost;
+  unsigned int from, to;
+  unsigned int from_version, to_version;
+  bool operator<(const collapse& o) const { return cost > o.cost; }  // cheapest on top
+};
+
+struct simplifier {
+  const std::vector<glm::vec4>* positions;
+  std::vector<unsigned int> triangles;             // updated by the collapses
+  std::vector<bool> alive;                         // per triangle
+  size_t nb_alive;
+  std::vector<std::vector<unsigned int> > around;  // triangles around each vertex, some dead
+  std::vector<quadric> quadrics;
+  std::vector<bool> locked, removed;
+  std::vector<unsigned int> version;
+  std::priority_queue<collapse> queue;
+};
+
+static glm::dvec3 position(const simplifier* s, unsigned int v) {
+  return glm::dvec3((*s->positions)[v]);
+}
+
+static void push_collapse(simplifier* s, unsigned int from, unsigned int to) {
+  if (s->locked[from])
+    return;
+  quadric q = s->quadrics[from];
+  quadric_add(&q, s->quadrics[to]);
+  collapse c = { quadric_error(q, position(s, to)), from, to, s->version[from], s->version[to] };
+  s->queue.push(c);
+}
+
+static void simplifier_init(simplifier* s, const std::vector<unsigned int>& elements,
+			    const std::vector<glm::vec4>& positions) {
+  size_t nb_vertices = positions.size();
+  s->positions = &positions;
+  s->triangles.assign(elements.begin(), elements.begin() + elements.size() / 3 * 3);
+  s->nb_alive = s->triangles.size() / 3;
+  s->alive.assign(s->nb_alive, true);
+  s->around.assign(nb_vertices, std::vector<unsigned int>());
+  s->quadrics.assign(nb_vertices, quadric());
+  s->locked.assign(nb_vertices, false);
+  s->removed.assign(nb_vertices, false);
+  s->version.assign(nb_vertices, 0);
+
+  // Planes of the triangles around each vertex, weighted by their area
+  std::unordered_map<uint64_t, int> edges;
+  edges.reserve(s->triangles.size());
+  for (size_t t = 0; t < s->nb_alive; t++) {
+    unsigned int* v = &s->triangles[t*3];
+    glm::dvec3 a = position(s, v[0]), b = position(s, v[1]), c = position(s, v[2]);
+    glm::dvec3 n = glm::cross(b - a, c - a);
+    double length = glm::length(n);
+    for (int k = 0; k < 3; k++) {
+      s->around[v[k]].push_back(t);
+      if (length > 0)
+	quadric_add_plane(&s->quadrics[v[k]], n / length, -glm::dot(n / length, a), length / 2);
+      unsigned int v1 = std::min(v[k], v[(k+1)%3]), v2 = std::max(v[k], v[(k+1)%3]);
+      edges[((uint64_t)v1 << 32) | v2]++;
+    }
+  }
+  // Edges that don't have exactly 2 triangles: borders
+  for (std::unordered_map<uint64_t, int>::iterator it = edges.begin(); it != edges.end(); it++) {
+    if (it->second != 2) {
+      s->locked[it->first >> 32] = true;
+      s->locked[it->first & 0xffffffff] = true;
+    }
+  }
+  for (size_t t = 0; t < s->nb_alive; t++) {
+    for (int k = 0; k < 3; k++) {
+      push_collapse(s, s->triangles[t*3 + k], s->triangles[t*3 + (k+1)%3]);
+      push_collapse(s, s->triangles[t*3 + (k+1)%3], s->triangles[t*3 + k]);
+    }
+  }
+}
+
+static bool contains(const unsigned int* triangle, unsigned int v) {
+  return triangle[0] == v || triangle[1] == v || triangle[2] == v;
+}
+
+/**
+ * Move vertex from onto vertex to, unless it would fold a triangle
+ * over, or make the surface non-manifold (the two vertices have
+ * other common neighbours than the ones of the triangles they share).
+ */
+static bool try_collapse(simplifier* s, unsigned int from, unsigned int to) {
+  std::vector<unsigned int>& from_triangles = s->around[from];
+  int shared = 0;
+  std::vector<unsigned int> from_neighbours, to_neighbours;
+  for (size_t i = 0; i < from_triangles.size(); i++) {
+    unsigned int t = from_triangles[i];
+    if (!s->alive[t])
+      continue;
+    const unsigned int* v = &s->triangles[t*3];
+    for (int k = 0; k < 3; k++)
+      from_neighbours.push_back(v[k]);
+    if (contains(v, to)) {
+      shared++;
+      continue;
+    }
+    glm::dvec3 p[3], q[3];
+    for (int k = 0; k < 3; k++) {
+      p[k] = position(s, v[k]);
+      q[k] = position(s, v[k] == from ? to : v[k]);
+    }
+    glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+    glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+    double length = glm::length(before) * glm::length(after);
+    if (length == 0 || glm::dot(before, after) < 0.2 * length)
+      return false;
+  }
+  if (shared == 0)
+    return false;
+  for (size_t i = 0; i < s->around[to].size(); i++) {
+    unsigned int t = s->around[to][i];
+    if (s->alive[t])
+      for (int k = 0; k < 3; k++)
+	to_neighbours.push_back(s->triangles[t*3 + k]);
+  }
+  std::sort(from_neighbours.begin(), from_neighbours.end());
+  from_neighbours.erase(std::unique(from_neighbours.begin(), from_neighbours.end()), from_neighbours.end());
+  std::sort(to_neighbours.begin(), to_neighbours.end());
+  to_neighbours.erase(std::unique(to_neighbours.begin(), to_neighbours.end()), to_neighbours.end());
+  std::vector<unsigned int> common;
+  std::set_intersection(from_neighbours.begin(), from_neighbours.end(),
+			to_neighbours.begin(), to_neighbours.end(), std::back_inserter(common));
+  if ((int)common.size() - 2 != shared)  // from and to are in both
+    return false;
+
+  std::vector<unsigned int>& to_triangles = s->around[to];
+  for (size_t i = 0; i < from_triangles.size(); i++) {
+    unsigned int t = from_triangles[i];
+    if (!s->alive[t])
+      continue;
+    unsigned int* v = &s->triangles[t*3];
+    if (contains(v, to)) {
+      s->alive[t] = false;
+      s->nb_alive--;
+    } else {
+      for (int k = 0; k < 3; k++)
+	if (v[k] == from)
+	  v[k] = to;
+      to_triangles.push_back(t);
+    }
+  }
+  quadric_add(&s->quadrics[to], s->quadrics[from]);
+  s->removed[from] = true;
+  from_triangles.clear();
+  s->version[to]++;
+
+  size_t nb_to = 0;
+  for (size_t i = 0; i < to_triangles.size(); i++)
+    if (s->alive[to_triangles[i]])
+      to_triangles[nb_to++] = to_triangles[i];
+  to_triangles.resize(nb_to);
+  for (size_t i = 0; i < to_triangles.size(); i++) {
+    const unsigned int* v = &s->triangles[to_triangles[i]*3];
+    for (int k = 0; k < 3; k++) {
+      if (v[k] != to) {
+	push_collapse(s, v[k], to);
+	push_collapse(s, to, v[k]);
+      }
+    }
+  }
+  return true;
+}
+
+/* Collapse the cheapest edges first until there are target triangles left */
+static void simplifier_run(simplifier* s, size_t target_triangles) {
+  while (s->nb_alive > target_triangles && !s->queue.empty()) {
+    collapse c = s->queue.top();
+    s->queue.pop();
+    if (s->removed[c.from] || s->removed[c.to]
+	|| s->version[c.from] != c.from_version || s->version[c.to] != c.to_version)
+      continue;
+    try_collapse(s, c.from, c.to);
+  }
+}
+
+static void simplifier_elements(const simplifier* s, std::vector<unsigned int>& elements) {
+  elements.clear();
+  for (size_t t = 0; t < s->alive.size(); t++)
+    if (s->alive[t])
+      elements.insert(elements.end(), &s->triangles[t*3], &s->triangles[t*3] + 3);
+}
+
+/**
+ * Simplify the triangle list elements down to target_triangles, or as
+ * close as the borders and the folding checks allow.  Returns the
+ * number of triangles left.
+ */
+size_t mesh_simplify(std::vector<unsigned int>& elements, const std::vector<glm::vec4>& positions,
+		     size_t target_triangles) {
+  simplifier s;
+  simplifier_init(&s, elements, positions);
+  simplifier_run(&s, target_triangles);
+  simplifier_elements(&s, elements);
+  return elements.size() / 3;
+}
+
+/**
+ * Nearest point of triangle abc, from "Real-Time Collision Detection",
+ * Ericson.  In doubles: the long thin triangles that simplification
+ * leaves on flat areas are too much for floats.
+ */
+static glm::dvec3 closest_point(const glm::dvec3& p, const glm::dvec3& a, const glm::dvec3& b,
+				const glm::dvec3& c) {
+  glm::dvec3 ab = b - a, ac = c - a, ap = p - a;
+  double d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+  if (d1 <= 0 && d2 <= 0)
+    return a;
+  glm::dvec3 bp = p - b;
+  double d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+  if (d3 >= 0 && d4 <= d3)
+    return b;
+  double vc = d1*d4 - d3*d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    return a + ab * (d1 / (d1 - d3));
+  glm::dvec3 cp = p - c;
+  double d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+  if (d6 >= 0 && d5 <= d6)
+    return c;
+  double vb = d5*d2 - d1*d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    return a + ac * (d2 / (d2 - d6));
+  double va = d3*d6 - d5*d4;
+  if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  if (va + vb + vc == 0)
+    return a;  // degenerate
+  double denom = 1 / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+/* Triangles of a mesh in a uniform grid, for nearest point queries */
+struct triangle_grid {
+  const std::vector<unsigned int>* elements;
+  const std::vector<glm::vec4>* positions;
+  glm::vec3 origin;
+  float cell;
+  int size[3];
+  std::vector<unsigned int> offsets, triangles;  // triangles of cell i: offsets[i]..offsets[i+1]-1
+  std::vector<unsigned int> stamp;               // last query that looked at each triangle
+  unsigned int query;
+};
+
+static void cell_of(const triangle_grid* g, const glm::vec3& p, int* c) {
+  for (int k = 0; k < 3; k++)
+    c[k] = std::max(0, std::min(g->size[k] - 1, (int)floor((p[k] - g->origin[k]) / g->cell)));
+}
+
+static void grid_init(triangle_grid* g, const std::vector<unsigned int>& elements,
+		      const std::vector<glm::vec4>& positions) {
+  g->elements = &elements;
+  g->positions = &positions;
+  size_t nb_triangles = elements.size() / 3;
+  glm::vec3 min_p(FLT_MAX), max_p(-FLT_MAX);
+  double area = 0;
+  for (size_t t = 0; t < nb_triangles; t++) {
+    glm::vec3 a(positions[elements[t*3]]), b(positions[elements[t*3+1]]), c(positions[elements[t*3+2]]);
+    min_p = glm::min(min_p, glm::min(a, glm::min(b, c)));
+    max_p = glm::max(max_p, glm::max(a, glm::max(b, c)));
+    area += glm::length(glm::cross(b - a, c - a)) / 2;
+  }
+  // A few triangles per cell on the surface, and not many more cells
+  // than triangles in the volume
+  glm::vec3 extent = glm::max(max_p - min_p, glm::vec3(1e-6f));
+  g->cell = std::max(2 * sqrt(area / std::max(nb_triangles, (size_t)1)), 1e-6);
+  double volume = (double)extent.x * extent.y * extent.z;
+  if (volume / pow(g->cell, 3) > 4.0 * nb_triangles + 64)
+    g->cell = cbrt(volume / (4.0 * nb_triangles + 64));
+  g->cell = std::max(g->cell, std::max(extent.x, std::max(extent.y, extent.z)) / 1024);
+  g->origin = min_p;
+  for (int k = 0; k < 3; k++)
+    g->size[k] = std::max(1, std::min(1024, (int)ceil(extent[k] / g->cell)));
+
+  size_t nb_cells = (size_t)g->size[0] * g->size[1] * g->size[2];
+  g->offsets.assign(nb_cells + 1, 0);
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<unsigned int> fill;
+    if (pass == 1) {
+      for (size_t i = 0; i < nb_cells; i++)
+	g->offsets[i+1] += g->offsets[i];
+      g->triangles.resize(g->offsets[nb_cells]);
+      fill.assign(g->offsets.begin(), g->offsets.end() - 1);
+    }
+    for (size_t t = 0; t < nb_triangles; t++) {
+      glm::vec3 a(positions[elements[t*3]]), b(positions[elements[t*3+1]]), c(positions[elements[t*3+2]]);
+      int c0[3], c1[3];
+      cell_of(g, glm::min(a, glm::min(b, c)), c0);
+      cell_of(g, glm::max(a, glm::max(b, c)), c1);
+      for (int z = c0[2]; z <= c1[2]; z++)
+	for (int y = c0[1]; y <= c1[1]; y++)
+	  for (int x = c0[0]; x <= c1[0]; x++) {
+	    size_t i = ((size_t)z * g->size[1] + y) * g->size[0] + x;
+	    if (pass == 0)
+	      g->offsets[i+1]++;
+	    else
+	      g->triangles[fill[i]++] = t;
+	  }
+    }
+  }
+  g->stamp.assign(nb_triangles, 0);
+  g->query = 0;
+}
+
+/* Distance from p to the nearest triangle, looking at the cells in growing rings */
+static float grid_distance(triangle_grid* g, const glm::vec3& p) {
+  const std::vector<unsigned int>& elements = *g->elements;
+  const std::vector<glm::vec4>& positions = *g->positions;
+  int c[3];
+  cell_of(g, p, c);
+  g->query++;
+  glm::dvec3 dp(p);
+  double best = DBL_MAX;
+  int max_ring = std::max(g->size[0], std::max(g->size[1], g->size[2]));
+  for (int r = 0; r <= max_ring; r++) {
+    for (int z = std::max(0, c[2] - r); z <= std::min(g->size[2] - 1, c[2] + r); z++)
+      for (int y = std::max(0, c[1] - r); y <= std::min(g->size[1] - 1, c[1] + r); y++)
+	for (int x = std::max(0, c[0] - r); x <= std::min(g->size[0] - 1, c[0] + r); x++) {
+	  if (abs(x - c[0]) != r && abs(y - c[1]) != r && abs(z - c[2]) != r)
+	    continue;  // inner rings are done
+	  size_t i = ((size_t)z * g->size[1] + y) * g->size[0] + x;
+	  for (unsigned int j = g->offsets[i]; j < g->offsets[i+1]; j++) {
+	    unsigned int t = g->triangles[j];
+	    if (g->stamp[t] == g->query)
+	      continue;
+	    g->stamp[t] = g->query;
+	    glm::dvec3 a(positions[elements[t*3]]), b(positions[elements[t*3+1]]), cc(positions[elements[t*3+2]]);
+	    glm::dvec3 d = dp - closest_point(dp, a, b, cc);
+	    best = std::min(best, glm::dot(d, d));  // squared until the end
+	  }
+	}
+    // nothing beyond ring r is nearer than its outer faces
+    float bound = FLT_MAX;
+    for (int k = 0; k < 3; k++) {
+      if (c[k] - r > 0)
+	bound = std::min(bound, p[k] - (g->origin[k] + (c[k] - r) * g->cell));
+      if (c[k] + r < g->size[k] - 1)
+	bound = std::min(bound, g->origin[k] + (c[k] + r + 1) * g->cell - p[k]);
+    }
+    if (best <= bound * bound)
+      break;
+  }
+  return (float)sqrt(best);
+}
+
+/* Farthest sample of a (vertices and triangle centers) from the surface in grid */
+static float one_sided_distance(const std::vector<unsigned int>& a, const std::vector<glm::vec4>& positions,
+				triangle_grid* grid) {
+  if (a.size() < 3 || grid->elements->size() < 3)
+    return 0;
+  std::vector<bool> done(positions.size(), false);
+  float res = 0;
+  for (size_t t = 0; t < a.size() / 3; t++) {
+    glm::vec3 center(0.0);
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = a[t*3 + k];
+      center += glm::vec3(positions[v]) / 3.0f;
+      if (!done[v]) {
+	done[v] = true;
+	res = std::max(res, grid_distance(grid, glm::vec3(positions[v])));
+      }
+    }
+    res = std::max(res, grid_distance(grid, center));
+  }
+  return res;
+}
+
+static float hausdorff(triangle_grid* grid_a, const std::vector<unsigned int>& b,
+		       const std::vector<glm::vec4>& positions) {
+  triangle_grid grid_b;
+  grid_init(&grid_b, b, positions);
+  return std::max(one_sided_distance(*grid_a->elements, positions, &grid_b),
+		  one_sided_distance(b, positions, grid_a));
+}
+
+/**
+ * Hausdorff distance between the surfaces of two triangle lists over
+ * the same vertices: how far a point of either can be from the other,
+ * measured at the vertices and triangle centers.
+ */
+float mesh_hausdorff(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b,
+		     const std::vector<glm::vec4>& positions) {
+  triangle_grid grid_a;
+  grid_init(&grid_a, a, positions);
+  return hausdorff(&grid_a, b, positions);
+}
+
+/**
+ * LOD chain: half the triangles of the previous level each time, down
+ * to min_triangles, or until the simplification stalls.  Each level is
+ * one more step of the same simplification, reordered for the vertex
+ * cache and overdraw like the full mesh, with its distance to the full
+ * mesh.
+ */
+void mesh_build_lods(const std::vector<unsigned int>& elements, const std::vector<glm::vec4>& positions,
+		     size_t min_triangles, std::vector<mesh_lod>* lods) {
+  lods->clear();
+  simplifier s;
+  simplifier_init(&s, elements, positions);
+  triangle_grid full;  // shared by the error measures of all the levels
+  grid_init(&full, elements, positions);
+  size_t current = s.nb_alive;
+  while (current / 2 >= min_triangles) {
+    simplifier_run(&s, current / 2);
+    if (s.nb_alive > current * 9 / 10)
+      break;
+    current = s.nb_alive;
+    lods->push_back(mesh_lod());
+    mesh_lod& lod = lods->back();
+    simplifier_elements(&s, lod.elements);
+    mesh_tipsify(lod.elements.data(), lod.elements.size(), positions.size(), MESH_CACHE_SIZE);
+    mesh_optimize_overdraw(lod.elements.data(), lod.elements.size(), positions.data(), positions.size(),
+			   MESH_CACHE_SIZE, 1.05);
+    lod.error = hausdorff(&full, lod.elements, positions);
+  }
+}
+
+/**
+ * Size on screen of one object unit at the nearest point of the
+ * object's bounding sphere, in pixels: multiply by a LOD error to know
+ * how visible it is.  Infinite when the camera is in the sphere.
+ */
+float mesh_pixels_per_unit(const glm::mat4& projection, const glm::mat4& model_view,
+			   const glm::vec3& center, float radius, int viewport_height) {
+  float scale = std::max(glm::length(glm::vec3(model_view[0])),
+			 std::max(glm::length(glm::vec3(model_view[1])), glm::length(glm::vec3(model_view[2]))));
+  float distance = glm::length(glm::vec3(model_view * glm::vec4(center, 1))) - radius * scale;
+  if (distance <= 0)
+    return INFINITY;
+  return fabs(projection[1][1]) * viewport_height / 2 * scale / distance;
+}
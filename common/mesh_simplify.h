@@ -0,0 +1,26 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _MESH_SIMPLIFY_H
+#define _MESH_SIMPLIFY_H
+#include <stddef.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+/* Coarser version of a mesh, drawn with the same vertices */
+struct mesh_lod {
+  std::vector<unsigned int> elements;
+  float error;  // Hausdorff distance to the full mesh, in object units
+};
+
+size_t mesh_simplify(std::vector<unsigned int>& elements, const std::vector<glm::vec4>& positions,
+		     size_t target_triangles);
+void mesh_build_lods(const std::vector<unsigned int>& elements, const std::vector<glm::vec4>& positions,
+		     size_t min_triangles, std::vector<mesh_lod>* lods);
+float mesh_hausdorff(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b,
+		     const std::vector<glm::vec4>& positions);
+float mesh_pixels_per_unit(const glm::mat4& projection, const glm::mat4& model_view,
+			   const glm::vec3& center, float radius, int viewport_height);
+#endif
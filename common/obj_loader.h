@@ -0,0 +1,37 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _OBJ_LOADER_H
+#define _OBJ_LOADER_H
+#include <stddef.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+/* One corner of a face: 0-based indices, -1 when not given */
+struct obj_corner {
+  int v, vt, vn;
+};
+
+struct obj_model {
+  std::vector<glm::vec4> vertices;        // v
+  std::vector<glm::vec2> texcoords;       // vt
+  std::vector<glm::vec3> normals;         // vn
+  std::vector<obj_corner> corners;        // f, 3 per triangle
+  std::vector<glm::vec3> vertex_normals;  // one per v, see obj_compute_normals()
+};
+
+/* Vertex of an indexed mesh, see obj_index_vertices() */
+struct obj_vertex {
+  glm::vec4 position;
+  glm::vec3 normal;
+  glm::vec2 texcoord;
+};
+
+bool obj_parse(const char* data, size_t size, obj_model* model, int nb_threads = 0);
+void obj_compute_normals(obj_model* model);
+void obj_index_vertices(const obj_model* model, std::vector<obj_vertex>* vertices,
+			std::vector<unsigned int>* elements);
+bool obj_load(const char* filename, obj_model* model, int nb_threads = 0);
+#endif
@@ -5,11 +5,20 @@
  */
 #ifndef _SHADER_UTILS_H
 #define _SHADER_UTILS_H
+#include <string>
+#include <vector>
 #include <GL/glew.h>
 char* file_read(const char* filename);
 void print_log(GLuint object);
 GLuint create_shader(const char* filename, GLenum type);
-GLuint create_program(const char* vertexfile, const char *fragmentfile);
+bool get_shader_files(const char* filename, std::vector<std::string>* files);
+GLuint create_program(const char* vertexfile, const char *fragmentfile, const char* defines = NULL);
+GLuint create_program_async(const char* vertexfile, const char *fragmentfile, const char* defines = NULL);
+bool program_ready(GLuint program);
+GLuint finish_program(GLuint program);
+std::string shader_permutation(const char* const* features, unsigned int mask);
+void enable_program_cache(bool on);
+void get_program_cache_stats(int* hits, int* misses);
 GLuint create_gs_program(const char* vertexfile, const char *geometryfile, const char *fragmentfile, GLint input, GLint output, GLint vertices);
 GLint get_attrib(GLuint program, const char *name);
 GLint get_uniform(GLuint program, const char *name);
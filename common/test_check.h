@@ -0,0 +1,27 @@
+/**
+ * This file is in the public domain.
+ */
+#ifndef _TEST_CHECK_H
+#define _TEST_CHECK_H
+#include <stdio.h>
+
+/*
+ * Results of the test programs in the tests/ directories, built and
+ * run by "make check" from the directory of their demo: one line per
+ * check, then the number of failures, which is also the exit status.
+ */
+
+static int failures = 0;
+
+static inline void check(const char* name, bool ok) {
+  printf("%-4s %s\n", ok ? "ok" : "FAIL", name);
+  if (!ok)
+    failures++;
+}
+
+/* The exit status of main() */
+static inline int check_summary() {
+  printf("%d failure(s)\n", failures);
+  return failures != 0;
+}
+#endif
@@ -0,0 +1,337 @@
+/*
+ * Synthetic load for the world server. Opens a number of connections that
+ * each behave like a player digging and building around a random spot,
+ * sending a batch of edits every tick. All connections decode everything
+ * the server sends; the first one also keeps a full copy of the world.
+ *
+ * Every batch contains one probe edit, used to measure the time until the
+ * server broadcasts it back.
+ *
+ * At the end, the replica's checksum is printed, to compare with the one
+ * the server prints when it shuts down (see tests/loopback.sh).
+ *
+ * Usage: ./bot [-c clients] [-r edits per second per client] [-t seconds] [-p port] [host]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <map>
+
+#include "../glescraft/brickmap.h"
+#include "protocol.h"
+#include "net.h"
+
+#define TICKRATE 20
+
+struct bot {
+	int fd;
+	std::vector<uint8_t> in;
+	outbuf out;
+	bool replica;			// keep a copy of the world
+	brickmap *world;
+	int cx, cz;			// center of the area this bot edits
+	int cells;			// snapshot cells received
+	int ncells;
+	double loaded;			// time at which the snapshot was complete
+	std::map<uint64_t, double> probes;	// probe edits in flight, and when they were sent
+	int nprobes;
+};
+
+static uint32_t rng = 1;
+
+static uint32_t next() {
+	rng = rng * 1664525 + 1013904223;
+	return rng >> 8;
+}
+
+static struct {
+	unsigned long sent;		// edits sent
+	unsigned long received;		// edits received in deltas
+	unsigned long bytes;		// bytes received
+	unsigned long probes;
+	double latency;			// sum of probe round trip times
+	double maxlatency;
+} stats, total;
+
+static uint64_t key(const edit &e) {
+	return (uint64_t)(uint16_t)e.x << 32 | (uint64_t)(uint16_t)e.y << 16 | (uint16_t)e.z;
+}
+
+static bool handle(bot *b, uint8_t type, const uint8_t *p, uint32_t len) {
+	std::vector<uint8_t> raw;
+
+	switch(type) {
+	case MSG_HELLO:
+		if(len != 24)
+			return false;
+		b->ncells = get32(p) * get32(p + 4) * get32(p + 8);
+		if(b->replica) {
+			b->world = new brickmap(get32(p) * BS, get32(p + 4) * BS, get32(p + 8) * BS);
+			b->world->ox = get32(p + 12);
+			b->world->oy = get32(p + 16);
+			b->world->oz = get32(p + 20);
+		}
+		return true;
+
+	case MSG_SNAPSHOT: {
+		if(len < 8 || !get_compressed(p + 8, len - 8, raw))
+			return false;
+		int first = get32(p), n = get32(p + 4);
+		if(first < 0 || n < 0 || first + n > b->ncells)
+			return false;
+		if(b->world) {
+			size_t pos = 0;
+			for(int i = first; i < first + n; i++)
+				if(!b->world->deserialize_cell(i, raw.data(), raw.size(), &pos))
+					return false;
+		}
+		b->cells += n;
+		if(b->cells == b->ncells)
+			b->loaded = now();
+		return true;
+	}
+
+	case MSG_DELTAS: {
+		if(len < 8 || !get_compressed(p + 8, len - 8, raw))
+			return false;
+		uint32_t count = get32(p + 4);
+		if(raw.size() != count * EDIT_SIZE)
+			return false;
+
+		double t = now();
+		for(uint32_t i = 0; i < count; i++) {
+			edit e = get_edit(&raw[i * EDIT_SIZE]);
+			if(b->world)
+				b->world->set(e.x, e.y, e.z, e.type);
+			if(b->probes.empty())
+				continue;
+			std::map<uint64_t, double>::iterator it = b->probes.find(key(e));
+			if(it != b->probes.end()) {
+				double latency = t - it->second;
+				stats.probes++;
+				stats.latency += latency;
+				if(latency > stats.maxlatency)
+					stats.maxlatency = latency;
+				b->probes.erase(it);
+			}
+		}
+
+		stats.received += count;
+		return true;
+	}
+
+	default:
+		return false;
+	}
+}
+
+/* Queue one tick worth of edits */
+static void send_edits(bot *b, int n) {
+	if(!n)
+		return;
+
+	size_t start = begin_message(b->out.data, MSG_EDITS);
+	edit e;
+
+	// The probe goes into the top layer, which the other edits never
+	// touch, and cycles through the block types so that it is almost
+	// never a no-op.
+	e.x = b->cx + (int)(next() % 64) - 32;
+	e.y = 31;
+	e.z = b->cz + (int)(next() % 64) - 32;
+	e.type = 1 + b->nprobes++ % 15;
+	put_edit(b->out.data, e);
+	b->probes[key(e)] = now();
+
+	for(int i = 1; i < n; i++) {
+		e.x = b->cx + (int)(next() % 64) - 32;
+		e.y = (int)(next() % 32) - 8;
+		e.z = b->cz + (int)(next() % 64) - 32;
+		e.type = next() % 3 ? 0 : 1 + next() % 15;
+		put_edit(b->out.data, e);
+	}
+
+	end_message(b->out.data, start);
+	stats.sent += n;
+}
+
+/* Wait up to timeout ms, then read and write what the sockets allow; false on error */
+static bool poll_bots(std::vector<bot *> &bots, std::vector<struct pollfd> &fds, int timeout) {
+	int nbots = bots.size();
+	for(int i = 0; i < nbots; i++) {
+		fds[i].fd = bots[i]->fd;
+		fds[i].events = POLLIN | (bots[i]->out.pending() ? POLLOUT : 0);
+	}
+
+	poll(&fds[0], nbots, timeout);
+
+	for(int i = 0; i < nbots; i++) {
+		bot *b = bots[i];
+
+		if(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+			ssize_t n = read_available(b->fd, b->in);
+			if(n < 0) {
+				fprintf(stderr, "Connection %d closed by server\n", i);
+				return false;
+			}
+			stats.bytes += n;
+			if(!parse_messages(b->in, [b](uint8_t type, const uint8_t *p, uint32_t len) { return handle(b, type, p, len); })) {
+				fprintf(stderr, "Protocol error on connection %d\n", i);
+				return false;
+			}
+		}
+
+		if((fds[i].revents & POLLOUT) && !b->out.flush(b->fd)) {
+			fprintf(stderr, "Write error on connection %d\n", i);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Everything sent has been broadcast back, as far as the probes tell */
+static bool settled(const std::vector<bot *> &bots) {
+	if(bots[0]->loaded <= 0)
+		return false;
+	for(size_t i = 0; i < bots.size(); i++)
+		if(bots[i]->out.pending() || !bots[i]->probes.empty())
+			return false;
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	int nbots = 16;
+	int rate = 1000;
+	int seconds = 10;
+	int port = DEFAULT_PORT;
+	const char *host = "127.0.0.1";
+	int opt;
+
+	while((opt = getopt(argc, argv, "c:r:t:p:")) != -1) {
+		switch(opt) {
+		case 'c': nbots = atoi(optarg); break;
+		case 'r': rate = atoi(optarg); break;
+		case 't': seconds = atoi(optarg); break;
+		case 'p': port = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-c clients] [-r edits per second per client] [-t seconds] [-p port] [host]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind < argc)
+		host = argv[optind];
+
+	struct sockaddr_in addr;
+	if(nbots <= 0 || !make_address(host, port, &addr))
+		return 1;
+
+	std::vector<bot *> bots;
+
+	for(int i = 0; i < nbots; i++) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof addr)) {
+			perror("Could not connect");
+			return 1;
+		}
+		setup_socket(fd);
+
+		bot *b = new bot;
+		b->fd = fd;
+		b->replica = i == 0;
+		b->world = 0;
+		b->cx = (int)(next() % 448) - 224;
+		b->cz = (int)(next() % 448) - 224;
+		b->cells = 0;
+		b->ncells = -1;
+		b->loaded = 0;
+		b->nprobes = 0;
+		bots.push_back(b);
+	}
+
+	printf("%d clients sending %d edits/s each to %s:%d\n", nbots, rate, host, port);
+
+	double start = now();
+	double period = 1.0 / TICKRATE;
+	double next_tick = start;
+	double next_report = start + 1;
+	double end = start + seconds;
+	long ticks = 0;
+	std::vector<struct pollfd> fds(nbots);
+
+	while(now() < end) {
+		int timeout = ceil((next_tick - now()) * 1000);
+		if(!poll_bots(bots, fds, timeout > 0 ? timeout : 0))
+			return 1;
+
+		double t = now();
+
+		if(t >= next_tick) {
+			// Spread the rate evenly over the ticks of each second
+			ticks++;
+			int n = (long)rate * ticks / TICKRATE - (long)rate * (ticks - 1) / TICKRATE;
+			for(int i = 0; i < nbots; i++) {
+				send_edits(bots[i], n);
+				if(!bots[i]->out.flush(bots[i]->fd)) {
+					fprintf(stderr, "Write error on connection %d\n", i);
+					return 1;
+				}
+			}
+			next_tick += period;
+		}
+
+		if(t >= next_report) {
+			int loaded = 0;
+			for(int i = 0; i < nbots; i++)
+				loaded += bots[i]->loaded > 0;
+
+			printf("%lu edits/s sent, %lu edits/s received, %.1f MB/s in, latency %.1f ms avg %.1f ms max, %d/%d clients loaded\n",
+			       stats.sent, stats.received, stats.bytes / 1048576.0,
+			       stats.probes ? stats.latency / stats.probes * 1000 : 0.0, stats.maxlatency * 1000, loaded, nbots);
+			fflush(stdout);
+
+			total.sent += stats.sent;
+			total.received += stats.received;
+			total.bytes += stats.bytes;
+			total.probes += stats.probes;
+			total.latency += stats.latency;
+			if(stats.maxlatency > total.maxlatency)
+				total.maxlatency = stats.maxlatency;
+			memset(&stats, 0, sizeof stats);
+			next_report += 1;
+		}
+	}
+
+	double elapsed = now() - start;
+	double loadtime = bots[0]->loaded > 0 ? bots[0]->loaded - start : -1;
+
+	printf("Total: %.0f edits/s sent, %.0f edits/s received per client, %.1f MB received, latency %.1f ms avg %.1f ms max\n",
+	       total.sent / elapsed, total.received / elapsed / nbots, total.bytes / 1048576.0,
+	       total.probes ? total.latency / total.probes * 1000 : 0.0, total.maxlatency * 1000);
+
+	if(loadtime >= 0)
+		printf("Initial world snapshot took %.2f s, %d bricks\n", loadtime, bots[0]->world->bricks);
+	else
+		printf("Initial world snapshot did not complete\n");
+
+	// Stop editing and give the server a few ticks to broadcast the last
+	// edits, so that the replica can be compared with the server's world.
+	// A probe that changed nothing never comes back, hence the deadline.
+	double deadline = now() + 2;
+	while(!settled(bots) && now() < deadline)
+		if(!poll_bots(bots, fds, 10))
+			return 1;
+
+	if(bots[0]->loaded > 0) {
+		std::vector<uint8_t> data;
+		bots[0]->world->compact();
+		bots[0]->world->serialize(data);
+		printf("Replica checksum %08x%s\n", checksum(data), settled(bots) ? "" : " (some edits may still be in flight)");
+	}
+
+	for(int i = 0; i < nbots; i++)
+		close(bots[i]->fd);
+	return 0;
+}
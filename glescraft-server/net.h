@@ -0,0 +1,109 @@
+#ifndef NET_H
+#define NET_H
+
+/* Small helpers for non-blocking TCP sockets, shared by server and bot */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static void setup_socket(int fd) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	// Messages are already batched per tick, don't delay them any further
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+}
+
+static bool make_address(const char *host, int port, struct sockaddr_in *addr) {
+	memset(addr, 0, sizeof *addr);
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+	if(inet_pton(AF_INET, host, &addr->sin_addr) != 1) {
+		fprintf(stderr, "Invalid address %s\n", host);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Append everything that can be read without blocking to in.
+ * Returns the number of bytes read, or -1 if the connection is closed.
+ */
+static ssize_t read_available(int fd, std::vector<uint8_t> &in) {
+	ssize_t total = 0;
+
+	for(;;) {
+		size_t old = in.size();
+		in.resize(old + 65536);
+		ssize_t n = recv(fd, &in[old], 65536, 0);
+		in.resize(old + (n > 0 ? n : 0));
+
+		if(n > 0) {
+			total += n;
+			continue;
+		}
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return total;
+		if(n < 0 && errno == EINTR)
+			continue;
+		return -1;
+	}
+}
+
+/*
+ * Outgoing byte stream of one connection. Data is only removed from the
+ * front of the buffer once a large part of it has been sent, to avoid
+ * moving memory around after every partial write.
+ */
+struct outbuf {
+	std::vector<uint8_t> data;
+	size_t sent;
+
+	outbuf(): sent(0) {}
+
+	size_t pending() const {
+		return data.size() - sent;
+	}
+
+	/* Returns false if the connection is broken */
+	bool flush(int fd) {
+		while(pending()) {
+			ssize_t n = send(fd, &data[sent], pending(), MSG_NOSIGNAL);
+			if(n < 0) {
+				if(errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				if(errno == EINTR)
+					continue;
+				return false;
+			}
+			sent += n;
+		}
+
+		if(!pending()) {
+			data.clear();
+			sent = 0;
+		} else if(sent > data.size() / 2) {
+			data.erase(data.begin(), data.begin() + sent);
+			sent = 0;
+		}
+
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/*
+ * Wire protocol shared by the world server and the bot client.
+ *
+ * Every message starts with a 5 byte header: the message type, followed by
+ * the length of the payload as a 32 bit little endian number. All other
+ * numbers are little endian as well.
+ *
+ * client -> server
+ *   MSG_EDITS     n times: x, y, z (16 bit each), block type (8 bit)
+ *
+ * server -> client
+ *   MSG_HELLO     world size and origin (see brickmap), 6 x 32 bit
+ *   MSG_SNAPSHOT  first cell, number of cells, raw size (32 bit each),
+ *                 then the cells in brickmap::serialize_cell() format,
+ *                 compressed with zlib
+ *   MSG_DELTAS    tick, number of edits, raw size (32 bit each), then all
+ *                 edits made during that tick, compressed with zlib
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <zlib.h>
+
+#define DEFAULT_PORT 4242
+
+enum {
+	MSG_EDITS = 1,
+	MSG_HELLO = 2,
+	MSG_SNAPSHOT = 3,
+	MSG_DELTAS = 4,
+};
+
+#define HEADER_SIZE 5
+#define EDIT_SIZE 7
+
+// Larger messages are treated as a protocol error
+#define MAX_MESSAGE (16 << 20)
+
+struct edit {
+	int16_t x, y, z;
+	uint8_t type;
+};
+
+static inline void put32(std::vector<uint8_t> &out, uint32_t v) {
+	for(int i = 0; i < 4; i++)
+		out.push_back(v >> (i * 8));
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void put_edit(std::vector<uint8_t> &out, const edit &e) {
+	out.push_back(e.x);
+	out.push_back(e.x >> 8);
+	out.push_back(e.y);
+	out.push_back(e.y >> 8);
+	out.push_back(e.z);
+	out.push_back(e.z >> 8);
+	out.push_back(e.type);
+}
+
+static inline edit get_edit(const uint8_t *p) {
+	edit e;
+	e.x = p[0] | p[1] << 8;
+	e.y = p[2] | p[3] << 8;
+	e.z = p[4] | p[5] << 8;
+	e.type = p[6];
+	return e;
+}
+
+/* Start a message; returns the offset to pass to end_message() */
+static inline size_t begin_message(std::vector<uint8_t> &out, uint8_t type) {
+	size_t start = out.size();
+	out.push_back(type);
+	put32(out, 0);
+	return start;
+}
+
+static inline void end_message(std::vector<uint8_t> &out, size_t start) {
+	uint32_t len = out.size() - start - HEADER_SIZE;
+	for(int i = 0; i < 4; i++)
+		out[start + 1 + i] = len >> (i * 8);
+}
+
+/* Append raw, compressed with zlib, preceded by its uncompressed size */
+static inline void put_compressed(std::vector<uint8_t> &out, const std::vector<uint8_t> &raw) {
+	put32(out, raw.size());
+	uLongf len = compressBound(raw.size());
+	size_t start = out.size();
+	out.resize(start + len);
+	if(compress2(&out[start], &len, raw.empty() ? (const Bytef *)"" : &raw[0], raw.size(), Z_BEST_SPEED) != Z_OK)
+		len = 0;
+	out.resize(start + len);
+}
+
+/* Inverse of put_compressed(); returns false on corrupt data */
+static inline bool get_compressed(const uint8_t *p, size_t len, std::vector<uint8_t> &raw) {
+	if(len < 4)
+		return false;
+	uLongf size = get32(p);
+	if(size > MAX_MESSAGE)
+		return false;
+	raw.resize(size);
+	if(!size)
+		return true;
+	return uncompress(&raw[0], &size, p + 4, len - 4) == Z_OK && size == raw.size();
+}
+
+/* Of a serialized brickmap, to compare two worlds */
+static inline uint32_t checksum(const std::vector<uint8_t> &data) {
+	return crc32(0, data.empty() ? (const Bytef *)"" : &data[0], data.size());
+}
+
+/*
+ * Incoming byte stream of one connection. Calls handler(type, payload, len)
+ * for every complete message, and keeps partial messages for later.
+ * Returns false if the stream contains an invalid message.
+ */
+template<typename F> static bool parse_messages(std::vector<uint8_t> &in, F handler) {
+	size_t pos = 0;
+
+	while(in.size() - pos >= HEADER_SIZE) {
+		uint32_t len = get32(&in[pos + 1]);
+		if(len > MAX_MESSAGE)
+			return false;
+		if(in.size() - pos < HEADER_SIZE + len)
+			break;
+		if(!handler(in[pos], &in[pos + HEADER_SIZE], len))
+			return false;
+		pos += HEADER_SIZE + len;
+	}
+
+	in.erase(in.begin(), in.begin() + pos);
+	return true;
+}
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * Headless, authoritative glescraft world server.
+ *
+ * Clients send block edits whenever they like. The server collects them,
+ * and once per tick applies them to its world, drops duplicates and edits
+ * that change nothing, and broadcasts the result as a single compressed
+ * message to every client. New clients first get the whole world, streamed
+ * in compressed slices of brick cells over the following ticks.
+ *
+ * Usage: ./server [port] [ticks per second]
+ */
+
+#include <stdlib.h>
+#include <signal.h>
+#include <poll.h>
+#include <math.h>
+#include <algorithm>
+
+#include "../glescraft/brickmap.h"
+#include "protocol.h"
+#include "net.h"
+
+// Same world size as glescraft
+#define WX 512
+#define WY 64
+#define WZ 512
+
+// Raw bytes of snapshot data sent to a client per tick
+#define SNAPSHOT_SLICE (256 << 10)
+
+// Don't send more snapshot data while this much output is still queued
+#define SNAPSHOT_BACKLOG (1 << 20)
+
+// Clients that fall this far behind are disconnected
+#define MAX_BACKLOG (64 << 20)
+
+struct client {
+	int fd;
+	std::vector<uint8_t> in;
+	outbuf out;
+	int snapshot;		// next cell to send, or -1 when the world has been sent
+	char name[32];
+};
+
+/* An edit as it arrives, with the order in which it arrived */
+struct pending_edit {
+	uint64_t key;
+	uint32_t seq;
+	edit e;
+
+	bool operator<(const pending_edit &other) const {
+		return key < other.key || (key == other.key && seq < other.seq);
+	}
+};
+
+static brickmap world(WX, WY, WZ);
+static std::vector<client *> clients;
+static std::vector<pending_edit> pending;
+static uint32_t tick;
+static volatile sig_atomic_t running = 1;
+
+static struct {
+	unsigned long received;		// edits received from clients
+	unsigned long applied;		// edits that changed the world
+	unsigned long raw;		// uncompressed delta bytes
+	unsigned long compressed;	// compressed delta bytes
+	unsigned long sent;		// bytes written to all sockets
+} stats;
+
+static void stop(int sig) {
+	running = 0;
+}
+
+static void generate() {
+	for(int x = -WX / 2; x < WX / 2; x++) {
+		for(int z = -WZ / 2; z < WZ / 2; z++) {
+			int h = 4 + 6 * sinf(x / 37.0) * cosf(z / 29.0) + 3 * sinf((x + z) / 11.0);
+			for(int y = -WY / 2; y < h; y++)
+				world.set(x, y, z, y < h - 4 ? 6 : (y == h - 1 ? 3 : 1));
+		}
+	}
+
+	world.compact();
+}
+
+static uint64_t key(const edit &e) {
+	return (uint64_t)(uint16_t)e.x << 32 | (uint64_t)(uint16_t)e.y << 16 | (uint16_t)e.z;
+}
+
+static void drop(client *c, const char *reason) {
+	fprintf(stderr, "%s: disconnected (%s)\n", c->name, reason);
+	close(c->fd);
+	c->fd = -1;
+}
+
+static bool handle(client *c, uint8_t type, const uint8_t *payload, uint32_t len) {
+	if(type != MSG_EDITS || len % EDIT_SIZE)
+		return false;
+
+	for(uint32_t i = 0; i < len; i += EDIT_SIZE) {
+		pending_edit p;
+		p.e = get_edit(payload + i);
+		p.key = key(p.e);
+		p.seq = pending.size();
+		pending.push_back(p);
+	}
+
+	stats.received += len / EDIT_SIZE;
+	return true;
+}
+
+static void accept_clients(int listener) {
+	for(;;) {
+		struct sockaddr_in addr;
+		socklen_t addrlen = sizeof addr;
+		int fd = accept(listener, (struct sockaddr *)&addr, &addrlen);
+		if(fd < 0)
+			return;
+
+		setup_socket(fd);
+
+		client *c = new client;
+		c->fd = fd;
+		c->snapshot = 0;
+		snprintf(c->name, sizeof c->name, "%s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+		clients.push_back(c);
+
+		size_t start = begin_message(c->out.data, MSG_HELLO);
+		const int dims[6] = {world.nx, world.ny, world.nz, world.ox, world.oy, world.oz};
+		for(int i = 0; i < 6; i++)
+			put32(c->out.data, dims[i]);
+		end_message(c->out.data, start);
+	}
+}
+
+/* Queue the next slice of the world for a client that is still loading */
+static void send_snapshot(client *c) {
+	int ncells = world.nx * world.ny * world.nz;
+	if(c->snapshot < 0 || c->out.pending() > SNAPSHOT_BACKLOG)
+		return;
+
+	std::vector<uint8_t> raw;
+	int first = c->snapshot;
+	while(c->snapshot < ncells && raw.size() < SNAPSHOT_SLICE)
+		world.serialize_cell(c->snapshot++, raw);
+
+	size_t start = begin_message(c->out.data, MSG_SNAPSHOT);
+	put32(c->out.data, first);
+	put32(c->out.data, c->snapshot - first);
+	put_compressed(c->out.data, raw);
+	end_message(c->out.data, start);
+
+	if(c->snapshot == ncells)
+		c->snapshot = -1;
+}
+
+/*
+ * Apply everything received since the last tick, and broadcast the edits
+ * that actually changed the world. Sorting by position groups duplicates,
+ * of which only the last one counts, and makes the batch compress well.
+ */
+static void run_tick() {
+	std::sort(pending.begin(), pending.end());
+
+	std::vector<uint8_t> raw;
+	uint32_t count = 0;
+
+	for(size_t i = 0; i < pending.size(); i++) {
+		if(i + 1 < pending.size() && pending[i + 1].key == pending[i].key)
+			continue;
+
+		const edit &e = pending[i].e;
+		if(world.get(e.x, e.y, e.z) == e.type || !world.find(e.x, e.y, e.z))
+			continue;
+
+		world.set(e.x, e.y, e.z, e.type);
+		put_edit(raw, e);
+		count++;
+	}
+
+	pending.clear();
+	tick++;
+
+	if(count) {
+		std::vector<uint8_t> msg;
+		size_t start = begin_message(msg, MSG_DELTAS);
+		put32(msg, tick);
+		put32(msg, count);
+		put_compressed(msg, raw);
+		end_message(msg, start);
+
+		stats.applied += count;
+		stats.raw += raw.size();
+		stats.compressed += msg.size();
+
+		for(size_t i = 0; i < clients.size(); i++)
+			if(clients[i]->fd >= 0)
+				clients[i]->out.data.insert(clients[i]->out.data.end(), msg.begin(), msg.end());
+	}
+
+	// Clients dropped before the tick are only removed after it
+	for(size_t i = 0; i < clients.size(); i++)
+		if(clients[i]->fd >= 0)
+			send_snapshot(clients[i]);
+}
+
+static void flush(client *c) {
+	size_t before = c->out.pending();
+	if(!c->out.flush(c->fd))
+		drop(c, "write error");
+	else if(c->out.pending() > MAX_BACKLOG)
+		drop(c, "too far behind");
+	stats.sent += before - c->out.pending();
+}
+
+int main(int argc, char *argv[]) {
+	int port = argc > 1 ? atoi(argv[1]) : DEFAULT_PORT;
+	int rate = argc > 2 ? atoi(argv[2]) : 20;
+
+	if(port <= 0 || rate <= 0) {
+		fprintf(stderr, "Usage: %s [port] [ticks per second]\n", argv[0]);
+		return 1;
+	}
+
+	generate();
+
+	std::vector<uint8_t> data;
+	world.serialize(data);
+	printf("World of %d x %d x %d blocks, %d bricks, %.1f kB serialized\n", WX, WY, WZ, world.bricks, data.size() / 1024.0);
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+	struct sockaddr_in addr;
+	make_address("127.0.0.1", port, &addr);
+	if(listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof addr) || listen(listener, 64)) {
+		perror("Could not listen");
+		return 1;
+	}
+
+	fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+	printf("Listening on 127.0.0.1:%d, %d ticks per second\n", port, rate);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	double period = 1.0 / rate;
+	double next_tick = now() + period;
+	double next_report = now() + 1;
+	std::vector<struct pollfd> fds;
+
+	while(running) {
+		fds.resize(clients.size() + 1);
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for(size_t i = 0; i < clients.size(); i++) {
+			fds[i + 1].fd = clients[i]->fd;
+			fds[i + 1].events = POLLIN | (clients[i]->out.pending() ? POLLOUT : 0);
+		}
+
+		int timeout = ceil((next_tick - now()) * 1000);
+		poll(&fds[0], fds.size(), timeout > 0 ? timeout : 0);
+
+		if(fds[0].revents & POLLIN)
+			accept_clients(listener);
+
+		for(size_t i = 0; i + 1 < fds.size(); i++) {
+			client *c = clients[i];
+
+			if(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+				if(read_available(c->fd, c->in) < 0) {
+					drop(c, "connection closed");
+					continue;
+				}
+				if(!parse_messages(c->in, [c](uint8_t type, const uint8_t *p, uint32_t len) { return handle(c, type, p, len); })) {
+					drop(c, "protocol error");
+					continue;
+				}
+			}
+
+			if(fds[i + 1].revents & POLLOUT)
+				flush(c);
+		}
+
+		double t = now();
+
+		if(t >= next_tick) {
+			run_tick();
+			for(size_t i = 0; i < clients.size(); i++)
+				if(clients[i]->fd >= 0)
+					flush(clients[i]);
+
+			// Don't try to catch up on ticks if we fell far behind
+			next_tick += period;
+			if(next_tick < t)
+				next_tick = t + period;
+		}
+
+		for(size_t i = 0; i < clients.size();) {
+			if(clients[i]->fd < 0) {
+				delete clients[i];
+				clients.erase(clients.begin() + i);
+			} else {
+				i++;
+			}
+		}
+
+		if(t >= next_report) {
+			printf("tick %u: %zu clients, %lu edits/s received, %lu applied, %.1f kB/s deltas (%.1f kB/s raw), %.1f kB/s sent, %d bricks\n",
+			       tick, clients.size(), stats.received, stats.applied,
+			       stats.compressed / 1024.0, stats.raw / 1024.0, stats.sent / 1024.0, world.bricks);
+			fflush(stdout);
+			memset(&stats, 0, sizeof stats);
+			next_report += 1;
+		}
+	}
+
+	// For comparison with a replica, see tests/loopback.sh
+	world.compact();
+	world.serialize(data);
+	printf("Shutting down, world checksum %08x\n", checksum(data));
+	for(size_t i = 0; i < clients.size(); i++)
+		close(clients[i]->fd);
+	close(listener);
+	return 0;
+}
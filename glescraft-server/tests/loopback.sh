@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Runs the server and the bot against each other on loopback, then checks
+# that the bot's replica ended up the same as the server's world.
+# Run by make check, or from glescraft-server after make:
+#   tests/loopback.sh [port] [seconds]
+# Exits with 0 if the checksums match.
+
+port=${1:-4343}
+seconds=${2:-5}
+log=$(mktemp)
+trap 'rm -f "$log" "$log.bot"' EXIT
+
+./server "$port" > "$log" 2>&1 &
+server=$!
+
+# Generating the world takes a moment
+for i in $(seq 50); do
+	grep -q Listening "$log" && break
+	sleep 0.1
+done
+
+./bot -c 8 -r 500 -t "$seconds" -p "$port" > "$log.bot" 2>&1
+status=$?
+kill -TERM $server
+wait $server
+
+cat "$log.bot"
+replica=$(sed -n 's/^Replica checksum \([0-9a-f]*\).*/\1/p' "$log.bot")
+world=$(sed -n 's/.*world checksum \([0-9a-f]*\).*/\1/p' "$log")
+
+if [ $status -ne 0 ] || [ -z "$replica" ] || [ "$replica" != "$world" ]; then
+	echo "FAIL replica ${replica:-missing}, server world ${world:-missing}"
+	exit 1
+fi
+echo "ok   replica matches the server world ($world)"
@@ -735,12 +735,20 @@ static void update_vectors() {
 }
 
 static int init_resources() {
+	// Linked programs are kept next to the shaders: a warm start skips the compiler
+	enable_program_cache(true);
+	int t = glutGet(GLUT_ELAPSED_TIME);
 	light_program = create_program("light.v.glsl", "light.f.glsl");
 	camera_program = create_program("camera.v.glsl", "camera.f.glsl");
 
 	if(!light_program || !camera_program)
 		return 0;
 
+	int hits, misses;
+	get_program_cache_stats(&hits, &misses);
+	printf("Shaders ready in %d ms (%d programs from the cache, %d compiled)\n",
+		glutGet(GLUT_ELAPSED_TIME) - t, hits, misses);
+
 	light_coord = get_attrib(light_program, "coord");
 	light_model = get_uniform(light_program, "model");
 	light_lvp = get_uniform(light_program, "lvp");
@@ -0,0 +1,351 @@
+#ifndef BRICKMAP_H
+#define BRICKMAP_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Sparse world storage, an alternative to the dense superchunk.
+ *
+ * The world is cut into bricks of BS x BS x BS blocks. The top level is a
+ * flat grid with one cell per brick. A cell either points to a brick with
+ * individual blocks, or has no brick at all and then every block in it has
+ * the same "uniform" type. Sky, deep solid rock and open water therefore
+ * cost one byte per 512 blocks instead of one byte per block.
+ *
+ * The get()/set() calls take the same world coordinates as superchunk.
+ */
+
+// Size of one brick in blocks, must be a power of two
+#define BS 8
+#define BSHIFT 3
+
+struct brick {
+	uint8_t blk[BS][BS][BS];
+};
+
+struct brickcell {
+	brick *b;
+	uint8_t uniform;
+};
+
+struct brickmap {
+	int nx, ny, nz;		// size of the top level grid in bricks
+	int ox, oy, oz;		// world coordinate of block (0, 0, 0) of brick (0, 0, 0)
+	brickcell *cell;
+	int bricks;		// number of allocated bricks
+
+	brickmap(int sx, int sy, int sz): nx(sx / BS), ny(sy / BS), nz(sz / BS), ox(-sx / 2), oy(-sy / 2), oz(-sz / 2), bricks(0) {
+		cell = new brickcell[nx * ny * nz];
+		memset(cell, 0, sizeof *cell * nx * ny * nz);
+	}
+
+	~brickmap() {
+		clear();
+		delete[] cell;
+	}
+
+	void clear() {
+		for(int i = 0; i < nx * ny * nz; i++) {
+			delete cell[i].b;
+			cell[i].b = 0;
+			cell[i].uniform = 0;
+		}
+		bricks = 0;
+	}
+
+	brickcell *find(int x, int y, int z) const {
+		x -= ox;
+		y -= oy;
+		z -= oz;
+
+		if(x < 0 || y < 0 || z < 0)
+			return 0;
+
+		x >>= BSHIFT;
+		y >>= BSHIFT;
+		z >>= BSHIFT;
+
+		if(x >= nx || y >= ny || z >= nz)
+			return 0;
+
+		return &cell[(x * ny + y) * nz + z];
+	}
+
+	uint8_t get(int x, int y, int z) const {
+		const brickcell *c = find(x, y, z);
+		if(!c)
+			return 0;
+		if(!c->b)
+			return c->uniform;
+		return c->b->blk[(x - ox) & (BS - 1)][(y - oy) & (BS - 1)][(z - oz) & (BS - 1)];
+	}
+
+	void set(int x, int y, int z, uint8_t type) {
+		brickcell *c = find(x, y, z);
+		if(!c)
+			return;
+
+		if(!c->b) {
+			// Writing the same type into a uniform brick changes nothing
+			if(type == c->uniform)
+				return;
+			c->b = new brick;
+			memset(c->b->blk, c->uniform, sizeof c->b->blk);
+			bricks++;
+		}
+
+		c->b->blk[(x - ox) & (BS - 1)][(y - oy) & (BS - 1)][(z - oz) & (BS - 1)] = type;
+	}
+
+	/*
+	 * Free all bricks whose blocks all have the same type.
+	 * Call this after bulk edits such as world generation.
+	 */
+	void compact() {
+		for(int i = 0; i < nx * ny * nz; i++) {
+			brick *b = cell[i].b;
+			if(!b)
+				continue;
+
+			const uint8_t *p = &b->blk[0][0][0];
+			int j;
+			for(j = 1; j < BS * BS * BS; j++)
+				if(p[j] != p[0])
+					break;
+
+			if(j == BS * BS * BS) {
+				cell[i].uniform = p[0];
+				cell[i].b = 0;
+				delete b;
+				bricks--;
+			}
+		}
+	}
+
+	size_t memory_usage() const {
+		return sizeof *this + sizeof *cell * nx * ny * nz + sizeof(brick) * bricks;
+	}
+
+	/*
+	 * Cast a ray from origin in direction dir (need not be normalized) and
+	 * find the first non-air block within maxdist. On a hit, the block
+	 * coordinates are stored in hit, and face gets the same numbering as
+	 * the face variable in glescraft.cpp.
+	 *
+	 * This is a regular voxel traversal (Amanatides & Woo), except that
+	 * whenever it enters a brick filled with air it jumps straight to the
+	 * block where the ray leaves that brick.
+	 */
+	bool raycast(const float origin[3], const float dir[3], float maxdist, int hit[3], int *face) const {
+		float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+		if(len == 0)
+			return false;
+
+		const int org[3] = {ox, oy, oz};
+		const int n[3] = {nx, ny, nz};
+		float d[3], inv[3], tmax[3];
+		int step[3], v[3];
+
+		for(int i = 0; i < 3; i++) {
+			d[i] = dir[i] / len;
+			step[i] = d[i] > 0 ? 1 : -1;
+			inv[i] = d[i] != 0 ? fabsf(1 / d[i]) : 1.0e30;
+			v[i] = floorf(origin[i]);
+			tmax[i] = boundary(origin[i], d[i], v[i], 1, step[i], inv[i]);
+		}
+
+		int axis = -1;
+		float t = 0;
+
+		while(t <= maxdist) {
+			const brickcell *c = find(v[0], v[1], v[2]);
+
+			if(!c) {
+				// Outside of the world; stop if we are moving away from it
+				for(int i = 0; i < 3; i++)
+					if((v[i] < org[i] && step[i] < 0) || (v[i] >= org[i] + n[i] * BS && step[i] > 0))
+						return false;
+			} else if(!c->b && !c->uniform) {
+				// Empty brick: continue from the point where the ray leaves it
+				int lo[3];
+				float tb[3];
+				for(int i = 0; i < 3; i++) {
+					lo[i] = org[i] + ((v[i] - org[i]) & ~(BS - 1));
+					tb[i] = boundary(origin[i], d[i], lo[i], BS, step[i], inv[i]);
+				}
+				int exitaxis = nextaxis(tb);
+				t = tb[exitaxis];
+				for(int i = 0; i < 3; i++) {
+					if(i == exitaxis) {
+						v[i] = step[i] > 0 ? lo[i] + BS : lo[i] - 1;
+					} else {
+						v[i] = floorf(origin[i] + d[i] * t);
+						if(v[i] < lo[i])
+							v[i] = lo[i];
+						if(v[i] > lo[i] + BS - 1)
+							v[i] = lo[i] + BS - 1;
+					}
+					tmax[i] = boundary(origin[i], d[i], v[i], 1, step[i], inv[i]);
+				}
+				axis = exitaxis;
+				continue;
+			} else if(c->b ? c->b->blk[(v[0] - ox) & (BS - 1)][(v[1] - oy) & (BS - 1)][(v[2] - oz) & (BS - 1)] : c->uniform) {
+				hit[0] = v[0];
+				hit[1] = v[1];
+				hit[2] = v[2];
+				if(face)
+					*face = axis < 0 ? 0 : axis + (step[axis] > 0 ? 3 : 0);
+				return true;
+			}
+
+			axis = nextaxis(tmax);
+			t = tmax[axis];
+			v[axis] += step[axis];
+			tmax[axis] = boundary(origin[axis], d[axis], v[axis], 1, step[axis], inv[axis]);
+		}
+
+		return false;
+	}
+
+	/*
+	 * Distance along the ray to the far side of the cell of the given size
+	 * that starts at lo, in the direction of travel.
+	 */
+	static float boundary(float origin, float d, int lo, int size, int step, float inv) {
+		if(d == 0)
+			return 1.0e30;
+		return ((step > 0 ? lo + size : lo) - origin) * inv * step;
+	}
+
+	static int nextaxis(const float t[3]) {
+		return t[0] < t[1] ? (t[0] < t[2] ? 0 : 2) : (t[1] < t[2] ? 1 : 2);
+	}
+
+	/*
+	 * Compact serialized form. After a small header, each top level cell
+	 * is a single byte: the uniform block type for cells without a brick,
+	 * or 0xff followed by the run-length encoded blocks of its brick.
+	 * Runs are (count - 1, type) byte pairs.
+	 */
+	void serialize(std::vector<uint8_t> &out) const {
+		out.clear();
+		const char *magic = "BRK1";
+		for(int i = 0; i < 4; i++)
+			out.push_back(magic[i]);
+		const int dims[6] = {nx, ny, nz, ox, oy, oz};
+		for(int i = 0; i < 6; i++)
+			for(int j = 0; j < 4; j++)
+				out.push_back((uint32_t)dims[i] >> (j * 8));
+
+		for(int i = 0; i < nx * ny * nz; i++)
+			serialize_cell(i, out);
+	}
+
+	void serialize_cell(int i, std::vector<uint8_t> &out) const {
+		if(!cell[i].b) {
+			out.push_back(cell[i].uniform);
+			return;
+		}
+
+		out.push_back(0xff);
+		const uint8_t *p = &cell[i].b->blk[0][0][0];
+		for(int j = 0; j < BS * BS * BS;) {
+			int run = 1;
+			while(j + run < BS * BS * BS && p[j + run] == p[j] && run < 256)
+				run++;
+			out.push_back(run - 1);
+			out.push_back(p[j]);
+			j += run;
+		}
+	}
+
+	bool deserialize(const uint8_t *data, size_t len) {
+		if(len < 28 || memcmp(data, "BRK1", 4))
+			return false;
+
+		int dims[6];
+		for(int i = 0; i < 6; i++)
+			dims[i] = data[4 + i * 4] | data[5 + i * 4] << 8 | data[6 + i * 4] << 16 | data[7 + i * 4] << 24;
+
+		if(dims[0] != nx || dims[1] != ny || dims[2] != nz)
+			return false;
+
+		// Read into a scratch map, so that a truncated or corrupt file leaves this one untouched
+		brickmap tmp(nx * BS, ny * BS, nz * BS);
+		tmp.ox = dims[3];
+		tmp.oy = dims[4];
+		tmp.oz = dims[5];
+
+		size_t pos = 28;
+		for(int i = 0; i < nx * ny * nz; i++)
+			if(!tmp.deserialize_cell(i, data, len, &pos))
+				return false;
+
+		swap(tmp);
+		return true;
+	}
+
+	void swap(brickmap &other) {
+		std::swap(nx, other.nx);
+		std::swap(ny, other.ny);
+		std::swap(nz, other.nz);
+		std::swap(ox, other.ox);
+		std::swap(oy, other.oy);
+		std::swap(oz, other.oz);
+		std::swap(cell, other.cell);
+		std::swap(bricks, other.bricks);
+	}
+
+	/* Replaces cell i, or leaves it as it was if the data is bad */
+
+	bool deserialize_cell(int i, const uint8_t *data, size_t len, size_t *pos) {
+		if(*pos >= len)
+			return false;
+
+		uint8_t tag = data[(*pos)++];
+
+		if(tag != 0xff) {
+			drop_brick(i);
+			cell[i].uniform = tag;
+			return true;
+		}
+
+		brick *b = new brick;
+		uint8_t *p = &b->blk[0][0][0];
+		for(int j = 0; j < BS * BS * BS;) {
+			if(*pos + 2 > len) {
+				delete b;
+				return false;
+			}
+			int run = data[*pos] + 1;
+			uint8_t type = data[*pos + 1];
+			*pos += 2;
+			if(j + run > BS * BS * BS) {
+				delete b;
+				return false;
+			}
+			memset(p + j, type, run);
+			j += run;
+		}
+
+		drop_brick(i);
+		cell[i].b = b;
+		cell[i].uniform = 0;
+		bricks++;
+		return true;
+	}
+
+	void drop_brick(int i) {
+		if(cell[i].b) {
+			delete cell[i].b;
+			cell[i].b = 0;
+			bricks--;
+		}
+	}
+};
+
+#endif
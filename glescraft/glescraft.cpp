@@ -13,6 +13,7 @@
 #include <glm/gtc/noise.hpp>
 
 #include "../common/shader_utils.h"
+#include "../common/file_watch.h"
 
 #include "textures.c"
 
@@ -714,20 +715,32 @@ static void update_vectors() {
 	up = glm::cross(right, lookat);
 }
 
+/* Also when reload_programs() rebuilds the program: kept only if they are all there */
+static bool program_locations(GLuint program, void* data) {
+	GLint coord = get_attrib(program, "coord");
+	GLint mvp = get_uniform(program, "mvp");
+
+	if(coord == -1 || mvp == -1)
+		return false;
+
+	attribute_coord = coord;
+	uniform_mvp = mvp;
+	return true;
+}
+
 static int init_resources() {
-	/* Create shaders */
+	/* Create shaders, rebuilt when edited while running (see idle()) */
 
 	program = create_program("glescraft.v.glsl", "glescraft.f.glsl");
 
 	if(program == 0)
 		return 0;
 
-	attribute_coord = get_attrib(program, "coord");
-	uniform_mvp = get_uniform(program, "mvp");
-
-	if(attribute_coord == -1 || uniform_mvp == -1)
+	if(!program_locations(program, NULL))
 		return 0;
 
+	watch_program(&program, "glescraft.v.glsl", "glescraft.f.glsl", NULL, program_locations);
+
 	/* Create and upload the texture */
 
 	glActiveTexture(GL_TEXTURE0);
@@ -1017,6 +1030,13 @@ static void idle() {
 	static int pt = 0;
 	static const float movespeed = 10;
 
+	/* Shaders edited while running: the world stays */
+	if(reload_programs() > 0) {
+		glUseProgram(program);
+		glUniform1i(uniform_texture, 0);
+		glEnableVertexAttribArray(attribute_coord);
+	}
+
 	now = time(0);
 	int t = glutGet(GLUT_ELAPSED_TIME);
 	float dt = (t - pt) * 1.0e-3;
@@ -1104,6 +1124,7 @@ static void mouse(int button, int state, int x, int y) {
 }
 
 static void free_resources() {
+	unwatch_programs();
 	glDeleteProgram(program);
 }
 
@@ -0,0 +1,283 @@
+/*
+ * Compare the dense chunk grid used by glescraft with the sparse brickmap
+ * on a generated world: memory use, get/set throughput and ray casting.
+ *
+ * Usage: ./world-bench [height in chunks]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/noise.hpp>
+
+#include "brickmap.h"
+
+// Same chunk layout as glescraft.cpp
+#define CX 16
+#define CY 32
+#define CZ 16
+
+#define SCX 32
+#define SCZ 32
+
+#define SEALEVEL 4
+
+static int SCY = 8;
+
+/* The dense representation, laid out exactly like superchunk */
+struct densegrid {
+	typedef uint8_t chunkdata[CX][CY][CZ];
+	chunkdata *c;
+
+	densegrid() {
+		c = new chunkdata[SCX * SCY * SCZ];
+		memset(c, 0, sizeof *c * SCX * SCY * SCZ);
+	}
+
+	~densegrid() {
+		delete[] c;
+	}
+
+	uint8_t get(int x, int y, int z) const {
+		int cx = (x + CX * (SCX / 2)) / CX;
+		int cy = (y + CY * (SCY / 2)) / CY;
+		int cz = (z + CZ * (SCZ / 2)) / CZ;
+
+		if(cx < 0 || cx >= SCX || cy < 0 || cy >= SCY || cz < 0 || cz >= SCZ)
+			return 0;
+
+		return c[(cx * SCY + cy) * SCZ + cz][x & (CX - 1)][y & (CY - 1)][z & (CZ - 1)];
+	}
+
+	void set(int x, int y, int z, uint8_t type) {
+		int cx = (x + CX * (SCX / 2)) / CX;
+		int cy = (y + CY * (SCY / 2)) / CY;
+		int cz = (z + CZ * (SCZ / 2)) / CZ;
+
+		if(cx < 0 || cx >= SCX || cy < 0 || cy >= SCY || cz < 0 || cz >= SCZ)
+			return;
+
+		c[(cx * SCY + cy) * SCZ + cz][x & (CX - 1)][y & (CY - 1)][z & (CZ - 1)] = type;
+	}
+
+	void compact() {
+	}
+
+	size_t memory_usage() const {
+		return sizeof *c * SCX * SCY * SCZ;
+	}
+
+	/* The same voxel traversal as brickmap::raycast(), without skipping */
+	bool raycast(const float origin[3], const float dir[3], float maxdist, int hit[3]) const {
+		float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+		float d[3], inv[3], tmax[3];
+		int step[3], v[3];
+
+		for(int i = 0; i < 3; i++) {
+			d[i] = dir[i] / len;
+			step[i] = d[i] > 0 ? 1 : -1;
+			inv[i] = d[i] != 0 ? fabsf(1 / d[i]) : 1.0e30;
+			v[i] = floorf(origin[i]);
+			tmax[i] = brickmap::boundary(origin[i], d[i], v[i], 1, step[i], inv[i]);
+		}
+
+		float t = 0;
+		while(t <= maxdist) {
+			if(get(v[0], v[1], v[2])) {
+				hit[0] = v[0];
+				hit[1] = v[1];
+				hit[2] = v[2];
+				return true;
+			}
+
+			int axis = brickmap::nextaxis(tmax);
+			t = tmax[axis];
+			v[axis] += step[axis];
+			tmax[axis] = brickmap::boundary(origin[axis], d[axis], v[axis], 1, step[axis], inv[axis]);
+		}
+
+		return false;
+	}
+};
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static float noise2d(float x, float y, int octaves, float persistence) {
+	float sum = 0;
+	float strength = 1.0;
+	float scale = 1.0;
+
+	for(int i = 0; i < octaves; i++) {
+		sum += strength * glm::simplex(glm::vec2(x, y) * scale);
+		scale *= 2.0;
+		strength *= persistence;
+	}
+
+	return sum;
+}
+
+/*
+ * Rolling hills with caves, in a world that is much taller than the
+ * terrain itself. Calls put() for every non-air block.
+ */
+template<typename T> static void generate(T *world) {
+	int x0 = -CX * SCX / 2, y0 = -CY * SCY / 2, z0 = -CZ * SCZ / 2;
+
+	for(int x = x0; x < -x0; x++) {
+		for(int z = z0; z < -z0; z++) {
+			int h = noise2d(x / 256.0, z / 256.0, 5, 0.8) * 8;
+
+			for(int y = y0; y < SEALEVEL && y < -y0; y++) {
+				if(y >= h) {
+					world->set(x, y, z, 8);
+					continue;
+				}
+
+				// Caves
+				if(y < h - 3 && glm::simplex(glm::vec3(x, y, z) / 24.0f) > 0.4)
+					continue;
+
+				world->set(x, y, z, y < h - 4 ? 6 : (y == h - 1 ? 3 : 1));
+			}
+
+			for(int y = SEALEVEL; y < h && y < -y0; y++)
+				world->set(x, y, z, y == h - 1 ? 3 : 1);
+		}
+	}
+}
+
+/* Pseudo-random numbers, identical sequences for both worlds */
+static uint32_t rng = 1;
+
+static uint32_t next() {
+	rng = rng * 1664525 + 1013904223;
+	return rng >> 8;
+}
+
+template<typename T> static void bench(const char *name, T *world) {
+	const int n = 1 << 24;
+	int x0 = CX * SCX, y0 = CY * SCY, z0 = CZ * SCZ;
+
+	double t0 = now();
+	generate(world);
+	world->compact();
+	size_t mem = world->memory_usage();
+	double t1 = now();
+
+	rng = 1;
+	unsigned int sum = 0;
+	for(int i = 0; i < n; i++)
+		sum += world->get((int)(next() % x0) - x0 / 2, (int)(next() % y0) - y0 / 2, (int)(next() % z0) - z0 / 2);
+	double t2 = now();
+
+	// Random edits, mostly in the lower half where the terrain is
+	rng = 2;
+	for(int i = 0; i < n / 16; i++) {
+		int x = (int)(next() % x0) - x0 / 2;
+		int y = (int)(next() % (y0 / 2 + 16)) - y0 / 2;
+		int z = (int)(next() % z0) - z0 / 2;
+		world->set(x, y, z, i & 7);
+	}
+	double t3 = now();
+
+	// Rays from above the terrain looking down at random angles, as well
+	// as rays cast horizontally through the sky.
+	rng = 3;
+	int rays = 1 << 16, hits = 0;
+	for(int i = 0; i < rays; i++) {
+		float origin[3] = {(next() % 25600) / 100.0f - 128, (i & 1) ? 40.0f : (float)(y0 / 2 - 8), (next() % 25600) / 100.0f - 128};
+		float dir[3] = {(next() % 2001) / 1000.0f - 1, (i & 1) ? -1.0f : 0.0f, (next() % 2001) / 1000.0f - 1};
+		int hit[3];
+		if(world->raycast(origin, dir, 256, hit))
+			hits++;
+	}
+	double t4 = now();
+
+	printf("%-10s %6.1f MB  generate %6.2f s  get %6.1f M/s  set %6.1f M/s  raycast %8.0f rays/s (%d hits)  [%u]\n",
+	       name, mem / 1048576.0, t1 - t0,
+	       n / (t2 - t1) * 1.0e-6, n / 16 / (t3 - t2) * 1.0e-6, rays / (t4 - t3), hits, sum);
+}
+
+/* brickmap::raycast() with the same signature as densegrid::raycast() */
+struct bench_brickmap: brickmap {
+	bench_brickmap(): brickmap(CX * SCX, CY * SCY, CZ * SCZ) {}
+
+	bool raycast(const float origin[3], const float dir[3], float maxdist, int hit[3]) const {
+		return brickmap::raycast(origin, dir, maxdist, hit, 0);
+	}
+};
+
+int main(int argc, char *argv[]) {
+	if(argc > 1)
+		SCY = atoi(argv[1]);
+
+	if(SCY < 2 || SCY & 1) {
+		fprintf(stderr, "Usage: %s [height in chunks, even number]\n", argv[0]);
+		return 1;
+	}
+
+	printf("World of %d x %d x %d blocks\n", CX * SCX, CY * SCY, CZ * SCZ);
+
+	densegrid *dense = new densegrid;
+	bench("dense", dense);
+
+	bench_brickmap *sparse = new bench_brickmap;
+	bench("brickmap", sparse);
+
+	double t0 = now();
+	std::vector<uint8_t> data;
+	sparse->serialize(data);
+	double t1 = now();
+	printf("brickmap: %d bricks, serialized to %.1f kB in %.3f s\n", sparse->bricks, data.size() / 1024.0, t1 - t0);
+
+	/* Sanity check: both worlds and the deserialized copy must agree */
+	bench_brickmap *copy = new bench_brickmap;
+	if(!copy->deserialize(data.data(), data.size())) {
+		fprintf(stderr, "Could not deserialize brickmap\n");
+		return 1;
+	}
+
+	rng = 4;
+	for(int i = 0; i < 1 << 20; i++) {
+		int x = (int)(next() % (CX * SCX)) - CX * SCX / 2;
+		int y = (int)(next() % (CY * SCY)) - CY * SCY / 2;
+		int z = (int)(next() % (CZ * SCZ)) - CZ * SCZ / 2;
+		if(dense->get(x, y, z) != sparse->get(x, y, z) || sparse->get(x, y, z) != copy->get(x, y, z)) {
+			fprintf(stderr, "Mismatch at %d, %d, %d\n", x, y, z);
+			return 1;
+		}
+	}
+
+	// Rays that graze an edge within float precision may go either way,
+	// so allow for a handful of differences.
+	rng = 5;
+	int rays = 1 << 14, differ = 0;
+	for(int i = 0; i < rays; i++) {
+		float origin[3] = {(next() % 25600) / 100.0f - 128, 40.5f, (next() % 25600) / 100.0f - 128};
+		float dir[3] = {(next() % 2001) / 1000.0f - 1, -1.0f, (next() % 2001) / 1000.0f - 1};
+		int a[3], b[3];
+		bool ha = dense->raycast(origin, dir, 256, a);
+		bool hb = sparse->raycast(origin, dir, 256, b);
+		if(ha != hb || (ha && (a[0] != b[0] || a[1] != b[1] || a[2] != b[2])))
+			differ++;
+	}
+
+	if(differ > rays / 1000) {
+		fprintf(stderr, "Ray casts disagree for %d out of %d rays\n", differ, rays);
+		return 1;
+	}
+
+	delete copy;
+	delete sparse;
+	delete dense;
+	return 0;
+}
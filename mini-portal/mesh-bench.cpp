@@ -0,0 +1,356 @@
+/**
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ *
+ * OBJ parsing throughput: ../common/obj_loader.cpp against the
+ * getline/istringstream loader that the demos used before.
+ *
+ * Usage: ./mesh-bench [file.obj | size in MB] [max threads]
+ * Without a file, a scan-like height field of about that size (64 MB
+ * by default) is generated in /tmp, in "f a b c" syntax that both
+ * loaders understand, and again with texture coordinates, normals and
+ * quads ("f a/b/c ...") for the new loader only.
+ *
+ * Then obj_parse() on the file in memory with 1, 2, 4... up to max
+ * threads (one per core by default), checking that the result is the
+ * same as with one thread.
+ *
+ * And what load_obj() in mini-portal.cpp costs without and with the
+ * binary mesh cache, with the files in the page cache (warm) or
+ * dropped from it first (cold).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <iterator>
+#include <thread>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include "../common/obj_loader.h"
+#include "../common/mesh_optimizer.h"
+#include "../common/mesh_cache.h"
+
+using namespace std;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The previous load_obj(), minus the Mesh; unsigned int elements so
+   that it can read meshes of more than 65536 vertices */
+static void load_obj_getline(const char* filename, vector<glm::vec4>& vertices,
+			     vector<unsigned int>& elements, vector<glm::vec3>& normals) {
+  ifstream in(filename, ios::in);
+  if (!in) { cerr << "Cannot open " << filename << endl; exit(1); }
+  vector<int> nb_seen;
+
+  string line;
+  while (getline(in, line)) {
+    if (line.substr(0,2) == "v ") {
+      istringstream s(line.substr(2));
+      glm::vec4 v; s >> v.x; s >> v.y; s >> v.z; v.w = 1.0;
+      vertices.push_back(v);
+    }  else if (line.substr(0,2) == "f ") {
+      istringstream s(line.substr(2));
+      unsigned int a,b,c;
+      s >> a; s >> b; s >> c;
+      a--; b--; c--;
+      elements.push_back(a); elements.push_back(b); elements.push_back(c);
+    }
+    else if (line[0] == '#') { /* ignoring this line */ }
+    else { /* ignoring this line */ }
+  }
+
+  normals.resize(vertices.size(), glm::vec3(0.0, 0.0, 0.0));
+  nb_seen.resize(vertices.size(), 0);
+  for (unsigned int i = 0; i < elements.size(); i+=3) {
+    unsigned int ia = elements[i];
+    unsigned int ib = elements[i+1];
+    unsigned int ic = elements[i+2];
+    glm::vec3 normal = glm::normalize(glm::cross(
+      glm::vec3(vertices[ib]) - glm::vec3(vertices[ia]),
+      glm::vec3(vertices[ic]) - glm::vec3(vertices[ia])));
+
+    int v[3];  v[0] = ia;  v[1] = ib;  v[2] = ic;
+    for (int j = 0; j < 3; j++) {
+      unsigned int cur_v = v[j];
+      nb_seen[cur_v]++;
+      if (nb_seen[cur_v] == 1) {
+	normals[cur_v] = normal;
+      } else {
+	// average
+	normals[cur_v].x = normals[cur_v].x * (1.0 - 1.0/nb_seen[cur_v]) + normal.x * 1.0/nb_seen[cur_v];
+	normals[cur_v].y = normals[cur_v].y * (1.0 - 1.0/nb_seen[cur_v]) + normal.y * 1.0/nb_seen[cur_v];
+	normals[cur_v].z = normals[cur_v].z * (1.0 - 1.0/nb_seen[cur_v]) + normal.z * 1.0/nb_seen[cur_v];
+	normals[cur_v] = glm::normalize(normals[cur_v]);
+      }
+    }
+  }
+}
+
+static float height(int x, int y) {
+  return 0.3f * sinf(x * 0.05f) * cosf(y * 0.07f) + 0.0001f * ((x * 7919 + y * 104729) % 97);
+}
+
+/**
+ * side x side vertices on a bumpy grid.  full: with "vt" and "vn" lines
+ * and "f v/vt/vn" quads, otherwise "f a b c" triangles.
+ */
+static void generate(const char* filename, int side, bool full) {
+  FILE* out = fopen(filename, "w");
+  if (out == NULL) { perror(filename); exit(1); }
+  fprintf(out, "# mesh-bench height field, %d x %d\no grid\n", side, side);
+  for (int y = 0; y < side; y++)
+    for (int x = 0; x < side; x++)
+      fprintf(out, "v %f %f %f\n", x * 0.01f, height(x, y), y * 0.01f);
+  if (full) {
+    for (int y = 0; y < side; y++)
+      for (int x = 0; x < side; x++)
+	fprintf(out, "vt %f %f\n", 1.0f * x / side, 1.0f * y / side);
+    for (int y = 0; y < side; y++)
+      for (int x = 0; x < side; x++)
+	fprintf(out, "vn %f %f %f\n", 0.0f, 1.0f, 0.0f);
+    fprintf(out, "s 1\n");
+  }
+  for (int y = 0; y + 1 < side; y++) {
+    for (int x = 0; x + 1 < side; x++) {
+      int a = y * side + x + 1, b = a + 1, c = a + side, d = c + 1;
+      if (full)
+	fprintf(out, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a,a,a, c,c,c, d,d,d, b,b,b);
+      else
+	fprintf(out, "f %d %d %d\nf %d %d %d\n", a, c, b, b, c, d);
+    }
+  }
+  fclose(out);
+}
+
+static double file_mb(const char* filename) {
+  struct stat st;
+  if (stat(filename, &st) < 0) { perror(filename); exit(1); }
+  return st.st_size / 1e6;
+}
+
+/* Welding into an indexed mesh, as the demos do after loading */
+static void bench_index(const obj_model& model) {
+  vector<obj_vertex> vertices;
+  vector<unsigned int> elements;
+  double t0 = now();
+  obj_index_vertices(&model, &vertices, &elements);
+  double t1 = now();
+  printf("%-24s %7.2f s  %zu vertices for %zu corners\n", "  obj_index_vertices",
+	 t1 - t0, vertices.size(), elements.size());
+}
+
+static bool same_model(const obj_model& a, const obj_model& b) {
+  return a.vertices.size() == b.vertices.size() && a.texcoords.size() == b.texcoords.size()
+    && a.normals.size() == b.normals.size() && a.corners.size() == b.corners.size()
+    && memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(a.vertices[0])) == 0
+    && memcmp(a.texcoords.data(), b.texcoords.data(), a.texcoords.size() * sizeof(a.texcoords[0])) == 0
+    && memcmp(a.normals.data(), b.normals.data(), a.normals.size() * sizeof(a.normals[0])) == 0
+    && memcmp(a.corners.data(), b.corners.data(), a.corners.size() * sizeof(a.corners[0])) == 0;
+}
+
+/* obj_parse() throughput from 1 to max_threads threads */
+static bool bench_threads(const char* filename, int max_threads) {
+  ifstream in(filename, ios::in | ios::binary);
+  string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  double mb = data.size() / 1e6;
+  obj_model reference, model;
+  double t1 = 0;
+  for (int nb_threads = 1; ; nb_threads = (nb_threads * 2 > max_threads) ? max_threads : nb_threads * 2) {
+    double t0 = now();
+    if (!obj_parse(data.data(), data.size(), &model, nb_threads))
+      return false;
+    double t = now() - t0;
+    if (nb_threads == 1) {
+      t1 = t;
+      reference.vertices.swap(model.vertices);
+      reference.texcoords.swap(model.texcoords);
+      reference.normals.swap(model.normals);
+      reference.corners.swap(model.corners);
+    } else if (!same_model(reference, model)) {
+      fprintf(stderr, "%d threads: not the same as with 1 thread\n", nb_threads);
+      return false;
+    }
+    printf("  obj_parse %2d thread(s) %7.2f s  %7.1f MB/s  x%.2f\n",
+	   nb_threads, t, mb / t, t1 / t);
+    if (nb_threads == max_threads)
+      break;
+  }
+  return true;
+}
+
+/* Evict filename from the page cache, so that it is read from the disk again */
+static void drop_cache(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+/* load_obj() without a cache: parse, index and optimize */
+static double load_text(const char* filename, bool cold, vector<glm::vec4>& positions,
+			vector<glm::vec3>& normals, vector<unsigned int>& elements) {
+  if (cold)
+    drop_cache(filename);
+  double t0 = now();
+  obj_model model;
+  if (!obj_load(filename, &model))
+    exit(1);
+  vector<obj_vertex> vertices;
+  obj_index_vertices(&model, &vertices, &elements);
+  positions.resize(vertices.size());
+  normals.resize(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    positions[i] = vertices[i].position;
+    normals[i] = vertices[i].normal;
+  }
+  vector<unsigned int> remap;
+  mesh_optimize(elements, positions, &remap, NULL, NULL);
+  mesh_remap(positions, remap);
+  mesh_remap(normals, remap);
+  return now() - t0;
+}
+
+/* load_obj() with a cache; the copies stand for glBufferData() */
+static double load_cache(const char* cache_filename, const char* filename, bool cold) {
+  if (cold)
+    drop_cache(cache_filename);
+  double t0 = now();
+  mesh_cache cache;
+  if (!mesh_cache_open(cache_filename, filename, &cache))
+    exit(1);
+  const mesh_cache_header* header = cache.header;
+  vector<char> vbo((size_t)header->nb_vertices * header->stride);
+  vector<char> ibo((size_t)header->nb_elements * header->element_size);
+  memcpy(vbo.data(), cache.vertices, vbo.size());
+  memcpy(ibo.data(), cache.elements, ibo.size());
+  mesh_cache_close(&cache);
+  return now() - t0;
+}
+
+static void bench_cache(const char* filename) {
+  string cache_filename = mesh_cache_filename(filename);
+  vector<glm::vec4> positions;
+  vector<glm::vec3> normals;
+  vector<unsigned int> elements;
+  double text_cold = load_text(filename, true, positions, normals, elements);
+  double text_warm = load_text(filename, false, positions, normals, elements);
+  double t0 = now();
+  if (!mesh_cache_write(cache_filename.c_str(), filename, positions, normals, elements,
+			vector<mesh_cache_lod>()))
+    exit(1);
+  double t_write = now() - t0;
+  double cache_cold = load_cache(cache_filename.c_str(), filename, true);
+  double cache_warm = load_cache(cache_filename.c_str(), filename, false);
+  double mb = file_mb(cache_filename.c_str());
+  printf("%s: %.1f MB\n", cache_filename.c_str(), mb);
+  printf("%-24s %7.2f s cold  %7.2f s warm\n", "  parse+index+optimize", text_cold, text_warm);
+  printf("%-24s %7.2f s\n", "  mesh_cache_write", t_write);
+  printf("%-24s %7.2f s cold  %7.2f s warm  %7.1f / %7.1f MB/s  x%.0f / x%.0f\n", "  mesh_cache_open+copy",
+	 cache_cold, cache_warm, mb / cache_cold, mb / cache_warm,
+	 text_cold / cache_cold, text_warm / cache_warm);
+  unlink(cache_filename.c_str());
+}
+
+int main(int argc, char* argv[]) {
+  const char* filename = NULL;
+  char plain[64] = "", full[64] = "";
+  double size_mb = 64;
+  int max_threads = std::thread::hardware_concurrency();
+  if (argc > 2)
+    max_threads = atoi(argv[2]);
+  if (max_threads < 1)
+    max_threads = 1;
+  if (argc > 1) {
+    char* end;
+    size_mb = strtod(argv[1], &end);
+    if (*end != '\0' || size_mb <= 0)
+      filename = argv[1];
+  }
+  if (filename == NULL) {
+    // about 30 bytes per "v" line and 2 "f" lines of 23 bytes per vertex
+    int side = sqrt(size_mb * 1e6 / 76);
+    snprintf(plain, sizeof(plain), "/tmp/mesh-bench-%d.obj", (int)getpid());
+    snprintf(full, sizeof(full), "/tmp/mesh-bench-%d-full.obj", (int)getpid());
+    generate(plain, side, false);
+    generate(full, side, true);
+    filename = plain;
+  }
+  double mb = file_mb(filename);
+  printf("%s: %.1f MB\n", filename, mb);
+
+  double t0 = now();
+  vector<glm::vec4> old_vertices;
+  vector<unsigned int> old_elements;
+  vector<glm::vec3> old_normals;
+  load_obj_getline(filename, old_vertices, old_elements, old_normals);
+  double t1 = now();
+  printf("%-24s %7.2f s  %7.1f MB/s  %zu vertices, %zu triangles\n", "getline + istringstream",
+	 t1 - t0, mb / (t1 - t0), old_vertices.size(), old_elements.size() / 3);
+
+  obj_model model;
+  t0 = now();
+  if (!obj_load(filename, &model))
+    return 1;
+  t1 = now();
+  printf("%-24s %7.2f s  %7.1f MB/s  %zu vertices, %zu triangles\n", "obj_load",
+	 t1 - t0, mb / (t1 - t0), model.vertices.size(), model.corners.size() / 3);
+  t0 = now();
+  obj_compute_normals(&model);
+  t1 = now();
+  printf("%-24s %7.2f s\n", "  normals alone", t1 - t0);
+  bench_index(model);
+
+  // Same mesh?  Positions must match to the float; the normals differ
+  // where the triangles around a vertex have different areas
+  bool same = old_vertices.size() == model.vertices.size()
+    && old_elements.size() == model.corners.size();
+  float max_dist = 0, max_angle = 0;
+  for (size_t i = 0; same && i < old_vertices.size(); i++)
+    max_dist = fmax(max_dist, glm::length(old_vertices[i] - model.vertices[i]));
+  for (size_t i = 0; same && i < old_elements.size(); i++)
+    same = (int)old_elements[i] == model.corners[i].v;
+  for (size_t i = 0; same && i < old_normals.size(); i++)
+    if (glm::length(model.vertex_normals[i]) > 0)
+      max_angle = fmax(max_angle, acos(fmin(1.0f, glm::dot(old_normals[i], model.vertex_normals[i]))));
+  if (same)
+    printf("same mesh, positions within %g, normals within %.2f degrees\n",
+	   max_dist, max_angle * 180 / M_PI);
+  else
+    printf("not the same mesh: the old loader only reads \"f a b c\" triangles\n");
+  if (!bench_threads(filename, max_threads))
+    return 1;
+  bench_cache(filename);
+
+  if (full[0] != '\0') {
+    mb = file_mb(full);
+    t0 = now();
+    if (!obj_load(full, &model))
+      return 1;
+    t1 = now();
+    printf("%s: %.1f MB, with vt/vn and quads\n", full, mb);
+    printf("%-24s %7.2f s  %7.1f MB/s  %zu vertices, %zu texcoords, %zu normals, %zu triangles\n", "obj_load",
+	   t1 - t0, mb / (t1 - t0), model.vertices.size(), model.texcoords.size(),
+	   model.normals.size(), model.corners.size() / 3);
+    bench_index(model);
+    if (!bench_threads(full, max_threads))
+      return 1;
+    unlink(plain);
+    unlink(full);
+  }
+  return 0;
+}
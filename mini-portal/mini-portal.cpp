@@ -5,13 +5,15 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
 #include <unistd.h>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <vector>
 #include <algorithm>
+#include <new>
 /* Use glew.h instead of gl.h to get all the GL prototypes declared */
 #include <GL/glew.h>
 /* Using the GLUT library for the base windowing setup */
@@ -23,6 +25,13 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "../common/shader_utils.h"
+#include "../common/geometry_pool.h"
+#include "../common/obj_loader.h"
+#include "../common/mesh_optimizer.h"
+#include "../common/mesh_cache.h"
+#include "../common/mesh_simplify.h"
+#include "portal_clip.h"
+#include "portal_bvh.h"
 
 #define GROUND_SIZE 20
 
@@ -32,13 +41,28 @@ GLint attribute_v_coord;
 GLint attribute_v_normal;
 GLint uniform_m, uniform_v, uniform_p;
 GLint uniform_m_3x3_inv_transp, uniform_v_inv;
+GLuint program_portal;
+GLint attribute_portal_v_coord;
+GLint uniform_portal_m, uniform_portal_v, uniform_portal_p;
+GLint uniform_portal_cached_vp, uniform_portal_texture;
 bool compute_arcball;
 int last_mx = 0, last_my = 0, cur_mx = 0, cur_my = 0;
 int arcball_on = false;
 
 using namespace std;
 
-struct rect { int x,y,w,h; };
+/* Count heap allocations, to keep an eye on what happens per frame */
+static unsigned long alloc_count = 0;
+void* operator new(size_t size) {
+  alloc_count++;
+  void* p = malloc(size ? size : 1);
+  if (p == NULL)
+    throw bad_alloc();
+  return p;
+}
+void operator delete(void* p) noexcept {
+  free(p);
+}
 
 enum MODES { MODE_OBJECT, MODE_CAMERA, MODE_LIGHT, MODE_LAST } view_mode = MODE_CAMERA;
 int rotY_direction = 0, rotX_direction = 0, transZ_direction = 0, strife = 0;
@@ -52,161 +76,454 @@ static unsigned int fps_frames = 0;
 static float zNear = 0.01;
 static float fovy = 45;
 
+/* Portal recursion limits, see build_portal_graph() */
+static int portal_max_depth = 64;  // safety net only, <= PORTAL_STACK_SIZE
+static int portal_min_area = 64;   // in pixels
+static int portal_budget = 32;     // portal passes per frame
+static int portal_passes = 0, portal_deepest = 0;
+static bool portals_facing = false;
+static int portal_scene_pairs = 0;  // generate_portal_scene(), 0 for the two-portal layouts
+
+/*
+ * PORTAL_STENCIL re-renders the scene through the stencil buffer for
+ * each level of recursion, every frame.  PORTAL_TEXTURE renders what
+ * each portal shows into a texture, and keeps using it in the next
+ * frames, reprojected, until the camera moved or turned too much.
+ */
+enum PORTAL_MODES { PORTAL_STENCIL, PORTAL_TEXTURE } portal_mode = PORTAL_STENCIL;
+struct portal_cache {
+  GLuint fbo, texture, rbo_depth_stencil;
+  glm::mat4 view;          // camera when the texture was rendered
+  glm::mat4 object2world;  // main object when the texture was rendered
+  int age;                 // in frames
+  bool valid;
+};
+static portal_cache portal_caches[MAX_PORTALS];  // created on first use
+static float portal_cache_max_move = 0.02;  // camera movement, in units
+static float portal_cache_max_angle = 0.5;  // camera rotation, in degrees
+static int portal_cache_max_age = 60;       // frames
+static int portal_texture_level = -1;       // stack level rendered into a texture
+static unsigned int portal_refreshes = 0;
+
+/*
+ * Level of detail of the main object: the coarsest LOD whose error is
+ * at most lod_max_error pixels on screen, with lod_portal_bias times
+ * more allowed at each portal level, see Mesh::select_lod()
+ */
+static bool lod_enabled = true;
+static float lod_max_error = 0.5;     // in pixels
+static float lod_portal_bias = 2;
+static int lod_viewport_height = 0;   // of the view being drawn
+static unsigned long triangles_drawn = 0;
+
+/* Frame time statistics */
+static double frame_time_total = 0, frame_time_max = 0;
+static unsigned int frame_passes_total = 0;
+static unsigned long frame_allocs_total = 0;
+static unsigned long frame_buffers_start = 0;
+static unsigned long frame_triangles_start = 0;
+static int frame_deepest = 0;
+
+/* --bench: render the facing-portals worst case with several limits */
+struct bench_config {
+  const char* name;
+  PORTAL_MODES mode;
+  int max_depth, min_area, budget;
+  float turn;  // camera rotation per frame, in degrees
+  int pairs;   // generate_portal_scene(), 0 for the facing portals
+  bool lod;    // see select_lod()
+};
+static bench_config bench_configs[] = {
+  { "rec < 5 (previous)",       PORTAL_STENCIL,  5,   0, INT_MAX, 0, 0, true },
+  { "area >= 16px",             PORTAL_STENCIL, 64,  16, INT_MAX, 0, 0, true },
+  { "area >= 64px",             PORTAL_STENCIL, 64,  64, INT_MAX, 0, 0, true },
+  { "area >= 256px",            PORTAL_STENCIL, 64, 256, INT_MAX, 0, 0, true },
+  { "area >= 64px, budget 32",  PORTAL_STENCIL, 64,  64, 32, 0, 0, true },
+  { "budget 32, no LOD",        PORTAL_STENCIL, 64,  64, 32, 0, 0, false },
+  { "area >= 64px, budget 8",   PORTAL_STENCIL, 64,  64, 8, 0, 0, true },
+  { "stencil, turning",         PORTAL_STENCIL, 64,  64, 32, 0.2, 0, true },
+  { "texture, still",           PORTAL_TEXTURE, 64,  64, 32, 0, 0, true },
+  { "texture, turning",         PORTAL_TEXTURE, 64,  64, 32, 0.2, 0, true },
+  { "texture, turning fast",    PORTAL_TEXTURE, 64,  64, 32, 1, 0, true },
+  { "8 pairs, turning",         PORTAL_STENCIL, 64,  64, 32, 0.2, 8, true },
+  { "32 pairs, turning",        PORTAL_STENCIL, 64,  64, 32, 0.2, 32, true },
+  { "32 pairs, budget 8",       PORTAL_STENCIL, 64,  64, 8, 0.2, 32, true },
+  { "32 pairs, no LOD",         PORTAL_STENCIL, 64,  64, 32, 0.2, 32, false },
+};
+static bool bench_mode = false;
+static int bench_config_idx = -1;
+static int bench_frame = 0;
+#define BENCH_WARMUP 20
+#define BENCH_FRAMES 200
+
+/*
+ * Portal traversal stack: level 0 is the camera, level n is the view
+ * through n portals.  Views are inverted once when pushed, and the
+ * scissor rectangle of each level is the one of its parent clipped by
+ * the portal.
+ */
+#define PORTAL_STACK_SIZE 64
+struct portal_level {
+  glm::mat4 view, view_inv;
+  rect scissor;
+  int portal;  // seen through this portal, -1 for the camera
+};
+static portal_level portal_stack[PORTAL_STACK_SIZE];
+static int portal_top = -1;
+static glm::mat4 projection;
+
+/*
+ * Draw-order graph: the views to render this frame, found by
+ * build_portal_graph() with the recursion limits above, each one with
+ * the portals in its frustum and its children (the views through
+ * them) in drawing order.  Drawing only replays it.  When it is full,
+ * it acts as a budget.
+ */
+#define PORTAL_GRAPH_SIZE 256
+struct portal_node {
+  portal_level level;
+  int depth, rec;                 // stack level and recursion depth
+  int first_child, nb_children;   // children are next to each other
+  int first_visible, nb_visible;  // in portal_visible
+};
+static portal_node portal_graph[PORTAL_GRAPH_SIZE];
+static int portal_graph_size = 0;
+static int portal_visible[PORTAL_GRAPH_SIZE * MAX_PORTALS];
+static int portal_visible_size = 0;
+
+/*
+ * Last values uploaded to the uniforms of the (only) program, so that
+ * unchanged matrices are not uploaded again.
+ */
+static struct {
+  glm::mat4 m, v, p;
+  bool m_valid, v_valid, p_valid;
+  unsigned long uploads, skipped;
+} uniforms;
+
+void set_model(const glm::mat4& m) {
+  if (uniforms.m_valid && uniforms.m == m) {
+    uniforms.skipped++;
+    return;
+  }
+  uniforms.uploads++;
+  uniforms.m = m;
+  uniforms.m_valid = true;
+  glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
+  glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(m)));
+  glUniformMatrix3fv(uniform_m_3x3_inv_transp, 1, GL_FALSE, glm::value_ptr(m_3x3_inv_transp));
+}
+
+void set_view(const glm::mat4& v, const glm::mat4& v_inv) {
+  if (uniforms.v_valid && uniforms.v == v) {
+    uniforms.skipped++;
+    return;
+  }
+  uniforms.uploads++;
+  uniforms.v = v;
+  uniforms.v_valid = true;
+  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(v));
+  glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(v_inv));
+}
+
+void set_view(const portal_level* level) {
+  set_view(level->view, level->view_inv);
+}
+
+void set_projection(const glm::mat4& p) {
+  if (uniforms.p_valid && uniforms.p == p) {
+    uniforms.skipped++;
+    return;
+  }
+  uniforms.uploads++;
+  uniforms.p = p;
+  uniforms.p_valid = true;
+  glUniformMatrix4fv(uniform_p, 1, GL_FALSE, glm::value_ptr(p));
+}
+
+void init_level(portal_level* level, const glm::mat4& view, int portal = -1) {
+  level->view = view;
+  level->view_inv = glm::inverse(view);
+  level->portal = portal;
+  level->scissor.x = 0;
+  level->scissor.y = 0;
+  level->scissor.w = screen_width;
+  level->scissor.h = screen_height;
+}
+
+void push_view(const glm::mat4& view) {
+  init_level(&portal_stack[++portal_top], view);
+}
+
 class Mesh {
 private:
-  GLuint vbo_vertices, vbo_normals, ibo_elements;
+  GLuint vbo, ibo_elements;
+  GLsizei stride;        // bytes per vertex in vbo
+  GLenum element_type;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  GLsizei nb_elements;
+  vector<mesh_cache_lod> lod_ranges;  // in ibo_elements, the full mesh first
+  GLsizei nb_vertices;   // in vbo
+  glm::vec3 bounds_min, bounds_max;  // of the uploaded vertices, for draw_bbox()
+  glm::vec3 center;      // bounding sphere, for select_lod()
+  float radius;
 public:
+  /* CPU-side copies; they stay empty for a mesh uploaded from a cache */
   vector<glm::vec4> vertices;
   vector<glm::vec3> normals;
-  vector<GLushort> elements;
+  vector<GLuint> elements;
+  vector<mesh_lod> lods;  // coarser versions of elements, see build_lods()
   glm::mat4 object2world;
 
-  Mesh() : vbo_vertices(0), vbo_normals(0), ibo_elements(0), object2world(glm::mat4(1)) {}
+  Mesh() : vbo(0), ibo_elements(0), stride(0), element_type(GL_UNSIGNED_SHORT), nb_elements(0),
+	   nb_vertices(0), bounds_min(0.0), bounds_max(0.0), center(0.0), radius(0), object2world(glm::mat4(1)) {}
   ~Mesh() {
-    if (vbo_vertices != 0)
-      glDeleteBuffers(1, &vbo_vertices);
-    if (vbo_normals != 0)
-      glDeleteBuffers(1, &vbo_normals);
+    if (vbo != 0)
+      glDeleteBuffers(1, &vbo);
     if (ibo_elements != 0)
       glDeleteBuffers(1, &ibo_elements);
   }
 
+  /**
+   * Reorder the triangles for the post-transform cache and overdraw,
+   * and the vertices in the order they are drawn, see
+   * ../common/mesh_optimizer.cpp
+   */
+  void optimize() {
+    mesh_stats before, after;
+    vector<unsigned int> remap;
+    mesh_optimize(this->elements, this->vertices, &remap, &before, &after);
+    mesh_remap(this->vertices, remap);
+    mesh_remap(this->normals, remap);
+    printf("%zu triangles: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", this->elements.size() / 3,
+	   before.acmr, after.acmr, before.atvr, after.atvr);
+  }
+
+  /**
+   * Simplified versions of the mesh over the same vertices, each with
+   * about half the triangles of the previous one, see
+   * ../common/mesh_simplify.cpp
+   */
+  void build_lods() {
+    mesh_build_lods(this->elements, this->vertices, 32, &this->lods);
+    glm::vec3 min_p(this->vertices[0]), max_p(this->vertices[0]);
+    for (unsigned int i = 0; i < this->vertices.size(); i++) {
+      min_p = glm::min(min_p, glm::vec3(this->vertices[i]));
+      max_p = glm::max(max_p, glm::vec3(this->vertices[i]));
+    }
+    float size = glm::length(max_p - min_p);
+    for (unsigned int i = 0; i < this->lods.size(); i++)
+      printf("  LOD %u: %zu triangles (%.1f%%), error %g (%.2f%% of the size)\n", i + 1,
+	     this->lods[i].elements.size() / 3, 100.0 * this->lods[i].elements.size() / this->elements.size(),
+	     this->lods[i].error, 100 * this->lods[i].error / size);
+  }
+
+  /* The LOD table of mesh_cache_write() */
+  vector<mesh_cache_lod> lod_table() {
+    vector<mesh_cache_lod> table;
+    mesh_cache_lod full = { 0, (uint32_t)this->elements.size(), 0, 0 };
+    table.push_back(full);
+    for (unsigned int i = 0; i < this->lods.size(); i++) {
+      mesh_cache_lod lod = { table.back().first_element + table.back().nb_elements,
+			     (uint32_t)this->lods[i].elements.size(), this->lods[i].error, 0 };
+      table.push_back(lod);
+    }
+    return table;
+  }
+
+  /* The elements of all the LODs, in the order of lod_table() */
+  vector<GLuint> all_elements() {
+    vector<GLuint> res = this->elements;
+    for (unsigned int i = 0; i < this->lods.size(); i++)
+      res.insert(res.end(), this->lods[i].elements.begin(), this->lods[i].elements.end());
+    return res;
+  }
+
+  /**
+   * Coarsest LOD whose error stays under max_error pixels on screen,
+   * seen with view in a viewport of viewport_height pixels
+   */
+  int select_lod(const glm::mat4& view, int viewport_height, float max_error) {
+    float pixels_per_unit = mesh_pixels_per_unit(projection, view * this->object2world,
+						 this->center, this->radius, viewport_height);
+    int lod = 0;
+    while (lod + 1 < (int)this->lod_ranges.size()
+	   && this->lod_ranges[lod + 1].error * pixels_per_unit <= max_error)
+      lod++;
+    return lod;
+  }
+
   /**
    * Store object vertices, normals and/or elements in graphic card
-   * buffers
+   * buffers.  Vertices and normals are interleaved in a single buffer,
+   * (x,y,z,w,nx,ny,nz) for each vertex, so that fetching a vertex
+   * reads from one place.  Elements are stored on 16 bits when there
+   * are few enough vertices, followed by the ones of the LODs.
    */
   void upload() {
     if (this->vertices.size() > 0) {
-      glGenBuffers(1, &this->vbo_vertices);
-      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_vertices);
-      glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(this->vertices[0]),
-		   this->vertices.data(), GL_STATIC_DRAW);
-    }
-    
-    if (this->normals.size() > 0) {
-      glGenBuffers(1, &this->vbo_normals);
-      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_normals);
-      glBufferData(GL_ARRAY_BUFFER, this->normals.size() * sizeof(this->normals[0]),
-		   this->normals.data(), GL_STATIC_DRAW);
+      bool with_normals = this->normals.size() == this->vertices.size();
+      int nb_floats = with_normals ? 4+3 : 4;
+      vector<GLfloat> data(this->vertices.size() * nb_floats);
+      for (unsigned int i = 0; i < this->vertices.size(); i++) {
+	memcpy(&data[i*nb_floats], glm::value_ptr(this->vertices[i]), 4*sizeof(GLfloat));
+	if (with_normals)
+	  memcpy(&data[i*nb_floats+4], glm::value_ptr(this->normals[i]), 3*sizeof(GLfloat));
+      }
+      if (this->vbo == 0)
+	this->vbo = gen_buffer();
+      this->stride = nb_floats * sizeof(GLfloat);
+      glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+      glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(data[0]), data.data(), GL_STATIC_DRAW);
+
+      this->nb_vertices = this->vertices.size();
+
+      glm::vec3 min_p(this->vertices[0]), max_p(this->vertices[0]);
+      for (unsigned int i = 0; i < this->vertices.size(); i++) {
+	min_p = glm::min(min_p, glm::vec3(this->vertices[i]));
+	max_p = glm::max(max_p, glm::vec3(this->vertices[i]));
+      }
+      this->bounds_min = min_p;
+      this->bounds_max = max_p;
+      this->center = (min_p + max_p) * 0.5f;
+      this->radius = glm::length(max_p - min_p) * 0.5f;
     }
-    
+
     if (this->elements.size() > 0) {
-      glGenBuffers(1, &this->ibo_elements);
+      this->lod_ranges = lod_table();
+      vector<GLuint> elements = all_elements();
+      if (this->ibo_elements == 0)
+	this->ibo_elements = gen_buffer();
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
-      glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->elements.size() * sizeof(this->elements[0]),
-		   this->elements.data(), GL_STATIC_DRAW);
+      if (this->vertices.size() <= 65536) {
+	vector<GLushort> short_elements(elements.begin(), elements.end());
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, short_elements.size() * sizeof(short_elements[0]),
+		     short_elements.data(), GL_STATIC_DRAW);
+	this->element_type = GL_UNSIGNED_SHORT;
+      } else {
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(elements[0]),
+		     elements.data(), GL_STATIC_DRAW);
+	this->element_type = GL_UNSIGNED_INT;
+      }
+      this->nb_elements = this->elements.size();
     }
   }
 
   /**
-   * Draw the object
+   * Same from a binary mesh cache: the mapped file goes to the
+   * buffers as is, without filling vertices, normals and elements;
+   * the bounds come from the cache header.
    */
-  void draw() {
-    if (this->vbo_vertices != 0) {
+  void upload(const mesh_cache* cache) {
+    const mesh_cache_header* header = cache->header;
+    if (this->vbo == 0)
+      this->vbo = gen_buffer();
+    this->stride = header->stride;
+    glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)header->nb_vertices * header->stride,
+		 cache->vertices, GL_STATIC_DRAW);
+    this->nb_vertices = header->nb_vertices;
+
+    if (this->ibo_elements == 0)
+      this->ibo_elements = gen_buffer();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)header->nb_elements * header->element_size,
+		 cache->elements, GL_STATIC_DRAW);
+    this->element_type = (header->element_size == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    this->lod_ranges.assign(cache->lods, cache->lods + header->nb_lods);
+    this->nb_elements = this->lod_ranges[0].nb_elements;
+
+    glm::vec3 min_p(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+    glm::vec3 max_p(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+    this->bounds_min = min_p;
+    this->bounds_max = max_p;
+    this->center = (min_p + max_p) * 0.5f;
+    this->radius = glm::length(max_p - min_p) * 0.5f;
+  }
+
+  /**
+   * Draw the object, or one of its LODs
+   */
+  void draw(int lod = 0) {
+    bool with_normals = this->stride > (GLsizei)(4*sizeof(GLfloat));
+    if (this->vbo != 0) {
+      glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
       glEnableVertexAttribArray(attribute_v_coord);
-      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_vertices);
       glVertexAttribPointer(
         attribute_v_coord,  // attribute
         4,                  // number of elements per vertex, here (x,y,z,w)
         GL_FLOAT,           // the type of each element
         GL_FALSE,           // take our values as-is
-        0,                  // no extra data between each position
+        this->stride,       // the normal is in between two positions
         0                   // offset of first element
       );
+      if (with_normals) {
+	glEnableVertexAttribArray(attribute_v_normal);
+	glVertexAttribPointer(
+	  attribute_v_normal, // attribute
+	  3,                  // number of elements per vertex, here (x,y,z)
+	  GL_FLOAT,           // the type of each element
+	  GL_FALSE,           // take our values as-is
+	  this->stride,       // the next position is in between two normals
+	  (GLvoid*)(4*sizeof(GLfloat))  // offset of first element, after the first position
+	);
+      }
     }
 
-    if (this->vbo_normals != 0) {
-      glEnableVertexAttribArray(attribute_v_normal);
-      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_normals);
-      glVertexAttribPointer(
-        attribute_v_normal, // attribute
-        3,                  // number of elements per vertex, here (x,y,z)
-        GL_FLOAT,           // the type of each element
-        GL_FALSE,           // take our values as-is
-        0,                  // no extra data between each position
-        0                   // offset of first element
-      );
-    }
-    
     /* Apply object's transformation matrix */
-    glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(this->object2world));
-    glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(this->object2world)));
-    glUniformMatrix3fv(uniform_m_3x3_inv_transp, 1, GL_FALSE, glm::value_ptr(m_3x3_inv_transp));
+    set_model(this->object2world);
     
     /* Push each element in buffer_vertices to the vertex shader */
     if (this->ibo_elements != 0) {
+      const mesh_cache_lod& range = this->lod_ranges[lod];
+      GLsizei element_size = (this->element_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
-      int size;  glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-      glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
+      glDrawElements(GL_TRIANGLES, range.nb_elements, this->element_type,
+		     (GLvoid*)((size_t)range.first_element * element_size));
+      triangles_drawn += range.nb_elements / 3;
     } else {
-      glDrawArrays(GL_TRIANGLES, 0, this->vertices.size());
+      glDrawArrays(GL_TRIANGLES, 0, this->nb_vertices);
+      triangles_drawn += this->nb_vertices / 3;
     }
 
-    if (this->vbo_normals != 0)
+    if (this->vbo != 0)
       glDisableVertexAttribArray(attribute_v_coord);
-    if (this->vbo_vertices != 0)
+    if (with_normals)
       glDisableVertexAttribArray(attribute_v_normal);
   }
 
+  /**
+   * Draw the object with another program, using only the vertex
+   * coordinates; uniforms are up to the caller
+   */
+  void draw_coords(GLint attribute_coord) {
+    glEnableVertexAttribArray(attribute_coord);
+    glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+    glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, this->stride, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
+    glDrawElements(GL_TRIANGLES, this->nb_elements, this->element_type, 0);
+    glDisableVertexAttribArray(attribute_coord);
+  }
+
   /**
    * Draw object bounding box
    */
   void draw_bbox() {
-    if (this->vertices.size() == 0)
+    if (this->nb_vertices == 0)
       return;
-    
-    // Cube 1x1x1, centered on origin
-    GLfloat vertices[] = {
-      -0.5, -0.5, -0.5, 1.0,
-       0.5, -0.5, -0.5, 1.0,
-       0.5,  0.5, -0.5, 1.0,
-      -0.5,  0.5, -0.5, 1.0,
-      -0.5, -0.5,  0.5, 1.0,
-       0.5, -0.5,  0.5, 1.0,
-       0.5,  0.5,  0.5, 1.0,
-      -0.5,  0.5,  0.5, 1.0,
-    };
-    GLuint vbo_vertices;
-    glGenBuffers(1, &vbo_vertices);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    GLushort elements[] = {
-      0, 1, 2, 3,
-      4, 5, 6, 7,
-      0, 4, 1, 5, 2, 6, 3, 7
-    };
-    GLuint ibo_elements;
-    glGenBuffers(1, &ibo_elements);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    GLfloat
-      min_x, max_x,
-      min_y, max_y,
-      min_z, max_z;
-    min_x = max_x = this->vertices[0].x;
-    min_y = max_y = this->vertices[0].y;
-    min_z = max_z = this->vertices[0].z;
-    for (unsigned int i = 0; i < this->vertices.size(); i++) {
-      if (this->vertices[i].x < min_x) min_x = this->vertices[i].x;
-      if (this->vertices[i].x > max_x) max_x = this->vertices[i].x;
-      if (this->vertices[i].y < min_y) min_y = this->vertices[i].y;
-      if (this->vertices[i].y > max_y) max_y = this->vertices[i].y;
-      if (this->vertices[i].z < min_z) min_z = this->vertices[i].z;
-      if (this->vertices[i].z > max_z) max_z = this->vertices[i].z;
+    // Corners of the box, in the order of shape_unit_cube
+    GLfloat vertices[8*4];
+    for (int i = 0; i < 8; i++) {
+      vertices[i*4+0] = shape_unit_cube[i*4+0] < 0 ? this->bounds_min.x : this->bounds_max.x;
+      vertices[i*4+1] = shape_unit_cube[i*4+1] < 0 ? this->bounds_min.y : this->bounds_max.y;
+      vertices[i*4+2] = shape_unit_cube[i*4+2] < 0 ? this->bounds_min.z : this->bounds_max.z;
+      vertices[i*4+3] = 1.0;
     }
-    glm::vec3 size = glm::vec3(max_x-min_x, max_y-min_y, max_z-min_z);
-    glm::vec3 center = glm::vec3((min_x+max_x)/2, (min_y+max_y)/2, (min_z+max_z)/2);
-    glm::mat4 transform = glm::scale(glm::mat4(1), size) * glm::translate(glm::mat4(1), center);
+    GLintptr offset = stream_vertices(vertices, sizeof(vertices));
     
     /* Apply object's transformation matrix */
-    glm::mat4 m = this->object2world * transform;
-    glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
+    set_model(this->object2world);
     
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
     glEnableVertexAttribArray(attribute_v_coord);
     glVertexAttribPointer(
       attribute_v_coord,  // attribute
@@ -214,10 +531,10 @@ public:
       GL_FLOAT,           // the type of each element
       GL_FALSE,           // take our values as-is
       0,                  // no extra data between each position
-      0                   // offset of first element
+      (GLvoid*)offset     // offset of first element
     );
     
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
+    static_buffer(GL_ELEMENT_ARRAY_BUFFER, shape_cube_lines, sizeof(shape_cube_lines));
     glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, 0);
     glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, (GLvoid*)(4*sizeof(GLushort)));
     glDrawElements(GL_LINES, 8, GL_UNSIGNED_SHORT, (GLvoid*)(8*sizeof(GLushort)));
@@ -225,65 +542,51 @@ public:
     
     glDisableVertexAttribArray(attribute_v_coord);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    
-    glDeleteBuffers(1, &vbo_vertices);
-    glDeleteBuffers(1, &ibo_elements);
   }
 };
 Mesh ground, main_object, light_bbox;
-Mesh portals[2];
+Mesh portals[MAX_PORTALS];
+int nb_portals = 2;
+int portal_links[MAX_PORTALS];  // where each portal leads to
 
+/* World-space portals, see update_portal_bvh() */
+static portal_quad portal_quads[MAX_PORTALS];
+static glm::vec3 portal_box_min[MAX_PORTALS], portal_box_max[MAX_PORTALS];
+static portal_bvh portals_bvh;
 
-void draw_scene(vector<glm::mat4> view_stack, int rec, int outer_portal);
-void draw_portals(vector<glm::mat4> view_stack, int rec, int outer_portal);
 
+void draw_scene(int n);
+void draw_portals(const portal_node* node);
+
+/**
+ * Load an OBJ model, from its binary cache if it has one, which is
+ * uploaded right away; otherwise parse and optimize it, and write the
+ * cache for the next time.
+ */
 void load_obj(const char* filename, Mesh* mesh) {
-  ifstream in(filename, ios::in);
-  if (!in) { cerr << "Cannot open " << filename << endl; exit(1); }
-  vector<int> nb_seen;
-
-  string line;
-  while (getline(in, line)) {
-    if (line.substr(0,2) == "v ") {
-      istringstream s(line.substr(2));
-      glm::vec4 v; s >> v.x; s >> v.y; s >> v.z; v.w = 1.0;
-      mesh->vertices.push_back(v);
-    }  else if (line.substr(0,2) == "f ") {
-      istringstream s(line.substr(2));
-      GLushort a,b,c;
-      s >> a; s >> b; s >> c;
-      a--; b--; c--;
-      mesh->elements.push_back(a); mesh->elements.push_back(b); mesh->elements.push_back(c);
-    }
-    else if (line[0] == '#') { /* ignoring this line */ }
-    else { /* ignoring this line */ }
+  string cache_filename = mesh_cache_filename(filename);
+  mesh_cache cache;
+  if (mesh_cache_open(cache_filename.c_str(), filename, &cache)) {
+    mesh->upload(&cache);
+    mesh_cache_close(&cache);
+    return;
   }
 
-  mesh->normals.resize(mesh->vertices.size(), glm::vec3(0.0, 0.0, 0.0));
-  nb_seen.resize(mesh->vertices.size(), 0);
-  for (unsigned int i = 0; i < mesh->elements.size(); i+=3) {
-    GLushort ia = mesh->elements[i];
-    GLushort ib = mesh->elements[i+1];
-    GLushort ic = mesh->elements[i+2];
-    glm::vec3 normal = glm::normalize(glm::cross(
-      glm::vec3(mesh->vertices[ib]) - glm::vec3(mesh->vertices[ia]),
-      glm::vec3(mesh->vertices[ic]) - glm::vec3(mesh->vertices[ia])));
-
-    int v[3];  v[0] = ia;  v[1] = ib;  v[2] = ic;
-    for (int j = 0; j < 3; j++) {
-      GLushort cur_v = v[j];
-      nb_seen[cur_v]++;
-      if (nb_seen[cur_v] == 1) {
-	mesh->normals[cur_v] = normal;
-      } else {
-	// average
-	mesh->normals[cur_v].x = mesh->normals[cur_v].x * (1.0 - 1.0/nb_seen[cur_v]) + normal.x * 1.0/nb_seen[cur_v];
-	mesh->normals[cur_v].y = mesh->normals[cur_v].y * (1.0 - 1.0/nb_seen[cur_v]) + normal.y * 1.0/nb_seen[cur_v];
-	mesh->normals[cur_v].z = mesh->normals[cur_v].z * (1.0 - 1.0/nb_seen[cur_v]) + normal.z * 1.0/nb_seen[cur_v];
-	mesh->normals[cur_v] = glm::normalize(mesh->normals[cur_v]);
-      }
-    }
+  obj_model model;
+  if (!obj_load(filename, &model))
+    exit(1);
+  vector<obj_vertex> vertices;
+  obj_index_vertices(&model, &vertices, &mesh->elements);
+  mesh->vertices.resize(vertices.size());
+  mesh->normals.resize(vertices.size());
+  for (unsigned int i = 0; i < vertices.size(); i++) {
+    mesh->vertices[i] = vertices[i].position;
+    mesh->normals[i] = vertices[i].normal;
   }
+  mesh->optimize();
+  mesh->build_lods();
+  mesh_cache_write(cache_filename.c_str(), filename, mesh->vertices, mesh->normals, mesh->all_elements(),
+		   mesh->lod_table());
 }
 
 void create_portal(Mesh* portal, int screen_width, int screen_height, float zNear, float fovy) {
@@ -321,8 +624,175 @@ void create_portal(Mesh* portal, int screen_width, int screen_height, float zNea
   }
 }
 
+/**
+ * Recompute the world-space front quads and bounding boxes of the
+ * portals, and the hierarchy over them.  To call whenever portals are
+ * moved or reshaped.
+ */
+void update_portal_bvh() {
+  // frame around the portal, see draw_portal_bbox()
+  static const glm::vec4 frame_corners[] = {
+    glm::vec4(-1.05, -1.05, 0, 1), glm::vec4(1.05, -1.05, 0, 1),
+    glm::vec4(-1.05,  1.05, 0, 1), glm::vec4(1.05,  1.05, 0, 1),
+  };
+  for (int i = 0; i < nb_portals; i++) {
+    const glm::mat4& m = portals[i].object2world;
+    glm::vec3 p0 = glm::vec3(m * glm::vec4(-1, -1, 0, 1));
+    portal_quads[i].p0 = p0;
+    portal_quads[i].e1 = glm::vec3(m * glm::vec4( 1, -1, 0, 1)) - p0;
+    portal_quads[i].e2 = glm::vec3(m * glm::vec4(-1,  1, 0, 1)) - p0;
+
+    portal_box_min[i] = portal_box_max[i] = p0;
+    for (unsigned int j = 0; j < portals[i].vertices.size(); j++) {
+      glm::vec3 v = glm::vec3(m * portals[i].vertices[j]);
+      portal_box_min[i] = glm::min(portal_box_min[i], v);
+      portal_box_max[i] = glm::max(portal_box_max[i], v);
+    }
+    for (unsigned int j = 0; j < sizeof(frame_corners)/sizeof(frame_corners[0]); j++) {
+      glm::vec3 v = glm::vec3(m * frame_corners[j]);
+      portal_box_min[i] = glm::min(portal_box_min[i], v);
+      portal_box_max[i] = glm::max(portal_box_max[i], v);
+    }
+  }
+  bvh_build(&portals_bvh, portal_box_min, portal_box_max, nb_portals);
+}
+
+void invalidate_portal_caches() {
+  for (int i = 0; i < MAX_PORTALS; i++)
+    portal_caches[i].valid = false;
+}
+
+/**
+ * Place the portals.  Face to face is the worst case for recursion:
+ * each portal shows the other one, which shows the first one again,
+ * and so on.
+ */
+void set_portal_layout(bool facing) {
+  portals_facing = facing;
+  portal_scene_pairs = 0;
+  nb_portals = 2;
+  portal_links[0] = 1;
+  portal_links[1] = 0;
+  if (facing) {
+    portals[0].object2world = glm::translate(glm::mat4(1), glm::vec3(-2, 0, 0))
+      * glm::translate(glm::mat4(1), glm::vec3(0, 1, 0))
+      * glm::rotate(glm::mat4(1), glm::radians(90.0f), glm::vec3(0, 1, 0));
+    portals[1].object2world = glm::translate(glm::mat4(1), glm::vec3(2, 0, 0))
+      * glm::translate(glm::mat4(1), glm::vec3(0, 1, 0))
+      * glm::rotate(glm::mat4(1), glm::radians(-90.0f), glm::vec3(0, 1, 0));
+  } else {
+    // 90° angle + slightly higher
+    portals[0].object2world = glm::translate(glm::mat4(1), glm::vec3(0, 1, -2));
+    portals[1].object2world = glm::rotate(glm::mat4(1), glm::radians(-90.0f), glm::vec3(0, 1, 0))
+      * glm::translate(glm::mat4(1), glm::vec3(0, 1.2, -2));
+  }
+  update_portal_bvh();
+  invalidate_portal_caches();
+}
+
+/**
+ * Scene for benchmarks with many portals: 'pairs' pairs of linked
+ * portals, scattered on a grid at random angles and heights.  The two
+ * portals of a pair are usually far apart.  Always the same scene for
+ * a given number of pairs.
+ */
+void generate_portal_scene(int pairs) {
+  pairs = min(pairs, MAX_PORTALS / 2);
+  portal_scene_pairs = pairs;
+  nb_portals = 2 * pairs;
+
+  // one grid cell per portal, wide enough for a portal and its frame
+  const float spacing = 2.6;
+  int side = ceil(sqrt(nb_portals));
+  int cells[MAX_PORTALS];
+  for (int i = 0; i < side * side && i < MAX_PORTALS; i++)
+    cells[i] = i;
+  srand(pairs);
+  for (int i = min(side * side, MAX_PORTALS) - 1; i > 0; i--)
+    swap(cells[i], cells[rand() % (i + 1)]);
+
+  for (int i = 0; i < nb_portals; i++) {
+    float x = (cells[i] % side - (side - 1) / 2.0) * spacing + (rand() % 41 - 20) / 100.0;
+    float z = (cells[i] / side - (side - 1) / 2.0) * spacing + (rand() % 41 - 20) / 100.0;
+    float y = 1 + (rand() % 51) / 100.0;
+    float angle = rand() % 360;
+    portals[i].object2world = glm::translate(glm::mat4(1), glm::vec3(x, y, z))
+      * glm::rotate(glm::mat4(1), glm::radians(angle), glm::vec3(0, 1, 0));
+    portal_links[i] = i ^ 1;
+  }
+  update_portal_bvh();
+  invalidate_portal_caches();
+}
+
+/**
+ * Create the render target of a portal texture, at the size of the
+ * screen since it is mapped back onto it.
+ */
+void create_portal_cache(portal_cache* cache) {
+  if (cache->fbo != 0) {
+    glDeleteFramebuffers(1, &cache->fbo);
+    glDeleteTextures(1, &cache->texture);
+    glDeleteRenderbuffers(1, &cache->rbo_depth_stencil);
+  }
+
+  glGenTextures(1, &cache->texture);
+  glBindTexture(GL_TEXTURE_2D, cache->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, screen_width, screen_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // Nested portals still need a stencil buffer
+  glGenRenderbuffers(1, &cache->rbo_depth_stencil);
+  glBindRenderbuffer(GL_RENDERBUFFER, cache->rbo_depth_stencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, screen_width, screen_height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &cache->fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, cache->texture, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, cache->rbo_depth_stencil);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, cache->rbo_depth_stencil);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+    fprintf(stderr, "glCheckFramebufferStatus: error %p\n", (void*)(size_t)status);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  cache->valid = false;
+}
+
+/**
+ * Resize the render targets of the portal textures already in use;
+ * the other ones are created when first needed.
+ */
+void create_portal_caches() {
+  for (int i = 0; i < MAX_PORTALS; i++)
+    if (portal_caches[i].fbo != 0)
+      create_portal_cache(&portal_caches[i]);
+}
+
+void free_portal_caches() {
+  for (int i = 0; i < MAX_PORTALS; i++) {
+    portal_cache* cache = &portal_caches[i];
+    if (cache->fbo == 0)
+      continue;
+    glDeleteFramebuffers(1, &cache->fbo);
+    glDeleteTextures(1, &cache->texture);
+    glDeleteRenderbuffers(1, &cache->rbo_depth_stencil);
+    cache->fbo = 0;
+  }
+}
+
 int init_resources(char* model_filename, char* vshader_filename, char* fshader_filename)
 {
+  /* Start compiling the shaders, or loading them as linked the last time, while the models load */
+  enable_program_cache(true);
+  int t = glutGet(GLUT_ELAPSED_TIME);
+  program = create_program_async(vshader_filename, fshader_filename);
+  program_portal = create_program_async("portal-texture.v.glsl", "portal-texture.f.glsl");
+
   load_obj(model_filename, &main_object);
   // mesh position initialized in init_view()
 
@@ -350,47 +820,22 @@ int init_resources(char* model_filename, char* vshader_filename, char* fshader_f
   light_bbox.vertices.push_back(glm::vec4(-0.1,  0.1,  0.1, 0.0));
   light_bbox.object2world = glm::translate(glm::mat4(1), light_position);
 
-  create_portal(&portals[0], screen_width, screen_height, zNear, fovy);
-  create_portal(&portals[1], screen_width, screen_height, zNear, fovy);
-
-  // Face to face
-  // portals[0].object2world = glm::translate(glm::mat4(1), glm::vec3(-2, 0, 0))
-  //   * glm::translate(glm::mat4(1), glm::vec3(0, 1, 0))
-  //   * glm::rotate(glm::mat4(1), 90.0f, glm::vec3(0, 1, 0));
-  // portals[1].object2world = glm::translate(glm::mat4(1), glm::vec3(2, 0, 0))
-  //   * glm::translate(glm::mat4(1), glm::vec3(0, 1, 0))
-  //   * glm::rotate(glm::mat4(1), -90.0f, glm::vec3(0, 1, 0));
-
-  // 90° angle + slightly higher
-  portals[0].object2world = glm::translate(glm::mat4(1), glm::vec3(0, 1, -2));
-  portals[1].object2world = glm::rotate(glm::mat4(1), glm::radians(-90.0f), glm::vec3(0, 1, 0))
-    * glm::translate(glm::mat4(1), glm::vec3(0, 1.2, -2));
+  for (int i = 0; i < MAX_PORTALS; i++)
+    create_portal(&portals[i], screen_width, screen_height, zNear, fovy);
+  set_portal_layout(portals_facing);
 
   main_object.upload();
   ground.upload();
   light_bbox.upload();
-  portals[0].upload();
-  portals[1].upload();
+  for (int i = 0; i < MAX_PORTALS; i++)
+    portals[i].upload();
 
 
-  /* Compile and link shaders */
-  GLint link_ok = GL_FALSE;
+  /* Wait for the shaders */
   GLint validate_ok = GL_FALSE;
+  int t_wait = glutGet(GLUT_ELAPSED_TIME);
 
-  GLuint vs, fs;
-  if ((vs = create_shader(vshader_filename, GL_VERTEX_SHADER))   == 0) return 0;
-  if ((fs = create_shader(fshader_filename, GL_FRAGMENT_SHADER)) == 0) return 0;
-
-  program = glCreateProgram();
-  glAttachShader(program, vs);
-  glAttachShader(program, fs);
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
-  if (!link_ok) {
-    fprintf(stderr, "glLinkProgram:");
-    print_log(program);
-    return 0;
-  }
+  if ((program = finish_program(program)) == 0) return 0;
   glValidateProgram(program);
   glGetProgramiv(program, GL_VALIDATE_STATUS, &validate_ok);
   if (!validate_ok) {
@@ -443,12 +888,47 @@ int init_resources(char* model_filename, char* vshader_filename, char* fshader_f
     return 0;
   }
 
+  /* Textured portals */
+  if ((program_portal = finish_program(program_portal)) == 0) return 0;
+  if ((attribute_portal_v_coord = get_attrib(program_portal, "v_coord")) == -1) return 0;
+  if ((uniform_portal_m = get_uniform(program_portal, "m")) == -1) return 0;
+  if ((uniform_portal_v = get_uniform(program_portal, "v")) == -1) return 0;
+  if ((uniform_portal_p = get_uniform(program_portal, "p")) == -1) return 0;
+  if ((uniform_portal_cached_vp = get_uniform(program_portal, "cached_vp")) == -1) return 0;
+  if ((uniform_portal_texture = get_uniform(program_portal, "portal_texture")) == -1) return 0;
+
+  int hits, misses;
+  get_program_cache_stats(&hits, &misses);
+  printf("Ready in %d ms, %d ms waiting for the shaders (%d programs from the cache, %d compiled)\n",
+         glutGet(GLUT_ELAPSED_TIME) - t, glutGet(GLUT_ELAPSED_TIME) - t_wait, hits, misses);
+
   fps_start = glutGet(GLUT_ELAPSED_TIME);
 
   return 1;
 }
 
 void init_view() {
+  if (portal_scene_pairs > 0) {
+    // At the edge of the portal grid, looking across it
+    float edge = ceil(sqrt(2 * portal_scene_pairs)) * 2.6 / 2;
+    main_object.object2world = glm::translate(glm::mat4(1), glm::vec3(2, 1, edge + 1));
+    transforms[MODE_CAMERA] = glm::lookAt(
+      glm::vec3(0.0,  1.5, edge + 3),  // eye
+      glm::vec3(0.0,  1.0, 0.0),       // direction
+      glm::vec3(0.0,  1.0, 0.0));      // up
+    return;
+  }
+
+  if (portals_facing) {
+    // Out of the way of the portals, look slightly sideways into the tunnel
+    main_object.object2world = glm::translate(glm::mat4(1), glm::vec3(0, 1, -3));
+    transforms[MODE_CAMERA] = glm::lookAt(
+      glm::vec3( 1.0,  1.0, 0.5),   // eye
+      glm::vec3(-2.0,  1.0, 0.0),   // direction
+      glm::vec3( 0.0,  1.0, 0.0));  // up
+    return;
+  }
+
   main_object.object2world = glm::translate(glm::mat4(1), glm::vec3(-2, 1, 0))
     * glm::rotate(glm::mat4(1), glm::radians(90.0f), glm::vec3(0, 1, 0));
   transforms[MODE_CAMERA] = glm::lookAt(
@@ -525,6 +1005,47 @@ void onSpecialUp(int key, int x, int y) {
   }
 }
 
+void onKeyboard(unsigned char key, int x, int y) {
+  switch (key) {
+  case 'f':
+    set_portal_layout(!portals_facing);
+    init_view();
+    break;
+  case 'g':
+    // 8, 16, then 32 pairs of portals
+    generate_portal_scene(portal_scene_pairs == 0 || portal_scene_pairs >= 32 ? 8 : portal_scene_pairs * 2);
+    init_view();
+    break;
+  case '+':
+    portal_min_area *= 2;
+    break;
+  case '-':
+    portal_min_area = max(1, portal_min_area / 2);
+    break;
+  case 'b':
+    portal_budget = (portal_budget == INT_MAX) ? 32 : INT_MAX;
+    break;
+  case 't':
+    portal_mode = (portal_mode == PORTAL_STENCIL) ? PORTAL_TEXTURE : PORTAL_STENCIL;
+    invalidate_portal_caches();
+    break;
+  case 'l':
+    lod_enabled = !lod_enabled;
+    invalidate_portal_caches();
+    break;
+  default:
+    return;
+  }
+  if (portal_scene_pairs > 0)
+    cout << portal_scene_pairs << " pairs of portals";
+  else
+    cout << "portals " << (portals_facing ? "facing" : "at 90°");
+  cout << (portal_mode == PORTAL_TEXTURE ? ", textured" : ", stencil")
+       << ", min area " << portal_min_area << "px"
+       << ", budget " << (portal_budget == INT_MAX ? -1 : portal_budget)
+       << ", LOD " << (lod_enabled ? "on" : "off") << endl;
+}
+
 /**
  * Get a normalized vector from the center of the virtual ball O to a
  * point P on the virtual ball surface, such that P is aligned on
@@ -544,40 +1065,6 @@ glm::vec3 get_arcball_vector(int x, int y) {
   return P;
 }
 
-/**
- * Checks whether the line defined by two points la and lb intersects
- * the portal.
- */
-int portal_intersection(glm::vec4 la, glm::vec4 lb, Mesh* portal) {
-  if (la != lb) {  // camera moved
-    // Check for intersection with each of the portal's 2 front triangles
-    for (int i = 0; i < 2; i++) {
-      // Portal coordinates in world view
-      glm::vec4
-	p0 = portal->object2world * portal->vertices[portal->elements[i*3+0]],
-	p1 = portal->object2world * portal->vertices[portal->elements[i*3+1]],
-	p2 = portal->object2world * portal->vertices[portal->elements[i*3+2]];
-
-      // Solve line-plane intersection using parametric form
-      glm::vec3 tuv =
-	glm::inverse(glm::mat3(glm::vec3(la.x - lb.x, la.y - lb.y, la.z - lb.z),
-			       glm::vec3(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z),
-			       glm::vec3(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z)))
-	* glm::vec3(la.x - p0.x, la.y - p0.y, la.z - p0.z);
-      float t = tuv.x, u = tuv.y, v = tuv.z;
-
-      // intersection with the plane
-      if (t >= 0-1e-6 && t <= 1+1e-6) {
-	// intersection with the triangle
-	if (u >= 0-1e-6 && u <= 1+1e-6 && v >= 0-1e-6 && v <= 1+1e-6 && (u + v) <= 1+1e-6) {
-	  return 1;
-	}
-      }
-    }
-  }
-  return 0;
-}
-
 /**
  * Compute a world2camera view matrix to see from portal 'dst', given
  * the original view and the 'src' portal position.
@@ -603,10 +1090,23 @@ void logic() {
   {
     fps_frames++;
     int delta_t = glutGet(GLUT_ELAPSED_TIME) - fps_start;
-    if (delta_t > 1000) {
-      cout << 1000.0 * fps_frames / delta_t << endl;
+    if (delta_t > 1000 && !bench_mode) {
+      cout << 1000.0 * fps_frames / delta_t << " fps, "
+           << frame_time_total / fps_frames << " ms/frame (max " << frame_time_max << "), "
+           << 1.0 * frame_passes_total / fps_frames << " portal passes, depth " << frame_deepest << ", "
+           << 1.0 * portal_refreshes / fps_frames << " portal textures refreshed, "
+           << frame_allocs_total / fps_frames << " allocations/frame, "
+           << 1.0 * (gl_buffers_created - frame_buffers_start) / fps_frames << " buffers created/frame, "
+           << (triangles_drawn - frame_triangles_start) / fps_frames << " triangles/frame" << endl;
       fps_frames = 0;
       fps_start = glutGet(GLUT_ELAPSED_TIME);
+      frame_time_total = frame_time_max = 0;
+      frame_passes_total = 0;
+      frame_allocs_total = 0;
+      frame_buffers_start = gl_buffers_created;
+      frame_triangles_start = triangles_drawn;
+      frame_deepest = 0;
+      portal_refreshes = 0;
     }
   }
 
@@ -651,12 +1151,22 @@ void logic() {
   }
 
   /* Handle portals */
-  // Movement of the camera in world view
-  for (int i = 0; i < 2; i++) {
-    glm::vec4 la = glm::inverse(prev_cam) * glm::vec4(0.0, 0.0, 0.0, 1.0);
-    glm::vec4 lb = glm::inverse(transforms[MODE_CAMERA]) * glm::vec4(0.0, 0.0, 0.0, 1.0);
-    if (portal_intersection(la, lb, &portals[i]))
-      transforms[MODE_CAMERA] = portal_view(transforms[MODE_CAMERA], &portals[i], &portals[(i+1)%2]);
+  // Movement of the camera in world view, from la to lb.  If it goes
+  // through a portal, the rest of the movement starts from the other
+  // end and may go through another portal, and so on.
+  glm::vec3 la = glm::vec3(glm::inverse(prev_cam) * glm::vec4(0.0, 0.0, 0.0, 1.0));
+  int exit_portal = -1;
+  for (int crossings = 0; crossings < 4; crossings++) {
+    glm::mat4 cam = transforms[MODE_CAMERA];
+    glm::vec3 lb = glm::vec3(glm::inverse(cam) * glm::vec4(0.0, 0.0, 0.0, 1.0));
+    float t;
+    int i = bvh_first_hit(&portals_bvh, portal_quads, la, lb, exit_portal, &t);
+    if (i == -1)
+      break;
+    exit_portal = portal_links[i];
+    transforms[MODE_CAMERA] = portal_view(cam, &portals[i], &portals[exit_portal]);
+    // crossing point, moved like the camera
+    la = glm::vec3(glm::inverse(transforms[MODE_CAMERA]) * cam * glm::vec4(la + (lb - la) * t, 1));
   }
 
   /* Handle arcball */
@@ -676,105 +1186,89 @@ void logic() {
   // Set in onDisplay() - cf. main_object.object2world
 
   // View
-  glm::mat4 world2camera = transforms[MODE_CAMERA];
+  // Set in draw() - cf. portal_stack
 
   // Projection
-  glm::mat4 camera2screen = glm::perspective(fovy, 1.0f*screen_width/screen_height, zNear, 100.0f);
+  projection = glm::perspective(fovy, 1.0f*screen_width/screen_height, zNear, 100.0f);
 
   glUseProgram(program);
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(world2camera));
-  glUniformMatrix4fv(uniform_p, 1, GL_FALSE, glm::value_ptr(camera2screen));
-
-  glm::mat4 v_inv = glm::inverse(world2camera);
-  glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(v_inv));
+  set_projection(projection);
 
   glutPostRedisplay();
 }
 
-/**
- * Draw a frame around the portal.
- */
-void draw_portal_bbox(Mesh* portal) {
-  // 0.05 frame around the portal
-  Mesh portal_bbox;
-  portal_bbox.vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.05, -1.05, 0, 1));
+/* 0.05 frame around the portal, one side */
+static const GLfloat portal_frame_vertices[] = {
+  -1.00, -1.05, 0, 1,
+  -1.00,  1.05, 0, 1,
+  -1.05, -1.05, 0, 1,
 
-  portal_bbox.vertices.push_back(glm::vec4(-1.05, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.05,  1.05, 0, 1));
+  -1.05, -1.05, 0, 1,
+  -1.00,  1.05, 0, 1,
+  -1.05,  1.05, 0, 1,
 
-  portal_bbox.vertices.push_back(glm::vec4( 1.05, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.05,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
+   1.05, -1.05, 0, 1,
+   1.05,  1.05, 0, 1,
+   1.00, -1.05, 0, 1,
 
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.05,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
+   1.00, -1.05, 0, 1,
+   1.05,  1.05, 0, 1,
+   1.00,  1.05, 0, 1,
 
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.00, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
+  -1.00,  1.05, 0, 1,
+  -1.00,  1.00, 0, 1,
+   1.00,  1.05, 0, 1,
 
-  portal_bbox.vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.00, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00,  1.00, 0, 1));
+   1.00,  1.05, 0, 1,
+  -1.00,  1.00, 0, 1,
+   1.00,  1.00, 0, 1,
 
-  portal_bbox.vertices.push_back(glm::vec4(-1.00, -1.00, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.00, 0, 1));
+  -1.00, -1.00, 0, 1,
+  -1.00, -1.05, 0, 1,
+   1.00, -1.00, 0, 1,
 
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.00, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
+   1.00, -1.00, 0, 1,
+  -1.00, -1.05, 0, 1,
+   1.00, -1.05, 0, 1,
+};
+static const GLfloat portal_frame_normals[] = {
+  0,0,1, 0,0,1, 0,0,1,  0,0,1, 0,0,1, 0,0,1,
+  0,0,1, 0,0,1, 0,0,1,  0,0,1, 0,0,1, 0,0,1,
+  0,0,1, 0,0,1, 0,0,1,  0,0,1, 0,0,1, 0,0,1,
+  0,0,1, 0,0,1, 0,0,1,  0,0,1, 0,0,1, 0,0,1,
+};
 
-  for (int i = 0; i < portal_bbox.vertices.size(); i++)
-    portal_bbox.normals.push_back(glm::vec3(0,0,1));
+/**
+ * Draw a frame around the portal.
+ */
+void draw_portal_bbox(Mesh* portal) {
+  static_buffer(GL_ARRAY_BUFFER, portal_frame_vertices, sizeof(portal_frame_vertices));
+  glEnableVertexAttribArray(attribute_v_coord);
+  glVertexAttribPointer(attribute_v_coord, 4, GL_FLOAT, GL_FALSE, 0, 0);
+  static_buffer(GL_ARRAY_BUFFER, portal_frame_normals, sizeof(portal_frame_normals));
+  glEnableVertexAttribArray(attribute_v_normal);
+  glVertexAttribPointer(attribute_v_normal, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  portal_bbox.upload();
+  /* Apply object's transformation matrix, for both sides */
+  set_model(portal->object2world);
+  glDrawArrays(GL_TRIANGLES, 0, sizeof(portal_frame_vertices)/sizeof(portal_frame_vertices[0])/4);
+  set_model(portal->object2world * glm::rotate(glm::mat4(1), glm::radians(180.0f), glm::vec3(0, 1, 0)));
+  glDrawArrays(GL_TRIANGLES, 0, sizeof(portal_frame_vertices)/sizeof(portal_frame_vertices[0])/4);
 
-  /* Apply object's transformation matrix */
-  portal_bbox.object2world = portal->object2world;
-  portal_bbox.draw();
-  portal_bbox.object2world = portal->object2world * glm::rotate(glm::mat4(1), glm::radians(180.0f), glm::vec3(0, 1, 0));
-  portal_bbox.draw();
+  glDisableVertexAttribArray(attribute_v_coord);
+  glDisableVertexAttribArray(attribute_v_normal);
 }
 
 /**
  * Fill screen with a black square aligned with the perspective
  */
 void fill_screen() {
-  GLfloat vertices[] = {
-    -1, -1, 0, 1,
-     1, -1, 0, 1,
-    -1,  1, 0, 1,
-    -1,  1, 0, 1,
-     1, -1, 0, 1,
-     1,  1, 0, 1,
-  };
-  GLuint vbo_vertices;
-  glGenBuffers(1, &vbo_vertices);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-
   /* Apply object's transformation matrix */
-  glm::mat4 m = glm::inverse(glm::perspective(fovy, 1.0f*screen_width/screen_height, zNear, 100.0f));
-  glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
-
-  // Save current view matrix - useful since we're going to
-  // recursively draw the scene from different points of View
-  GLuint cur_program;
-  GLfloat save_v[16];
-  GLfloat save_v_inv[16];
-  glGetIntegerv(GL_CURRENT_PROGRAM, (GLint*)&cur_program);
-  glGetUniformfv(cur_program, uniform_v, save_v);
-  glGetUniformfv(cur_program, uniform_v_inv, save_v_inv);
-
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0)));
+  set_model(glm::inverse(projection));
+  set_view(glm::mat4(1.0), glm::mat4(1.0));
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
+  static_buffer(GL_ARRAY_BUFFER, shape_screen_quad, sizeof(shape_screen_quad));
   glEnableVertexAttribArray(attribute_v_coord);
   glVertexAttribPointer(
     attribute_v_coord,  // attribute
@@ -785,20 +1279,17 @@ void fill_screen() {
     0                   // offset of first element
   );
 
-  glDrawArrays(GL_TRIANGLES, 0, sizeof(vertices)/sizeof(vertices[0])/4);
+  glDrawArrays(GL_TRIANGLES, 0, sizeof(shape_screen_quad)/sizeof(shape_screen_quad[0])/4);
 
   glDisableVertexAttribArray(attribute_v_coord);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  glDeleteBuffers(1, &vbo_vertices);
-
   // Restore view matrix
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, save_v);
-  glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, save_v_inv);
+  set_view(&portal_stack[portal_top]);
 }
 
 void draw_camera() {
-  GLfloat vertices[] = {
+  static const GLfloat vertices[] = {
     -1, -1, 0, 1,
      1, -1, 0, 1,
      1, -1, 0, 1,
@@ -813,17 +1304,11 @@ void draw_camera() {
      1,  1, 0, 1,
     -1,  1, 0, 1,
   };
-  GLuint vbo_vertices;
-  glGenBuffers(1, &vbo_vertices);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
   /* Apply object's transformation matrix */
-  glm::mat4 m = glm::inverse(transforms[MODE_CAMERA]);
-  glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
+  set_model(glm::inverse(transforms[MODE_CAMERA]));
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
+  static_buffer(GL_ARRAY_BUFFER, vertices, sizeof(vertices));
   glEnableVertexAttribArray(attribute_v_coord);
   glVertexAttribPointer(
     attribute_v_coord,  // attribute
@@ -839,17 +1324,20 @@ void draw_camera() {
 
   glDisableVertexAttribArray(attribute_v_coord);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-  glDeleteBuffers(1, &vbo_vertices);
 }
 
-void draw_portal_stencil(vector<glm::mat4> view_stack, Mesh* portal) {
+/**
+ * Recreate the stencil of the top level of the stack: the part of the
+ * screen where each level's portal, seen from the level before it,
+ * overlaps all the others.
+ */
+void draw_portal_stencil() {
   GLboolean save_color_mask[4];
   GLboolean save_depth_mask;
   glGetBooleanv(GL_COLOR_WRITEMASK, save_color_mask);
   glGetBooleanv(GL_DEPTH_WRITEMASK, &save_depth_mask);
 
-  //bool debug = (view_stack.size() == 4);
+  //bool debug = (portal_top == 3);
   bool debug = false;
 
   glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
@@ -860,8 +1348,8 @@ void draw_portal_stencil(vector<glm::mat4> view_stack, Mesh* portal) {
   // stencil buffer, looks like a bug; doesn't happen in stencil/cube.cpp.
   // draw stencil pattern
   glClear(GL_STENCIL_BUFFER_BIT);  // needs mask=0xFF
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack[0]));
-  portal->draw();
+  set_view(&portal_stack[0]);
+  portals[portal_stack[1].portal].draw();
   if (debug) {
       glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
       glClear(GL_COLOR_BUFFER_BIT);
@@ -874,11 +1362,12 @@ void draw_portal_stencil(vector<glm::mat4> view_stack, Mesh* portal) {
       glStencilMask(0xFF);
       glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
     }
-  for (unsigned int i = 1; i < view_stack.size() - 1; i++) {  // -1 to ignore last view
+  for (int i = 1; i < portal_top; i++) {  // ignore last view
     // Increment intersection for current portal
+    Mesh* portal = &portals[portal_stack[i+1].portal];
     glStencilFunc(GL_EQUAL, 0, 0xFF);
     glStencilOp(GL_INCR, GL_KEEP, GL_KEEP);  // draw 1s on test fail (always)
-    glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack[i]));
+    set_view(&portal_stack[i]);
     portal->draw();
     if (debug) {
       glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
@@ -898,8 +1387,8 @@ void draw_portal_stencil(vector<glm::mat4> view_stack, Mesh* portal) {
     // Decremental outer portal -> only sub-portal intersection remains
     glStencilFunc(GL_NEVER, 0, 0xFF);
     glStencilOp(GL_DECR, GL_KEEP, GL_KEEP);  // draw 1s on test fail (always)
-    glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack[i-1]));
-    portal->draw();
+    set_view(&portal_stack[i-1]);
+    portals[portal_stack[i].portal].draw();
     if (debug) {
       glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
       glClear(GL_COLOR_BUFFER_BIT);
@@ -925,117 +1414,140 @@ void draw_portal_stencil(vector<glm::mat4> view_stack, Mesh* portal) {
   // sleep(1);
   glColorMask(save_color_mask[0], save_color_mask[1], save_color_mask[2], save_color_mask[3]);
   glDepthMask(save_depth_mask);
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack.back()));
+  set_view(&portal_stack[portal_top]);
   // -Ready to draw main scene-
 }
 
-bool clip_portal(vector<glm::mat4> view_stack, Mesh* outer_portal, rect* scissor) {
-  scissor->x = 0;
-  scissor->y = 0;
-  scissor->w = screen_width;
-  scissor->h = screen_height;
-  for (unsigned int v = 0; v < view_stack.size() - 1; v++) {  // -1 to ignore last view
-    glm::vec4 p[4];
-    rect r;
-    bool found_negative_w = false;
-    for (int pi = 0; pi < 4; pi++) {
-      p[pi] = (glm::perspective(fovy, 1.0f*screen_width/screen_height, zNear, 100.0f)
-	      * view_stack[v]
-	      * outer_portal->object2world)
-	* outer_portal->vertices[pi];
-      if (p[pi].w < 0) {
-	// TODO: I tried to deal with that case, but it's quite
-	// complex because this means the coordinate is projected from
-	// the back of the camera, and we should clip to the min or
-	// max of the screen.  I'll let the stencil buffer deal with
-	// it for now.
-	// Possible fix: restrict the portal rectangle using its line
-	// intersection with the camera frustum.
-	//cout << "w<0" << endl;
-	//glDisable(GL_SCISSOR_TEST);
-	found_negative_w = true;
-      } else {
-	p[pi].x /= p[pi].w;
-	p[pi].y /= p[pi].w;
-      }
-    }
-    if (found_negative_w)
-      continue;
+/**
+ * Compute the scissor rectangle of a view through portal: the parent
+ * level's rectangle, clipped to the portal as seen from the parent
+ * level.  Since the parent rectangle is itself clipped by all the
+ * outer portals, so is the result.
+ *
+ * The whole portal mesh is clipped, not only its front quad: the
+ * thick part is what shows when the camera is about to cross it.
+ */
+bool clip_portal(const portal_level* parent, Mesh* portal, rect* scissor) {
+  *scissor = parent->scissor;
+  glm::mat4 mvp = projection * parent->view * portal->object2world;
+  rect r;
+  if (!screen_rect(mvp, portal->vertices.data(),
+		   portal->elements.data(), portal->elements.size(),
+		   screen_width, screen_height, &r))
+    return false;
+  return intersect_rect(scissor, r);
+}
 
-    glm::vec4 min_x, max_x, max_y, min_y;
-    min_x = max_x = min_y = max_y = p[0];
-    for (int i = 0; i < 4; i++) {
-      if (p[i].x < min_x.x) min_x = p[i];
-      if (p[i].x > max_x.x) max_x = p[i];
-      if (p[i].y < min_y.y) min_y = p[i];
-      if (p[i].y > max_y.y) max_y = p[i];
-    }
+/**
+ * Planes of the view frustum of a stack level in world coordinates,
+ * narrowed to its scissor rectangle (inside when dot(plane, p) >= 0).
+ */
+void level_planes(const portal_level* level, glm::vec4* planes) {
+  const rect& r = level->scissor;
+  float x0 = 2.0 * r.x / screen_width - 1, x1 = 2.0 * (r.x + r.w) / screen_width - 1;
+  float y0 = 2.0 * r.y / screen_height - 1, y1 = 2.0 * (r.y + r.h) / screen_height - 1;
+  glm::vec4 clip_planes[6] = {
+    glm::vec4( 1,  0,  0, -x0),  // x >= x0*w
+    glm::vec4(-1,  0,  0,  x1),  // x <= x1*w
+    glm::vec4( 0,  1,  0, -y0),
+    glm::vec4( 0, -1,  0,  y1),
+    frustum_planes[4],           // near
+    frustum_planes[5],           // far
+  };
+  // dot(plane, vp * p) == dot(transpose(vp) * plane, p)
+  glm::mat4 vp_transp = glm::transpose(projection * level->view);
+  for (int i = 0; i < 6; i++)
+    planes[i] = vp_transp * clip_planes[i];
+}
 
-    // (broken) attempt to deal with w < 0
-    // if (min_x.w < 0) { min_x.x = max_x.x; max_x.x =  1; }
-    // if (max_x.w < 0) { max_x.x = min_x.x; min_x.x = -1; }
-
-    min_x.x = (max(-1.0f, min_x.x) + 1) / 2 * screen_width;
-    max_x.x = (min( 1.0f, max_x.x) + 1) / 2 * screen_width;
-    min_y.y = (max(-1.0f, min_y.y) + 1) / 2 * screen_height;
-    max_y.y = (min( 1.0f, max_y.y) + 1) / 2 * screen_height;
-
-    r.x = min_x.x;
-    r.y = min_y.y;
-    r.w = max_x.x-min_x.x;
-    r.h = max_y.y-min_y.y;
-
-    // intersection with previous rect
-    //cout << "+" << scissor->x << "," << scissor->y << "," << scissor->w << "," << scissor->h << endl;
-    //cout << "+" << r.x << "," << r.y << "," << r.w << "," << r.h << endl;
-    {
-      int r_min_x = max(r.x, scissor->x);
-      int r_max_x = min(r.x+r.w, scissor->x+scissor->w);
-      scissor->x = r_min_x;
-      scissor->w = r_max_x - scissor->x;
-      int r_min_y = max(r.y, scissor->y);
-      int r_max_y = min(r.y+r.h, scissor->y+scissor->h);
-      scissor->y = r_min_y;
-      scissor->h = r_max_y - scissor->y;
-    }
-    //cout << "=" << scissor->x << "," << scissor->y << "," << scissor->w << "," << scissor->h << endl;
-    if (scissor->w <= 0 || scissor->h <= 0) {
-      return false;
+/**
+ * Append a view to the draw-order graph, with the portals in its
+ * frustum; returns -1 if the graph is full.
+ */
+int add_portal_node(const portal_level* level, int depth, int rec) {
+  if (portal_graph_size == PORTAL_GRAPH_SIZE)
+    return -1;
+  int n = portal_graph_size++;
+  portal_node* node = &portal_graph[n];
+  node->level = *level;
+  node->depth = depth;
+  node->rec = rec;
+  node->first_child = -1;
+  node->nb_children = 0;
+
+  // Portals in this view, as restricted by the outer portals
+  glm::vec4 planes[6];
+  level_planes(level, planes);
+  node->first_visible = portal_visible_size;
+  node->nb_visible = bvh_cull(&portals_bvh, planes, 6, &portal_visible[portal_visible_size]);
+  portal_visible_size += node->nb_visible;
+  return n;
+}
+
+/**
+ * Build the draw-order graph from a view: the views through the
+ * portals it shows, the views through the portals these show, etc.
+ * Returns the root node.
+ *
+ * Recursion stops when the visible part of the portal, as clipped by
+ * all the outer portals, covers less than portal_min_area pixels, or
+ * when this frame already used portal_budget passes.  The graph is
+ * built breadth-first, so an exhausted budget cuts the deepest levels
+ * first, and every portal on screen gets its view before any portal
+ * inside of them.
+ */
+int build_portal_graph(const portal_level* root, int depth, int rec) {
+  int first = add_portal_node(root, depth, rec);
+  for (int n = first; n != -1 && n < portal_graph_size; n++) {
+    portal_node* node = &portal_graph[n];
+    if (node->rec + 1 >= portal_max_depth)
+      continue;
+    // Textured portals are drawn as they are, see draw_portal_textures()
+    if (portal_mode == PORTAL_TEXTURE && node->rec == 1)
+      continue;
+    node->first_child = portal_graph_size;
+    for (int k = 0; k < node->nb_visible; k++) {
+      int i = portal_visible[node->first_visible + k];
+      // Important: don't look through the portal we are coming out
+      // of, we only see its back (and with two portals, only the
+      // outer portal remains, seen from the other one).
+      if (node->level.portal != -1 && i == portal_links[node->level.portal])
+	continue;
+      if (portal_passes >= portal_budget)
+	break;
+      portal_level level;
+      init_level(&level, portal_view(node->level.view, &portals[i], &portals[portal_links[i]]), i);
+      // if basic clipping returns an empty rectangle, we can stop here
+      if (!clip_portal(&node->level, &portals[i], &level.scissor))
+	continue;
+      // same if the portal is too small to make a visible difference
+      if (level.scissor.w * level.scissor.h < portal_min_area)
+	continue;
+      if (add_portal_node(&level, node->depth + 1, node->rec + 1) == -1)
+	break;
+      node->nb_children++;
+      portal_passes++;
+      portal_deepest = max(portal_deepest, node->depth + 1);
     }
   }
-  
-  //cout << scissor->x << "," << scissor->y << "," << scissor->w << "," << scissor->h << endl;
-  //cout << endl;
-  return true;
+  return first;
 }
 
 /**
  * Draw the active portals contents
  */
-void draw_portals(vector<glm::mat4> view_stack, int rec, int outer_portal) {
-  //if (rec >= 2) return;
-  // TODO: replace rec with size threshold for MV * portal.bbox ?
-
+void draw_portals(const portal_node* node) {
   GLboolean save_stencil_test;
   glGetBooleanv(GL_STENCIL_TEST, &save_stencil_test);
 
   glEnable(GL_STENCIL_TEST);
   glEnable(GL_SCISSOR_TEST);
-  for (int i = 0; i < 2; i++) {
-    // Important: don't draw outer_portal's outgoing portal - only
-    // draw the same portal when displaying a sub-portal (seen from
-    // the other portal).
-    if (outer_portal == -1 || i == outer_portal) {
-      glm::mat4 portal_cam = portal_view(view_stack.back(), &portals[i], &portals[(i+1)%2]);
-      view_stack.push_back(portal_cam);
-      // draw_portal_stencil(view_stack, &portals[i]);
-      draw_scene(view_stack, rec + 1, i);
-      view_stack.pop_back();
-      glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack.back()));
-      glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(glm::inverse(view_stack.back())));
-      // TODO: write something without lines, I don't have confidence in its interaction with the stencil buffer
-      //glLineWidth(1);
-    }
+  for (int child = node->first_child; child < node->first_child + node->nb_children; child++) {
+    draw_scene(child);
+    portal_top = node->depth;
+    set_view(&portal_stack[portal_top]);
+    // TODO: write something without lines, I don't have confidence in its interaction with the stencil buffer
+    //glLineWidth(1);
   }
   if (!save_stencil_test) {
     glDisable(GL_STENCIL_TEST);
@@ -1051,97 +1563,303 @@ void draw_portals(vector<glm::mat4> view_stack, int rec, int outer_portal) {
   glGetBooleanv(GL_DEPTH_WRITEMASK, &save_depth_mask);
   glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
   glDepthMask(GL_TRUE);
-  for (int i = 0; i < 2; i++)
-    portals[i].draw();
+  for (int k = 0; k < node->nb_visible; k++)
+    portals[portal_visible[node->first_visible + k]].draw();
   glColorMask(save_color_mask[0], save_color_mask[1], save_color_mask[2], save_color_mask[3]);
   glDepthMask(save_depth_mask);
 }
 
-void draw_scene(vector<glm::mat4> view_stack, int rec, int outer_portal = -1) {
-  if (rec >= 5) {
-    //draw_portal_stencil(view_stack, &portals[outer_portal]);
-    //draw_mesh(&portals[(outer_portal+1)%2]);
-    return;
-  }
-  rect scissor;
-  if (outer_portal != -1) {
-    // if basic clipping returns an empty rectangle, we can stop here
-    if (!clip_portal(view_stack, &portals[outer_portal], &scissor))
-      return;
+/**
+ * Draw the portals with their cached texture, seen from the current
+ * view, and leave them in the depth buffer like draw_portals().
+ */
+void draw_portal_textures(const portal_node* node) {
+  glm::mat4 v = portal_stack[portal_top].view;
+  glUseProgram(program_portal);
+  glUniformMatrix4fv(uniform_portal_v, 1, GL_FALSE, glm::value_ptr(v));
+  glUniformMatrix4fv(uniform_portal_p, 1, GL_FALSE, glm::value_ptr(projection));
+  glUniform1i(uniform_portal_texture, 0);
+  glActiveTexture(GL_TEXTURE0);
+  for (int k = 0; k < node->nb_visible; k++) {
+    int i = portal_visible[node->first_visible + k];
+    portal_cache* cache = &portal_caches[i];
+    // never rendered because never visible, nothing to show either
+    if (!cache->valid)
+      continue;
+    glm::mat4 cached_vp = projection * cache->view;
+    glUniformMatrix4fv(uniform_portal_m, 1, GL_FALSE, glm::value_ptr(portals[i].object2world));
+    glUniformMatrix4fv(uniform_portal_cached_vp, 1, GL_FALSE, glm::value_ptr(cached_vp));
+    glBindTexture(GL_TEXTURE_2D, cache->texture);
+    portals[i].draw_coords(attribute_portal_v_coord);
   }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glUseProgram(program);
+}
+
+/**
+ * Draw the scene as seen from a node of the draw-order graph, after
+ * the views through its portals.
+ */
+void draw_scene(int n) {
+  const portal_node* node = &portal_graph[n];
+  portal_top = node->depth;
+  portal_stack[portal_top] = node->level;
+  const rect& scissor = node->level.scissor;
+  bool texture_level = (portal_top == portal_texture_level);
 
   // Set view matrix
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack.back()));
-  glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(glm::inverse(view_stack.back())));
+  set_view(&portal_stack[portal_top]);
 
   glClear(GL_DEPTH_BUFFER_BIT);
 
   // Draw portals contents
-  draw_portals(view_stack, rec, outer_portal);
+  if (portal_mode == PORTAL_TEXTURE && node->rec == 1)
+    draw_portal_textures(node);
+  else
+    draw_portals(node);
 
-  if (outer_portal != -1) {
+  if (node->level.portal != -1 && !texture_level) {
     // clip the current view as much as possible, more efficient than
     // using the stencil buffer
     glScissor(scissor.x, scissor.y, scissor.w, scissor.h);
 
     // draw the current stencil - or actually recreate it if we just
     // drew a sub-portal and hence messed the stencil buffer
-    draw_portal_stencil(view_stack, &portals[outer_portal]);
+    draw_portal_stencil();
   }
   
   // Draw portals frames after the stencil buffer is set
-  for (int i = 0; i < 2; i++) {
-    draw_portal_bbox(&portals[i]);
+  for (int k = 0; k < node->nb_visible; k++) {
+    draw_portal_bbox(&portals[portal_visible[node->first_visible + k]]);
     //portals[i].draw_bbox();
   }
   
   /* Draw scene */
   //light_bbox.draw_bbox();
-  main_object.draw();
+  int lod = 0;
+  if (lod_enabled)
+    lod = main_object.select_lod(node->level.view, lod_viewport_height,
+				 lod_max_error * pow(lod_portal_bias, node->depth));
+  main_object.draw(lod);
   ground.draw();
   //portals[0].draw();
 
-  // Restore view matrix
-  view_stack.pop_back();
-  if (view_stack.size() > 0) {
-    glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack.back()));
-    glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(glm::inverse(view_stack.back())));
-  }
-
   // glutSwapBuffers();
   // cout << "rec=" << rec << endl;
   // sleep(2);
 }
 
+/**
+ * How much the camera moved since the portal texture was rendered,
+ * relative to the thresholds: >= 1 means it is time to refresh it.
+ */
+float portal_cache_error(portal_cache* cache, const glm::mat4& view) {
+  if (!cache->valid || cache->object2world != main_object.object2world)
+    return INFINITY;
+  // camera movement, in the cached camera coordinates
+  glm::mat4 delta = view * glm::inverse(cache->view);
+  float move = glm::length(glm::vec3(delta[3]));
+  float cos_angle = (delta[0][0] + delta[1][1] + delta[2][2] - 1) / 2;
+  float angle = glm::degrees(acos(max(-1.0f, min(1.0f, cos_angle))));
+  float error = max(move / portal_cache_max_move, angle / portal_cache_max_angle);
+  if (cache->age >= portal_cache_max_age)
+    error = max(error, 1.0f);
+  return error;
+}
+
+/**
+ * Render what portal i shows from the camera into its texture, nested
+ * portals included (those use the stencil buffer as usual).
+ */
+void render_portal_texture(int i) {
+  portal_cache* cache = &portal_caches[i];
+  if (cache->fbo == 0)
+    create_portal_cache(cache);
+  glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+  glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
+
+  // the view through the portal covers the whole texture, no clipping
+  portal_level level;
+  init_level(&level, portal_view(portal_stack[0].view, &portals[i], &portals[portal_links[i]]), i);
+  if (portal_passes < portal_budget) {
+    int n = build_portal_graph(&level, 1, 2);
+    if (n != -1) {
+      portal_passes++;
+      portal_deepest = max(portal_deepest, 1);
+      portal_texture_level = 1;
+      draw_scene(n);
+      portal_texture_level = -1;
+    }
+  }
+  portal_top = 0;
+  set_view(&portal_stack[portal_top]);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  cache->view = portal_stack[0].view;
+  cache->object2world = main_object.object2world;
+  cache->age = 0;
+  cache->valid = true;
+  portal_refreshes++;
+}
+
+/**
+ * Refresh the portal textures that are out of date: only the worst
+ * one per frame, to spread the cost, unless another one is way off
+ * (e.g. after going through a portal).  Portals that are not on
+ * screen (in the camera node of the graph) are left alone.
+ */
+void update_portal_textures(const portal_node* camera) {
+  float errors[MAX_PORTALS];
+  bool visible[MAX_PORTALS];
+  int worst = -1;
+  for (int i = 0; i < nb_portals; i++) {
+    portal_caches[i].age++;
+    visible[i] = false;
+  }
+  for (int k = 0; k < camera->nb_visible; k++) {
+    int i = portal_visible[camera->first_visible + k];
+    errors[i] = portal_cache_error(&portal_caches[i], portal_stack[0].view);
+    rect scissor;
+    visible[i] = clip_portal(&portal_stack[0], &portals[i], &scissor) && scissor.w * scissor.h >= portal_min_area;
+    if (visible[i] && errors[i] >= 1 && (worst == -1 || errors[i] > errors[worst]))
+      worst = i;
+  }
+  for (int i = 0; i < nb_portals; i++)
+    if (visible[i] && (i == worst || errors[i] >= 4))
+      render_portal_texture(i);
+}
+
 void draw() {
   glClearColor(0.45, 0.45, 0.45, 1.0);
   glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
 
   glUseProgram(program);
 
-  vector<glm::mat4> view_stack;
-  view_stack.push_back(transforms[MODE_CAMERA]);
+  portal_top = -1;
+  push_view(transforms[MODE_CAMERA]);
 
-  glViewport(0, 0, screen_width, screen_height);
-  draw_scene(view_stack, 1);
-
-  glViewport(2*screen_width/3, 0, screen_width/3, screen_height/3);
-  glClear(GL_DEPTH_BUFFER_BIT);
-  view_stack.clear();
-  view_stack.push_back(glm::lookAt(
+  // Overview first, so that it always fits in the graph
+  portal_graph_size = 0;
+  portal_visible_size = 0;
+  portal_level level;
+  init_level(&level, glm::lookAt(
     glm::vec3(0.0,  9.0,-2.0),   // eye
     glm::vec3(0.0,  0.0,-2.0),   // direction
     glm::vec3(0.0,  0.0,-1.0))   // up
   );
-  draw_scene(view_stack, 4);
+  // no portal contents
+  int overview = build_portal_graph(&level, 0, portal_max_depth - 1);
+
+  portal_passes = 0;
+  portal_deepest = 0;
+  glViewport(0, 0, screen_width, screen_height);
+  lod_viewport_height = screen_height;
+  int camera = build_portal_graph(&portal_stack[0], 0, 1);
+  if (portal_mode == PORTAL_TEXTURE)
+    update_portal_textures(&portal_graph[camera]);
+  draw_scene(camera);
+  frame_passes_total += portal_passes;
+  frame_deepest = max(frame_deepest, portal_deepest);
+
+  glViewport(2*screen_width/3, 0, screen_width/3, screen_height/3);
+  lod_viewport_height = screen_height/3;
+  glClear(GL_DEPTH_BUFFER_BIT);
+  draw_scene(overview);
   draw_camera();
 }
 
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * Called after each frame in --bench mode: time BENCH_FRAMES frames
+ * with each configuration in turn, then quit.
+ */
+void bench_step(double frame_time, unsigned long frame_allocs) {
+  static double total, worst;
+  static unsigned int passes;
+  static unsigned long allocs, uploads, skipped;
+  static unsigned int refreshes;
+  static unsigned long buffers, triangles;
+  static int deepest;
+
+  bench_frame++;
+  if (bench_frame > BENCH_WARMUP) {
+    total += frame_time;
+    allocs += frame_allocs;
+    worst = max(worst, frame_time);
+    passes += portal_passes;
+    deepest = max(deepest, portal_deepest);
+  } else {
+    uploads = uniforms.uploads;
+    skipped = uniforms.skipped;
+    refreshes = portal_refreshes;
+    buffers = gl_buffers_created;
+    triangles = triangles_drawn;
+  }
+  if (bench_frame < BENCH_WARMUP + BENCH_FRAMES) {
+    // Look left and right, 25 frames each way
+    float turn = bench_configs[bench_config_idx].turn;
+    if (turn != 0) {
+      if ((bench_frame / 25) % 2)
+	turn = -turn;
+      transforms[MODE_CAMERA] = glm::rotate(glm::mat4(1), glm::radians(turn), glm::vec3(0, 1, 0))
+	* transforms[MODE_CAMERA];
+    }
+    return;
+  }
+
+  if (bench_config_idx >= 0)
+    printf("%-26s %8.3f ms/frame (max %7.3f)  %6.1f portal passes  %2d levels  %6lu allocations/frame"
+           "  %5lu uniform uploads/frame (%lu skipped)  %4.2f textures refreshed/frame  %lu buffers created"
+           "  %7lu triangles/frame\n",
+           bench_configs[bench_config_idx].name, total / BENCH_FRAMES, worst,
+           1.0 * passes / BENCH_FRAMES, deepest, allocs / BENCH_FRAMES,
+           (uniforms.uploads - uploads) / BENCH_FRAMES, (uniforms.skipped - skipped) / BENCH_FRAMES,
+           1.0 * (portal_refreshes - refreshes) / BENCH_FRAMES, gl_buffers_created - buffers,
+           (triangles_drawn - triangles) / BENCH_FRAMES);
+
+  bench_config_idx++;
+  if (bench_config_idx == sizeof(bench_configs)/sizeof(bench_configs[0])) {
+    glutLeaveMainLoop();
+    return;
+  }
+  portal_max_depth = bench_configs[bench_config_idx].max_depth;
+  portal_min_area = bench_configs[bench_config_idx].min_area;
+  portal_budget = bench_configs[bench_config_idx].budget;
+  portal_mode = bench_configs[bench_config_idx].mode;
+  lod_enabled = bench_configs[bench_config_idx].lod;
+  if (bench_configs[bench_config_idx].pairs > 0)
+    generate_portal_scene(bench_configs[bench_config_idx].pairs);
+  else
+    set_portal_layout(true);
+  init_view();
+  bench_frame = 0;
+  total = worst = 0;
+  passes = 0;
+  allocs = 0;
+  deepest = 0;
+}
+
 void onDisplay()
 {
   logic();
+  double start = now_ms();
+  unsigned long allocs = alloc_count;
   draw();
+  allocs = alloc_count - allocs;
+  frame_allocs_total += allocs;
+  if (bench_mode)
+    glFinish();  // include GPU time
+  double frame_time = now_ms() - start;
+  frame_time_total += frame_time;
+  frame_time_max = max(frame_time_max, frame_time);
   glutSwapBuffers();
+  if (bench_mode)
+    bench_step(frame_time, allocs);
 }
 
 void onMouse(int button, int state, int x, int y) {
@@ -1165,13 +1883,18 @@ void onReshape(int width, int height) {
   screen_width = width;
   screen_height = height;
   glViewport(0, 0, screen_width, screen_height);
-  create_portal(&portals[0], screen_width, screen_height, zNear, fovy);
-  create_portal(&portals[1], screen_width, screen_height, zNear, fovy);
+  for (int i = 0; i < MAX_PORTALS; i++)
+    create_portal(&portals[i], screen_width, screen_height, zNear, fovy);
+  update_portal_bvh();
+  create_portal_caches();
 }
 
 void free_resources()
 {
   glDeleteProgram(program);
+  glDeleteProgram(program_portal);
+  free_portal_caches();
+  free_geometry_pool();
 }
 
 
@@ -1193,11 +1916,21 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  if (argc > 1 && string(argv[1]) == "--bench") {
+    // Facing portals, starting the first configuration right away
+    bench_mode = true;
+    portals_facing = true;
+    bench_frame = BENCH_WARMUP + BENCH_FRAMES;
+    argv[1] = argv[0];
+    argc--;
+    argv++;
+  }
+
   char* obj_filename = (char*) "cube.obj";
   char* v_shader_filename = (char*) "phong-shading.v.glsl";
   char* f_shader_filename = (char*) "phong-shading.f.glsl";
   if (argc != 4) {
-    fprintf(stderr, "Usage: %s model.obj vertex_shader.v.glsl fragment_shader.f.glsl\n", argv[0]);
+    fprintf(stderr, "Usage: %s [--bench] model.obj vertex_shader.v.glsl fragment_shader.f.glsl\n", argv[0]);
   } else {
     obj_filename = argv[1];
     v_shader_filename = argv[2];
@@ -1209,6 +1942,7 @@ int main(int argc, char* argv[]) {
     glutDisplayFunc(onDisplay);
     glutSpecialFunc(onSpecial);
     glutSpecialUpFunc(onSpecialUp);
+    glutKeyboardFunc(onKeyboard);
     glutMouseFunc(onMouse);
     glutMotionFunc(onMotion);
     glutReshapeFunc(onReshape);
@@ -0,0 +1,13 @@
+/**
+ * This file is in the public domain.
+ */
+uniform sampler2D portal_texture;
+varying vec4 cached_position;
+
+void main()
+{
+  // Where this point of the portal was on screen when the texture was
+  // rendered; identical to gl_FragCoord if the camera didn't move since.
+  vec2 texcoord = cached_position.xy / cached_position.w * 0.5 + 0.5;
+  gl_FragColor = texture2D(portal_texture, texcoord);
+}
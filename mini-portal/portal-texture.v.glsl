@@ -0,0 +1,14 @@
+/**
+ * This file is in the public domain.
+ */
+attribute vec4 v_coord;
+uniform mat4 m, v, p;
+// projection * view of the camera when the portal texture was rendered
+uniform mat4 cached_vp;
+varying vec4 cached_position;
+
+void main()
+{
+  cached_position = cached_vp * m * v_coord;
+  gl_Position = p * v * m * v_coord;
+}
@@ -0,0 +1,224 @@
+/**
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef PORTAL_BVH_H
+#define PORTAL_BVH_H
+
+/*
+ * Bounding volume hierarchy over the portals, for the two questions
+ * asked every frame: which portal did the camera go through (first
+ * hit along its movement), and which portals can a view see (frustum
+ * culling).  Everything lives in fixed-size arrays, nothing is
+ * allocated, and there are no GL calls, like portal_clip.h.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#define MAX_PORTALS 64
+
+/* Front face of a portal in world coordinates: p0 + u*e1 + v*e2, u,v in [0,1] */
+struct portal_quad {
+  glm::vec3 p0, e1, e2;
+};
+
+struct bvh_node {
+  glm::vec3 min, max;
+  int right;         // inner nodes: second child, the first one is the next node
+  int first, count;  // leaves: range in portal_bvh::order; count == 0 for inner nodes
+};
+
+struct portal_bvh {
+  bvh_node nodes[2*MAX_PORTALS];
+  int order[MAX_PORTALS];
+  int nb_nodes;
+  glm::vec3 box_min[MAX_PORTALS], box_max[MAX_PORTALS];  // of each portal, for the leaves
+};
+
+/* Leaves hold at most this many portals */
+#define BVH_LEAF_SIZE 2
+
+/**
+ * Möller-Trumbore, for a parallelogram instead of a triangle: does the
+ * segment [a,b] cross the quad?  t is where, from 0 (a) to 1 (b).
+ * Both sides count.
+ */
+static bool segment_quad(const glm::vec3& a, const glm::vec3& b, const portal_quad& q, float* t) {
+  const float eps = 1e-6;
+  glm::vec3 dir = b - a;
+  glm::vec3 pvec = glm::cross(dir, q.e2);
+  float det = glm::dot(q.e1, pvec);
+  if (fabs(det) < 1e-12)
+    return false;  // parallel, or not moving
+  float inv_det = 1 / det;
+  glm::vec3 tvec = a - q.p0;
+  float u = glm::dot(tvec, pvec) * inv_det;
+  if (u < 0-eps || u > 1+eps)
+    return false;
+  glm::vec3 qvec = glm::cross(tvec, q.e1);
+  float v = glm::dot(dir, qvec) * inv_det;
+  if (v < 0-eps || v > 1+eps)
+    return false;
+  *t = glm::dot(q.e2, qvec) * inv_det;
+  return *t >= 0-eps && *t <= 1+eps;
+}
+
+/**
+ * Does the segment [a,b] go through the box?  (slab test)
+ */
+static bool segment_box(const glm::vec3& a, const glm::vec3& b, const glm::vec3& min, const glm::vec3& max) {
+  float t0 = 0, t1 = 1;
+  for (int k = 0; k < 3; k++) {
+    float d = b[k] - a[k];
+    if (fabs(d) < 1e-12) {
+      if (a[k] < min[k] || a[k] > max[k])
+	return false;
+      continue;
+    }
+    float ta = (min[k] - a[k]) / d;
+    float tb = (max[k] - a[k]) / d;
+    if (ta > tb)
+      std::swap(ta, tb);
+    t0 = (ta > t0) ? ta : t0;
+    t1 = (tb < t1) ? tb : t1;
+    if (t0 > t1)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Is the box at least partly on the inside of all the planes?
+ * (inside when dot(plane, p) >= 0; conservative near the corners)
+ */
+static bool box_in_planes(const glm::vec3& min, const glm::vec3& max, const glm::vec4* planes, int nb_planes) {
+  for (int i = 0; i < nb_planes; i++) {
+    // corner of the box the furthest along the plane normal
+    glm::vec4 p(planes[i].x >= 0 ? max.x : min.x,
+		planes[i].y >= 0 ? max.y : min.y,
+		planes[i].z >= 0 ? max.z : min.z,
+		1);
+    if (glm::dot(planes[i], p) < 0)
+      return false;
+  }
+  return true;
+}
+
+static int bvh_build_node(portal_bvh* bvh, const glm::vec3* box_min, const glm::vec3* box_max, int first, int count) {
+  int n = bvh->nb_nodes++;
+  bvh_node* node = &bvh->nodes[n];
+  node->min = box_min[bvh->order[first]];
+  node->max = box_max[bvh->order[first]];
+  glm::vec3 cmin = (node->min + node->max) * 0.5f, cmax = cmin;
+  for (int i = first + 1; i < first + count; i++) {
+    int p = bvh->order[i];
+    node->min = glm::min(node->min, box_min[p]);
+    node->max = glm::max(node->max, box_max[p]);
+    glm::vec3 c = (box_min[p] + box_max[p]) * 0.5f;
+    cmin = glm::min(cmin, c);
+    cmax = glm::max(cmax, c);
+  }
+  if (count <= BVH_LEAF_SIZE) {
+    node->first = first;
+    node->count = count;
+    node->right = -1;
+    return n;
+  }
+
+  // Split in the middle, in number of portals, along the axis where
+  // their centers are the most spread
+  glm::vec3 extent = cmax - cmin;
+  int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+  int* begin = bvh->order + first;
+  std::nth_element(begin, begin + count/2, begin + count,
+		   [&](int a, int b) { return box_min[a][axis] + box_max[a][axis]
+				         < box_min[b][axis] + box_max[b][axis]; });
+  node->first = first;
+  node->count = 0;
+  bvh_build_node(bvh, box_min, box_max, first, count/2);
+  int right = bvh_build_node(bvh, box_min, box_max, first + count/2, count - count/2);
+  bvh->nodes[n].right = right;
+  return n;
+}
+
+/**
+ * Build the hierarchy over n <= MAX_PORTALS portals, given their
+ * world-space bounding boxes.
+ */
+static void bvh_build(portal_bvh* bvh, const glm::vec3* box_min, const glm::vec3* box_max, int n) {
+  bvh->nb_nodes = 0;
+  for (int i = 0; i < n; i++) {
+    bvh->order[i] = i;
+    bvh->box_min[i] = box_min[i];
+    bvh->box_max[i] = box_max[i];
+  }
+  if (n > 0)
+    bvh_build_node(bvh, box_min, box_max, 0, n);
+}
+
+/**
+ * First portal crossed by the segment [a,b], or -1; ignore is a portal
+ * to leave out (e.g. the one we just came out of).
+ */
+static int bvh_first_hit(const portal_bvh* bvh, const portal_quad* quads,
+			 const glm::vec3& a, const glm::vec3& b, int ignore, float* t_hit) {
+  int stack[2*MAX_PORTALS];
+  int top = 0;
+  int hit = -1;
+  float t_min = 2;
+  if (bvh->nb_nodes > 0)
+    stack[top++] = 0;
+  while (top > 0) {
+    const bvh_node* node = &bvh->nodes[stack[--top]];
+    if (!segment_box(a, b, node->min, node->max))
+      continue;
+    if (node->count == 0) {
+      stack[top++] = node->right;
+      stack[top++] = node - bvh->nodes + 1;
+      continue;
+    }
+    for (int i = node->first; i < node->first + node->count; i++) {
+      int p = bvh->order[i];
+      float t;
+      if (p != ignore && segment_quad(a, b, quads[p], &t) && t < t_min) {
+	t_min = t;
+	hit = p;
+      }
+    }
+  }
+  *t_hit = t_min;
+  return hit;
+}
+
+/**
+ * Portals whose bounding box is at least partly inside the planes,
+ * by increasing index; returns how many were written to out.
+ */
+static int bvh_cull(const portal_bvh* bvh, const glm::vec4* planes, int nb_planes, int* out) {
+  int stack[2*MAX_PORTALS];
+  int top = 0;
+  int nb_out = 0;
+  if (bvh->nb_nodes > 0)
+    stack[top++] = 0;
+  while (top > 0) {
+    const bvh_node* node = &bvh->nodes[stack[--top]];
+    if (!box_in_planes(node->min, node->max, planes, nb_planes))
+      continue;
+    if (node->count == 0) {
+      stack[top++] = node->right;
+      stack[top++] = node - bvh->nodes + 1;
+      continue;
+    }
+    for (int i = node->first; i < node->first + node->count; i++) {
+      int p = bvh->order[i];
+      if (node->count == 1 || box_in_planes(bvh->box_min[p], bvh->box_max[p], planes, nb_planes))
+	out[nb_out++] = p;
+    }
+  }
+  std::sort(out, out + nb_out);
+  return nb_out;
+}
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef PORTAL_CLIP_H
+#define PORTAL_CLIP_H
+
+/*
+ * Screen-space bounds of a portal, for the scissor test.
+ *
+ * Projecting the portal corners and taking their bounding box only
+ * works when they are all in front of the camera: a point behind the
+ * camera (w < 0) projects mirrored, on the wrong side of the screen.
+ * So the portal triangles are clipped against the view frustum in
+ * homogeneous coordinates first (Sutherland-Hodgman), and only what
+ * remains, which is in front of the near plane, is projected.
+ *
+ * No GL calls here, so that it can be tested on its own, see tests/.
+ */
+
+#include <math.h>
+#include <glm/glm.hpp>
+
+struct rect { int x,y,w,h; };
+
+/* Frustum planes in clip coordinates: inside when dot(plane, p) >= 0 */
+static const glm::vec4 frustum_planes[] = {
+  glm::vec4( 1,  0,  0, 1),  // left:   x >= -w
+  glm::vec4(-1,  0,  0, 1),  // right:  x <=  w
+  glm::vec4( 0,  1,  0, 1),  // bottom: y >= -w
+  glm::vec4( 0, -1,  0, 1),  // top:    y <=  w
+  glm::vec4( 0,  0,  1, 1),  // near:   z >= -w
+  glm::vec4( 0,  0, -1, 1),  // far:    z <=  w
+};
+
+/* A triangle gains at most one vertex per plane */
+#define CLIP_MAX_VERTICES (3 + sizeof(frustum_planes)/sizeof(frustum_planes[0]))
+
+/**
+ * Clip the convex polygon in[0..n-1] against a plane; returns the
+ * number of vertices written to out.
+ */
+static int clip_polygon(const glm::vec4* in, int n, const glm::vec4& plane, glm::vec4* out) {
+  int nb_out = 0;
+  for (int i = 0; i < n; i++) {
+    const glm::vec4& a = in[i];
+    const glm::vec4& b = in[(i+1) % n];
+    float da = glm::dot(plane, a);
+    float db = glm::dot(plane, b);
+    if (da >= 0)
+      out[nb_out++] = a;
+    if ((da >= 0) != (db >= 0))
+      out[nb_out++] = a + (b - a) * (da / (da - db));
+  }
+  return nb_out;
+}
+
+/**
+ * Pixel rectangle covered by the visible part of a triangle mesh.
+ * Returns false if no part of it is in the view frustum.
+ */
+static bool screen_rect(const glm::mat4& mvp, const glm::vec4* vertices,
+			const unsigned int* elements, int nb_elements,
+			int screen_width, int screen_height, rect* r) {
+  float min_x = 1, max_x = -1, min_y = 1, max_y = -1;
+  bool visible = false;
+  glm::vec4 poly[CLIP_MAX_VERTICES], tmp[CLIP_MAX_VERTICES];
+
+  for (int t = 0; t + 2 < nb_elements; t += 3) {
+    int n = 3;
+    for (int k = 0; k < 3; k++)
+      poly[k] = mvp * vertices[elements[t+k]];
+    for (unsigned int p = 0; p < sizeof(frustum_planes)/sizeof(frustum_planes[0]) && n > 0; p++) {
+      n = clip_polygon(poly, n, frustum_planes[p], tmp);
+      for (int k = 0; k < n; k++)
+	poly[k] = tmp[k];
+    }
+    for (int k = 0; k < n; k++) {
+      // w >= zNear > 0 after the near plane
+      float x = poly[k].x / poly[k].w;
+      float y = poly[k].y / poly[k].w;
+      min_x = fmin(min_x, x);  max_x = fmax(max_x, x);
+      min_y = fmin(min_y, y);  max_y = fmax(max_y, y);
+      visible = true;
+    }
+  }
+  if (!visible)
+    return false;
+
+  // Round outwards, the scissor must not cut into the portal
+  int x0 = floor((fmax(-1.0f, min_x) + 1) / 2 * screen_width);
+  int x1 = ceil ((fmin( 1.0f, max_x) + 1) / 2 * screen_width);
+  int y0 = floor((fmax(-1.0f, min_y) + 1) / 2 * screen_height);
+  int y1 = ceil ((fmin( 1.0f, max_y) + 1) / 2 * screen_height);
+  r->x = x0;
+  r->y = y0;
+  r->w = x1 - x0;
+  r->h = y1 - y0;
+  return true;
+}
+
+/**
+ * Restrict r to its intersection with other; returns false if it is
+ * empty.
+ */
+static bool intersect_rect(rect* r, const rect& other) {
+  int x0 = (r->x > other.x) ? r->x : other.x;
+  int x1 = (r->x + r->w < other.x + other.w) ? r->x + r->w : other.x + other.w;
+  int y0 = (r->y > other.y) ? r->y : other.y;
+  int y1 = (r->y + r->h < other.y + other.h) ? r->y + r->h : other.y + other.h;
+  r->x = x0;
+  r->y = y0;
+  r->w = x1 - x0;
+  r->h = y1 - y0;
+  return r->w > 0 && r->h > 0;
+}
+
+#endif
@@ -0,0 +1,212 @@
+/**
+ * This file is in the public domain.
+ *
+ * CPU test of the portal hierarchy, see portal_bvh.h: swept crossing
+ * of a portal, and frustum culling against brute force.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../portal_bvh.h"
+#include "../../common/test_check.h"
+
+/* The [-1,1] square in the z=z0 plane, as update_portal_bvh() makes it */
+static portal_quad square(float z0) {
+  portal_quad q = { glm::vec3(-1, -1, z0), glm::vec3(2, 0, 0), glm::vec3(0, 2, 0) };
+  return q;
+}
+
+static bool crosses(const portal_quad& q, glm::vec3 a, glm::vec3 b) {
+  float t;
+  return segment_quad(a, b, q, &t);
+}
+
+static void test_segment_quad() {
+  portal_quad q = square(0);
+  float t = -1;
+  check("quad: through the center", segment_quad(glm::vec3(0, 0, 1), glm::vec3(0, 0, -3), q, &t)
+	&& fabs(t - 0.25) < 1e-6);
+  check("quad: from behind", crosses(q, glm::vec3(0.5, 0.5, -1), glm::vec3(0.5, 0.5, 1)));
+  check("quad: just inside the edges", crosses(q, glm::vec3(0.999, 0, 1), glm::vec3(0.999, 0, -1))
+	&& crosses(q, glm::vec3(-0.999, 0, 1), glm::vec3(-0.999, 0, -1))
+	&& crosses(q, glm::vec3(0, 0.999, 1), glm::vec3(0, 0.999, -1))
+	&& crosses(q, glm::vec3(0, -0.999, 1), glm::vec3(0, -0.999, -1)));
+  check("quad: just outside the edges", !crosses(q, glm::vec3(1.001, 0, 1), glm::vec3(1.001, 0, -1))
+	&& !crosses(q, glm::vec3(-1.001, 0, 1), glm::vec3(-1.001, 0, -1))
+	&& !crosses(q, glm::vec3(0, 1.001, 1), glm::vec3(0, 1.001, -1))
+	&& !crosses(q, glm::vec3(0, -1.001, 1), glm::vec3(0, -1.001, -1)));
+  check("quad: just outside a corner", !crosses(q, glm::vec3(1.001, 1.001, 1), glm::vec3(1.001, 1.001, -1)));
+  check("quad: stopping short", !crosses(q, glm::vec3(0, 0, 1), glm::vec3(0, 0, 0.001)));
+  check("quad: starting past it", !crosses(q, glm::vec3(0, 0, -0.001), glm::vec3(0, 0, -1)));
+  check("quad: ending on it", crosses(q, glm::vec3(0, 0, 1), glm::vec3(0, 0, 0)));
+  check("quad: slanted", crosses(q, glm::vec3(-3, 0, 1), glm::vec3(1, 0, -1)));
+  check("quad: parallel, in front", !crosses(q, glm::vec3(-2, 0, 0.5), glm::vec3(2, 0, 0.5)));
+  check("quad: parallel, in its plane", !crosses(q, glm::vec3(-2, 0, 0), glm::vec3(2, 0, 0)));
+  check("quad: not moving", !crosses(q, glm::vec3(0, 0, 0), glm::vec3(0, 0, 0)));
+}
+
+static void test_segment_box() {
+  glm::vec3 min(-1, -1, -1), max(1, 1, 1);
+  check("box: through", segment_box(glm::vec3(-2, 0, 0), glm::vec3(2, 0, 0), min, max));
+  check("box: inside", segment_box(glm::vec3(0, 0, 0), glm::vec3(0.5, 0, 0), min, max));
+  check("box: near miss", !segment_box(glm::vec3(-2, 1.001, 0), glm::vec3(2, 1.001, 0), min, max));
+  check("box: past a corner", !segment_box(glm::vec3(-2, 0.5, 0), glm::vec3(0.5, 3, 0), min, max));
+  check("box: stopping short", !segment_box(glm::vec3(-3, 0, 0), glm::vec3(-1.001, 0, 0), min, max));
+  check("box: along a face", segment_box(glm::vec3(-2, 1, 0), glm::vec3(2, 1, 0), min, max));
+}
+
+static void test_first_hit() {
+  // Two portals one behind the other, and one off to the side
+  portal_quad quads[3] = { square(0), square(-1), square(0) };
+  quads[2].p0.x += 5;
+  glm::vec3 box_min[3], box_max[3];
+  for (int i = 0; i < 3; i++) {
+    box_min[i] = quads[i].p0;
+    box_max[i] = quads[i].p0 + quads[i].e1 + quads[i].e2;
+  }
+  portal_bvh bvh;
+  bvh_build(&bvh, box_min, box_max, 3);
+
+  float t;
+  int hit = bvh_first_hit(&bvh, quads, glm::vec3(0, 0, 1), glm::vec3(0, 0, -2), -1, &t);
+  check("first hit: nearest of two", hit == 0 && fabs(t - 1/3.0) < 1e-6);
+  hit = bvh_first_hit(&bvh, quads, glm::vec3(0, 0, -2), glm::vec3(0, 0, 1), -1, &t);
+  check("first hit: nearest of two, backwards", hit == 1 && fabs(t - 1/3.0) < 1e-6);
+  hit = bvh_first_hit(&bvh, quads, glm::vec3(0, 0, 1), glm::vec3(0, 0, -2), 0, &t);
+  check("first hit: ignored portal", hit == 1 && fabs(t - 2/3.0) < 1e-6);
+  hit = bvh_first_hit(&bvh, quads, glm::vec3(0, 0, 1), glm::vec3(0, 0, -0.5), 0, &t);
+  check("first hit: only the ignored portal", hit == -1);
+  hit = bvh_first_hit(&bvh, quads, glm::vec3(5, 0, 1), glm::vec3(5, 0, -2), -1, &t);
+  check("first hit: the other one", hit == 2);
+  hit = bvh_first_hit(&bvh, quads, glm::vec3(-3, 0, 0.5), glm::vec3(8, 0, 0.5), -1, &t);
+  check("first hit: parallel movement", hit == -1);
+
+  portal_bvh empty;
+  bvh_build(&empty, box_min, box_max, 0);
+  check("first hit: no portals", bvh_first_hit(&empty, quads, glm::vec3(0, 0, 1), glm::vec3(0, 0, -2), -1, &t) == -1);
+}
+
+/*
+ * The scene of generate_portal_scene(), with the quads and boxes of
+ * update_portal_bvh() for portals made by create_portal() at 800x600,
+ * zNear 0.01 and fovy 45.
+ */
+static int nb_portals;
+static portal_quad quads[MAX_PORTALS];
+static glm::vec3 box_min[MAX_PORTALS], box_max[MAX_PORTALS];
+
+static void generate_portal_scene(int pairs) {
+  nb_portals = 2 * pairs;
+  const float spacing = 2.6;
+  int side = ceil(sqrt(nb_portals));
+  int cells[MAX_PORTALS];
+  for (int i = 0; i < side * side && i < MAX_PORTALS; i++)
+    cells[i] = i;
+  srand(pairs);
+  for (int i = std::min(side * side, MAX_PORTALS) - 1; i > 0; i--)
+    std::swap(cells[i], cells[rand() % (i + 1)]);
+
+  float fovy_rad = 45 * M_PI / 180, fovx_rad = fovy_rad / (800.0 / 600);
+  float dz = std::max(0.01 / cos(fovx_rad), 0.01 / cos(fovy_rad));
+  float dx = tan(fovx_rad) * dz, dy = tan(fovy_rad) * dz;
+  glm::vec4 corners[] = {
+    glm::vec4(-1, -1, 0, 1), glm::vec4(1, -1, 0, 1), glm::vec4(-1, 1, 0, 1), glm::vec4(1, 1, 0, 1),
+    glm::vec4(-(1+dx), -(1+dy), -dz, 1), glm::vec4((1+dx), -(1+dy), -dz, 1),
+    glm::vec4(-(1+dx),  (1+dy), -dz, 1), glm::vec4((1+dx),  (1+dy), -dz, 1),
+    glm::vec4(-1.05, -1.05, 0, 1), glm::vec4(1.05, -1.05, 0, 1),
+    glm::vec4(-1.05,  1.05, 0, 1), glm::vec4(1.05,  1.05, 0, 1),
+  };
+
+  for (int i = 0; i < nb_portals; i++) {
+    float x = (cells[i] % side - (side - 1) / 2.0) * spacing + (rand() % 41 - 20) / 100.0;
+    float z = (cells[i] / side - (side - 1) / 2.0) * spacing + (rand() % 41 - 20) / 100.0;
+    float y = 1 + (rand() % 51) / 100.0;
+    float angle = rand() % 360;
+    glm::mat4 m = glm::translate(glm::mat4(1), glm::vec3(x, y, z))
+      * glm::rotate(glm::mat4(1), glm::radians(angle), glm::vec3(0, 1, 0));
+    quads[i].p0 = glm::vec3(m * corners[0]);
+    quads[i].e1 = glm::vec3(m * corners[1]) - quads[i].p0;
+    quads[i].e2 = glm::vec3(m * corners[2]) - quads[i].p0;
+    box_min[i] = box_max[i] = quads[i].p0;
+    for (unsigned int j = 0; j < sizeof(corners)/sizeof(corners[0]); j++) {
+      glm::vec3 v = glm::vec3(m * corners[j]);
+      box_min[i] = glm::min(box_min[i], v);
+      box_max[i] = glm::max(box_max[i], v);
+    }
+  }
+}
+
+static float frand(float lo, float hi) {
+  return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+/* Frustum planes of a camera, as level_planes() computes them */
+static void camera_planes(glm::vec3 eye, glm::vec3 center, glm::vec4* planes) {
+  glm::mat4 vp = glm::perspective(glm::radians(45.0f), 800.0f/600, 0.01f, 100.0f)
+    * glm::lookAt(eye, center, glm::vec3(0, 1, 0));
+  const glm::vec4 clip_planes[6] = {
+    glm::vec4( 1,  0,  0, 1), glm::vec4(-1,  0,  0, 1),
+    glm::vec4( 0,  1,  0, 1), glm::vec4( 0, -1,  0, 1),
+    glm::vec4( 0,  0,  1, 1), glm::vec4( 0,  0, -1, 1),
+  };
+  glm::mat4 vp_transp = glm::transpose(vp);
+  for (int i = 0; i < 6; i++)
+    planes[i] = vp_transp * clip_planes[i];
+}
+
+/* Random cameras and movements in scenes of 1 to 32 pairs, against testing every portal */
+static void test_scene() {
+  bool cull_ok = true, hit_ok = true;
+  int nb_culled = 0, nb_visible = 0, nb_hits = 0;
+  for (int pairs = 1; pairs <= MAX_PORTALS / 2; pairs++) {
+    generate_portal_scene(pairs);
+    portal_bvh bvh;
+    bvh_build(&bvh, box_min, box_max, nb_portals);
+    float extent = ceil(sqrt(nb_portals)) * 2.6 / 2 + 2;
+
+    for (int n = 0; n < 200; n++) {
+      glm::vec4 planes[6];
+      glm::vec3 eye(frand(-extent, extent), frand(0, 3), frand(-extent, extent));
+      camera_planes(eye, glm::vec3(frand(-extent, extent), frand(0, 2), frand(-extent, extent)), planes);
+      int culled[MAX_PORTALS], expected[MAX_PORTALS];
+      int nb = bvh_cull(&bvh, planes, 6, culled), nb_expected = 0;
+      for (int i = 0; i < nb_portals; i++)
+	if (box_in_planes(box_min[i], box_max[i], planes, 6))
+	  expected[nb_expected++] = i;
+      cull_ok = cull_ok && nb == nb_expected && std::equal(culled, culled + nb, expected);
+      nb_visible += nb;
+      nb_culled += nb_portals - nb;
+
+      // Short steps, as in idle(), and now and then a long jump
+      glm::vec3 a(frand(-extent, extent), frand(0.5, 2.5), frand(-extent, extent));
+      glm::vec3 b = a + glm::vec3(frand(-1, 1), frand(-0.2, 0.2), frand(-1, 1)) * (n % 10 ? 0.5f : 10.0f);
+      int ignore = (n % 3 == 0) ? rand() % nb_portals : -1;
+      float t, t_expected = 2;
+      int hit = bvh_first_hit(&bvh, quads, a, b, ignore, &t), hit_expected = -1;
+      for (int i = 0; i < nb_portals; i++) {
+	float ti;
+	if (i != ignore && segment_quad(a, b, quads[i], &ti) && ti < t_expected) {
+	  t_expected = ti;
+	  hit_expected = i;
+	}
+      }
+      hit_ok = hit_ok && hit == hit_expected && (hit == -1 || t == t_expected);
+      nb_hits += hit != -1;
+    }
+  }
+  check("scene: culling as testing every portal", cull_ok);
+  check("scene: first hit as testing every portal", hit_ok);
+  printf("  %d portals visible, %d culled, %d crossings\n", nb_visible, nb_culled, nb_hits);
+  check("scene: both outcomes exercised", nb_visible > 0 && nb_culled > 0 && nb_hits > 0);
+}
+
+int main() {
+  test_segment_quad();
+  test_segment_box();
+  test_first_hit();
+  test_scene();
+
+  return check_summary();
+}
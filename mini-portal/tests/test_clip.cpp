@@ -0,0 +1,152 @@
+/**
+ * This file is in the public domain.
+ *
+ * CPU test of the portal scissor rectangles, see portal_clip.h.
+ */
+#include <stdio.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../portal_clip.h"
+#include "../../common/test_check.h"
+
+#define W 800
+#define H 600
+
+/* Portal as built by create_portal(): front quad, and a slightly
+   larger one behind it so that it is never cut by the near plane */
+static glm::vec4 portal_vertices[] = {
+  glm::vec4(-1, -1, 0, 1),
+  glm::vec4( 1, -1, 0, 1),
+  glm::vec4(-1,  1, 0, 1),
+  glm::vec4( 1,  1, 0, 1),
+
+  glm::vec4(-1.01, -1.01, -0.01, 1),
+  glm::vec4( 1.01, -1.01, -0.01, 1),
+  glm::vec4(-1.01,  1.01, -0.01, 1),
+  glm::vec4( 1.01,  1.01, -0.01, 1),
+};
+static unsigned int portal_elements[] = {
+  0,1,2, 2,1,3,
+  4,5,6, 6,5,7,
+  0,4,2, 2,4,6,
+  5,1,7, 7,1,3,
+};
+#define NB_ELEMENTS (int)(sizeof(portal_elements)/sizeof(portal_elements[0]))
+
+static glm::mat4 projection() {
+  return glm::perspective(glm::radians(45.0f), 1.0f*W/H, 0.01f, 100.0f);
+}
+
+/**
+ * Reference: cast a ray through each pixel center, from the near plane
+ * to the far plane, and take the bounding box of the pixels that hit
+ * the portal.
+ */
+static bool traced_rect(const glm::mat4& mvp, rect* r) {
+  glm::mat4 inv = glm::inverse(mvp);
+  int min_x = W, max_x = -1, min_y = H, max_y = -1;
+  for (int py = 0; py < H; py++) {
+    for (int px = 0; px < W; px++) {
+      float nx = (px + 0.5f) / W * 2 - 1;
+      float ny = (py + 0.5f) / H * 2 - 1;
+      glm::vec4 n = inv * glm::vec4(nx, ny, -1, 1);
+      glm::vec4 f = inv * glm::vec4(nx, ny,  1, 1);
+      glm::vec3 orig = glm::vec3(n) / n.w;
+      glm::vec3 dir = glm::vec3(f) / f.w - orig;
+      for (int t = 0; t < NB_ELEMENTS; t += 3) {
+	// Moller-Trumbore, with the segment parameter in [0,1]
+	glm::vec3 v0 = glm::vec3(portal_vertices[portal_elements[t]]);
+	glm::vec3 e1 = glm::vec3(portal_vertices[portal_elements[t+1]]) - v0;
+	glm::vec3 e2 = glm::vec3(portal_vertices[portal_elements[t+2]]) - v0;
+	glm::vec3 pv = glm::cross(dir, e2);
+	float det = glm::dot(e1, pv);
+	if (fabs(det) < 1e-12)
+	  continue;
+	glm::vec3 tv = orig - v0;
+	float u = glm::dot(tv, pv) / det;
+	if (u < 0 || u > 1)
+	  continue;
+	glm::vec3 qv = glm::cross(tv, e1);
+	float v = glm::dot(dir, qv) / det;
+	if (v < 0 || u + v > 1)
+	  continue;
+	float d = glm::dot(e2, qv) / det;
+	if (d < 0 || d > 1)
+	  continue;
+	min_x = (px < min_x) ? px : min_x;  max_x = (px > max_x) ? px : max_x;
+	min_y = (py < min_y) ? py : min_y;  max_y = (py > max_y) ? py : max_y;
+	break;
+      }
+    }
+  }
+  r->x = min_x;
+  r->y = min_y;
+  r->w = max_x + 1 - min_x;
+  r->h = max_y + 1 - min_y;
+  return max_x >= 0;
+}
+
+/**
+ * The clipped rectangle must contain the traced one, and not be more
+ * than a pixel larger on each side.
+ */
+static void check_clip(const char* name, glm::vec3 eye, glm::vec3 center, bool expect_visible, bool expect_full_screen) {
+  glm::mat4 mvp = projection() * glm::lookAt(eye, center, glm::vec3(0, 1, 0));
+  rect r = { 0, 0, 0, 0 }, ref = { 0, 0, 0, 0 };
+  bool visible = screen_rect(mvp, portal_vertices, portal_elements, NB_ELEMENTS, W, H, &r);
+  bool ref_visible = traced_rect(mvp, &ref);
+
+  bool ok = (visible == expect_visible) && (ref_visible == expect_visible);
+  if (ok && visible) {
+    ok = r.x <= ref.x && r.y <= ref.y
+      && r.x + r.w >= ref.x + ref.w && r.y + r.h >= ref.y + ref.h
+      && ref.x - r.x <= 1 && ref.y - r.y <= 1
+      && (r.x + r.w) - (ref.x + ref.w) <= 1 && (r.y + r.h) - (ref.y + ref.h) <= 1
+      && r.x >= 0 && r.y >= 0 && r.x + r.w <= W && r.y + r.h <= H;
+    bool full_screen = (r.x == 0 && r.y == 0 && r.w == W && r.h == H);
+    ok = ok && (full_screen == expect_full_screen);
+  }
+
+  check(name, ok);
+  if (visible)
+    printf("  %3d,%3d %3dx%3d", r.x, r.y, r.w, r.h);
+  else
+    printf("  invisible");
+  if (ref_visible)
+    printf("  (traced %3d,%3d %3dx%3d)", ref.x, ref.y, ref.w, ref.h);
+  printf("\n");
+}
+
+static void check_intersection(const char* name, rect a, rect b, bool expect, rect expect_r) {
+  bool res = intersect_rect(&a, b);
+  bool ok = (res == expect);
+  if (ok && res)
+    ok = a.x == expect_r.x && a.y == expect_r.y && a.w == expect_r.w && a.h == expect_r.h;
+  check(name, ok);
+}
+
+int main() {
+  // Camera positions in portal coordinates: the portal is the [-1,1]
+  // square in the z=0 plane, facing +z
+  check_clip("in front",                    glm::vec3( 0.0,  0.0,  3.0), glm::vec3( 0,  0,  0), true, false);
+  check_clip("in front, off-center",        glm::vec3( 2.0,  0.5,  2.0), glm::vec3( 0,  0,  0), true, false);
+  check_clip("straddling, looking sideways", glm::vec3( 0.5,  0.0,  0.2), glm::vec3( 2,  0, -0.6), true, false);
+  check_clip("straddling, looking along",   glm::vec3( 0.0,  0.2,  0.3), glm::vec3(-3,  0,  0.3), true, false);
+  check_clip("straddling, looking down",    glm::vec3( 0.3,  0.5,  0.1), glm::vec3( 0.3, -1, 0.3), true, false);
+  check_clip("in the plane, outside",       glm::vec3( 1.5,  0.0,  0.0), glm::vec3(-1,  0,  0), true, false);
+  check_clip("closer than the near plane",  glm::vec3( 0.0,  0.0,  0.001), glm::vec3( 0, 0, -1), true, true);
+  check_clip("crossed, back within zNear",   glm::vec3( 0.0,  0.0, -0.005), glm::vec3( 0, 0, -1), false, false);
+  check_clip("behind the camera",           glm::vec3( 0.0,  0.0,  1.0), glm::vec3( 0,  0,  2), false, false);
+  check_clip("outside the frustum",         glm::vec3( 0.0,  0.0,  3.0), glm::vec3(10,  0,  3), false, false);
+  check_clip("beyond the far plane",        glm::vec3( 0.0,  0.0,  150), glm::vec3( 0,  0,  0), false, false);
+
+  rect a = { 0, 0, 100, 100 }, b = { 50, 20, 100, 100 }, c = { 200, 0, 10, 10 }, d = { 10, 10, 5, 5 };
+  rect ab = { 50, 20, 50, 80 };
+  check_intersection("intersection, overlapping", a, b, true, ab);
+  check_intersection("intersection, disjoint", a, c, false, a);
+  check_intersection("intersection, nested", a, d, true, d);
+  check_intersection("intersection, touching", a, (rect){ 100, 0, 10, 10 }, false, a);
+
+  return check_summary();
+}
@@ -0,0 +1,207 @@
+/**
+ * This file is in the public domain.
+ *
+ * CPU test of ../../common/mesh_optimizer.cpp on the bundled models:
+ * same triangles after optimization, fewer vertex shader runs, and the
+ * overdraw of the cluster order against the cache order alone, with a
+ * small depth-tested rasterizer from a few points of view.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../../common/obj_loader.h"
+#include "../../common/mesh_optimizer.h"
+#include "../../common/test_check.h"
+
+#define SIZE 256
+
+using namespace std;
+
+/* Triangles as position triples, starting from the smallest vertex so
+   that the winding is kept, in sorted order */
+static vector<glm::vec4> triangle_set(const vector<unsigned int>& elements,
+				      const vector<glm::vec4>& positions) {
+  vector<vector<float> > triangles;
+  for (size_t i = 0; i < elements.size(); i += 3) {
+    vector<float> t;
+    for (int k = 0; k < 3; k++)
+      for (int c = 0; c < 4; c++)
+	t.push_back(positions[elements[i+k]][c]);
+    // rotate so that the smallest corner comes first
+    int first = 0;
+    for (int k = 1; k < 3; k++)
+      if (lexicographical_compare(t.begin() + k*4, t.begin() + k*4 + 4,
+				  t.begin() + first*4, t.begin() + first*4 + 4))
+	first = k;
+    rotate(t.begin(), t.begin() + first*4, t.end());
+    triangles.push_back(t);
+  }
+  sort(triangles.begin(), triangles.end());
+  vector<glm::vec4> res;
+  for (size_t i = 0; i < triangles.size(); i++)
+    for (int k = 0; k < 3; k++)
+      res.push_back(glm::vec4(triangles[i][k*4], triangles[i][k*4+1], triangles[i][k*4+2], triangles[i][k*4+3]));
+  return res;
+}
+
+/**
+ * Fragments that pass the depth test per covered pixel, back faces
+ * culled, orthographic view of the whole mesh along direction
+ */
+static float overdraw(const vector<unsigned int>& elements, const vector<glm::vec4>& positions,
+		      glm::vec3 direction) {
+  glm::vec3 min_p(FLT_MAX), max_p(-FLT_MAX);
+  for (size_t i = 0; i < positions.size(); i++) {
+    min_p = glm::min(min_p, glm::vec3(positions[i]));
+    max_p = glm::max(max_p, glm::vec3(positions[i]));
+  }
+  glm::vec3 center = (min_p + max_p) * 0.5f;
+  float radius = glm::length(max_p - min_p) * 0.5f;
+  glm::vec3 up = fabs(direction.y) > 0.9 ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+  glm::mat4 view = glm::lookAt(center - glm::normalize(direction) * radius * 2.0f, center, up);
+
+  vector<glm::vec3> screen(positions.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+    glm::vec4 p = view * positions[i];
+    screen[i] = glm::vec3((p.x / radius + 1) * 0.5f * SIZE, (p.y / radius + 1) * 0.5f * SIZE, -p.z);
+  }
+
+  vector<float> depth(SIZE * SIZE, FLT_MAX);
+  size_t fragments = 0, covered = 0;
+  for (size_t i = 0; i < elements.size(); i += 3) {
+    glm::vec3 a = screen[elements[i]], b = screen[elements[i+1]], c = screen[elements[i+2]];
+    float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+    if (area <= 0)
+      continue;  // back face
+    int x0 = max(0, (int)floor(min(a.x, min(b.x, c.x)))), x1 = min(SIZE - 1, (int)ceil(max(a.x, max(b.x, c.x))));
+    int y0 = max(0, (int)floor(min(a.y, min(b.y, c.y)))), y1 = min(SIZE - 1, (int)ceil(max(a.y, max(b.y, c.y))));
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+	float px = x + 0.5f, py = y + 0.5f;
+	float wa = (b.x - px) * (c.y - py) - (c.x - px) * (b.y - py);
+	float wb = (c.x - px) * (a.y - py) - (a.x - px) * (c.y - py);
+	float wc = area - wa - wb;
+	if (wa < 0 || wb < 0 || wc < 0)
+	  continue;
+	float z = (wa * a.z + wb * b.z + wc * c.z) / area;
+	float& d = depth[y * SIZE + x];
+	if (z < d) {
+	  if (d == FLT_MAX)
+	    covered++;
+	  d = z;
+	  fragments++;
+	}
+      }
+    }
+  }
+  return covered > 0 ? 1.0f * fragments / covered : 0;
+}
+
+/* Average overdraw from the 6 axes and the 8 diagonals */
+static float average_overdraw(const vector<unsigned int>& elements, const vector<glm::vec4>& positions) {
+  float sum = 0;
+  int n = 0;
+  for (int x = -1; x <= 1; x++)
+    for (int y = -1; y <= 1; y++)
+      for (int z = -1; z <= 1; z++)
+	if (abs(x) + abs(y) + abs(z) == 1 || abs(x) + abs(y) + abs(z) == 3) {
+	  sum += overdraw(elements, positions, glm::vec3(x, y, z));
+	  n++;
+	}
+  return sum / n;
+}
+
+static void test_model(const char* filename) {
+  obj_model model;
+  if (!obj_load(filename, &model)) {
+    check(filename, false);
+    return;
+  }
+  vector<obj_vertex> vertices;
+  vector<unsigned int> elements;
+  obj_index_vertices(&model, &vertices, &elements);
+  vector<glm::vec4> positions(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++)
+    positions[i] = vertices[i].position;
+  printf("%s: %zu vertices, %zu triangles\n", filename, positions.size(), elements.size() / 3);
+
+  // Cache order only, for the overdraw comparison
+  vector<unsigned int> tipsified = elements;
+  mesh_tipsify(tipsified.data(), tipsified.size(), positions.size(), MESH_CACHE_SIZE);
+  mesh_stats tipsify_stats;
+  mesh_cache_stats(tipsified.data(), tipsified.size(), positions.size(), MESH_CACHE_SIZE, &tipsify_stats);
+
+  vector<unsigned int> optimized = elements, remap;
+  vector<glm::vec4> optimized_positions = positions;
+  mesh_stats before, after;
+  mesh_optimize(optimized, positions, &remap, &before, &after);
+  mesh_remap(optimized_positions, remap);
+  printf("  ACMR %.3f -> %.3f (Tipsify alone %.3f), ATVR %.3f -> %.3f\n",
+	 before.acmr, after.acmr, tipsify_stats.acmr, before.atvr, after.atvr);
+
+  vector<bool> seen(remap.size(), false);
+  bool permutation = remap.size() == positions.size();
+  for (size_t i = 0; permutation && i < remap.size(); i++) {
+    permutation = remap[i] < remap.size() && !seen[remap[i]];
+    if (permutation)
+      seen[remap[i]] = true;
+  }
+  check("  remap is a permutation", permutation);
+
+  bool fetch_order = true;
+  unsigned int next = 0;
+  for (size_t i = 0; i < optimized.size(); i++) {
+    if (optimized[i] > next)
+      fetch_order = false;
+    else if (optimized[i] == next)
+      next++;
+  }
+  check("  vertices numbered in the order they are drawn", fetch_order);
+  check("  same triangles, same winding",
+	triangle_set(elements, positions) == triangle_set(optimized, optimized_positions));
+  check("  same triangles after Tipsify alone",
+	triangle_set(elements, positions) == triangle_set(tipsified, positions));
+  check("  ACMR not worse", after.acmr <= before.acmr + 1e-6);
+
+  float overdraw_before = average_overdraw(elements, positions);
+  float overdraw_tipsify = average_overdraw(tipsified, positions);
+  float overdraw_after = average_overdraw(optimized, optimized_positions);
+  printf("  overdraw %.3f in file order, %.3f after Tipsify, %.3f with the clusters sorted\n",
+	 overdraw_before, overdraw_tipsify, overdraw_after);
+  check("  overdraw not worse than Tipsify alone", overdraw_after <= overdraw_tipsify + 1e-6);
+}
+
+int main() {
+  // Vertices 1 and 3 are not used
+  unsigned int elements[] = { 0,2,4, 4,2,5, 0,4,6 };
+  vector<unsigned int> remap;
+  mesh_optimize_vertex_fetch(elements, 9, 7, &remap);
+  check("unused vertices last",
+	remap[0] == 0 && remap[2] == 1 && remap[4] == 2 && remap[5] == 3 && remap[6] == 4
+	&& remap[1] == 5 && remap[3] == 6);
+
+  // Strip of 1000 quads in file order: 2 new vertices per quad at best
+  vector<unsigned int> strip;
+  for (unsigned int i = 0; i < 1000; i++) {
+    unsigned int a = i*2, b = a+1, c = a+2, d = a+3;
+    strip.push_back(a); strip.push_back(b); strip.push_back(c);
+    strip.push_back(c); strip.push_back(b); strip.push_back(d);
+  }
+  mesh_stats stats;
+  mesh_cache_stats(strip.data(), strip.size(), 2002, MESH_CACHE_SIZE, &stats);
+  check("strip: ACMR 1, ATVR 1", fabs(stats.acmr - 2002.0 / 2000) < 1e-4 && fabs(stats.atvr - 1) < 1e-6);
+  mesh_tipsify(strip.data(), strip.size(), 2002, MESH_CACHE_SIZE);
+  mesh_cache_stats(strip.data(), strip.size(), 2002, MESH_CACHE_SIZE, &stats);
+  check("strip: still ATVR 1 after Tipsify", fabs(stats.atvr - 1) < 1e-6);
+
+  test_model("cube.obj");
+  test_model("../post-processing-sdl2/suzanne.obj");
+
+  return check_summary();
+}
@@ -0,0 +1,138 @@
+/**
+ * This file is in the public domain.
+ *
+ * CPU test of ../../common/mesh_simplify.cpp: LOD chains of a flat
+ * grid (no error, no fold) and of the bundled models, and the screen
+ * size used to pick a LOD.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../../common/obj_loader.h"
+#include "../../common/mesh_optimizer.h"
+#include "../../common/mesh_simplify.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+static glm::vec3 normal(const vector<unsigned int>& elements, size_t t, const vector<glm::vec4>& positions) {
+  glm::vec3 a(positions[elements[t*3]]), b(positions[elements[t*3+1]]), c(positions[elements[t*3+2]]);
+  return glm::cross(b - a, c - a);
+}
+
+/* Triangles that lost their area, or that face the other way than z+ */
+static size_t flat_faults(const vector<unsigned int>& elements, const vector<glm::vec4>& positions) {
+  size_t res = 0;
+  for (size_t t = 0; t < elements.size() / 3; t++)
+    if (normal(elements, t, positions).z <= 0)
+      res++;
+  return res;
+}
+
+static void test_grid() {
+  // 32x32 quads in the z=0 plane
+  const int n = 32;
+  vector<glm::vec4> positions;
+  vector<unsigned int> elements;
+  for (int y = 0; y <= n; y++)
+    for (int x = 0; x <= n; x++)
+      positions.push_back(glm::vec4(x, y, 0, 1));
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      unsigned int a = y*(n+1) + x, b = a + 1, c = a + n+1, d = c + 1;
+      elements.push_back(a); elements.push_back(b); elements.push_back(c);
+      elements.push_back(c); elements.push_back(b); elements.push_back(d);
+    }
+  }
+  vector<mesh_lod> lods;
+  mesh_build_lods(elements, positions, 16, &lods);
+  printf("grid: %zu triangles, %zu LODs\n", elements.size() / 3, lods.size());
+  check("grid: some LODs", lods.size() >= 3);
+  bool halves = true, exact = true, no_fold = true;
+  size_t previous = elements.size() / 3;
+  for (size_t i = 0; i < lods.size(); i++) {
+    size_t triangles = lods[i].elements.size() / 3;
+    printf("  LOD %zu: %zu triangles, error %g\n", i + 1, triangles, lods[i].error);
+    halves = halves && triangles <= previous * 9 / 10 && triangles >= previous / 2 - 2;
+    exact = exact && lods[i].error < 1e-4;
+    no_fold = no_fold && flat_faults(lods[i].elements, positions) == 0;
+    previous = triangles;
+  }
+  check("grid: about half the triangles at each level", halves);
+  check("grid: still the same plane", exact);
+  check("grid: no folded or empty triangle", no_fold);
+
+  // The border vertices are all kept
+  vector<bool> used(positions.size(), false);
+  const vector<unsigned int>& last = lods.empty() ? elements : lods.back().elements;
+  for (size_t i = 0; i < last.size(); i++)
+    used[last[i]] = true;
+  bool border = true;
+  for (size_t i = 0; i < positions.size(); i++)
+    if (positions[i].x == 0 || positions[i].y == 0 || positions[i].x == n || positions[i].y == n)
+      border = border && used[i];
+  check("grid: border kept", border);
+
+  // A bump in the middle: the error of the coarsest LOD can't be 0
+  positions[(n/2)*(n+1) + n/2].z = 4;
+  mesh_build_lods(elements, positions, 16, &lods);
+  check("grid with a bump: error reported", !lods.empty() && lods.back().error > 0.1);
+  check("same mesh: no error", mesh_hausdorff(elements, elements, positions) < 1e-5);
+}
+
+static void test_model(const char* filename) {
+  obj_model model;
+  if (!obj_load(filename, &model)) {
+    check(filename, false);
+    return;
+  }
+  vector<obj_vertex> vertices;
+  vector<unsigned int> elements;
+  obj_index_vertices(&model, &vertices, &elements);
+  vector<glm::vec4> positions(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++)
+    positions[i] = vertices[i].position;
+
+  vector<mesh_lod> lods;
+  mesh_build_lods(elements, positions, 32, &lods);
+  printf("%s: %zu triangles, %zu LODs\n", filename, elements.size() / 3, lods.size());
+  bool fewer = true, in_range = true;
+  size_t previous = elements.size() / 3;
+  for (size_t i = 0; i < lods.size(); i++) {
+    size_t triangles = lods[i].elements.size() / 3;
+    printf("  LOD %zu: %zu triangles, error %g\n", i + 1, triangles, lods[i].error);
+    fewer = fewer && triangles < previous && triangles > 0;
+    for (size_t j = 0; j < lods[i].elements.size(); j++)
+      in_range = in_range && lods[i].elements[j] < positions.size();
+    previous = triangles;
+  }
+  check("  fewer triangles at each level", fewer);
+  check("  same vertices", in_range);
+  if (lods.size() >= 2)
+    check("  more error at the last level than at the first", lods.back().error > lods[0].error);
+}
+
+static void test_pixels_per_unit() {
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3, 0.1f, 100.0f);
+  glm::mat4 view = glm::translate(glm::mat4(1), glm::vec3(0, 0, -11));
+  float ppu = mesh_pixels_per_unit(projection, view, glm::vec3(0), 1, 600);
+  // 10 units away from the sphere, 45 degrees over 600 pixels
+  float expected = 300 / tan(glm::radians(22.5f)) / 10;
+  check("pixels per unit", fabs(ppu - expected) < expected * 1e-3);
+  float scaled = mesh_pixels_per_unit(projection, glm::scale(view, glm::vec3(2)), glm::vec3(0), 1, 600);
+  check("pixels per unit, scaled object", fabs(scaled - 300 / tan(glm::radians(22.5f)) * 2 / 9) < 0.1);
+  check("camera in the sphere", isinf(mesh_pixels_per_unit(projection, view, glm::vec3(0), 20, 600)));
+}
+
+int main() {
+  test_grid();
+  test_model("cube.obj");
+  test_model("cube2.obj");
+  test_model("../post-processing-sdl2/suzanne.obj");
+  test_pixels_per_unit();
+
+  return check_summary();
+}
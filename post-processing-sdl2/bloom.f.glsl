@@ -0,0 +1,12 @@
+/* The scene with its blurred highlights added */
+#include "post_input.glsl"
+uniform sampler2D bloom_texture;
+uniform vec2 bloom_texture_scale, bloom_texture_max;
+uniform float intensity;
+
+void main(void) {
+  vec4 color = fetch(f_texcoord);
+  vec2 bloom_texcoord = f_texcoord / fbo_texture_scale * bloom_texture_scale;
+  vec3 bloom = texture2D(bloom_texture, min(bloom_texcoord, bloom_texture_max)).rgb;
+  gl_FragColor = vec4(color.rgb + bloom * intensity, color.a);
+}
@@ -0,0 +1,18 @@
+/*
+ * One direction of a separable Gaussian blur, two texels per fetch
+ * (see blur_linear_kernel()).  Drawing into a bigger target than
+ * fbo_texture upsamples it on the way.  Compiled for each number of
+ * fetches per side, NB_TAPS, for a loop without a branch.
+ */
+#include "post_input.glsl"
+uniform vec2 direction;  // (1,0) or (0,1)
+uniform float offsets[NB_TAPS], weights[NB_TAPS];  // [0] is the center
+
+void main(void) {
+  vec4 sum = fetch(f_texcoord) * weights[0];
+  for (int i = 1; i < NB_TAPS; i++) {
+    vec2 d = direction * texel_size * offsets[i];
+    sum += (fetch(f_texcoord + d) + fetch(f_texcoord - d)) * weights[i];
+  }
+  gl_FragColor = sum;
+}
@@ -0,0 +1,189 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <math.h>
+#include <algorithm>
+#include "blur_kernel.h"
+
+using namespace std;
+
+/**
+ * One side of a Gaussian kernel, weights[0] being the center, summing
+ * to 1 over both sides
+ */
+void blur_discrete_weights(float sigma, int radius, vector<float>* weights) {
+	weights->resize(radius + 1);
+	float sum = 0;
+	for (int i = 0; i <= radius; i++) {
+		(*weights)[i] = exp(-0.5f * i * i / (sigma * sigma));
+		sum += (i == 0) ? (*weights)[i] : 2 * (*weights)[i];
+	}
+	for (int i = 0; i <= radius; i++)
+		(*weights)[i] /= sum;
+}
+
+/**
+ * Gaussian kernel cut at 3 sigma, or at the radius that BLUR_MAX_TAPS
+ * fetches can cover.  Texels i and i+1 weigh w(i) and w(i+1): reading
+ * between them, at i + w(i+1) / (w(i) + w(i+1)), with linear filtering
+ * gives the same sum with w(i) + w(i+1), so that a kernel of radius r
+ * takes 1 + ceil(r/2) fetches per side instead of 1 + r.
+ */
+blur_kernel blur_linear_kernel(float sigma) {
+	blur_kernel kernel;
+	kernel.sigma = max(sigma, 0.1f);
+	kernel.radius = min((int)ceil(3 * kernel.sigma), 2 * (BLUR_MAX_TAPS - 1));
+	vector<float> w;
+	blur_discrete_weights(kernel.sigma, kernel.radius, &w);
+	kernel.offsets[0] = 0;
+	kernel.weights[0] = w[0];
+	kernel.nb_taps = 1;
+	for (int i = 1; i <= kernel.radius; i += 2) {
+		float a = w[i], b = (i + 1 <= kernel.radius) ? w[i+1] : 0;
+		kernel.weights[kernel.nb_taps] = a + b;
+		kernel.offsets[kernel.nb_taps] = i + b / (a + b);
+		kernel.nb_taps++;
+	}
+	for (int i = kernel.nb_taps; i < BLUR_MAX_TAPS; i++)
+		kernel.offsets[i] = kernel.weights[i] = 0;
+	return kernel;
+}
+
+/* What texture2D() returns with GL_LINEAR and GL_CLAMP_TO_EDGE */
+glm::vec4 blur_sample(const blur_image& image, glm::vec2 texcoord) {
+	float x = texcoord.x * image.width - 0.5f, y = texcoord.y * image.height - 0.5f;
+	int x0 = (int)floor(x), y0 = (int)floor(y);
+	float fx = x - x0, fy = y - y0;
+	int x1 = min(max(x0 + 1, 0), image.width - 1), y1 = min(max(y0 + 1, 0), image.height - 1);
+	x0 = min(max(x0, 0), image.width - 1);
+	y0 = min(max(y0, 0), image.height - 1);
+	return glm::mix(glm::mix(image.at(x0, y0), image.at(x1, y0), fx),
+					glm::mix(image.at(x0, y1), image.at(x1, y1), fx), fy);
+}
+
+/* Texture coordinates of the center of pixel (x,y) of a full-screen quad */
+static glm::vec2 pixel_texcoord(int x, int y, int width, int height) {
+	return glm::vec2((x + 0.5f) / width, (y + 0.5f) / height);
+}
+
+/* Drawn with copy.f.glsl into a target of another size */
+blur_image blur_resample(const blur_image& image, int width, int height) {
+	blur_image res(width, height);
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+			res.at(x, y) = blur_sample(image, pixel_texcoord(x, y, width, height));
+	return res;
+}
+
+/* One direction of the Gaussian blur, texel by texel */
+blur_image blur_gaussian_reference(const blur_image& image, float sigma, int radius, bool horizontal) {
+	vector<float> w;
+	blur_discrete_weights(sigma, radius, &w);
+	blur_image res(image.width, image.height);
+	for (int y = 0; y < image.height; y++) {
+		for (int x = 0; x < image.width; x++) {
+			glm::vec4 sum(0);
+			for (int i = -radius; i <= radius; i++) {
+				int sx = horizontal ? min(max(x + i, 0), image.width - 1) : x;
+				int sy = horizontal ? y : min(max(y + i, 0), image.height - 1);
+				sum += image.at(sx, sy) * w[abs(i)];
+			}
+			res.at(x, y) = sum;
+		}
+	}
+	return res;
+}
+
+/* Same as blur.f.glsl, drawn into a width x height target */
+blur_image blur_gaussian_linear(const blur_image& image, const blur_kernel& kernel, bool horizontal,
+		int width, int height) {
+	glm::vec2 step = horizontal ? glm::vec2(1.0f / image.width, 0) : glm::vec2(0, 1.0f / image.height);
+	blur_image res(width, height);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			glm::vec2 texcoord = pixel_texcoord(x, y, width, height);
+			glm::vec4 sum = blur_sample(image, texcoord) * kernel.weights[0];
+			for (int i = 1; i < kernel.nb_taps; i++) {
+				glm::vec2 d = step * kernel.offsets[i];
+				sum += (blur_sample(image, texcoord + d) + blur_sample(image, texcoord - d)) * kernel.weights[i];
+			}
+			res.at(x, y) = sum;
+		}
+	}
+	return res;
+}
+
+/* Same as kawase_down.f.glsl: half the size */
+blur_image blur_kawase_down(const blur_image& image) {
+	blur_image res(max(1, image.width / 2), max(1, image.height / 2));
+	glm::vec2 d(1.0f / image.width, 1.0f / image.height);
+	for (int y = 0; y < res.height; y++) {
+		for (int x = 0; x < res.width; x++) {
+			glm::vec2 texcoord = pixel_texcoord(x, y, res.width, res.height);
+			glm::vec4 sum = blur_sample(image, texcoord) * 4.0f
+				+ blur_sample(image, texcoord - d) + blur_sample(image, texcoord + d)
+				+ blur_sample(image, texcoord + glm::vec2(d.x, -d.y))
+				+ blur_sample(image, texcoord - glm::vec2(d.x, -d.y));
+			res.at(x, y) = sum / 8.0f;
+		}
+	}
+	return res;
+}
+
+/* Same as kawase_up.f.glsl, into a width x height target */
+blur_image blur_kawase_up(const blur_image& image, int width, int height) {
+	blur_image res(width, height);
+	glm::vec2 d(0.5f / image.width, 0.5f / image.height);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			glm::vec2 texcoord = pixel_texcoord(x, y, width, height);
+			glm::vec4 sum = blur_sample(image, texcoord + glm::vec2(-2*d.x, 0))
+				+ blur_sample(image, texcoord + glm::vec2(2*d.x, 0))
+				+ blur_sample(image, texcoord + glm::vec2(0, -2*d.y))
+				+ blur_sample(image, texcoord + glm::vec2(0, 2*d.y))
+				+ (blur_sample(image, texcoord + glm::vec2(-d.x, d.y))
+				   + blur_sample(image, texcoord + glm::vec2(d.x, d.y))
+				   + blur_sample(image, texcoord + glm::vec2(d.x, -d.y))
+				   + blur_sample(image, texcoord + glm::vec2(-d.x, -d.y))) * 2.0f;
+			res.at(x, y) = sum / 12.0f;
+		}
+	}
+	return res;
+}
+
+/* Same as bright.f.glsl: what is brighter than threshold, in a width x height target */
+blur_image blur_bright(const blur_image& image, float threshold, int width, int height) {
+	blur_image res(width, height);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			glm::vec4 c = blur_sample(image, pixel_texcoord(x, y, width, height));
+			float luma = glm::dot(glm::vec3(c), glm::vec3(0.299, 0.587, 0.114));
+			float k = max(luma - threshold, 0.0f) / max(luma, 1e-4f);
+			res.at(x, y) = glm::vec4(glm::vec3(c) * k, 1.0);
+		}
+	}
+	return res;
+}
+
+/* As stored in a GL_RGBA8 render target */
+blur_image blur_quantize(const blur_image& image) {
+	blur_image res = image;
+	for (size_t i = 0; i < res.pixels.size(); i++)
+		for (int c = 0; c < 4; c++)
+			res.pixels[i][c] = floor(min(max(res.pixels[i][c], 0.0f), 1.0f) * 255 + 0.5f) / 255;
+	return res;
+}
+
+/* Largest difference of any channel, or 1e30 if the sizes differ */
+float blur_max_difference(const blur_image& a, const blur_image& b) {
+	if (a.width != b.width || a.height != b.height)
+		return 1e30;
+	float res = 0;
+	for (size_t i = 0; i < a.pixels.size(); i++)
+		for (int c = 0; c < 4; c++)
+			res = max(res, fabs(a.pixels[i][c] - b.pixels[i][c]));
+	return res;
+}
@@ -0,0 +1,53 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _BLUR_KERNEL_H
+#define _BLUR_KERNEL_H
+#include <vector>
+#include <glm/glm.hpp>
+
+/*
+ * Blur kernels of post_blur.cpp, and the same filters on the CPU, to
+ * check what the GPU draws.  No GL calls here.
+ */
+
+/* Texture fetches per side of the Gaussian blur, the center one included */
+#define BLUR_MAX_TAPS 8
+
+/**
+ * Gaussian kernel of a separable blur, with two neighbour texels read
+ * in one bilinear fetch, between them: offsets in texels from the
+ * center, offsets[0] == 0 being the center, read once.
+ */
+struct blur_kernel {
+	float sigma;
+	int radius;              // of the discrete kernel, in texels
+	int nb_taps;
+	float offsets[BLUR_MAX_TAPS], weights[BLUR_MAX_TAPS];
+};
+
+void blur_discrete_weights(float sigma, int radius, std::vector<float>* weights);
+blur_kernel blur_linear_kernel(float sigma);
+
+/* RGBA image, rows from the bottom like GL textures */
+struct blur_image {
+	int width, height;
+	std::vector<glm::vec4> pixels;
+	blur_image(int width = 0, int height = 0) : width(width), height(height), pixels(width * height) {}
+	glm::vec4& at(int x, int y) { return pixels[y * width + x]; }
+	const glm::vec4& at(int x, int y) const { return pixels[y * width + x]; }
+};
+
+glm::vec4 blur_sample(const blur_image& image, glm::vec2 texcoord);
+blur_image blur_resample(const blur_image& image, int width, int height);
+blur_image blur_gaussian_reference(const blur_image& image, float sigma, int radius, bool horizontal);
+blur_image blur_gaussian_linear(const blur_image& image, const blur_kernel& kernel, bool horizontal,
+	int width, int height);
+blur_image blur_kawase_down(const blur_image& image);
+blur_image blur_kawase_up(const blur_image& image, int width, int height);
+blur_image blur_bright(const blur_image& image, float threshold, int width, int height);
+blur_image blur_quantize(const blur_image& image);
+float blur_max_difference(const blur_image& a, const blur_image& b);
+#endif
@@ -0,0 +1,9 @@
+/* What is brighter than threshold, for bloom */
+#include "post_input.glsl"
+uniform float threshold;
+
+void main(void) {
+  vec3 c = fetch(f_texcoord).rgb;
+  float luma = dot(c, vec3(0.299, 0.587, 0.114));
+  gl_FragColor = vec4(c * (max(luma - threshold, 0.0) / max(luma, 1e-4)), 1.0);
+}
@@ -0,0 +1,5 @@
+#include "post_input.glsl"
+
+void main(void) {
+  gl_FragColor = fetch(f_texcoord);
+}
@@ -0,0 +1,38 @@
+/*
+ * Fast approximate anti-aliasing, after Timothy Lottes' FXAA: blur
+ * along the edge where the luma of the corners changes most, unless
+ * that overshoots the local luma range.
+ */
+#include "post_input.glsl"
+
+#define FXAA_REDUCE_MIN (1.0/128.0)
+#define FXAA_REDUCE_MUL (1.0/8.0)
+#define FXAA_SPAN_MAX 8.0
+
+void main(void) {
+  vec3 luma = vec3(0.299, 0.587, 0.114);
+  float luma_nw = dot(fetch(f_texcoord + vec2(-1.0, -1.0) * texel_size).rgb, luma);
+  float luma_ne = dot(fetch(f_texcoord + vec2( 1.0, -1.0) * texel_size).rgb, luma);
+  float luma_sw = dot(fetch(f_texcoord + vec2(-1.0,  1.0) * texel_size).rgb, luma);
+  float luma_se = dot(fetch(f_texcoord + vec2( 1.0,  1.0) * texel_size).rgb, luma);
+  vec4 center = fetch(f_texcoord);
+  float luma_m = dot(center.rgb, luma);
+  float luma_min = min(luma_m, min(min(luma_nw, luma_ne), min(luma_sw, luma_se)));
+  float luma_max = max(luma_m, max(max(luma_nw, luma_ne), max(luma_sw, luma_se)));
+
+  vec2 dir = vec2(-((luma_nw + luma_ne) - (luma_sw + luma_se)),
+                    (luma_nw + luma_sw) - (luma_ne + luma_se));
+  float dir_reduce = max((luma_nw + luma_ne + luma_sw + luma_se) * (0.25 * FXAA_REDUCE_MUL), FXAA_REDUCE_MIN);
+  float rcp_dir_min = 1.0 / (min(abs(dir.x), abs(dir.y)) + dir_reduce);
+  dir = clamp(dir * rcp_dir_min, -FXAA_SPAN_MAX, FXAA_SPAN_MAX) * texel_size;
+
+  vec3 rgb_a = 0.5 * (fetch(f_texcoord + dir * (1.0/3.0 - 0.5)).rgb
+                    + fetch(f_texcoord + dir * (2.0/3.0 - 0.5)).rgb);
+  vec3 rgb_b = rgb_a * 0.5 + 0.25 * (fetch(f_texcoord + dir * -0.5).rgb
+                                   + fetch(f_texcoord + dir *  0.5).rgb);
+  float luma_b = dot(rgb_b, luma);
+  if (luma_b < luma_min || luma_b > luma_max)
+    gl_FragColor = vec4(rgb_a, center.a);
+  else
+    gl_FragColor = vec4(rgb_b, center.a);
+}
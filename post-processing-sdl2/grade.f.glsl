@@ -0,0 +1,20 @@
+/*
+ * Tone map (Reinhard, mid-grey kept at 0.5), then colour grade:
+ * contrast around mid-grey, saturation, and a warm tint.
+ */
+#include "post_input.glsl"
+
+#define EXPOSURE 2.0
+#define CONTRAST 1.1
+#define SATURATION 1.2
+#define TINT vec3(1.05, 1.0, 0.92)
+
+void main(void) {
+  vec4 color = fetch(f_texcoord);
+  vec3 c = color.rgb * EXPOSURE;
+  c = c / (1.0 + c);
+  c = (c - 0.5) * CONTRAST + 0.5;
+  float luma = dot(c, vec3(0.299, 0.587, 0.114));
+  c = mix(vec3(luma), c, SATURATION) * TINT;
+  gl_FragColor = vec4(clamp(c, 0.0, 1.0), color.a);
+}
@@ -0,0 +1,16 @@
+/*
+ * Dual filter (Marius Bjorge, "Bandwidth-Efficient Rendering",
+ * SIGGRAPH 2015), down to half size: the center and four diagonal
+ * fetches one texel away, each one averaging four texels.
+ */
+#include "post_input.glsl"
+
+void main(void) {
+  vec2 d = texel_size;
+  vec4 sum = fetch(f_texcoord) * 4.0;
+  sum += fetch(f_texcoord - d);
+  sum += fetch(f_texcoord + d);
+  sum += fetch(f_texcoord + vec2(d.x, -d.y));
+  sum += fetch(f_texcoord - vec2(d.x, -d.y));
+  gl_FragColor = sum / 8.0;
+}
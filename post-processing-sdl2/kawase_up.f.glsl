@@ -0,0 +1,19 @@
+/*
+ * Dual filter, up to twice the size: four fetches one texel away
+ * along the axes, four half a texel away along the diagonals, which
+ * count twice.
+ */
+#include "post_input.glsl"
+
+void main(void) {
+  vec2 d = texel_size * 0.5;
+  vec4 sum = fetch(f_texcoord + vec2(-2.0 * d.x, 0.0));
+  sum += fetch(f_texcoord + vec2(2.0 * d.x, 0.0));
+  sum += fetch(f_texcoord + vec2(0.0, -2.0 * d.y));
+  sum += fetch(f_texcoord + vec2(0.0, 2.0 * d.y));
+  sum += fetch(f_texcoord + vec2(-d.x, d.y)) * 2.0;
+  sum += fetch(f_texcoord + vec2(d.x, d.y)) * 2.0;
+  sum += fetch(f_texcoord + vec2(d.x, -d.y)) * 2.0;
+  sum += fetch(f_texcoord + vec2(-d.x, -d.y)) * 2.0;
+  gl_FragColor = sum / 12.0;
+}
@@ -0,0 +1,25 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ *
+ * Pack files for file_pack_open(), under their names as given:
+ *   make-pack post-processing.pack *.glsl suzanne.obj
+ */
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "SDL.h"
+#include "../common-sdl2/file_view.h"
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s file.pack file...\n", argv[0]);
+		return 1;
+	}
+	std::vector<std::string> files(argv + 2, argv + argc);
+	if (!file_pack_write(argv[1], files))
+		return 1;
+	printf("%s: %d files\n", argv[1], argc - 2);
+	return 0;
+}
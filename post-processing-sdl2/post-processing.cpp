@@ -4,21 +4,28 @@
  * Contributors: Sylvain Beucler
  */
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <vector>
 using namespace std;
 
 /* Use glew.h instead of gl.h to get all the GL prototypes declared */
 #include <GL/glew.h>
-#define GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS 0x8CD9
 /* Using SDL2 for the base window and OpenGL context init */
 #include "SDL.h"
 /* Using SDL2_image to load PNG & JPG in memory */
 #include "SDL_image.h"
 
 #include "../common-sdl2/shader_utils.h"
+#include "../common-sdl2/geometry_pool.h"
+#include "../common-sdl2/obj_loader.h"
+#include "../common-sdl2/mesh_optimizer.h"
+#include "../common-sdl2/mesh_cache.h"
+#include "../common-sdl2/file_watch.h"
+#include "../common-sdl2/file_view.h"
+#include "post_graph.h"
+#include "post_blur.h"
 
 /* GLM */
 // #define GLM_MESSAGES
@@ -38,9 +45,34 @@ bool compute_arcball;
 int last_mx = 0, last_my = 0, cur_mx = 0, cur_my = 0;
 int arcball_on = false;
 
-GLuint fbo, fbo_texture, rbo_depth;
-GLuint vbo_fbo_vertices;
-GLuint program_postproc, attribute_v_coord_postproc, uniform_fbo_texture, uniform_offset;
+/*
+ * Post-processing: the scene is drawn in a texture, then goes through
+ * the effects that are on, in this order, the last one drawing to the
+ * window.  Keys 1-5 switch them, 'd' switches the dynamic resolution.
+ */
+enum EFFECTS { EFFECT_WAVE, EFFECT_BLUR, EFFECT_BLOOM, EFFECT_FXAA, EFFECT_GRADE, EFFECT_LAST };
+struct effect {
+	const char* name;
+	const char* fshader_filename;  // NULL: passes from PostBlur
+	bool on;
+	GLuint program;
+} effects[EFFECT_LAST] = {
+	{ "wave",  "postproc.f.glsl", true,  0 },
+	{ "blur",  NULL,              false, 0 },
+	{ "bloom", NULL,              false, 0 },
+	{ "fxaa",  "fxaa.f.glsl",     false, 0 },
+	{ "grade", "grade.f.glsl",    false, 0 },
+};
+GLuint program_copy;  // when no effect is on
+GLint uniform_offset;
+PostGraph post;
+PostBlur post_blur;
+static vector<double> post_gpu_ms;  // summed by on_post_stats(), per pass
+static unsigned int post_stats_frames = 0;
+static size_t post_memory = 0, post_memory_unaliased = 0;
+static int post_allocations = 0;
+#define DYNAMIC_RESOLUTION_MS 16.0  // 60 fps
+bool dynamic_resolution = false;
 
 enum MODES { MODE_OBJECT, MODE_CAMERA, MODE_LIGHT, MODE_LAST } view_mode;
 int rotY_direction = 0, rotX_direction = 0, transZ_direction = 0, strife = 0;
@@ -50,83 +82,151 @@ int last_ticks = 0;
 
 static unsigned int fps_start = 0;
 static unsigned int fps_frames = 0;
+static unsigned long fps_buffers_start = 0;
 
 class Mesh {
 private:
-	GLuint vbo_vertices, vbo_normals, ibo_elements;
+	GLuint vbo, ibo_elements;
+	GLsizei stride;        // bytes per vertex in vbo
+	GLenum element_type;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	GLsizei nb_elements;
+	GLsizei nb_vertices;   // in vbo
+	glm::vec3 bounds_min, bounds_max;  // of the uploaded vertices, for draw_bbox()
 public:
+	/* CPU-side copies; they stay empty for a mesh uploaded from a cache */
 	vector<glm::vec4> vertices;
 	vector<glm::vec3> normals;
-	vector<GLushort> elements;
+	vector<GLuint> elements;
 	glm::mat4 object2world;
 
-	Mesh() : vbo_vertices(0), vbo_normals(0), ibo_elements(0), object2world(glm::mat4(1)) {}
+	Mesh() : vbo(0), ibo_elements(0), stride(0), element_type(GL_UNSIGNED_SHORT), nb_elements(0),
+		nb_vertices(0), bounds_min(0.0), bounds_max(0.0), object2world(glm::mat4(1)) {}
 	~Mesh() {
-		if (vbo_vertices != 0)
-			glDeleteBuffers(1, &vbo_vertices);
-		if (vbo_normals != 0)
-			glDeleteBuffers(1, &vbo_normals);
+		if (vbo != 0)
+			glDeleteBuffers(1, &vbo);
 		if (ibo_elements != 0)
 			glDeleteBuffers(1, &ibo_elements);
 	}
 
+	/**
+	 * Reorder the triangles for the post-transform cache and overdraw,
+	 * and the vertices in the order they are drawn, see
+	 * ../common-sdl2/mesh_optimizer.cpp
+	 */
+	void optimize() {
+		mesh_stats before, after;
+		vector<unsigned int> remap;
+		mesh_optimize(this->elements, this->vertices, &remap, &before, &after);
+		mesh_remap(this->vertices, remap);
+		mesh_remap(this->normals, remap);
+		cout << this->elements.size() / 3 << " triangles: ACMR " << before.acmr << " -> " << after.acmr
+			 << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+	}
+
 	/**
 	 * Store object vertices, normals and/or elements in graphic card
-	 * buffers
+	 * buffers.  Vertices and normals are interleaved in a single buffer,
+	 * (x,y,z,w,nx,ny,nz) for each vertex, so that fetching a vertex
+	 * reads from one place.  Elements are stored on 16 bits when there
+	 * are few enough vertices.
 	 */
 	void upload() {
 		if (this->vertices.size() > 0) {
-			glGenBuffers(1, &this->vbo_vertices);
-			glBindBuffer(GL_ARRAY_BUFFER, this->vbo_vertices);
-			glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(this->vertices[0]),
-						 &this->vertices[0], GL_STATIC_DRAW);
-		}
-    
-		if (this->normals.size() > 0) {
-			glGenBuffers(1, &this->vbo_normals);
-			glBindBuffer(GL_ARRAY_BUFFER, this->vbo_normals);
-			glBufferData(GL_ARRAY_BUFFER, this->normals.size() * sizeof(this->normals[0]),
-						 &this->normals[0], GL_STATIC_DRAW);
+			bool with_normals = this->normals.size() == this->vertices.size();
+			int nb_floats = with_normals ? 4+3 : 4;
+			vector<GLfloat> data(this->vertices.size() * nb_floats);
+			for (unsigned int i = 0; i < this->vertices.size(); i++) {
+				memcpy(&data[i*nb_floats], glm::value_ptr(this->vertices[i]), 4*sizeof(GLfloat));
+				if (with_normals)
+					memcpy(&data[i*nb_floats+4], glm::value_ptr(this->normals[i]), 3*sizeof(GLfloat));
+			}
+			if (this->vbo == 0)
+				this->vbo = gen_buffer();
+			this->stride = nb_floats * sizeof(GLfloat);
+			glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+			glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(data[0]), &data[0], GL_STATIC_DRAW);
+			this->nb_vertices = this->vertices.size();
+
+			this->bounds_min = this->bounds_max = glm::vec3(this->vertices[0]);
+			for (unsigned int i = 0; i < this->vertices.size(); i++) {
+				this->bounds_min = glm::min(this->bounds_min, glm::vec3(this->vertices[i]));
+				this->bounds_max = glm::max(this->bounds_max, glm::vec3(this->vertices[i]));
+			}
 		}
-    
+		
 		if (this->elements.size() > 0) {
-			glGenBuffers(1, &this->ibo_elements);
+			if (this->ibo_elements == 0)
+				this->ibo_elements = gen_buffer();
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->elements.size() * sizeof(this->elements[0]),
-						 &this->elements[0], GL_STATIC_DRAW);
+			if (this->vertices.size() <= 65536) {
+				vector<GLushort> short_elements(this->elements.begin(), this->elements.end());
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, short_elements.size() * sizeof(short_elements[0]),
+							 &short_elements[0], GL_STATIC_DRAW);
+				this->element_type = GL_UNSIGNED_SHORT;
+			} else {
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->elements.size() * sizeof(this->elements[0]),
+							 &this->elements[0], GL_STATIC_DRAW);
+				this->element_type = GL_UNSIGNED_INT;
+			}
+			this->nb_elements = this->elements.size();
 		}
 	}
 
+	/**
+	 * Same from a binary mesh cache: the mapped file goes to the
+	 * buffers as is, without filling vertices, normals and elements;
+	 * the bounds come from the cache header.
+	 */
+	void upload(const mesh_cache* cache) {
+		const mesh_cache_header* header = cache->header;
+		if (this->vbo == 0)
+			this->vbo = gen_buffer();
+		this->stride = header->stride;
+		glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)header->nb_vertices * header->stride,
+					 cache->vertices, GL_STATIC_DRAW);
+		this->nb_vertices = header->nb_vertices;
+		this->bounds_min = glm::vec3(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]);
+		this->bounds_max = glm::vec3(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]);
+
+		if (this->ibo_elements == 0)
+			this->ibo_elements = gen_buffer();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)header->nb_elements * header->element_size,
+					 cache->elements, GL_STATIC_DRAW);
+		this->element_type = (header->element_size == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		this->nb_elements = cache->lods[0].nb_elements;  // the full mesh, without LODs
+	}
+
 	/**
 	 * Draw the object
 	 */
 	void render() {
-		if (this->vbo_vertices != 0) {
+		bool with_normals = this->stride > (GLsizei)(4*sizeof(GLfloat));
+		if (this->vbo != 0) {
+			glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
 			glEnableVertexAttribArray(attribute_v_coord);
-			glBindBuffer(GL_ARRAY_BUFFER, this->vbo_vertices);
 			glVertexAttribPointer(
-	            attribute_v_coord,  // attribute
+				attribute_v_coord,  // attribute
 				4,                  // number of elements per vertex, here (x,y,z,w)
 				GL_FLOAT,           // the type of each element
 				GL_FALSE,           // take our values as-is
-				0,                  // no extra data between each position
+				this->stride,       // the normal is in between two positions
 				0                   // offset of first element
 			);
+			if (with_normals) {
+				glEnableVertexAttribArray(attribute_v_normal);
+				glVertexAttribPointer(
+					attribute_v_normal, // attribute
+					3,                  // number of elements per vertex, here (x,y,z)
+					GL_FLOAT,           // the type of each element
+					GL_FALSE,           // take our values as-is
+					this->stride,       // the next position is in between two normals
+					(GLvoid*)(4*sizeof(GLfloat))  // offset of first element, after the first position
+				);
+			}
 		}
 		
-		if (this->vbo_normals != 0) {
-			glEnableVertexAttribArray(attribute_v_normal);
-			glBindBuffer(GL_ARRAY_BUFFER, this->vbo_normals);
-			glVertexAttribPointer(
-				attribute_v_normal, // attribute
-				3,                  // number of elements per vertex, here (x,y,z)
-				GL_FLOAT,           // the type of each element
-				GL_FALSE,           // take our values as-is
-				0,                  // no extra data between each position
-				0                   // offset of first element
-			);
-		}
-    
 		/* Apply object's transformation matrix */
 		glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(this->object2world));
 		glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(this->object2world)));
@@ -135,15 +235,14 @@ public:
 		/* Push each element in buffer_vertices to the vertex shader */
 		if (this->ibo_elements != 0) {
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
-			int size;  glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-			glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
+			glDrawElements(GL_TRIANGLES, this->nb_elements, this->element_type, 0);
 		} else {
-			glDrawArrays(GL_TRIANGLES, 0, this->vertices.size());
+			glDrawArrays(GL_TRIANGLES, 0, this->nb_vertices);
 		}
 		
-		if (this->vbo_normals != 0)
+		if (this->vbo != 0)
 			glDisableVertexAttribArray(attribute_v_coord);
-		if (this->vbo_vertices != 0)
+		if (with_normals)
 			glDisableVertexAttribArray(attribute_v_normal);
 	}
 	
@@ -151,61 +250,22 @@ public:
 	 * Draw object bounding box
 	 */
 	void draw_bbox() {
-		if (this->vertices.size() == 0)
+		if (this->nb_vertices == 0)
 			return;
 		
-		// Cube 1x1x1, centered on origin
-		GLfloat vertices[] = {
-			-0.5, -0.5, -0.5, 1.0,
-			 0.5, -0.5, -0.5, 1.0,
-			 0.5,  0.5, -0.5, 1.0,
-			-0.5,  0.5, -0.5, 1.0,
-			-0.5, -0.5,  0.5, 1.0,
-			 0.5, -0.5,  0.5, 1.0,
-			 0.5,  0.5,  0.5, 1.0,
-			-0.5,  0.5,  0.5, 1.0,
-		};
-		GLuint vbo_vertices;
-		glGenBuffers(1, &vbo_vertices);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		
-		GLushort elements[] = {
-			0, 1, 2, 3,
-			4, 5, 6, 7,
-			0, 4, 1, 5, 2, 6, 3, 7
-		};
-		GLuint ibo_elements;
-		glGenBuffers(1, &ibo_elements);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-		
-		GLfloat
-			min_x, max_x,
-			min_y, max_y,
-			min_z, max_z;
-		min_x = max_x = this->vertices[0].x;
-		min_y = max_y = this->vertices[0].y;
-		min_z = max_z = this->vertices[0].z;
-		for (unsigned int i = 0; i < this->vertices.size(); i++) {
-			if (this->vertices[i].x < min_x) min_x = this->vertices[i].x;
-			if (this->vertices[i].x > max_x) max_x = this->vertices[i].x;
-			if (this->vertices[i].y < min_y) min_y = this->vertices[i].y;
-			if (this->vertices[i].y > max_y) max_y = this->vertices[i].y;
-			if (this->vertices[i].z < min_z) min_z = this->vertices[i].z;
-			if (this->vertices[i].z > max_z) max_z = this->vertices[i].z;
+		// Corners of the box, in the order of shape_unit_cube
+		GLfloat vertices[8*4];
+		for (int i = 0; i < 8; i++) {
+			vertices[i*4+0] = shape_unit_cube[i*4+0] < 0 ? this->bounds_min.x : this->bounds_max.x;
+			vertices[i*4+1] = shape_unit_cube[i*4+1] < 0 ? this->bounds_min.y : this->bounds_max.y;
+			vertices[i*4+2] = shape_unit_cube[i*4+2] < 0 ? this->bounds_min.z : this->bounds_max.z;
+			vertices[i*4+3] = 1.0;
 		}
-		glm::vec3 size = glm::vec3(max_x-min_x, max_y-min_y, max_z-min_z);
-		glm::vec3 center = glm::vec3((min_x+max_x)/2, (min_y+max_y)/2, (min_z+max_z)/2);
-		glm::mat4 transform = glm::scale(glm::mat4(1), size) * glm::translate(glm::mat4(1), center);
+		GLintptr offset = stream_vertices(vertices, sizeof(vertices));
 		
 		/* Apply object's transformation matrix */
-		glm::mat4 m = this->object2world * transform;
-		glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
+		glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(this->object2world));
 		
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
 		glEnableVertexAttribArray(attribute_v_coord);
 		glVertexAttribPointer(
 			attribute_v_coord,  // attribute
@@ -213,10 +273,10 @@ public:
 			GL_FLOAT,           // the type of each element
 			GL_FALSE,           // take our values as-is
 			0,                  // no extra data between each position
-			0                   // offset of first element
+			(GLvoid*)offset     // offset of first element
 		);
 		
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
+		static_buffer(GL_ELEMENT_ARRAY_BUFFER, shape_cube_lines, sizeof(shape_cube_lines));
 		glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, 0);
 		glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, (GLvoid*)(4*sizeof(GLushort)));
 		glDrawElements(GL_LINES, 8, GL_UNSIGNED_SHORT, (GLvoid*)(8*sizeof(GLushort)));
@@ -224,73 +284,147 @@ public:
 		
 		glDisableVertexAttribArray(attribute_v_coord);
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		
-		glDeleteBuffers(1, &vbo_vertices);
-		glDeleteBuffers(1, &ibo_elements);
 	}
 };
 Mesh ground, main_object, light_bbox;
 
 
+/**
+ * Load an OBJ model, from its binary cache if it has one, which is
+ * uploaded right away; otherwise parse and optimize it, and write the
+ * cache for the next time.
+ */
 bool load_obj(const char* filename, Mesh* mesh) {
-	char* obj = file_read(filename, NULL);
-	if (obj == NULL) {
-		cerr << "Could not load OBJ file " << filename << endl;
-		return false;
+	string cache_filename = mesh_cache_filename(filename);
+	mesh_cache cache;
+	if (mesh_cache_open(cache_filename.c_str(), filename, &cache)) {
+		mesh->upload(&cache);
+		mesh_cache_close(&cache);
+		return true;
 	}
-	stringstream in(obj, ios::in);
-	vector<int> nb_seen;
+
+	obj_model model;
+	if (!obj_load(filename, &model))
+		return false;
+	vector<obj_vertex> vertices;
+	obj_index_vertices(&model, &vertices, &mesh->elements);
+	mesh->vertices.resize(vertices.size());
+	mesh->normals.resize(vertices.size());
+	for (unsigned int i = 0; i < vertices.size(); i++) {
+		mesh->vertices[i] = vertices[i].position;
+		mesh->normals[i] = vertices[i].normal;
+	}
+	mesh->optimize();
+	mesh_cache_write(cache_filename.c_str(), filename, mesh->vertices, mesh->normals, mesh->elements,
+		vector<mesh_cache_lod>());
+	return true;
+}
+
+void draw_scene(void* data) {
+	glClearColor(0.45, 0.45, 0.45, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
 	
-	string line;
-	while (getline(in, line)) {
-		if (line.substr(0,2) == "v ") {
-			istringstream s(line.substr(2));
-			glm::vec4 v; s >> v.x; s >> v.y; s >> v.z; v.w = 1.0;
-			mesh->vertices.push_back(v);
-		}  else if (line.substr(0,2) == "f ") {
-			istringstream s(line.substr(2));
-			GLushort a,b,c;
-			s >> a; s >> b; s >> c;
-			a--; b--; c--;
-			mesh->elements.push_back(a); mesh->elements.push_back(b); mesh->elements.push_back(c);
+	glUseProgram(program);
+	main_object.render();
+	ground.render();
+	light_bbox.draw_bbox();
+}
+
+/**
+ * Instrumentation hook: sum the GPU time of each pass, printed with
+ * the frame rate
+ */
+void on_post_stats(const post_graph_stats& stats, void* data) {
+	for (unsigned int i = 0; i < stats.passes.size() && i < post_gpu_ms.size(); i++)
+		post_gpu_ms[i] += stats.passes[i].gpu_ms;
+	post_stats_frames++;
+	post_memory = stats.memory;
+	post_memory_unaliased = stats.memory_unaliased;
+	post_allocations = stats.allocations;
+}
+
+/**
+ * Declare the passes for the effects that are on, and place their
+ * render targets for the current screen size
+ */
+bool build_post_graph() {
+	post.clear();
+	post_blur.clear();
+	// Bloom adds up small values over several levels: finer than 8 bits if possible
+	GLenum bloom_format = GLEW_ARB_texture_float ? GL_RGBA16F_ARB : GL_RGBA8;
+	int last = post.add_target("scene", 1, GL_RGBA8, true);
+	post.add_pass("scene", 0, last, draw_scene);
+	
+	int nb_on = 0;
+	for (int i = 0; i < EFFECT_LAST; i++)
+		nb_on += effects[i].on;
+	for (int i = 0; i < EFFECT_LAST; i++) {
+		if (!effects[i].on)
+			continue;
+		nb_on--;
+		int output = (nb_on == 0) ? POST_SCREEN : post.add_target(effects[i].name, 1, GL_RGBA8);
+		if (i == EFFECT_BLUR) {
+			post_blur.gaussian(&post, last, output, 4);
+		} else if (i == EFFECT_BLOOM) {
+			post_blur.bloom(&post, last, output, 5, 0.7, 1.0, bloom_format);
+		} else {
+			int pass = post.add_pass(effects[i].name, effects[i].program, output);
+			post.read(pass, last, "fbo_texture");
 		}
-		else if (line[0] == '#') { /* ignoring this line */ }
-		else { /* ignoring this line */ }
+		last = output;
 	}
-	
-	mesh->normals.resize(mesh->vertices.size(), glm::vec3(0.0, 0.0, 0.0));
-	nb_seen.resize(mesh->vertices.size(), 0);
-	for (unsigned int i = 0; i < mesh->elements.size(); i+=3) {
-		GLushort ia = mesh->elements[i];
-		GLushort ib = mesh->elements[i+1];
-		GLushort ic = mesh->elements[i+2];
-		glm::vec3 normal = glm::normalize(glm::cross(
-			glm::vec3(mesh->vertices[ib]) - glm::vec3(mesh->vertices[ia]),
-			glm::vec3(mesh->vertices[ic]) - glm::vec3(mesh->vertices[ia])));
-		
-		int v[3];  v[0] = ia;  v[1] = ib;  v[2] = ic;
-		for (int j = 0; j < 3; j++) {
-			GLushort cur_v = v[j];
-			nb_seen[cur_v]++;
-			if (nb_seen[cur_v] == 1) {
-				mesh->normals[cur_v] = normal;
-			} else {
-				// average
-				mesh->normals[cur_v].x = mesh->normals[cur_v].x * (1.0 - 1.0/nb_seen[cur_v])
-					+ normal.x * 1.0/nb_seen[cur_v];
-				mesh->normals[cur_v].y = mesh->normals[cur_v].y * (1.0 - 1.0/nb_seen[cur_v])
-					+ normal.y * 1.0/nb_seen[cur_v];
-				mesh->normals[cur_v].z = mesh->normals[cur_v].z * (1.0 - 1.0/nb_seen[cur_v])
-					+ normal.z * 1.0/nb_seen[cur_v];
-				mesh->normals[cur_v] = glm::normalize(mesh->normals[cur_v]);
-			}
-		}
+	if (last != POST_SCREEN) {
+		int pass = post.add_pass("copy", program_copy, POST_SCREEN);
+		post.read(pass, last, "fbo_texture");
 	}
+	
+	post_gpu_ms.assign(post.passes.size(), 0);
+	post_stats_frames = 0;
+	return post.compile(screen_width, screen_height);
+}
 
+/**
+ * Locations in the scene program, also when reload_programs() rebuilds
+ * it: kept only if they are all there
+ */
+bool main_locations(GLuint program, void* data) {
+	GLint v_coord = get_attrib(program, "v_coord"), v_normal = get_attrib(program, "v_normal");
+	GLint m = get_uniform(program, "m"), v = get_uniform(program, "v"), p = get_uniform(program, "p");
+	GLint m_3x3_inv_transp = get_uniform(program, "m_3x3_inv_transp"), v_inv = get_uniform(program, "v_inv");
+	if (v_coord == -1 || v_normal == -1 || m == -1 || v == -1 || p == -1 || m_3x3_inv_transp == -1 || v_inv == -1)
+		return false;
+	attribute_v_coord = v_coord;
+	attribute_v_normal = v_normal;
+	uniform_m = m;
+	uniform_v = v;
+	uniform_p = p;
+	uniform_m_3x3_inv_transp = m_3x3_inv_transp;
+	uniform_v_inv = v_inv;
+	return true;
+}
+
+/* The other effects' uniforms are found by the post graph */
+bool wave_locations(GLuint program, void* data) {
+	GLint offset = get_uniform(program, "offset");
+	if (offset == -1)
+		return false;
+	uniform_offset = offset;
 	return true;
 }
 
 bool init_resources(char* model_filename, char* vshader_filename, char* fshader_filename) {
+	/* Start compiling the shaders, or loading them as linked the last time, while the models load */
+	enable_program_cache(true);
+	unsigned int t = SDL_GetTicks();
+	program = create_program_async(vshader_filename, fshader_filename);
+	for (int i = 0; i < EFFECT_LAST; i++)
+		if (effects[i].fshader_filename != NULL)
+			effects[i].program = create_program_async("postproc.v.glsl", effects[i].fshader_filename);
+	program_copy = create_program_async("postproc.v.glsl", "copy.f.glsl");
+	post_blur.start();
+	
 	if (!load_obj(model_filename, &main_object))
 		return false;
 	// mesh position initialized in init_view()
@@ -325,81 +459,12 @@ bool init_resources(char* model_filename, char* vshader_filename, char* fshader_
 	
 	
 	
-	/* Create back-buffer, used for post-processing */
-	
-	/* Texture */
-	glActiveTexture(GL_TEXTURE0);
-	glGenTextures(1, &fbo_texture);
-	glBindTexture(GL_TEXTURE_2D, fbo_texture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, screen_width, screen_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	/* Depth buffer */
-	glGenRenderbuffers(1, &rbo_depth);
-	glBindRenderbuffer(GL_RENDERBUFFER, rbo_depth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, screen_width, screen_height);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
-	
-	/* Framebuffer to link everything together */
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbo_texture, 0);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo_depth);
-	GLenum status;
-	if ((status = glCheckFramebufferStatus(GL_FRAMEBUFFER)) != GL_FRAMEBUFFER_COMPLETE) {
-		cerr << "glCheckFramebufferStatus: error 0x" << hex << status << endl;
-		switch (status) {
-		case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
-			cerr << "GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT" << endl;
-			break;
-		case GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS:
-			cerr << "GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS" << endl;
-			break;
-		case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
-			cerr << "GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT" << endl;
-			break;
-		case GL_FRAMEBUFFER_UNSUPPORTED:
-			cerr << "GL_FRAMEBUFFER_UNSUPPORTED" << endl;
-			break;
-		}
-		return false;
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	
-	GLfloat fbo_vertices[] = {
-		-1, -1,
-		 1, -1,
-		-1,  1,
-		 1,  1,
-	};
-	glGenBuffers(1, &vbo_fbo_vertices);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_fbo_vertices);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(fbo_vertices), fbo_vertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
-	
-	/* Compile and link shaders */
-	GLint link_ok = GL_FALSE;
+	/* Wait for the shaders */
 	GLint validate_ok = GL_FALSE;
+	unsigned int t_wait = SDL_GetTicks();
 	
-	GLuint vs, fs;
-	if ((vs = create_shader(vshader_filename, GL_VERTEX_SHADER))   == 0) return false;
-	if ((fs = create_shader(fshader_filename, GL_FRAGMENT_SHADER)) == 0) return false;
-	
-	program = glCreateProgram();
-	glAttachShader(program, vs);
-	glAttachShader(program, fs);
-	glLinkProgram(program);
-	glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
-	if (!link_ok) {
-		cerr << "glLinkProgram:";
-		print_log(program);
+	if ((program = finish_program(program)) == 0)
 		return false;
-	}
 	glValidateProgram(program);
 	glGetProgramiv(program, GL_VALIDATE_STATUS, &validate_ok);
 	if (!validate_ok) {
@@ -407,93 +472,36 @@ bool init_resources(char* model_filename, char* vshader_filename, char* fshader_
 		print_log(program);
 	}
 	
-	const char* attribute_name;
-	attribute_name = "v_coord";
-	attribute_v_coord = glGetAttribLocation(program, attribute_name);
-	if (attribute_v_coord == -1) {
-		fprintf(stderr, "Could not bind attribute %s\n", attribute_name);
-		return false;
-	}
-	attribute_name = "v_normal";
-	attribute_v_normal = glGetAttribLocation(program, attribute_name);
-	if (attribute_v_normal == -1) {
-		cerr << "Could not bind attribute " << attribute_name << endl;
-		return false;
-	}
-	const char* uniform_name;
-	uniform_name = "m";
-	uniform_m = glGetUniformLocation(program, uniform_name);
-	if (uniform_m == -1) {
-		cerr << "Could not bind uniform " << uniform_name << endl;
-		return false;
-	}
-	uniform_name = "v";
-	uniform_v = glGetUniformLocation(program, uniform_name);
-	if (uniform_v == -1) {
-		cerr << "Could not bind uniform " << uniform_name << endl;
+	if (!main_locations(program, NULL))
 		return false;
-	}
-	uniform_name = "p";
-	uniform_p = glGetUniformLocation(program, uniform_name);
-	if (uniform_p == -1) {
-		cerr << "Could not bind uniform " << uniform_name << endl;
-		return false;
-	}
-	uniform_name = "m_3x3_inv_transp";
-	uniform_m_3x3_inv_transp = glGetUniformLocation(program, uniform_name);
-	if (uniform_m_3x3_inv_transp == -1) {
-		cerr << "Could not bind uniform " << uniform_name << endl;
-		return false;
-	}
-	uniform_name = "v_inv";
-	uniform_v_inv = glGetUniformLocation(program, uniform_name);
-	if (uniform_v_inv == -1) {
-		cerr << "Could not bind uniform " << uniform_name << endl;
-		return false;
-	}
 	
 	
 	/* Post-processing */
-	if ((vs = create_shader("postproc.v.glsl", GL_VERTEX_SHADER))   == 0) return false;
-	if ((fs = create_shader("postproc.f.glsl", GL_FRAGMENT_SHADER)) == 0) return false;
-	
-	program_postproc = glCreateProgram();
-	glAttachShader(program_postproc, vs);
-	glAttachShader(program_postproc, fs);
-	glLinkProgram(program_postproc);
-	glGetProgramiv(program_postproc, GL_LINK_STATUS, &link_ok);
-	if (!link_ok) {
-		cerr << "glLinkProgram:";
-		print_log(program);
-		return false;
-	}
-	glValidateProgram(program_postproc);
-	glGetProgramiv(program_postproc, GL_VALIDATE_STATUS, &validate_ok);
-	if (!validate_ok) {
-		cerr << "glValidateProgram:";
-		print_log(program_postproc);
+	for (int i = 0; i < EFFECT_LAST; i++) {
+		if (effects[i].fshader_filename != NULL
+			&& (effects[i].program = finish_program(effects[i].program)) == 0)
+			return false;
 	}
-	
-	attribute_name = "v_coord";
-	attribute_v_coord_postproc = glGetAttribLocation(program_postproc, attribute_name);
-	if (attribute_v_coord_postproc == -1) {
-		cerr << "Could not bind attribute " << attribute_name << endl;
+	if (!post_blur.init())
 		return false;
-	}
-	
-	uniform_name = "fbo_texture";
-	uniform_fbo_texture = glGetUniformLocation(program_postproc, uniform_name);
-	if (uniform_fbo_texture == -1) {
-		cerr << "Could not bind attribute " << attribute_name << endl;
+	if ((program_copy = finish_program(program_copy)) == 0)
 		return false;
-	}
-	
-	uniform_name = "offset";
-	uniform_offset = glGetUniformLocation(program_postproc, uniform_name);
-	if (uniform_offset == -1) {
-		cerr << "Could not bind attribute " << attribute_name << endl;
+	if (!wave_locations(effects[EFFECT_WAVE].program, NULL))
+		return false;
+	/* Rebuilt when their files change, see mainLoop() */
+	watch_program(&program, vshader_filename, fshader_filename, NULL, main_locations);
+	for (int i = 0; i < EFFECT_LAST; i++)
+		if (effects[i].fshader_filename != NULL)
+			watch_program(&effects[i].program, "postproc.v.glsl", effects[i].fshader_filename, NULL,
+						  i == EFFECT_WAVE ? wave_locations : NULL);
+	watch_program(&program_copy, "postproc.v.glsl", "copy.f.glsl");
+	int hits, misses;
+	get_program_cache_stats(&hits, &misses);
+	cout << "Ready in " << SDL_GetTicks() - t << " ms, " << SDL_GetTicks() - t_wait << " ms waiting for the shaders ("
+		 << hits << " programs from the cache, " << misses << " compiled)" << endl;
+	post.set_stats_hook(on_post_stats, NULL);
+	if (!build_post_graph())
 		return false;
-	}
 	
 	fps_start = SDL_GetTicks();
 	
@@ -533,15 +541,31 @@ void logic() {
 		fps_frames++;
 		int delta_t = SDL_GetTicks() - fps_start;
 		if (delta_t > 1000) {
-			cout << 1000.0 * fps_frames / delta_t << endl;
+			cout << 1000.0 * fps_frames / delta_t << " fps, "
+				 << 1.0 * (gl_buffers_created - fps_buffers_start) / fps_frames << " buffers created/frame" << endl;
+			if (post_stats_frames > 0) {
+				cout << "  GPU ms/frame:";
+				for (unsigned int i = 0; i < post.passes.size() && i < post_gpu_ms.size(); i++)
+					cout << " " << post.passes[i].name << " " << post_gpu_ms[i] / post_stats_frames;
+				cout << endl;
+			}
+			cout << "  render targets: " << post.textures.size() << " textures for " << post.targets.size()
+				 << " targets, " << post_memory / 1024 << " KiB (" << post_memory_unaliased / 1024
+				 << " KiB unaliased), " << post_allocations << " allocated so far, resolution "
+				 << post.get_resolution_scale() * 100 << "%" << endl;
+			post_gpu_ms.assign(post_gpu_ms.size(), 0);
+			post_stats_frames = 0;
 			fps_frames = 0;
 			fps_start = SDL_GetTicks();
+			fps_buffers_start = gl_buffers_created;
 		}
 	}
 	
 	/* Handle keyboard-based transformations */
 	int delta_t = SDL_GetTicks() - last_ticks;
 	last_ticks = SDL_GetTicks();
+	if (dynamic_resolution && !GLEW_ARB_timer_query)
+		post.update_resolution(delta_t);  // else timed on the GPU by the graph
 	
 	float delta_transZ = transZ_direction * delta_t / 1000.0 * 5 * speed_factor;  // 5 units per second
 	float delta_transX = 0, delta_transY = 0, delta_rotY = 0, delta_rotX = 0;
@@ -606,47 +630,31 @@ void logic() {
 	glm::mat4 v_inv = glm::inverse(world2camera);
 	glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(v_inv));
 	
-	glUseProgram(program_postproc);
+	glUseProgram(effects[EFFECT_WAVE].program);
 	GLfloat move = SDL_GetTicks() / 1000.0 * 2*3.14159 * .75;  // 3/4 of a wave cycle per second
 	glUniform1f(uniform_offset, move);
 }
 
 void render(SDL_Window* window) {
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glClearColor(0.45, 0.45, 0.45, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-	
-	glUseProgram(program);
-	
-	
-	main_object.render();
-	ground.render();
-	light_bbox.draw_bbox();
-	
-	/* Post-processing */
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glClearColor(0.0, 0.0, 0.0, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-	
-	glUseProgram(program_postproc);
-	glBindTexture(GL_TEXTURE_2D, fbo_texture);
-	glUniform1i(uniform_fbo_texture, /*GL_TEXTURE*/0);
-	glEnableVertexAttribArray(attribute_v_coord_postproc);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_fbo_vertices);
-	glVertexAttribPointer(
-		attribute_v_coord_postproc,  // attribute
-		2,                  // number of elements per vertex, here (x,y)
-		GL_FLOAT,           // the type of each element
-		GL_FALSE,           // take our values as-is
-		0,                  // no extra data between each position
-		0                   // offset of first element
-	);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glDisableVertexAttribArray(attribute_v_coord_postproc);
+	post.run();
 	SDL_GL_SwapWindow(window);
 }
 
+void onKey(int key) {
+	if (key == SDLK_d) {
+		dynamic_resolution = !dynamic_resolution;
+		post.set_dynamic_resolution(dynamic_resolution ? DYNAMIC_RESOLUTION_MS : 0);
+		cout << "dynamic resolution" << (dynamic_resolution ? " on" : " off") << endl;
+		return;
+	}
+	if (key < SDLK_1 || key >= SDLK_1 + EFFECT_LAST)
+		return;
+	struct effect* e = &effects[key - SDLK_1];
+	e->on = !e->on;
+	cout << e->name << (e->on ? " on" : " off") << endl;
+	build_post_graph();
+}
+
 void onMouse(int button, int state, int x, int y) {
 	if (button == SDL_BUTTON_LEFT && state ==  SDL_PRESSED) {
 		arcball_on = true;
@@ -669,23 +677,20 @@ void onResize(int width, int height) {
 	screen_height = height;
 	glViewport(0, 0, screen_width, screen_height);
 	
-	// Rescale FBO and RBO as well
-	glBindTexture(GL_TEXTURE_2D, fbo_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, screen_width, screen_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	glBindRenderbuffer(GL_RENDERBUFFER, rbo_depth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, screen_width, screen_height);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	// Render targets of the new size, at the start of the next frame
+	post.resize(screen_width, screen_height);
 }
 
 void free_resources() {
+	unwatch_programs();
 	glDeleteProgram(program);
-	glDeleteProgram(program_postproc);
-	glDeleteBuffers(1, &vbo_fbo_vertices);
-	glDeleteRenderbuffers(1, &rbo_depth);
-	glDeleteTextures(1, &fbo_texture);
-	glDeleteFramebuffers(1, &fbo);
+	for (int i = 0; i < EFFECT_LAST; i++)
+		glDeleteProgram(effects[i].program);
+	glDeleteProgram(program_copy);
+	post_blur.free();
+	post.free_textures();
+	free_geometry_pool();
+	file_pack_close();
 }
 
 void mainLoop(SDL_Window* window) {
@@ -696,11 +701,16 @@ void mainLoop(SDL_Window* window) {
 				return;
 			if (ev.type == SDL_WINDOWEVENT && ev.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
 				onResize(ev.window.data1, ev.window.data2);
+			if (ev.type == SDL_KEYDOWN)
+				onKey(ev.key.keysym.sym);
 			if (ev.type == SDL_MOUSEMOTION)
 				onMotion(ev.motion.x, ev.motion.y);
 			if (ev.type == SDL_MOUSEBUTTONDOWN || ev.type == SDL_MOUSEBUTTONUP)
 				onMouse(ev.button.button, ev.button.state, ev.button.x, ev.button.y);
 		}
+		/* Shaders edited while running: the post graph holds the programs and their uniforms */
+		if (reload_programs() > 0)
+			build_post_graph();
 		logic();
 		render(window);
 	}
@@ -746,13 +756,14 @@ int main(int argc, char* argv[]) {
 	}
 
 
+	/* Shaders and models from one mapped file, if made ("make post-processing.pack"): remove it to edit them */
+	if (file_pack_open("post-processing.pack"))
+		cout << "Using post-processing.pack" << endl;
 	if (!init_resources(obj_filename, v_shader_filename, f_shader_filename))
 		return EXIT_FAILURE;
 
     init_view();
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_DEPTH_TEST);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  // enabled by draw_scene()
     //glDepthFunc(GL_LEQUAL);
     //glDepthRange(1, 0);
     last_ticks = SDL_GetTicks();
@@ -0,0 +1,219 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <GL/glew.h>
+#include "../common-sdl2/shader_utils.h"
+#include "../common-sdl2/file_watch.h"
+#include "post_blur.h"
+
+using namespace std;
+
+/* Fragment shaders of down, up, bright, bloom and copy, after postproc.v.glsl */
+static const char* fshaders[] = { "kawase_down.f.glsl", "kawase_up.f.glsl", "bright.f.glsl", "bloom.f.glsl",
+								  "copy.f.glsl" };
+
+/* Uniforms of the passes, also when reload_programs() rebuilds their programs */
+static bool bright_locations(GLuint program, void* data) {
+	GLint threshold = get_uniform(program, "threshold");
+	if (threshold == -1)
+		return false;
+	((blur_programs*)data)->uniform_threshold = threshold;
+	return true;
+}
+
+static bool bloom_locations(GLuint program, void* data) {
+	GLint intensity = get_uniform(program, "intensity");
+	if (intensity == -1)
+		return false;
+	((blur_programs*)data)->uniform_intensity = intensity;
+	return true;
+}
+
+static bool gaussian_locations(GLuint program, void* data) {
+	blur_gaussian_program* g = (blur_gaussian_program*)data;
+	// Not all used with few taps
+	g->uniform_direction = glGetUniformLocation(program, "direction");
+	g->uniform_offsets = glGetUniformLocation(program, "offsets");
+	g->uniform_weights = glGetUniformLocation(program, "weights");
+	return true;
+}
+
+PostBlur::PostBlur() : started(false) {
+	memset(&this->programs, 0, sizeof(this->programs));
+}
+
+/*
+ * Start compiling the blur shaders, next to the program, side by side:
+ * call it with the other create_program_async(), before loading the
+ * models, and init() waits for them.
+ */
+void PostBlur::start() {
+	blur_programs& p = this->programs;
+	GLuint* programs[] = { &p.down, &p.up, &p.bright, &p.bloom, &p.copy };
+	for (int i = 0; i < 5; i++)
+		*programs[i] = create_program_async("postproc.v.glsl", fshaders[i]);
+	this->started = true;
+}
+
+/* Finish the programs of start(), which it calls first if it wasn't */
+bool PostBlur::init() {
+	if (!this->started)
+		start();
+	this->started = false;
+	blur_programs& p = this->programs;
+	GLuint* programs[] = { &p.down, &p.up, &p.bright, &p.bloom, &p.copy };
+	bool ok = true;
+	for (int i = 0; i < 5; i++)
+		ok = (*programs[i] = finish_program(*programs[i])) != 0 && ok;
+	if (!ok || !bright_locations(p.bright, &p) || !bloom_locations(p.bloom, &p))
+		return false;
+	/* Rebuilt when their files change, see reload_programs() */
+	program_locations_func locations[] = { NULL, NULL, bright_locations, bloom_locations, NULL };
+	for (int i = 0; i < 5; i++)
+		watch_program(programs[i], "postproc.v.glsl", fshaders[i], NULL, locations[i], &p);
+	return true;
+}
+
+/**
+ * blur.f.glsl with its loop unrolled for nb_taps fetches per side,
+ * compiled the first time a kernel needs it, then watched with its
+ * defines.  NULL if it doesn't compile.
+ */
+const blur_gaussian_program* PostBlur::gaussian_program(int nb_taps) {
+	blur_gaussian_program& g = this->programs.gaussian[nb_taps];
+	if (g.program == 0) {
+		char defines[32];
+		snprintf(defines, sizeof(defines), "NB_TAPS=%d", nb_taps);
+		if ((g.program = create_program("postproc.v.glsl", "blur.f.glsl", defines)) == 0)
+			return NULL;
+		gaussian_locations(g.program, &g);
+		watch_program(&g.program, "postproc.v.glsl", "blur.f.glsl", defines, gaussian_locations, &g);
+	}
+	return &g;
+}
+
+/* After unwatch_programs(), which still points to them */
+void PostBlur::free() {
+	GLuint* p[] = { &programs.down, &programs.up, &programs.bright, &programs.bloom, &programs.copy };
+	for (unsigned int i = 0; i < sizeof(p) / sizeof(p[0]); i++) {
+		glDeleteProgram(*p[i]);
+		*p[i] = 0;
+	}
+	for (int i = 0; i <= BLUR_MAX_TAPS; i++) {
+		glDeleteProgram(programs.gaussian[i].program);
+		programs.gaussian[i].program = 0;
+	}
+	this->passes.clear();
+}
+
+/* Forget the passes added so far, with PostGraph::clear() */
+void PostBlur::clear() {
+	this->passes.clear();
+}
+
+blur_pass_data* PostBlur::add_data(BLUR_PASSES type) {
+	this->passes.push_back(blur_pass_data());
+	blur_pass_data* data = &this->passes.back();
+	data->type = type;
+	data->programs = &this->programs;
+	return data;
+}
+
+void PostBlur::set_uniforms(void* data) {
+	const blur_pass_data* d = (const blur_pass_data*)data;
+	const blur_programs* p = d->programs;
+	switch (d->type) {
+	case BLUR_PASS_GAUSSIAN: {
+		const blur_gaussian_program* g = &p->gaussian[d->kernel.nb_taps];
+		glUniform2fv(g->uniform_direction, 1, d->direction);
+		glUniform1fv(g->uniform_offsets, d->kernel.nb_taps, d->kernel.offsets);
+		glUniform1fv(g->uniform_weights, d->kernel.nb_taps, d->kernel.weights);
+		break;
+	}
+	case BLUR_PASS_BRIGHT:
+		glUniform1f(p->uniform_threshold, d->value);
+		break;
+	case BLUR_PASS_BLOOM:
+		glUniform1f(p->uniform_intensity, d->value);
+		break;
+	}
+}
+
+/**
+ * Gaussian blur of input into output, sigma in pixels of input.  The
+ * input is first scaled down by scale (e.g. 0.5: half its size, a
+ * quarter of the pixels to blur, each with a kernel half as wide),
+ * blurred, and scaled back up to output with a single fetch per pixel.
+ * Returns the last pass, or -1 if the blur shader doesn't compile.
+ */
+int PostBlur::gaussian(PostGraph* graph, int input, int output, float sigma, float scale, GLenum format) {
+	blur_kernel kernel = blur_linear_kernel(sigma * scale);
+	const blur_gaussian_program* program = gaussian_program(kernel.nb_taps);
+	if (program == NULL)
+		return -1;
+	float small_scale = graph->targets[input].scale * scale;
+	int source = input;
+	if (scale != 1) {
+		source = graph->add_target("blur down", small_scale, format);
+		graph->read(graph->add_pass("blur down", this->programs.copy, source), input, "fbo_texture");
+	}
+	int horizontal = graph->add_target("blur h", small_scale, format);
+	int vertical = (scale != 1) ? graph->add_target("blur v", small_scale, format) : output;
+	for (int i = 0; i < 2; i++) {
+		blur_pass_data* data = add_data(BLUR_PASS_GAUSSIAN);
+		data->direction[0] = (i == 0) ? 1 : 0;
+		data->direction[1] = (i == 0) ? 0 : 1;
+		data->kernel = kernel;
+		int pass = graph->add_pass(i == 0 ? "blur h" : "blur v", program->program,
+			i == 0 ? horizontal : vertical, set_uniforms, data);
+		graph->read(pass, i == 0 ? source : horizontal, "fbo_texture");
+	}
+	if (scale != 1)
+		graph->read(graph->add_pass("blur up", this->programs.copy, output), vertical, "fbo_texture");
+	return graph->passes.size() - 1;
+}
+
+/**
+ * Add what is brighter than threshold in input, blurred, to input, in
+ * output.  The highlights are taken at half size, then go down levels
+ * times to half the size with the dual filter, and back up, each level
+ * widening the blur for a fraction of the cost of a larger kernel.
+ * Returns the last pass.
+ */
+int PostBlur::bloom(PostGraph* graph, int input, int output, int levels, float threshold, float intensity,
+		GLenum format) {
+	static const char* down_names[] = { "bloom down 1/4", "bloom down 1/8", "bloom down 1/16", "bloom down 1/32" };
+	static const char* up_names[] = { "bloom up 1/2", "bloom up 1/4", "bloom up 1/8", "bloom up 1/16" };
+	levels = max(1, min(levels, (int)(sizeof(down_names) / sizeof(down_names[0])) + 1));
+	float scale = graph->targets[input].scale * 0.5f;
+
+	blur_pass_data* data = add_data(BLUR_PASS_BRIGHT);
+	data->value = threshold;
+	int level = graph->add_target("bloom 1/2", scale, format);
+	graph->read(graph->add_pass("bloom bright", this->programs.bright, level, set_uniforms, data),
+		input, "fbo_texture");
+
+	for (int i = 1; i < levels; i++) {
+		int down = graph->add_target(down_names[i-1], scale / (1 << i), format);
+		graph->read(graph->add_pass(down_names[i-1], this->programs.down, down), level, "fbo_texture");
+		level = down;
+	}
+	for (int i = levels - 2; i >= 0; i--) {
+		int up = graph->add_target(up_names[i], scale / (1 << i), format);
+		graph->read(graph->add_pass(up_names[i], this->programs.up, up), level, "fbo_texture");
+		level = up;
+	}
+
+	data = add_data(BLUR_PASS_BLOOM);
+	data->value = intensity;
+	int pass = graph->add_pass("bloom", this->programs.bloom, output, set_uniforms, data);
+	graph->read(pass, input, "fbo_texture");
+	graph->read(pass, level, "bloom_texture");
+	return pass;
+}
@@ -0,0 +1,64 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _POST_BLUR_H
+#define _POST_BLUR_H
+#include <deque>
+#include <GL/glew.h>
+#include "blur_kernel.h"
+#include "post_graph.h"
+
+/*
+ * Blurs for the post-processing graph, each one a few passes added to
+ * a PostGraph: a separable Gaussian blur at a lower resolution, and
+ * bloom through a chain of dual filter (Kawase) downsamples and
+ * upsamples.  blur_kernel.cpp does the same on the CPU.
+ */
+
+enum BLUR_PASSES { BLUR_PASS_GAUSSIAN, BLUR_PASS_BRIGHT, BLUR_PASS_BLOOM };
+
+/* blur.f.glsl for kernels of nb_taps fetches per side, see PostBlur::gaussian_program() */
+struct blur_gaussian_program {
+	GLuint program;
+	GLint uniform_direction, uniform_offsets, uniform_weights;
+};
+
+struct blur_programs {
+	blur_gaussian_program gaussian[BLUR_MAX_TAPS + 1];  // by nb_taps, compiled when first used
+	GLuint down, up, bright, bloom, copy;
+	GLint uniform_threshold, uniform_intensity;
+};
+
+/* Uniforms of one pass, for PostBlur::set_uniforms() */
+struct blur_pass_data {
+	BLUR_PASSES type;
+	GLfloat direction[2];
+	blur_kernel kernel;
+	float value;             // bright: threshold, bloom: intensity
+	const blur_programs* programs;
+};
+
+class PostBlur {
+public:
+	PostBlur();
+	void start();
+	bool init();
+	void free();
+	void clear();
+	int gaussian(PostGraph* graph, int input, int output, float sigma, float scale = 0.5f,
+		GLenum format = GL_RGBA8);
+	int bloom(PostGraph* graph, int input, int output, int levels = 4, float threshold = 0.7f,
+		float intensity = 1.0f, GLenum format = GL_RGBA8);
+
+private:
+	blur_programs programs;
+	bool started;  // by start(), for init()
+	std::deque<blur_pass_data> passes;  // pointers to them are given to the graph
+
+	blur_pass_data* add_data(BLUR_PASSES type);
+	const blur_gaussian_program* gaussian_program(int nb_taps);
+	static void set_uniforms(void* data);
+};
+#endif
@@ -0,0 +1,542 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <math.h>
+#include <iostream>
+#include <GL/glew.h>
+#define GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS 0x8CD9
+#include "../common-sdl2/geometry_pool.h"
+#include "post_graph.h"
+
+using namespace std;
+
+PostGraph::PostGraph() : screen_width(0), screen_height(0), storage_width(0), storage_height(0),
+	pending_width(0), pending_height(0), resolution_scale(1), target_ms(0), min_scale(1), allocations(0),
+	compiled(false), hook(NULL), hook_data(NULL), timer_queries(false), frame(0) {}
+
+PostGraph::~PostGraph() {
+	free_textures();
+}
+
+/**
+ * Declare a render target, scale times the screen size.  Nothing is
+ * allocated before compile().
+ */
+int PostGraph::add_target(const char* name, float scale, GLenum format, bool depth) {
+	post_target target;
+	target.name = name;
+	target.scale = scale;
+	target.format = format;
+	target.depth = depth;
+	target.texture = -1;
+	target.first_pass = target.last_pass = -1;
+	this->targets.push_back(target);
+	this->compiled = false;
+	return this->targets.size() - 1;
+}
+
+/**
+ * Add a pass drawing into output, after the existing ones.  With a
+ * program, it draws a full-screen quad whose "v_coord" attribute goes
+ * from -1 to 1, after func set its uniforms; without one, func draws
+ * it, e.g. the scene.
+ */
+int PostGraph::add_pass(const char* name, GLuint program, int output, post_pass_func func, void* data) {
+	post_pass pass;
+	pass.name = name;
+	pass.program = program;
+	pass.attribute_v_coord = -1;
+	pass.uniform_texel_size = -1;
+	if (program != 0) {
+		pass.attribute_v_coord = glGetAttribLocation(program, "v_coord");
+		if (pass.attribute_v_coord == -1)
+			cerr << name << ": could not bind attribute v_coord" << endl;
+		pass.uniform_texel_size = glGetUniformLocation(program, "texel_size");
+	}
+	pass.output = output;
+	pass.func = func;
+	pass.data = data;
+	this->passes.push_back(pass);
+	this->compiled = false;
+	return this->passes.size() - 1;
+}
+
+/**
+ * Make pass read target, through its sampler uniform, and the
+ * <sampler>_scale and <sampler>_max uniforms if the program has them
+ */
+void PostGraph::read(int pass, int target, const char* sampler) {
+	GLuint program = this->passes[pass].program;
+	post_input input;
+	input.target = target;
+	input.uniform = glGetUniformLocation(program, sampler);
+	if (input.uniform == -1)
+		cerr << this->passes[pass].name << ": could not bind uniform " << sampler << endl;
+	input.uniform_scale = glGetUniformLocation(program, (string(sampler) + "_scale").c_str());
+	input.uniform_max = glGetUniformLocation(program, (string(sampler) + "_max").c_str());
+	this->passes[pass].inputs.push_back(input);
+	this->compiled = false;
+}
+
+/* Remove the passes and targets, to declare others; textures are kept */
+void PostGraph::clear() {
+	this->passes.clear();
+	this->targets.clear();
+	this->compiled = false;
+}
+
+/* Size of the texture holding target */
+void PostGraph::target_size(const post_target& target, int* width, int* height) const {
+	*width = max(1, (int)(this->storage_width * target.scale + 0.5f));
+	*height = max(1, (int)(this->storage_height * target.scale + 0.5f));
+}
+
+/* Part of it that is drawn, for the screen size and resolution scale */
+void PostGraph::target_viewport(const post_target& target, int* width, int* height) const {
+	int storage_width, storage_height;
+	target_size(target, &storage_width, &storage_height);
+	float scale = target.scale * this->resolution_scale;
+	*width = min(storage_width, max(1, (int)(this->screen_width * scale + 0.5f)));
+	*height = min(storage_height, max(1, (int)(this->screen_height * scale + 0.5f)));
+}
+
+/**
+ * Storage for a screen dimension: the current one while it is big
+ * enough and not more than twice too big, else half more than it was
+ * when growing, so that dragging a window edge reallocates a few
+ * times instead of at each step.
+ */
+static int storage_size(int current, int needed) {
+	if (needed <= current && needed * 2 > current)
+		return current;
+	if (needed > current && current > 0)
+		return max(needed, current + current / 2);
+	return needed;
+}
+
+static size_t bytes_per_pixel(GLenum format) {
+	return (format == GL_RGBA16F_ARB) ? 8 : 4;
+}
+
+static size_t texture_memory(int width, int height, GLenum format, bool depth) {
+	return (size_t)width * height * (bytes_per_pixel(format) + (depth ? 2 : 0));
+}
+
+bool PostGraph::create_texture(post_texture* t) {
+	this->allocations++;
+	glGenTextures(1, &t->texture);
+	glBindTexture(GL_TEXTURE_2D, t->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, t->format, t->width, t->height, 0, GL_RGBA,
+				 (t->format == GL_RGBA16F_ARB) ? GL_FLOAT : GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (t->rbo_depth != 0) {
+		glGenRenderbuffers(1, &t->rbo_depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, t->rbo_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, t->width, t->height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
+
+	glGenFramebuffers(1, &t->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t->texture, 0);
+	if (t->rbo_depth != 0)
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, t->rbo_depth);
+	GLenum status;
+	if ((status = glCheckFramebufferStatus(GL_FRAMEBUFFER)) != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "glCheckFramebufferStatus: error 0x" << hex << status << dec << endl;
+		switch (status) {
+		case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
+			cerr << "GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT" << endl;
+			break;
+		case GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS:
+			cerr << "GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS" << endl;
+			break;
+		case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
+			cerr << "GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT" << endl;
+			break;
+		case GL_FRAMEBUFFER_UNSUPPORTED:
+			cerr << "GL_FRAMEBUFFER_UNSUPPORTED" << endl;
+			break;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return true;
+}
+
+/**
+ * A texture for target, free from pass on: one that holds the same
+ * size and format and whose last target was read for the last time
+ * before, preferably without a depth buffer it doesn't need, or else
+ * a new one.
+ */
+int PostGraph::find_texture(const post_target& target, int pass, vector<int>& busy_until) {
+	int width, height;
+	target_size(target, &width, &height);
+	int best = -1;
+	for (unsigned int i = 0; i < this->textures.size(); i++) {
+		const post_texture& t = this->textures[i];
+		if (busy_until[i] >= pass || t.width != width || t.height != height || t.format != target.format
+			|| (target.depth && t.rbo_depth == 0))
+			continue;
+		if (best == -1 || (this->textures[best].rbo_depth != 0 && t.rbo_depth == 0))
+			best = i;
+	}
+	if (best != -1)
+		return best;
+
+	post_texture t;
+	t.width = width;
+	t.height = height;
+	t.format = target.format;
+	t.texture = t.fbo = 0;
+	t.rbo_depth = target.depth ? 1 : 0;  // created by create_texture()
+	t.used = false;
+	if (!create_texture(&t))
+		return -1;
+	this->textures.push_back(t);
+	busy_until.push_back(-1);
+	return this->textures.size() - 1;
+}
+
+/**
+ * Place the targets in textures, for this screen size: each target
+ * lives from the first pass that draws it to the last one that reads
+ * or draws it, and then its texture can hold another target.  Textures that are
+ * left unused are freed, e.g. when the storage size changes.
+ */
+bool PostGraph::compile(int screen_width, int screen_height) {
+	this->screen_width = screen_width;
+	this->screen_height = screen_height;
+	this->pending_width = this->pending_height = 0;
+	this->storage_width = storage_size(this->storage_width, screen_width);
+	this->storage_height = storage_size(this->storage_height, screen_height);
+	this->compiled = false;
+
+	for (unsigned int i = 0; i < this->targets.size(); i++) {
+		this->targets[i].texture = -1;
+		this->targets[i].first_pass = this->targets[i].last_pass = -1;
+	}
+	for (unsigned int p = 0; p < this->passes.size(); p++) {
+		const post_pass& pass = this->passes[p];
+		for (unsigned int i = 0; i < pass.inputs.size(); i++) {
+			post_target& target = this->targets[pass.inputs[i].target];
+			if (target.first_pass == -1) {
+				cerr << "Post-processing pass " << pass.name << " reads " << target.name
+					 << " before it is drawn" << endl;
+				return false;
+			}
+			target.last_pass = p;
+		}
+		if (pass.output != POST_SCREEN) {
+			// Drawn again after its last read, it still needs its texture
+			post_target& target = this->targets[pass.output];
+			if (target.first_pass == -1)
+				target.first_pass = p;
+			target.last_pass = p;
+		}
+	}
+
+	for (unsigned int i = 0; i < this->textures.size(); i++)
+		this->textures[i].used = false;
+	vector<int> busy_until(this->textures.size(), -1);  // last pass reading each texture
+	for (unsigned int p = 0; p < this->passes.size(); p++) {
+		int output = this->passes[p].output;
+		if (output == POST_SCREEN || this->targets[output].first_pass != (int)p)
+			continue;
+		post_target& target = this->targets[output];
+		int t = find_texture(target, p, busy_until);
+		if (t == -1)
+			return false;
+		target.texture = t;
+		busy_until[t] = target.last_pass;
+		this->textures[t].used = true;
+	}
+
+	// Free the textures nobody uses any more, e.g. of another size
+	vector<int> remap(this->textures.size(), -1);
+	vector<post_texture> kept;
+	for (unsigned int i = 0; i < this->textures.size(); i++) {
+		post_texture& t = this->textures[i];
+		if (t.used) {
+			remap[i] = kept.size();
+			kept.push_back(t);
+			continue;
+		}
+		glDeleteFramebuffers(1, &t.fbo);
+		if (t.rbo_depth != 0)
+			glDeleteRenderbuffers(1, &t.rbo_depth);
+		glDeleteTextures(1, &t.texture);
+	}
+	this->textures = kept;
+	for (unsigned int i = 0; i < this->targets.size(); i++)
+		if (this->targets[i].texture != -1)
+			this->targets[i].texture = remap[this->targets[i].texture];
+
+	// One timer query per pass and per frame in flight
+	this->timer_queries = GLEW_ARB_timer_query;
+	if (this->timer_queries && this->queries.size() != POST_QUERY_FRAMES * this->passes.size()) {
+		if (!this->queries.empty())
+			glDeleteQueries(this->queries.size(), &this->queries[0]);
+		this->queries.resize(POST_QUERY_FRAMES * this->passes.size());
+		if (!this->queries.empty())
+			glGenQueries(this->queries.size(), &this->queries[0]);
+	}
+	for (int i = 0; i < POST_QUERY_FRAMES; i++)
+		this->query_names[i].clear();
+	this->frame = 0;
+
+	this->compiled = true;
+	return true;
+}
+
+/**
+ * New screen size, e.g. from a window event.  Nothing happens before
+ * the next run(), so that the many events of a window being dragged
+ * cost one change per frame at most, and none while the storage holds
+ * the new size.
+ */
+void PostGraph::resize(int screen_width, int screen_height) {
+	this->pending_width = screen_width;
+	this->pending_height = screen_height;
+}
+
+void PostGraph::fill_stats(post_graph_stats* stats) const {
+	stats->memory = memory(true);
+	stats->memory_unaliased = memory(false);
+	stats->nb_textures = this->textures.size();
+	stats->nb_targets = this->targets.size();
+	stats->allocations = this->allocations;
+	stats->resolution_scale = this->resolution_scale;
+}
+
+/**
+ * Give the timings of the frame measured with this set of queries to
+ * the hook, if the GPU is done with it, and to the resolution scale
+ */
+bool PostGraph::read_queries(int set) {
+	vector<string>& names = this->query_names[set];
+	GLuint* queries = &this->queries[set * this->passes.size()];
+	GLint available = 0;
+	glGetQueryObjectiv(queries[names.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return false;
+
+	post_graph_stats stats;
+	double total_ms = 0;
+	for (unsigned int i = 0; i < names.size(); i++) {
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+		post_pass_stats pass = { names[i].c_str(), ns / 1000000.0 };
+		stats.passes.push_back(pass);
+		total_ms += pass.gpu_ms;
+	}
+	fill_stats(&stats);
+	if (this->hook != NULL)
+		this->hook(stats, this->hook_data);
+	names.clear();
+	update_resolution(total_ms);
+	return true;
+}
+
+/**
+ * Draw all the passes.  Full-screen passes run without depth test or
+ * blending; passes drawn by their func set what they need.
+ */
+void PostGraph::run() {
+	if (this->pending_width != 0) {
+		int width = this->pending_width, height = this->pending_height;
+		this->pending_width = this->pending_height = 0;
+		if (storage_size(this->storage_width, width) != this->storage_width
+			|| storage_size(this->storage_height, height) != this->storage_height) {
+			compile(width, height);
+		} else {
+			this->screen_width = width;
+			this->screen_height = height;
+		}
+	}
+	if (!this->compiled)
+		return;
+
+	// The first frame pays for the new textures and programs: not timed
+	int set = this->frame % POST_QUERY_FRAMES;
+	bool measure = this->timer_queries && !this->passes.empty() && this->frame > 0;
+	if (measure && !this->query_names[set].empty())
+		measure = read_queries(set);  // still running: skip this frame
+	GLuint* queries = measure ? &this->queries[set * this->passes.size()] : NULL;
+
+	for (unsigned int p = 0; p < this->passes.size(); p++) {
+		const post_pass& pass = this->passes[p];
+		int width = this->screen_width, height = this->screen_height;
+		if (pass.output == POST_SCREEN) {
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		} else {
+			const post_target& target = this->targets[pass.output];
+			glBindFramebuffer(GL_FRAMEBUFFER, this->textures[target.texture].fbo);
+			target_viewport(target, &width, &height);
+		}
+		glViewport(0, 0, width, height);
+		if (measure)
+			glBeginQuery(GL_TIME_ELAPSED, queries[p]);
+
+		if (pass.program == 0) {
+			pass.func(pass.data);
+		} else {
+			glDisable(GL_DEPTH_TEST);
+			glDisable(GL_BLEND);
+			glUseProgram(pass.program);
+			for (unsigned int i = 0; i < pass.inputs.size(); i++) {
+				const post_input& input = pass.inputs[i];
+				const post_texture& t = this->textures[this->targets[input.target].texture];
+				glActiveTexture(GL_TEXTURE0 + i);
+				glBindTexture(GL_TEXTURE_2D, t.texture);
+				glUniform1i(input.uniform, i);
+				// Texture coordinates of the part drawn, and clamped to it
+				int drawn_width, drawn_height;
+				target_viewport(this->targets[input.target], &drawn_width, &drawn_height);
+				if (input.uniform_scale != -1)
+					glUniform2f(input.uniform_scale, (float)drawn_width / t.width, (float)drawn_height / t.height);
+				if (input.uniform_max != -1)
+					glUniform2f(input.uniform_max, (drawn_width - 0.5f) / t.width, (drawn_height - 0.5f) / t.height);
+			}
+			if (pass.uniform_texel_size != -1 && !pass.inputs.empty()) {
+				const post_texture& t = this->textures[this->targets[pass.inputs[0].target].texture];
+				glUniform2f(pass.uniform_texel_size, 1.0 / t.width, 1.0 / t.height);
+			}
+			if (pass.func != NULL)
+				pass.func(pass.data);
+
+			static_buffer(GL_ARRAY_BUFFER, shape_screen_quad, sizeof(shape_screen_quad));
+			glEnableVertexAttribArray(pass.attribute_v_coord);
+			glVertexAttribPointer(
+				pass.attribute_v_coord,  // attribute
+				2,                  // number of elements per vertex, here (x,y)
+				GL_FLOAT,           // the type of each element
+				GL_FALSE,           // take our values as-is
+				4*sizeof(GLfloat),  // skip z,w
+				0                   // offset of first element
+			);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+			glDisableVertexAttribArray(pass.attribute_v_coord);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			glActiveTexture(GL_TEXTURE0);
+		}
+
+		if (measure)
+			glEndQuery(GL_TIME_ELAPSED);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, this->screen_width, this->screen_height);
+
+	if (measure) {
+		for (unsigned int p = 0; p < this->passes.size(); p++)
+			this->query_names[set].push_back(this->passes[p].name);
+	} else if (!this->timer_queries && this->hook != NULL) {
+		post_graph_stats stats;
+		for (unsigned int p = 0; p < this->passes.size(); p++) {
+			post_pass_stats pass = { this->passes[p].name.c_str(), -1 };
+			stats.passes.push_back(pass);
+		}
+		fill_stats(&stats);
+		this->hook(stats, this->hook_data);
+	}
+	this->frame++;
+}
+
+void PostGraph::set_stats_hook(post_stats_hook hook, void* data) {
+	this->hook = hook;
+	this->hook_data = data;
+}
+
+/**
+ * Scale the resolution of all targets, down to min_scale of the
+ * screen size, so that a frame takes target_ms on the GPU; 0 draws at
+ * the screen size.  The passes are timed with GL_ARB_timer_query;
+ * without it, call update_resolution() with frame times measured some
+ * other way.
+ */
+void PostGraph::set_dynamic_resolution(double target_ms, float min_scale) {
+	this->target_ms = target_ms;
+	this->min_scale = min(max(min_scale, 1.0f / POST_RESOLUTION_STEP), 1.0f);
+	if (target_ms <= 0)
+		this->resolution_scale = 1;
+}
+
+/**
+ * Move the resolution scale towards what makes a frame take
+ * target_ms, the cost going with the number of pixels.  It moves a
+ * quarter of the way at a time, since frame_ms is a few frames late,
+ * by whole steps so that small variations don't change it, and only
+ * goes up with some margin under target_ms.
+ */
+void PostGraph::update_resolution(double frame_ms) {
+	if (this->target_ms <= 0 || frame_ms <= 0)
+		return;
+	float wanted = this->resolution_scale * sqrt(this->target_ms / frame_ms);
+	float scale = this->resolution_scale + (wanted - this->resolution_scale) * 0.25f;
+	scale = floor(scale * POST_RESOLUTION_STEP + 0.5f) / POST_RESOLUTION_STEP;
+	if (scale > this->resolution_scale && frame_ms > this->target_ms * 0.9)
+		return;
+	this->resolution_scale = min(max(scale, this->min_scale), 1.0f);
+}
+
+float PostGraph::get_resolution_scale() const {
+	return this->resolution_scale;
+}
+
+/* Texture holding target, once compiled */
+GLuint PostGraph::texture(int target) const {
+	return this->textures[this->targets[target].texture].texture;
+}
+
+/* Framebuffer drawing into target, once compiled, e.g. to read it back */
+GLuint PostGraph::framebuffer(int target) const {
+	return this->textures[this->targets[target].texture].fbo;
+}
+
+/**
+ * Bytes in render targets, or with one texture per target, as it
+ * would take without aliasing
+ */
+size_t PostGraph::memory(bool aliased) const {
+	size_t res = 0;
+	if (aliased) {
+		for (unsigned int i = 0; i < this->textures.size(); i++) {
+			const post_texture& t = this->textures[i];
+			res += texture_memory(t.width, t.height, t.format, t.rbo_depth != 0);
+		}
+	} else {
+		for (unsigned int i = 0; i < this->targets.size(); i++) {
+			int width, height;
+			target_size(this->targets[i], &width, &height);
+			res += texture_memory(width, height, this->targets[i].format, this->targets[i].depth);
+		}
+	}
+	return res;
+}
+
+void PostGraph::free_textures() {
+	for (unsigned int i = 0; i < this->textures.size(); i++) {
+		post_texture& t = this->textures[i];
+		glDeleteFramebuffers(1, &t.fbo);
+		if (t.rbo_depth != 0)
+			glDeleteRenderbuffers(1, &t.rbo_depth);
+		glDeleteTextures(1, &t.texture);
+	}
+	this->textures.clear();
+	if (!this->queries.empty())
+		glDeleteQueries(this->queries.size(), &this->queries[0]);
+	this->queries.clear();
+	for (int i = 0; i < POST_QUERY_FRAMES; i++)
+		this->query_names[i].clear();
+	this->compiled = false;
+}
@@ -0,0 +1,138 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _POST_GRAPH_H
+#define _POST_GRAPH_H
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+/*
+ * Post-processing as a list of passes, each one drawing into a render
+ * target and reading from the ones drawn before.  Targets are only
+ * declared (size relative to the screen, format); compile() decides
+ * which textures they go to, and a target whose last pass is done
+ * hands its texture over to the next one that needs the same kind, so
+ * that a chain of effects uses a couple of textures whatever its
+ * length.  Textures are kept from one compile() to the next.
+ *
+ * Textures are sized for the storage size, which only grows, by half
+ * at a time, when the screen outgrows it, and shrinks when the screen
+ * needs less than half of it: in between, targets are drawn into the
+ * bottom-left corner of their texture, and shaders sample it through
+ * the <sampler>_scale and <sampler>_max uniforms.  A resolution scale
+ * shrinks that corner further when frames take too long.
+ */
+
+#define POST_SCREEN -1          // pass output: the window
+#define POST_QUERY_FRAMES 4     // timings are read this many frames late, not to wait for the GPU
+#define POST_RESOLUTION_STEP 32 // the resolution scale moves by 1/32ths
+
+/* Called for each pass: sets its uniforms, or draws it if it has no program */
+typedef void (*post_pass_func)(void* data);
+
+struct post_target {
+	std::string name;
+	float scale;             // of the screen size
+	GLenum format;           // GL_RGBA8, GL_RGBA16F_ARB
+	bool depth;              // with a depth buffer
+	int texture;             // in PostGraph::textures, set by compile()
+	int first_pass, last_pass;  // lifetime, set by compile()
+};
+
+struct post_input {
+	int target;
+	GLint uniform;           // sampler, bound to texture unit <index in inputs>
+	GLint uniform_scale;     // optional vec2 <sampler>_scale: drawn size / texture size
+	GLint uniform_max;       // optional vec2 <sampler>_max: texcoord of the last texel drawn
+};
+
+struct post_pass {
+	std::string name;
+	GLuint program;          // 0: func draws the pass itself
+	GLint attribute_v_coord; // full-screen quad
+	GLint uniform_texel_size;   // optional vec2: 1 / size of the first input
+	std::vector<post_input> inputs;
+	int output;              // target, or POST_SCREEN
+	post_pass_func func;
+	void* data;
+};
+
+/* Storage that targets are placed into */
+struct post_texture {
+	int width, height;       // storage: targets use the bottom-left corner
+	GLenum format;
+	GLuint texture, rbo_depth, fbo;  // rbo_depth: 0 without depth
+	bool used;               // by the current passes
+};
+
+struct post_pass_stats {
+	const char* name;
+	double gpu_ms;           // -1 without GL_ARB_timer_query
+};
+
+struct post_graph_stats {
+	std::vector<post_pass_stats> passes;
+	size_t memory;           // bytes in render targets
+	size_t memory_unaliased; // the same, with one texture per target
+	int nb_textures, nb_targets;
+	int allocations;         // textures created so far
+	float resolution_scale;
+};
+
+/* Instrumentation: called with the timings of a frame, once they are known */
+typedef void (*post_stats_hook)(const post_graph_stats& stats, void* data);
+
+class PostGraph {
+public:
+	std::vector<post_target> targets;
+	std::vector<post_pass> passes;
+	std::vector<post_texture> textures;
+
+	PostGraph();
+	~PostGraph();
+
+	int add_target(const char* name, float scale, GLenum format, bool depth = false);
+	int add_pass(const char* name, GLuint program, int output, post_pass_func func = NULL, void* data = NULL);
+	void read(int pass, int target, const char* sampler);
+	void clear();
+	bool compile(int screen_width, int screen_height);
+	void resize(int screen_width, int screen_height);
+	void run();
+	void set_stats_hook(post_stats_hook hook, void* data);
+	void set_dynamic_resolution(double target_ms, float min_scale = 0.5f);
+	void update_resolution(double frame_ms);
+	float get_resolution_scale() const;
+	GLuint texture(int target) const;
+	GLuint framebuffer(int target) const;
+	size_t memory(bool aliased = true) const;
+	void free_textures();
+
+private:
+	int screen_width, screen_height;
+	int storage_width, storage_height;  // that textures are sized for
+	int pending_width, pending_height;  // from resize(), 0: none
+	float resolution_scale;
+	double target_ms;        // frame time for the resolution scale, 0: fixed
+	float min_scale;
+	int allocations;
+	bool compiled;
+	post_stats_hook hook;
+	void* hook_data;
+	bool timer_queries;
+	// POST_QUERY_FRAMES sets of one query per pass
+	std::vector<GLuint> queries;
+	std::vector<std::string> query_names[POST_QUERY_FRAMES];
+	unsigned int frame;
+
+	void target_size(const post_target& target, int* width, int* height) const;
+	void target_viewport(const post_target& target, int* width, int* height) const;
+	void fill_stats(post_graph_stats* stats) const;
+	int find_texture(const post_target& target, int pass, std::vector<int>& busy_until);
+	bool create_texture(post_texture* texture);
+	bool read_queries(int set);
+};
+#endif
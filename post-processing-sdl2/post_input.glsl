@@ -0,0 +1,12 @@
+/*
+ * The first input of a PostGraph pass, for the post-processing
+ * fragment shaders to #include: fetch() reads it where it is drawn.
+ */
+uniform sampler2D fbo_texture;
+uniform vec2 fbo_texture_scale, fbo_texture_max;  // part drawn and last texel drawn, see PostGraph
+uniform vec2 texel_size;  // 1 / size of fbo_texture
+varying vec2 f_texcoord;
+
+vec4 fetch(vec2 texcoord) {
+  return texture2D(fbo_texture, min(texcoord, fbo_texture_max));
+}
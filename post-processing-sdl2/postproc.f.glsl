@@ -1,9 +1,9 @@
-uniform sampler2D fbo_texture;
+#include "post_input.glsl"
 uniform float offset;
-varying vec2 f_texcoord;
 
 void main(void) {
   vec2 texcoord = f_texcoord;
-  texcoord.x += sin(texcoord.y * 4.0*2.0*3.14159 + offset) / 100.0;
-  gl_FragColor = texture2D(fbo_texture, texcoord);
+  // Same wave whatever part of the texture is drawn
+  texcoord.x += sin(texcoord.y / fbo_texture_scale.y * 4.0*2.0*3.14159 + offset) / 100.0 * fbo_texture_scale.x;
+  gl_FragColor = fetch(texcoord);
 }
@@ -0,0 +1,156 @@
+/**
+ * This file is in the public domain.
+ *
+ * create_program_async() from ../../common-sdl2/shader_utils.cpp, in a
+ * hidden window: a batch of programs polled until ready, a broken
+ * shader failing alone, and programs from the cache ready at once,
+ * their cache files in a temporary directory.
+ *
+ */
+#include <stdio.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <string>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "../../common-sdl2/shader_utils.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define BROKEN_SHADER "broken.f.glsl"
+#define TEST_DIR "test_async_programs.tmp"
+/* The cache files are written next to the vertex shader: a copy of it in TEST_DIR */
+#define CACHED_VSHADER TEST_DIR "/postproc.v.glsl"
+
+static const char* fshaders[] = { "postproc.f.glsl", "blur.f.glsl", "kawase_down.f.glsl", "kawase_up.f.glsl",
+								  "bright.f.glsl", "bloom.f.glsl", "copy.f.glsl", "fxaa.f.glsl", "grade.f.glsl" };
+static const char* defines[] = { NULL, "NB_TAPS=4", NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+#define NB_PROGRAMS (int)(sizeof(fshaders) / sizeof(fshaders[0]))
+
+/* Start them all, poll until they are all ready, then finish them */
+static bool batch(GLuint* programs, const char* vshader = "postproc.v.glsl") {
+	for (int i = 0; i < NB_PROGRAMS; i++)
+		programs[i] = create_program_async(vshader, fshaders[i], defines[i]);
+	int polls = 0, nb_ready = 0;
+	while (nb_ready < NB_PROGRAMS && polls < 1000000) {
+		nb_ready = 0;
+		for (int i = 0; i < NB_PROGRAMS; i++)
+			nb_ready += program_ready(programs[i]);
+		polls++;
+	}
+	printf("  %d programs ready after %d polls\n", NB_PROGRAMS, polls);
+	bool ok = nb_ready == NB_PROGRAMS;
+	for (int i = 0; i < NB_PROGRAMS; i++) {
+		programs[i] = finish_program(programs[i]);
+		GLint link_ok = GL_FALSE;
+		if (programs[i] != 0)
+			glGetProgramiv(programs[i], GL_LINK_STATUS, &link_ok);
+		ok = ok && link_ok;
+	}
+	return ok;
+}
+
+static void free_programs(GLuint* programs) {
+	for (int i = 0; i < NB_PROGRAMS; i++)
+		glDeleteProgram(programs[i]);
+}
+
+static void test_batch() {
+	GLuint programs[NB_PROGRAMS];
+	check("batch: all linked", batch(programs));
+	check("batch: finished twice", finish_program(programs[0]) == programs[0]);
+	free_programs(programs);
+}
+
+static void test_broken() {
+	FILE* out = fopen(BROKEN_SHADER, "w");
+	fprintf(out, "void main(void) { gl_FragColor = undeclared; }\n");
+	fclose(out);
+	GLuint good = create_program_async("postproc.v.glsl", "copy.f.glsl");
+	GLuint broken = create_program_async("postproc.v.glsl", BROKEN_SHADER);
+	GLuint missing = create_program_async("postproc.v.glsl", "missing.f.glsl");
+	check("broken: missing file", missing == 0 && finish_program(missing) == 0);
+	printf("  (an error about %s is expected)\n", BROKEN_SHADER);
+	check("broken: fails", finish_program(broken) == 0 && !glIsProgram(broken));
+	good = finish_program(good);
+	check("broken: others still link", good != 0);
+	glDeleteProgram(good);
+	remove(BROKEN_SHADER);
+}
+
+static bool copy_vshader() {
+	mkdir(TEST_DIR, 0755);
+	FILE* in = fopen("postproc.v.glsl", "rb");
+	FILE* out = fopen(CACHED_VSHADER, "wb");
+	char buf[4096];
+	size_t len;
+	while (in != NULL && out != NULL && (len = fread(buf, 1, sizeof(buf), in)) > 0)
+		fwrite(buf, 1, len, out);
+	if (in != NULL)
+		fclose(in);
+	if (out != NULL)
+		fclose(out);
+	return in != NULL && out != NULL;
+}
+
+/* With the program cache files */
+static void remove_files() {
+	DIR* dir = opendir(TEST_DIR);
+	struct dirent* entry;
+	while (dir != NULL && (entry = readdir(dir)) != NULL)
+		remove((string(TEST_DIR) + "/" + entry->d_name).c_str());
+	if (dir != NULL)
+		closedir(dir);
+	remove(TEST_DIR);
+}
+
+static void test_cache() {
+	if (!copy_vshader()) {
+		check("cache: vertex shader copied", false);
+		remove_files();
+		return;
+	}
+	enable_program_cache(true);
+	GLuint programs[NB_PROGRAMS];
+	bool ok = batch(programs, CACHED_VSHADER);
+	free_programs(programs);
+	int hits, misses;
+	get_program_cache_stats(&hits, &misses);
+	for (int i = 0; i < NB_PROGRAMS; i++)
+		programs[i] = create_program_async(CACHED_VSHADER, fshaders[i], defines[i]);
+	bool ready = true;
+	for (int i = 0; i < NB_PROGRAMS; i++) {
+		ready = ready && program_ready(programs[i]);
+		ok = (programs[i] = finish_program(programs[i])) != 0 && ok;
+	}
+	int hits2, misses2;
+	get_program_cache_stats(&hits2, &misses2);
+	printf("  cache: %d hits, %d misses\n", hits2, misses2);
+	check("cache: all linked", ok && hits + misses == NB_PROGRAMS);
+	check("cache: loaded programs ready at once", ready && hits2 - hits == NB_PROGRAMS && misses2 == misses);
+	free_programs(programs);
+	enable_program_cache(false);
+	remove_files();
+}
+
+int main(int argc, char* argv[]) {
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_Window* window = SDL_CreateWindow("test_async_programs", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		64, 64, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (window == NULL || SDL_GL_CreateContext(window) == NULL) {
+		fprintf(stderr, "Error: no OpenGL context: %s\n", SDL_GetError());
+		return 1;
+	}
+	if (glewInit() != GLEW_OK || !GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error: no OpenGL 2.0\n");
+		return 1;
+	}
+	printf("parallel shader compile: %s\n", GLEW_KHR_parallel_shader_compile ? "yes" : "no");
+
+	test_batch();
+	test_broken();
+	test_cache();
+
+	return check_summary();
+}
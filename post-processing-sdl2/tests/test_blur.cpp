@@ -0,0 +1,144 @@
+/**
+ * This file is in the public domain.
+ *
+ * CPU test of ../blur_kernel.cpp on golden images (impulse, edge,
+ * checkerboard, noise): the Gaussian blur with two texels per fetch
+ * against the texel by texel one, and what the dual filter keeps.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "../blur_kernel.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define WIDTH 64
+#define HEIGHT 48
+
+/* Same images as test_blur_gpu.cpp */
+static blur_image golden(int which) {
+	blur_image image(WIDTH, HEIGHT);
+	unsigned int seed = 12345;
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			glm::vec4& p = image.at(x, y);
+			switch (which) {
+			case 0:  // impulse
+				p = (x == WIDTH/2 && y == HEIGHT/2) ? glm::vec4(1) : glm::vec4(0, 0, 0, 1);
+				break;
+			case 1:  // edge
+				p = (x < WIDTH/3) ? glm::vec4(1, 0.5, 0.25, 1) : glm::vec4(0, 0.25, 1, 1);
+				break;
+			case 2:  // checkerboard
+				p = ((x/4 + y/4) % 2) ? glm::vec4(1) : glm::vec4(0, 0, 0, 1);
+				break;
+			default:  // noise
+				for (int c = 0; c < 3; c++) {
+					seed = seed * 1103515245 + 12345;
+					p[c] = ((seed >> 16) & 0xff) / 255.0f;
+				}
+				p.a = 1;
+			}
+		}
+	}
+	return image;
+}
+static const char* golden_names[] = { "impulse", "edge", "checkerboard", "noise" };
+
+static glm::vec4 image_sum(const blur_image& image) {
+	glm::vec4 sum(0);
+	for (size_t i = 0; i < image.pixels.size(); i++)
+		sum += image.pixels[i];
+	return sum;
+}
+
+static void test_kernels() {
+	bool normalized = true, fewer = true;
+	for (float sigma = 0.5; sigma < 10; sigma += 0.5) {
+		blur_kernel k = blur_linear_kernel(sigma);
+		float sum = k.weights[0];
+		for (int i = 1; i < k.nb_taps; i++)
+			sum += 2 * k.weights[i];
+		normalized = normalized && fabs(sum - 1) < 1e-5;
+		fewer = fewer && k.nb_taps <= BLUR_MAX_TAPS && k.nb_taps == 1 + (k.radius + 1) / 2;
+	}
+	check("kernels: weights sum to 1", normalized);
+	check("kernels: 1 + ceil(r/2) fetches per side", fewer);
+	blur_kernel k = blur_linear_kernel(2);
+	printf("  sigma 2: radius %d, %d fetches instead of %d\n", k.radius, 2 * k.nb_taps - 1, 2 * k.radius + 1);
+}
+
+static void test_gaussian() {
+	float sigmas[] = { 0.8, 2, 4, 7 };
+	for (int g = 0; g < 4; g++) {
+		blur_image image = golden(g);
+		float worst = 0;
+		for (int s = 0; s < 4; s++) {
+			blur_kernel k = blur_linear_kernel(sigmas[s]);
+			for (int h = 0; h < 2; h++) {
+				blur_image linear = blur_gaussian_linear(image, k, h, WIDTH, HEIGHT);
+				blur_image reference = blur_gaussian_reference(image, k.sigma, k.radius, h);
+				worst = max(worst, blur_max_difference(linear, reference));
+			}
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "gaussian, %s: two texels per fetch as texel by texel", golden_names[g]);
+		printf("  max difference %g\n", worst);
+		check(name, worst < 1e-5);
+	}
+
+	// The impulse response is the kernel in both directions
+	blur_kernel k = blur_linear_kernel(3);
+	blur_image impulse = golden(0);
+	blur_image b = blur_gaussian_linear(blur_gaussian_linear(impulse, k, true, WIDTH, HEIGHT), k, false,
+		WIDTH, HEIGHT);
+	vector<float> w;
+	blur_discrete_weights(k.sigma, k.radius, &w);
+	bool separable = true;
+	for (int dy = -k.radius; dy <= k.radius; dy++)
+		for (int dx = -k.radius; dx <= k.radius; dx++)
+			separable = separable && fabs(b.at(WIDTH/2 + dx, HEIGHT/2 + dy).r - w[abs(dx)] * w[abs(dy)]) < 1e-6;
+	check("gaussian: impulse response", separable);
+	check("gaussian: energy kept", fabs(image_sum(b).r - 1) < 1e-5);
+}
+
+static void test_kawase() {
+	// Constant images stay the same
+	blur_image flat(WIDTH, HEIGHT);
+	for (size_t i = 0; i < flat.pixels.size(); i++)
+		flat.pixels[i] = glm::vec4(0.25, 0.5, 0.75, 1);
+	blur_image down = blur_kawase_down(flat);
+	blur_image up = blur_kawase_up(down, WIDTH, HEIGHT);
+	check("dual filter: down to half size", down.width == WIDTH/2 && down.height == HEIGHT/2);
+	check("dual filter: flat stays flat", blur_max_difference(up, flat) < 1e-6);
+
+	// Away from the edges, each level keeps the energy, spread out
+	blur_image impulse = golden(0);
+	blur_image d1 = blur_kawase_down(impulse), d2 = blur_kawase_down(d1);
+	blur_image u2 = blur_kawase_up(d2, d1.width, d1.height), u1 = blur_kawase_up(u2, WIDTH, HEIGHT);
+	float e0 = image_sum(impulse).r, e1 = image_sum(d1).r * 4, e2 = image_sum(d2).r * 16;
+	float e3 = image_sum(u2).r * 4, e4 = image_sum(u1).r;
+	printf("  energy: %g %g %g %g %g\n", e0, e1, e2, e3, e4);
+	check("dual filter: energy kept", fabs(e1 - e0) < 1e-5 && fabs(e2 - e0) < 1e-5
+		&& fabs(e3 - e0) < 1e-5 && fabs(e4 - e0) < 1e-5);
+	float peak = 0;
+	for (size_t i = 0; i < u1.pixels.size(); i++)
+		peak = max(peak, u1.pixels[i].r);
+	check("dual filter: spread out", peak < 0.05);
+
+	// Bright pass
+	blur_image bright = blur_bright(golden(2), 0.5, WIDTH/2, HEIGHT/2);
+	blur_image dark = blur_bright(flat, 0.6, WIDTH/2, HEIGHT/2);
+	check("bright: nothing under the threshold", image_sum(dark).r == 0 && image_sum(dark).b == 0);
+	check("bright: something over it", image_sum(bright).r > 0);
+}
+
+int main() {
+	test_kernels();
+	test_gaussian();
+	test_kawase();
+
+	return check_summary();
+}
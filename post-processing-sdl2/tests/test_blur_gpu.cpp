@@ -0,0 +1,170 @@
+/**
+ * This file is in the public domain.
+ *
+ * The blurs of ../post_blur.cpp drawn by the GPU, in a hidden window,
+ * against ../blur_kernel.cpp on the golden images of test_blur.cpp,
+ * 8 bits per channel.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "../post_graph.h"
+#include "../post_blur.h"
+#include "../../common-sdl2/geometry_pool.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define WIDTH 64
+#define HEIGHT 48
+/* Rounding to 8 bits after each of up to 6 passes, and the GPU's own linear filtering precision */
+#define TOLERANCE (4.0 / 255)
+
+static blur_image golden(int which) {
+	blur_image image(WIDTH, HEIGHT);
+	unsigned int seed = 12345;
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			glm::vec4& p = image.at(x, y);
+			switch (which) {
+			case 0:
+				p = (x == WIDTH/2 && y == HEIGHT/2) ? glm::vec4(1) : glm::vec4(0, 0, 0, 1);
+				break;
+			case 1:
+				p = (x < WIDTH/3) ? glm::vec4(1, 0.5, 0.25, 1) : glm::vec4(0, 0.25, 1, 1);
+				break;
+			case 2:
+				p = ((x/4 + y/4) % 2) ? glm::vec4(1) : glm::vec4(0, 0, 0, 1);
+				break;
+			default:
+				for (int c = 0; c < 3; c++) {
+					seed = seed * 1103515245 + 12345;
+					p[c] = ((seed >> 16) & 0xff) / 255.0f;
+				}
+				p.a = 1;
+			}
+		}
+	}
+	return image;
+}
+static const char* golden_names[] = { "impulse", "edge", "checkerboard", "noise" };
+
+/* First pass of each graph: the golden image in a target */
+struct upload_data {
+	PostGraph* graph;
+	int target;
+	const blur_image* image;
+};
+
+static void upload(void* data) {
+	upload_data* u = (upload_data*)data;
+	glBindTexture(GL_TEXTURE_2D, u->graph->texture(u->target));
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, u->image->width, u->image->height, GL_RGBA, GL_FLOAT,
+					&u->image->pixels[0]);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static blur_image read_back(PostGraph* graph, int target) {
+	const post_texture& t = graph->textures[graph->targets[target].texture];
+	blur_image res(t.width, t.height);
+	glBindFramebuffer(GL_FRAMEBUFFER, graph->framebuffer(target));
+	glReadPixels(0, 0, t.width, t.height, GL_RGBA, GL_FLOAT, &res.pixels[0]);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return res;
+}
+
+static blur_image composite(const blur_image& scene, const blur_image& bloom, float intensity) {
+	blur_image res(scene.width, scene.height);
+	for (int y = 0; y < res.height; y++) {
+		for (int x = 0; x < res.width; x++) {
+			glm::vec2 texcoord((x + 0.5f) / res.width, (y + 0.5f) / res.height);
+			glm::vec4 s = blur_sample(scene, texcoord);
+			res.at(x, y) = glm::vec4(glm::vec3(s) + glm::vec3(blur_sample(bloom, texcoord)) * intensity, s.a);
+		}
+	}
+	return res;
+}
+
+enum { GAUSSIAN_FULL, GAUSSIAN_HALF, BLOOM };
+
+/* Run one blur on the GPU and the CPU, return the largest difference */
+static float compare(PostBlur* blur, int which, const blur_image& image) {
+	PostGraph graph;
+	int source = graph.add_target("golden", 1, GL_RGBA8);
+	int result = graph.add_target("result", 1, GL_RGBA8);
+	blur_image input = blur_quantize(image);
+	upload_data data = { &graph, source, &input };
+	graph.add_pass("upload", 0, source, upload, &data);
+
+	blur_image expected;
+	float sigma = 3;
+	blur_kernel k;
+	switch (which) {
+	case GAUSSIAN_FULL:
+		blur->gaussian(&graph, source, result, sigma, 1);
+		k = blur_linear_kernel(sigma);
+		expected = blur_quantize(blur_gaussian_linear(input, k, true, WIDTH, HEIGHT));
+		expected = blur_quantize(blur_gaussian_linear(expected, k, false, WIDTH, HEIGHT));
+		break;
+	case GAUSSIAN_HALF: {
+		blur->gaussian(&graph, source, result, sigma, 0.5);
+		k = blur_linear_kernel(sigma * 0.5);
+		blur_image small = blur_quantize(blur_resample(input, WIDTH/2, HEIGHT/2));
+		small = blur_quantize(blur_gaussian_linear(small, k, true, WIDTH/2, HEIGHT/2));
+		small = blur_quantize(blur_gaussian_linear(small, k, false, WIDTH/2, HEIGHT/2));
+		expected = blur_quantize(blur_resample(small, WIDTH, HEIGHT));
+		break;
+	}
+	case BLOOM: {
+		blur->bloom(&graph, source, result, 3, 0.5, 1.0);
+		blur_image level = blur_quantize(blur_bright(input, 0.5, WIDTH/2, HEIGHT/2));
+		blur_image d1 = blur_quantize(blur_kawase_down(level));
+		blur_image d2 = blur_quantize(blur_kawase_down(d1));
+		blur_image u1 = blur_quantize(blur_kawase_up(d2, d1.width, d1.height));
+		blur_image u0 = blur_quantize(blur_kawase_up(u1, level.width, level.height));
+		expected = blur_quantize(composite(input, u0, 1.0));
+		break;
+	}
+	}
+	if (!graph.compile(WIDTH, HEIGHT))
+		return 1e30;
+	graph.run();
+	blur_image res = read_back(&graph, result);
+	blur->clear();
+	graph.free_textures();
+	return blur_max_difference(res, expected);
+}
+
+int main(int argc, char* argv[]) {
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_Window* window = SDL_CreateWindow("test_blur_gpu", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		WIDTH, HEIGHT, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (window == NULL || SDL_GL_CreateContext(window) == NULL) {
+		fprintf(stderr, "Error: no OpenGL context: %s\n", SDL_GetError());
+		return 1;
+	}
+	if (glewInit() != GLEW_OK || !GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error: no OpenGL 2.0\n");
+		return 1;
+	}
+
+	PostBlur blur;
+	if (!blur.init())
+		return 1;
+	const char* blur_names[] = { "gaussian", "gaussian at half size", "bloom" };
+	for (int which = 0; which < 3; which++) {
+		for (int g = 0; g < 4; g++) {
+			float diff = compare(&blur, which, golden(g));
+			char name[64];
+			snprintf(name, sizeof(name), "%s, %s", blur_names[which], golden_names[g]);
+			printf("  max difference %.2f/255\n", diff * 255);
+			check(name, diff <= TOLERANCE);
+		}
+	}
+	blur.free();
+	free_geometry_pool();
+
+	return check_summary();
+}
@@ -0,0 +1,135 @@
+/**
+ * This file is in the public domain.
+ *
+ * ../../common-sdl2/file_view.cpp on files written to a temporary
+ * directory: views of files, empty and missing ones, pack files read
+ * without the files on disk, and damaged packs refused.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "../../common-sdl2/shader_utils.h"
+#include "../../common-sdl2/file_view.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define TEST_DIR "test_file_view.tmp"
+#define PACK TEST_DIR "/test.pack"
+
+static void write_file(const char* filename, const string& content) {
+	FILE* out = fopen(filename, "wb");
+	fwrite(content.data(), 1, content.size(), out);
+	fclose(out);
+}
+
+static bool view_is(const char* filename, const string& content, int flags = 0) {
+	file_view view(filename, flags);
+	return view.is_open() && view.size() == content.size() && memcmp(view.data(), content.data(), content.size()) == 0;
+}
+
+static const char* names[] = { TEST_DIR "/b.glsl", TEST_DIR "/a.obj", TEST_DIR "/empty", TEST_DIR "/big.bin" };
+#define NB_NAMES (int)(sizeof(names) / sizeof(names[0]))
+static string contents[NB_NAMES];
+
+static void write_files() {
+	mkdir(TEST_DIR, 0755);
+	contents[0] = "void main(void) { gl_FragColor = vec4(1.0); }\n";
+	contents[1] = "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+	contents[2] = "";
+	// A page exactly, with no NUL after it
+	contents[3] = string(4096, 'x');
+	for (int i = 0; i < NB_NAMES; i++)
+		write_file(names[i], contents[i]);
+}
+
+static void test_views() {
+	bool ok = true;
+	for (int i = 0; i < NB_NAMES; i++)
+		ok = ok && view_is(names[i], contents[i]) && view_is(names[i], contents[i], FILE_VIEW_SEQUENTIAL);
+	check("view: content", ok);
+	file_view missing(TEST_DIR "/missing");
+	check("view: missing file", !missing.is_open() && missing.data() == NULL);
+	file_view view(names[0]);
+	view.close();
+	check("view: closed", !view.is_open() && view.size() == 0);
+
+	int size = 0;
+	char* text = file_read(names[3], &size);
+	check("file_read: NUL-terminated copy", text != NULL && size == 4096 && text[4096] == '\0');
+	free(text);
+
+	file_view rw_view(names[1]);
+	SDL_RWops* rw = rw_view.rwops();
+	char buffer[64] = { 0 };
+	size_t nb = rw != NULL ? SDL_RWread(rw, buffer, 1, sizeof(buffer)) : 0;
+	if (rw != NULL)
+		SDL_RWclose(rw);
+	check("view: rwops", nb == contents[1].size() && contents[1] == buffer);
+}
+
+static void test_pack() {
+	vector<string> files(names, names + NB_NAMES);
+	check("pack: written", file_pack_write(PACK, files));
+	files.push_back(names[0]);
+	printf("  (an error about %s given twice is expected)\n", names[0]);
+	check("pack: same file twice refused", !file_pack_write(TEST_DIR "/twice.pack", files));
+
+	check("pack: opened", file_pack_open(PACK));
+	// Only in the pack from now on
+	for (int i = 0; i < NB_NAMES; i++)
+		remove(names[i]);
+	bool ok = true;
+	for (int i = 0; i < NB_NAMES; i++)
+		ok = ok && view_is(names[i], contents[i]);
+	check("pack: files read from it", ok);
+	check("pack: not with FILE_VIEW_NO_PACK", !file_view(names[0], FILE_VIEW_NO_PACK).is_open());
+	check("pack: other files not in it", !file_view(TEST_DIR "/a.ob").is_open()
+		  && !file_view(TEST_DIR "/a.objx").is_open() && !file_view("b.glsl").is_open());
+	file_view packed(names[1]);
+	check("pack: data aligned to 16", ((uintptr_t)packed.data() & 15) == 0);
+	packed.close();
+
+	// A newer file of the same name, in a pack opened later
+	write_file(names[1], "v 2 2 2\n");
+	vector<string> newer(1, names[1]);
+	file_pack_write(TEST_DIR "/newer.pack", newer);
+	check("pack: last opened first", file_pack_open(TEST_DIR "/newer.pack") && view_is(names[1], "v 2 2 2\n"));
+	file_pack_close();
+	check("pack: closed", !file_view(names[0]).is_open());
+	remove(names[1]);
+	remove(TEST_DIR "/newer.pack");
+}
+
+static void test_damaged() {
+	file_view pack(PACK, FILE_VIEW_NO_PACK);
+	string content(pack.data(), pack.size());
+	pack.close();
+	printf("  (errors about damaged.pack are expected)\n");
+	write_file(TEST_DIR "/damaged.pack", content.substr(0, content.size() - 1));
+	check("damaged: truncated", !file_pack_open(TEST_DIR "/damaged.pack"));
+	string other = content;
+	other[8] = 99;
+	write_file(TEST_DIR "/damaged.pack", other);
+	check("damaged: other version", !file_pack_open(TEST_DIR "/damaged.pack"));
+	write_file(TEST_DIR "/damaged.pack", "FILEPAK");
+	check("damaged: header only in part", !file_pack_open(TEST_DIR "/damaged.pack"));
+	check("damaged: missing", !file_pack_open(TEST_DIR "/missing.pack"));
+	remove(TEST_DIR "/damaged.pack");
+	remove(PACK);
+	remove(TEST_DIR);
+}
+
+int main(int argc, char* argv[]) {
+	write_files();
+	test_views();
+	test_pack();
+	test_damaged();
+
+	return check_summary();
+}
@@ -0,0 +1,124 @@
+/**
+ * This file is in the public domain.
+ *
+ * Shaders reloaded by ../../common-sdl2/file_watch.cpp, in a hidden
+ * window, on shaders written to a temporary directory: an edit, an
+ * editor saving by renaming, an included file, a broken shader and a
+ * missing uniform keeping the last good program.
+ */
+#include <stdio.h>
+#include <sys/stat.h>
+#include <string>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "../../common-sdl2/shader_utils.h"
+#include "../../common-sdl2/file_watch.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define TEST_DIR "test_hot_reload.tmp"
+/* Beyond the once per second of the modification times, where there is no inotify */
+#define TIMEOUT_MS 3000
+
+static void write_file(const char* filename, const char* text) {
+	FILE* out = fopen(filename, "w");
+	fputs(text, out);
+	fclose(out);
+}
+
+/* Saved the way many editors do */
+static void write_file_renamed(const char* filename, const char* text) {
+	string tmp = string(filename) + ".swp";
+	write_file(tmp.c_str(), text);
+	rename(tmp.c_str(), filename);
+}
+
+static const char* vshader =
+	"attribute vec2 v_coord;\n"
+	"void main(void) { gl_Position = vec4(v_coord, 0.0, 1.0); }\n";
+
+static const char* fshader(const char* uniform) {
+	static string text;
+	text = string("#include \"color.glsl\"\n"
+				  "uniform float ") + uniform + ";\n"
+		"void main(void) { gl_FragColor = color() * " + uniform + "; }\n";
+	return text.c_str();
+}
+
+static GLint uniform_scale = -1;
+
+static bool locations(GLuint program, void* data) {
+	GLint scale = get_uniform(program, "scale");
+	if (scale == -1)
+		return false;
+	uniform_scale = scale;
+	return true;
+}
+
+/* Frames until a program is replaced, or -1 */
+static int frames_to_reload() {
+	unsigned int start = SDL_GetTicks();
+	for (int frame = 0; SDL_GetTicks() - start < TIMEOUT_MS; frame++) {
+		if (reload_programs() > 0)
+			return frame;
+		SDL_Delay(1);
+	}
+	return -1;
+}
+
+int main(int argc, char* argv[]) {
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_Window* window = SDL_CreateWindow("test_hot_reload", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		64, 64, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (window == NULL || SDL_GL_CreateContext(window) == NULL) {
+		fprintf(stderr, "Error: no OpenGL context: %s\n", SDL_GetError());
+		return 1;
+	}
+	if (glewInit() != GLEW_OK || !GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error: no OpenGL 2.0\n");
+		return 1;
+	}
+
+	mkdir(TEST_DIR, 0755);
+	write_file(TEST_DIR "/main.v.glsl", vshader);
+	write_file(TEST_DIR "/main.f.glsl", fshader("scale"));
+	write_file(TEST_DIR "/color.glsl", "vec4 color() { return vec4(1.0); }\n");
+	GLuint program = create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl");
+	check("start", program != 0 && locations(program, NULL));
+	check("watch", watch_program(&program, TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl", NULL, locations));
+	check("nothing changed", reload_programs() == 0);
+
+	GLuint before = program;
+	write_file(TEST_DIR "/main.f.glsl", (string("// edited\n") + fshader("scale")).c_str());
+	int frames = frames_to_reload();
+	printf("  reloaded after %d frames\n", frames);
+	check("edit: replaced", frames >= 0 && program != before && !glIsProgram(before)
+		  && uniform_scale == glGetUniformLocation(program, "scale"));
+
+	before = program;
+	write_file_renamed(TEST_DIR "/main.f.glsl", fshader("scale"));
+	check("saved by renaming: replaced", frames_to_reload() >= 0 && program != before);
+
+	before = program;
+	write_file(TEST_DIR "/color.glsl", "vec4 color() { return vec4(0.5); }\n");
+	check("included file: replaced", frames_to_reload() >= 0 && program != before);
+
+	before = program;
+	printf("  (errors about main.f.glsl are expected)\n");
+	write_file(TEST_DIR "/main.f.glsl", "void main(void) { gl_FragColor = undeclared; }\n");
+	check("broken: last good program kept", frames_to_reload() == -1 && program == before && glIsProgram(program));
+	write_file(TEST_DIR "/main.f.glsl", fshader("other"));
+	check("missing uniform: last good program kept", frames_to_reload() == -1 && program == before);
+	write_file(TEST_DIR "/main.f.glsl", fshader("scale"));
+	check("fixed: replaced", frames_to_reload() >= 0 && program != before);
+
+	unwatch_programs();
+	glDeleteProgram(program);
+	remove(TEST_DIR "/main.v.glsl");
+	remove(TEST_DIR "/main.f.glsl");
+	remove(TEST_DIR "/color.glsl");
+	remove(TEST_DIR);
+
+	return check_summary();
+}
@@ -0,0 +1,173 @@
+/**
+ * This file is in the public domain.
+ *
+ * Placement of the render targets of ../post_graph.cpp in textures, in
+ * a hidden window: which targets share a texture, the demo's chain,
+ * targets drawn again after their last read, and textures kept from
+ * one compile() to the next.
+ */
+#include <stdio.h>
+#include <vector>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "../post_graph.h"
+#include "../../common-sdl2/shader_utils.h"
+#include "../../common-sdl2/geometry_pool.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define WIDTH 64
+#define HEIGHT 48
+
+static GLuint program_copy;
+
+static void clear_red(void* data) {
+	glClearColor(1, 0, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static void clear_green(void* data) {
+	glClearColor(0, 1, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+/* A full-screen pass copying from one target into another */
+static int copy(PostGraph* graph, const char* name, int from, int to) {
+	int pass = graph->add_pass(name, program_copy, to);
+	graph->read(pass, from, "fbo_texture");
+	return pass;
+}
+
+/* The chain of post-processing.cpp with its three effects on: scene -> wave -> fxaa -> grade */
+static void declare_demo_chain(PostGraph* graph, int* targets) {
+	targets[0] = graph->add_target("scene", 1, GL_RGBA8, true);
+	graph->add_pass("scene", 0, targets[0], clear_red);
+	targets[1] = graph->add_target("wave", 1, GL_RGBA8);
+	copy(graph, "wave", targets[0], targets[1]);
+	targets[2] = graph->add_target("fxaa", 1, GL_RGBA8);
+	copy(graph, "fxaa", targets[1], targets[2]);
+	copy(graph, "grade", targets[2], POST_SCREEN);
+}
+
+static void test_demo_chain() {
+	PostGraph graph;
+	int t[3];
+	declare_demo_chain(&graph, t);
+	check("demo chain: compiled", graph.compile(800, 600));
+	printf("  %zu targets in %zu textures, %.1f MiB instead of %.1f MiB\n", graph.targets.size(),
+		   graph.textures.size(), graph.memory() / 1048576.0, graph.memory(false) / 1048576.0);
+	check("demo chain: 3 targets in 2 textures", graph.targets.size() == 3 && graph.textures.size() == 2);
+	check("demo chain: fxaa takes the scene's texture once wave has read it",
+		  graph.texture(t[2]) == graph.texture(t[0]) && graph.texture(t[1]) != graph.texture(t[0]));
+	check("demo chain: aliasing saves a target", graph.memory() < graph.memory(false));
+	graph.free_textures();
+}
+
+/* Targets of another size or format never share */
+static void test_kinds() {
+	PostGraph graph;
+	int full = graph.add_target("full", 1, GL_RGBA8);
+	graph.add_pass("full", 0, full, clear_red);
+	int half = graph.add_target("half", 0.5, GL_RGBA8);
+	copy(&graph, "half", full, half);
+	int hdr = graph.add_target("hdr", 1, GL_RGBA16F_ARB);
+	copy(&graph, "hdr", half, hdr);
+	int last = graph.add_target("last", 1, GL_RGBA8);
+	copy(&graph, "last", hdr, last);
+	copy(&graph, "screen", last, POST_SCREEN);
+	graph.compile(WIDTH, HEIGHT);
+	check("kinds: one texture per size and format", graph.textures.size() == 3
+		  && graph.texture(full) != graph.texture(half) && graph.texture(full) != graph.texture(hdr)
+		  && graph.texture(half) != graph.texture(hdr));
+	check("kinds: same kind, reused", graph.texture(last) == graph.texture(full));
+	graph.free_textures();
+}
+
+/*
+ * a is drawn again after b, its last reader, copied it: c must not
+ * take a's texture in between, or the second drawing of a overwrites it
+ */
+static void test_second_writer() {
+	PostGraph graph;
+	int a = graph.add_target("a", 1, GL_RGBA8);
+	int b = graph.add_target("b", 1, GL_RGBA8);
+	int c = graph.add_target("c", 1, GL_RGBA8);
+	graph.add_pass("a", 0, a, clear_red);
+	copy(&graph, "b", a, b);
+	copy(&graph, "c", b, c);
+	graph.add_pass("a again", 0, a, clear_green);
+	copy(&graph, "screen", c, POST_SCREEN);
+	graph.compile(WIDTH, HEIGHT);
+	check("second writer: lives until then", graph.targets[a].last_pass == 3);
+	check("second writer: texture not shared", graph.texture(c) != graph.texture(a));
+
+	graph.run();
+	unsigned char pixel[4];
+	glReadPixels(WIDTH / 2, HEIGHT / 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+	check("second writer: first drawing on screen", pixel[0] == 255 && pixel[1] == 0);
+	graph.free_textures();
+}
+
+/* Declared again, e.g. when an effect is toggled: the same textures, nothing allocated */
+static void test_recompile() {
+	PostGraph graph;
+	int t[3];
+	declare_demo_chain(&graph, t);
+	graph.compile(WIDTH, HEIGHT);
+	vector<GLuint> before;
+	for (unsigned int i = 0; i < graph.textures.size(); i++)
+		before.push_back(graph.textures[i].texture);
+
+	graph.clear();
+	declare_demo_chain(&graph, t);
+	graph.compile(WIDTH, HEIGHT);
+	bool same = graph.textures.size() == before.size();
+	for (unsigned int i = 0; same && i < before.size(); i++)
+		same = graph.textures[i].texture == before[i];
+	check("recompile: same textures", same);
+
+	// One effect off: the scene and the last effect, one texture less
+	graph.clear();
+	int scene = graph.add_target("scene", 1, GL_RGBA8, true);
+	graph.add_pass("scene", 0, scene, clear_red);
+	int wave = graph.add_target("wave", 1, GL_RGBA8);
+	copy(&graph, "wave", scene, wave);
+	copy(&graph, "grade", wave, POST_SCREEN);
+	graph.compile(WIDTH, HEIGHT);
+	bool kept = graph.textures.size() == 2;
+	for (unsigned int i = 0; kept && i < graph.textures.size(); i++)
+		kept = graph.textures[i].texture == before[i];
+	check("recompile: shorter chain, textures kept", kept);
+
+	// Another size: new textures, the old ones freed
+	graph.compile(WIDTH * 4, HEIGHT * 4);
+	check("recompile: another size", graph.textures.size() == 2 && graph.textures[0].width == WIDTH * 4
+		  && !glIsTexture(before[0]) && !glIsTexture(before[1]));
+	graph.free_textures();
+}
+
+int main(int argc, char* argv[]) {
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_Window* window = SDL_CreateWindow("test_post_graph", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		WIDTH, HEIGHT, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (window == NULL || SDL_GL_CreateContext(window) == NULL) {
+		fprintf(stderr, "Error: no OpenGL context: %s\n", SDL_GetError());
+		return 1;
+	}
+	if (glewInit() != GLEW_OK || !GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error: no OpenGL 2.0\n");
+		return 1;
+	}
+	if ((program_copy = create_program("postproc.v.glsl", "copy.f.glsl")) == 0)
+		return 1;
+
+	test_demo_chain();
+	test_kinds();
+	test_second_writer();
+	test_recompile();
+
+	glDeleteProgram(program_copy);
+	free_geometry_pool();
+	return check_summary();
+}
@@ -0,0 +1,201 @@
+/**
+ * This file is in the public domain.
+ *
+ * Resizing ../post_graph.cpp, in a hidden window: the blurs drawn in
+ * the corner of bigger textures give the same pixels as in textures of
+ * the exact size, dragging a window edge reallocates a few times, and
+ * the resolution scale follows the frame time.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "../post_graph.h"
+#include "../post_blur.h"
+#include "../../common-sdl2/geometry_pool.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define WIDTH 60
+#define HEIGHT 44
+#define BIG_WIDTH 96
+#define BIG_HEIGHT 72
+/* Texture coordinates computed differently, rounding to 8 bits */
+#define TOLERANCE (1.0 / 255)
+
+/* Edge and noise: what the right and top sides of a blur would spill */
+static blur_image golden() {
+	blur_image image(WIDTH, HEIGHT);
+	unsigned int seed = 12345;
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			glm::vec4& p = image.at(x, y);
+			for (int c = 0; c < 3; c++) {
+				seed = seed * 1103515245 + 12345;
+				p[c] = ((seed >> 16) & 0xff) / 255.0f * 0.5f + ((x > WIDTH - 8 || y > HEIGHT - 8) ? 0.5f : 0);
+			}
+			p.a = 1;
+		}
+	}
+	return image;
+}
+
+struct upload_data {
+	PostGraph* graph;
+	int target;
+	const blur_image* image;
+};
+
+/* The golden image in the corner of the target's texture */
+static void upload(void* data) {
+	upload_data* u = (upload_data*)data;
+	glBindTexture(GL_TEXTURE_2D, u->graph->texture(u->target));
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, u->image->width, u->image->height, GL_RGBA, GL_FLOAT,
+					&u->image->pixels[0]);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/* What is left beyond the corner from a bigger frame */
+static void fill_white(PostGraph* graph) {
+	for (unsigned int i = 0; i < graph->textures.size(); i++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, graph->textures[i].fbo);
+		glViewport(0, 0, graph->textures[i].width, graph->textures[i].height);
+		glClearColor(1, 1, 1, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+enum { GAUSSIAN_FULL, GAUSSIAN_HALF, BLOOM };
+
+/* Draw the golden image through a blur, in a graph first compiled for width x height */
+static blur_image draw(PostBlur* blur, int which, int width, int height) {
+	PostGraph graph;
+	int source = graph.add_target("golden", 1, GL_RGBA8);
+	int result = graph.add_target("result", 1, GL_RGBA8);
+	blur_image input = blur_quantize(golden());
+	upload_data data = { &graph, source, &input };
+	graph.add_pass("upload", 0, source, upload, &data);
+	if (which == GAUSSIAN_FULL)
+		blur->gaussian(&graph, source, result, 3, 1);
+	else if (which == GAUSSIAN_HALF)
+		blur->gaussian(&graph, source, result, 3, 0.5);
+	else
+		blur->bloom(&graph, source, result, 4, 0.5, 1.0);
+
+	blur_image res(WIDTH, HEIGHT);
+	if (graph.compile(width, height)) {
+		fill_white(&graph);
+		graph.resize(WIDTH, HEIGHT);
+		graph.run();
+		glBindFramebuffer(GL_FRAMEBUFFER, graph.framebuffer(result));
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_FLOAT, &res.pixels[0]);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	blur->clear();
+	graph.free_textures();
+	return res;
+}
+
+static void test_corner(PostBlur* blur) {
+	const char* names[] = { "gaussian", "gaussian at half size", "bloom" };
+	for (int which = 0; which < 3; which++) {
+		float diff = blur_max_difference(draw(blur, which, BIG_WIDTH, BIG_HEIGHT),
+										 draw(blur, which, WIDTH, HEIGHT));
+		char name[64];
+		snprintf(name, sizeof(name), "corner of bigger textures: %s", names[which]);
+		printf("  max difference %.2f/255\n", diff * 255);
+		check(name, diff <= TOLERANCE);
+	}
+}
+
+static void clear_scene(void* data) {
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+/* Frames where the texture changed size */
+static int allocations = 0, last_width = 0;
+static void run(PostGraph* graph) {
+	graph->run();
+	if (graph->textures[0].width != last_width)
+		allocations++;
+	last_width = graph->textures[0].width;
+}
+
+static void test_drag() {
+	PostGraph graph;
+	int scene = graph.add_target("scene", 1, GL_RGBA8, true);
+	graph.add_pass("scene", 0, scene, clear_scene);
+	graph.compile(100, 100);
+	run(&graph);
+	int start = allocations;
+
+	// Ten events per frame, growing by a pixel each
+	int size = 100;
+	for (int frame = 0; frame < 100; frame++) {
+		for (int i = 0; i < 10; i++, size++)
+			graph.resize(size, size);
+		run(&graph);
+	}
+	printf("  100 -> %d in 100 frames: %d allocations, textures of %d\n", size - 1, allocations - start,
+		   graph.textures[0].width);
+	check("drag: geometric growth", allocations - start <= 6 && graph.textures[0].width >= size - 1);
+
+	int grown = allocations;
+	for (int frame = 0; frame < 10; frame++) {
+		graph.resize(size - 1 - frame * 20, size - 1 - frame * 20);
+		run(&graph);
+	}
+	check("drag: kept while shrinking by less than half", allocations == grown);
+	graph.resize(100, 100);
+	run(&graph);
+	check("drag: shrunk below half", allocations == grown + 1 && graph.textures[0].width == 100);
+	graph.free_textures();
+}
+
+static void test_resolution() {
+	PostGraph graph;
+	graph.set_dynamic_resolution(10, 0.5);
+	for (int i = 0; i < 50; i++)
+		graph.update_resolution(40);
+	check("resolution: down to the minimum", graph.get_resolution_scale() == 0.5f);
+	for (int i = 0; i < 50; i++)
+		graph.update_resolution(10 * graph.get_resolution_scale() * graph.get_resolution_scale() / (0.75 * 0.75));
+	printf("  cost going with the pixels, 10 ms at 75%%: %g\n", graph.get_resolution_scale());
+	check("resolution: settles", fabs(graph.get_resolution_scale() - 0.75) <= 1.0 / POST_RESOLUTION_STEP);
+	float settled = graph.get_resolution_scale();
+	graph.update_resolution(10 * settled * settled / (0.75 * 0.75) * 1.04);
+	check("resolution: small variations ignored", graph.get_resolution_scale() == settled);
+	for (int i = 0; i < 50; i++)
+		graph.update_resolution(1);
+	check("resolution: up to the screen size", graph.get_resolution_scale() == 1);
+	graph.set_dynamic_resolution(0);
+	check("resolution: off", graph.get_resolution_scale() == 1);
+}
+
+int main(int argc, char* argv[]) {
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_Window* window = SDL_CreateWindow("test_resize", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+		WIDTH, HEIGHT, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (window == NULL || SDL_GL_CreateContext(window) == NULL) {
+		fprintf(stderr, "Error: no OpenGL context: %s\n", SDL_GetError());
+		return 1;
+	}
+	if (glewInit() != GLEW_OK || !GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error: no OpenGL 2.0\n");
+		return 1;
+	}
+
+	PostBlur blur;
+	if (!blur.init())
+		return 1;
+	test_corner(&blur);
+	blur.free();
+	test_drag();
+	test_resolution();
+	free_geometry_pool();
+
+	return check_summary();
+}
@@ -0,0 +1,201 @@
+/**
+ * This file is in the public domain.
+ *
+ * The shader preprocessing of ../../common-sdl2/shader_utils.cpp, in a
+ * hidden window, on shaders written to a temporary directory:
+ * #include relative to the including file, or commented out, include
+ * loops, defines and permutations, a program cache file per variant, a
+ * vertex shader compiled once for programs started together, and
+ * expanded sources read again after an edit.
+ */
+#include <stdio.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <string>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "../../common-sdl2/shader_utils.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define TEST_DIR "test_shader_preprocessor.tmp"
+
+static const char* files[] = {
+	TEST_DIR "/main.v.glsl",
+	"attribute vec2 v_coord;\n"
+	"void main(void) { gl_Position = vec4(v_coord, 0.0, 1.0); }\n",
+
+	// Includes lib/color.glsl, which includes lib/tint.glsl next to it
+	TEST_DIR "/main.f.glsl",
+	"#include \"lib/color.glsl\"\n"
+	"void main(void) {\n"
+	"  gl_FragColor = color();\n"
+	"}\n",
+	TEST_DIR "/lib/color.glsl",
+	"#include \"tint.glsl\"\n"
+	"#ifdef FOG\n"
+	"uniform float fog;\n"
+	"#endif\n"
+	"vec4 color() {\n"
+	"  vec4 c = vec4(1.0);\n"
+	"#ifdef FOG\n"
+	"  c *= fog;\n"
+	"#endif\n"
+	"  return tint(c);\n"
+	"}\n",
+	TEST_DIR "/lib/tint.glsl",
+	"#ifdef TINT\n"
+	"uniform vec4 tint_color;\n"
+	"vec4 tint(vec4 c) { return c * tint_color; }\n"
+	"#else\n"
+	"vec4 tint(vec4 c) { return c; }\n"
+	"#endif\n"
+	"#if SAMPLES != 4\n"
+	"#error SAMPLES=4 expected\n"
+	"#endif\n",
+
+	TEST_DIR "/white.f.glsl",
+	"void main(void) { gl_FragColor = vec4(1.0); }\n",
+
+	// Not included: in a block comment
+	TEST_DIR "/commented.f.glsl",
+	"/*\n"
+	"#include \"missing.glsl\"\n"
+	"*/\n"
+	"void main(void) { gl_FragColor = vec4(1.0); }\n",
+
+	TEST_DIR "/loop.f.glsl",
+	"#include \"loop.f.glsl\"\n"
+	"void main(void) { gl_FragColor = vec4(1.0); }\n",
+};
+#define NB_FILES (int)(sizeof(files) / sizeof(files[0]) / 2)
+
+static void write_files() {
+	mkdir(TEST_DIR, 0755);
+	mkdir(TEST_DIR "/lib", 0755);
+	for (int i = 0; i < NB_FILES; i++) {
+		FILE* out = fopen(files[2*i], "w");
+		fputs(files[2*i + 1], out);
+		fclose(out);
+	}
+}
+
+/* With the program cache files */
+static void remove_files() {
+	const char* dirs[] = { TEST_DIR "/lib", TEST_DIR };
+	for (int i = 0; i < 2; i++) {
+		DIR* dir = opendir(dirs[i]);
+		struct dirent* entry;
+		while (dir != NULL && (entry = readdir(dir)) != NULL)
+			remove((string(dirs[i]) + "/" + entry->d_name).c_str());
+		if (dir != NULL)
+			closedir(dir);
+		remove(dirs[i]);
+	}
+}
+
+static void test_includes() {
+	GLuint program = create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl", "SAMPLES=4");
+	check("include: relative to the including file", program != 0);
+	glDeleteProgram(program);
+	printf("  (errors about SAMPLES and loop.f.glsl are expected)\n");
+	program = create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl");
+	check("include: defines reach included files", program == 0);
+	program = create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/loop.f.glsl");
+	check("include: loop", program == 0);
+	program = create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/commented.f.glsl");
+	check("include: in a block comment", program != 0);
+	glDeleteProgram(program);
+}
+
+static void test_permutations() {
+	const char* features[] = { "FOG", "TINT", NULL };
+	check("permutation: names", shader_permutation(features, 0) == ""
+		  && shader_permutation(features, 1) == "FOG" && shader_permutation(features, 3) == "FOG TINT");
+
+	bool ok = true;
+	for (unsigned int mask = 0; mask < 4; mask++) {
+		string defines = shader_permutation(features, mask) + " SAMPLES=4";
+		GLuint program = create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl", defines.c_str());
+		ok = ok && program != 0
+			&& (glGetUniformLocation(program, "fog") != -1) == ((mask & 1) != 0)
+			&& (glGetUniformLocation(program, "tint_color") != -1) == ((mask & 2) != 0);
+		glDeleteProgram(program);
+	}
+	check("permutation: uniforms of the features only", ok);
+}
+
+static void test_cache() {
+	enable_program_cache(true);
+	int hits, misses;
+	get_program_cache_stats(&hits, &misses);
+	const char* variants[] = { "SAMPLES=4", "FOG SAMPLES=4" };
+	for (int run = 0; run < 2; run++) {
+		for (int i = 0; i < 2; i++)
+			glDeleteProgram(create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl", variants[i]));
+	}
+	int hits2, misses2;
+	get_program_cache_stats(&hits2, &misses2);
+	printf("  %d hits, %d misses\n", hits2 - hits, misses2 - misses);
+	check("cache: one file per variant", hits2 - hits == 2 && misses2 - misses == 2);
+	enable_program_cache(false);
+}
+
+static void test_shared_shader() {
+	// The defines go to both shaders: the same for both programs
+	GLuint a = create_program_async(TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl", "SAMPLES=4");
+	GLuint b = create_program_async(TEST_DIR "/main.v.glsl", TEST_DIR "/white.f.glsl", "SAMPLES=4");
+	GLuint shaders_a[2], shaders_b[2];
+	GLsizei count_a = 0, count_b = 0;
+	glGetAttachedShaders(a, 2, &count_a, shaders_a);
+	glGetAttachedShaders(b, 2, &count_b, shaders_b);
+	int shared = 0;
+	for (int i = 0; i < count_a; i++)
+		for (int j = 0; j < count_b; j++)
+			shared += shaders_a[i] == shaders_b[j];
+	check("shared: same vertex shader, other fragment shader", count_a == 2 && count_b == 2 && shared == 1);
+	a = finish_program(a);
+	b = finish_program(b);
+	check("shared: both link", a != 0 && b != 0);
+	glDeleteProgram(a);
+	glDeleteProgram(b);
+}
+
+static void test_edit() {
+	// The expanded source of the first program isn't used again once tint.glsl changes
+	GLuint program = create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl", "SAMPLES=4");
+	check("edit: before", program != 0 && glGetUniformLocation(program, "tint_color") == -1);
+	glDeleteProgram(program);
+	FILE* out = fopen(TEST_DIR "/lib/tint.glsl", "w");
+	fputs("uniform vec4 tint_color;\n"
+		  "vec4 tint(vec4 c) { return c * tint_color; }\n", out);
+	fclose(out);
+	program = create_program(TEST_DIR "/main.v.glsl", TEST_DIR "/main.f.glsl", "SAMPLES=4");
+	check("edit: included file read again", program != 0 && glGetUniformLocation(program, "tint_color") != -1);
+	glDeleteProgram(program);
+}
+
+int main(int argc, char* argv[]) {
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_Window* window = SDL_CreateWindow("test_shader_preprocessor", SDL_WINDOWPOS_CENTERED,
+		SDL_WINDOWPOS_CENTERED, 64, 64, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (window == NULL || SDL_GL_CreateContext(window) == NULL) {
+		fprintf(stderr, "Error: no OpenGL context: %s\n", SDL_GetError());
+		return 1;
+	}
+	if (glewInit() != GLEW_OK || !GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error: no OpenGL 2.0\n");
+		return 1;
+	}
+
+	write_files();
+	test_includes();
+	test_permutations();
+	test_cache();
+	test_shared_shader();
+	test_edit();
+	remove_files();
+
+	return check_summary();
+}
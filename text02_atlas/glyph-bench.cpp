@@ -0,0 +1,283 @@
+/**
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ *
+ * Glyph cache throughput, see glyph_cache.h:
+ * - misses: glyphs/second rendered into the atlas and uploaded, with
+ *   every glyph of the font, in an atlas large enough for all of them
+ *   and in one that has to evict all the time;
+ * - what text01_intro does instead: a glTexImage2D per character;
+ * - hits: the cost of a frame of text once its glyphs are cached,
+ *   ASCII and Greek/Cyrillic;
+ * - a HUD of many labels, see text_batch.h: a buffer and a draw per
+ *   label, as render_text() used to do, against the labels batched,
+ *   laid out every frame or once.
+ *
+ * Usage: ./glyph-bench [font file] [glyph height in pixels] [labels]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "../common/shader_utils.h"
+#include "glyph_cache.h"
+#include "text_batch.h"
+
+using namespace std;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Glyphs per frame when they are all new, e.g. a page of text in a new script */
+#define MISSES_PER_FRAME 64
+
+static void bench_misses(const char* name, FT_Face face, int height, unsigned int size,
+						 const vector<uint32_t>& codepoints, unsigned int nb_glyphs) {
+	atlas a(face, height, size, size);
+	unsigned long dropped = 0;
+	glFinish();
+	double t0 = now();
+	for (unsigned int i = 0; i < nb_glyphs; i++) {
+		if (a.get(codepoints[i % codepoints.size()]) == NULL)
+			dropped++;
+		if (i % MISSES_PER_FRAME == MISSES_PER_FRAME - 1) {
+			a.upload();
+			a.next_frame();
+		}
+	}
+	a.upload();
+	glFinish();
+	double t1 = now();
+	printf("%-34s %9.0f glyphs/s  %lu evicted, %lu dropped, %lu uploads of %.1f kB on average\n",
+		   name, nb_glyphs / (t1 - t0), a.stats.evictions, dropped, a.stats.uploads,
+		   a.stats.uploads ? a.stats.uploaded_bytes / 1024.0 / a.stats.uploads : 0);
+}
+
+/* text01_intro's render_text(): each character rendered and uploaded as a texture of its own */
+static void bench_teximage(FT_Face face, int height, const vector<uint32_t>& codepoints, unsigned int nb_glyphs) {
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	FT_Set_Pixel_Sizes(face, 0, height);
+	glFinish();
+	double t0 = now();
+	for (unsigned int i = 0; i < nb_glyphs; i++) {
+		if (FT_Load_Char(face, codepoints[i % codepoints.size()], FT_LOAD_RENDER))
+			continue;
+		FT_GlyphSlot g = face->glyph;
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, g->bitmap.width, g->bitmap.rows, 0, GL_ALPHA, GL_UNSIGNED_BYTE, g->bitmap.buffer);
+	}
+	glFinish();
+	double t1 = now();
+	printf("%-34s %9.0f glyphs/s\n", "glTexImage2D per character", nb_glyphs / (t1 - t0));
+	glDeleteTextures(1, &tex);
+}
+
+static void bench_hits(const char* name, FT_Face face, int height, const char* line, int nb_lines, int nb_frames) {
+	atlas a(face, height);
+	size_t nb_glyphs = 0;
+	float advance = 0;
+	/* Cached first */
+	for (const char* p = line; *p; nb_glyphs++)
+		a.get(utf8_next(&p));
+	a.upload();
+	nb_glyphs *= nb_lines;
+	unsigned long misses = a.stats.misses;
+
+	double t0 = now();
+	for (int frame = 0; frame < nb_frames; frame++) {
+		a.next_frame();
+		for (int l = 0; l < nb_lines; l++)
+			for (const char* p = line; *p;) {
+				const glyph* g = a.get(utf8_next(&p));
+				advance += g->ax;
+			}
+		a.upload();
+	}
+	double t1 = now();
+	double per_frame = (t1 - t0) / nb_frames;
+	printf("%-34s %9.3f ms per frame of %zu glyphs, %.1f ns per glyph%s\n", name, per_frame * 1e3,
+		   nb_glyphs, per_frame * 1e9 / nb_glyphs, (a.stats.misses == misses && advance > 0) ? "" : " (missed!)");
+}
+
+struct point {
+	GLfloat x;
+	GLfloat y;
+	GLfloat s;
+	GLfloat t;
+};
+
+/* render_text() before text_batch.h, the color a uniform */
+static void render_text_alone(const char *text, atlas * a, float x, float y, float sx, float sy, GLint attribute_coord, GLuint vbo) {
+	glBindTexture(GL_TEXTURE_2D, a->tex);
+	glEnableVertexAttribArray(attribute_coord);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+	vector<point> coords(6 * strlen(text));
+	int c = 0;
+	for (const char *p = text; *p;) {
+		const glyph *g = a->get(utf8_next(&p));
+		if (g == NULL)
+			continue;
+		float x2 = x + g->bl * sx;
+		float y2 = -y - g->bt * sy;
+		float w = g->bw * sx;
+		float h = g->bh * sy;
+		x += g->ax * sx;
+		y += g->ay * sy;
+		if (!w || !h)
+			continue;
+		coords[c++] = (point) { x2, -y2, g->tx, g->ty };
+		coords[c++] = (point) { x2 + w, -y2, g->tx + g->bw / a->w, g->ty };
+		coords[c++] = (point) { x2, -y2 - h, g->tx, g->ty + g->bh / a->h };
+		coords[c++] = (point) { x2 + w, -y2, g->tx + g->bw / a->w, g->ty };
+		coords[c++] = (point) { x2, -y2 - h, g->tx, g->ty + g->bh / a->h };
+		coords[c++] = (point) { x2 + w, -y2 - h, g->tx + g->bw / a->w, g->ty + g->bh / a->h };
+	}
+	a->upload();
+	glBufferData(GL_ARRAY_BUFFER, c * sizeof(point), &coords[0], GL_DYNAMIC_DRAW);
+	glDrawArrays(GL_TRIANGLES, 0, c);
+	glDisableVertexAttribArray(attribute_coord);
+}
+
+/* A grid of labels, "#123: 45.6" and the like, on a 1920x1080 screen */
+static void bench_labels(FT_Face face, int height, int nb_labels, int nb_frames) {
+	GLuint program = create_program("text.v.glsl", "text.f.glsl");
+	if (program == 0)
+		return;
+	GLint attribute_coord = get_attrib(program, "coord");
+	GLint attribute_color = get_attrib(program, "color");
+	glUseProgram(program);
+	glUniform1i(get_uniform(program, "tex"), 0);
+	glVertexAttrib4f(attribute_color, 0, 0, 0, 1);
+
+	atlas a(face, height);
+	vector<string> texts(nb_labels);
+	vector<float> xs(nb_labels), ys(nb_labels);
+	float sx = 2.0 / 1920, sy = 2.0 / 1080;
+	size_t nb_chars = 0;
+	for (int i = 0; i < nb_labels; i++) {
+		char text[32];
+		snprintf(text, sizeof(text), "#%d: %.1f", i, i * 0.7);
+		texts[i] = text;
+		nb_chars += texts[i].size();
+		xs[i] = -1 + (i % 16) * 120 * sx;
+		ys[i] = 1 - (i / 16 % 45 + 1) * 24 * sy;
+	}
+	GLfloat black[4] = { 0, 0, 0, 1 };
+	printf("%d labels, %zu characters:\n", nb_labels, nb_chars);
+
+	GLuint vbo;
+	glGenBuffers(1, &vbo);
+	/* The first frame renders the glyphs */
+	double cpu = 0, total = 0;
+	for (int frame = -1; frame < nb_frames; frame++) {
+		glFinish();
+		double t0 = now();
+		for (int i = 0; i < nb_labels; i++)
+			render_text_alone(texts[i].c_str(), &a, xs[i], ys[i], sx, sy, attribute_coord, vbo);
+		a.next_frame();
+		double t1 = now();
+		glFinish();
+		if (frame >= 0) {
+			cpu += t1 - t0;
+			total += now() - t0;
+		}
+	}
+	printf("%-34s %9.3f ms per frame, %.3f ms of it in the CPU, %d draws\n", "  a draw per label",
+		   total / nb_frames * 1e3, cpu / nb_frames * 1e3, nb_labels);
+	glDeleteBuffers(1, &vbo);
+
+	for (int retained = 0; retained < 2; retained++) {
+		text_batch batch;
+		vector<text_layout> layouts(retained ? nb_labels : 0);
+		cpu = total = 0;
+		/* The first frame lays out and uploads everything */
+		for (int frame = -1; frame < nb_frames; frame++) {
+			glFinish();
+			double t0 = now();
+			for (int i = 0; i < nb_labels; i++) {
+				if (retained) {
+					layouts[i].set(texts[i].c_str(), &a, xs[i], ys[i], sx, sy, black);
+					batch.add(&layouts[i]);
+				} else {
+					batch.add(texts[i].c_str(), &a, xs[i], ys[i], sx, sy, black);
+				}
+			}
+			batch.draw(attribute_coord, attribute_color);
+			double t1 = now();
+			glFinish();
+			if (frame >= 0) {
+				cpu += t1 - t0;
+				total += now() - t0;
+			}
+		}
+		printf("%-34s %9.3f ms per frame, %.3f ms of it in the CPU, %lu draws, %lu uploads after the first\n",
+			   retained ? "  batched, laid out once" : "  batched, laid out every frame",
+			   total / nb_frames * 1e3, cpu / nb_frames * 1e3, batch.stats.draws / batch.stats.frames, batch.stats.uploads - 1);
+	}
+	glDeleteProgram(program);
+}
+
+int main(int argc, char* argv[]) {
+	const char* fontfilename = (argc > 1) ? argv[1] : "FreeSans.ttf";
+	int height = (argc > 2) ? atoi(argv[2]) : 24;
+	int nb_labels = (argc > 3) ? atoi(argv[3]) : 5000;
+
+	glutInit(&argc, argv);
+	glutInitContextVersion(2,0);
+	glutInitDisplayMode(GLUT_RGB);
+	glutInitWindowSize(64, 64);
+	glutCreateWindow("glyph-bench");
+	GLenum glew_status = glewInit();
+	if (GLEW_OK != glew_status) {
+		fprintf(stderr, "Error: %s\n", glewGetErrorString(glew_status));
+		return 1;
+	}
+
+	FT_Library ft;
+	FT_Face face;
+	if (FT_Init_FreeType(&ft) || FT_New_Face(ft, fontfilename, 0, &face)) {
+		fprintf(stderr, "Could not open font %s\n", fontfilename);
+		return 1;
+	}
+
+	/* Every glyph of the font */
+	vector<uint32_t> codepoints;
+	FT_UInt index;
+	for (FT_ULong c = FT_Get_First_Char(face, &index); index != 0; c = FT_Get_Next_Char(face, c, &index))
+		codepoints.push_back(c);
+	printf("%s: %zu glyphs, %d pixels high\n", fontfilename, codepoints.size(), height);
+
+	unsigned int nb_misses = codepoints.size();
+	bench_misses("misses, all glyphs fit", face, height, height * 96, codepoints, nb_misses);
+	/* Room for a few frames of new glyphs only */
+	bench_misses("misses, evicting", face, height, height * 16, codepoints, nb_misses * 4);
+	bench_teximage(face, height, codepoints, nb_misses);
+
+	/* About a 1080p screen full of text */
+	string ascii = "The Quick Brown Fox Jumps Over The Lazy Dog 0123456789 (The Quick Brown Fox...)";
+	string mixed = "Ξεσκεπάζω τὴν ψυχοφθόρα βδελυγμία; Съешь же ещё этих мягких французских булок";
+	bench_hits("hits, ASCII", face, height, ascii.c_str(), 60, 200);
+	bench_hits("hits, Greek and Cyrillic", face, height, mixed.c_str(), 60, 200);
+
+	bench_labels(face, height, nb_labels, 50);
+
+	FT_Done_Face(face);
+	FT_Done_FreeType(ft);
+	return 0;
+}
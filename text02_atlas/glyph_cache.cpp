@@ -0,0 +1,350 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "glyph_cache.h"
+
+/*
+ * Glyphs start a pixel away from the left and top edges, like the
+ * padding between them: clamping to the edge would otherwise repeat
+ * their first column or row when linear filtering samples beyond it.
+ */
+#define BORDER 1
+
+atlas::atlas(FT_Face face, int height, unsigned int w, unsigned int h)
+	: tex(0), w(w), h(h), face(face), height(height), frame(1), pixels(w * h, 0), high_water(0) {
+	memset(&stats, 0, sizeof(stats));
+	memset(latin1, 0, sizeof(latin1));
+
+	/* An empty texture, filled as glyphs are used */
+	glActiveTexture(GL_TEXTURE0);
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+
+	/* We require 1 byte alignment when uploading texture data */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, w, h, 0, GL_ALPHA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+	/* Clamping to edges is important to prevent artifacts when scaling */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	/* Linear filtering usually looks best for text */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	fprintf(stderr, "Created a %d x %d (%d kb) glyph cache for %d pixel high glyphs\n", w, h, w * h / 1024, height);
+}
+
+atlas::~atlas() {
+	glDeleteTextures(1, &tex);
+}
+
+const glyph* atlas::get(uint32_t codepoint) {
+	return lookup(codepoint);
+}
+
+glyph* atlas::lookup(uint32_t codepoint) {
+	glyph* g;
+	if (codepoint < 256) {
+		g = latin1[codepoint];
+	} else {
+		std::unordered_map<uint32_t, glyph>::iterator it = glyphs.find(codepoint);
+		g = (it != glyphs.end()) ? &it->second : NULL;
+	}
+	if (g == NULL) {
+		stats.misses++;
+		return add(codepoint);
+	}
+	stats.hits++;
+	/* Moved to the front of the LRU list once per frame only */
+	if (g->last_used != frame) {
+		g->last_used = frame;
+		if (g->shelf >= 0 && g->pins == 0)
+			lru.splice(lru.begin(), lru, g->lru);
+	}
+	return g;
+}
+
+const glyph* atlas::pin(uint32_t codepoint) {
+	glyph* g = lookup(codepoint);
+	if (g != NULL && g->pins++ == 0 && g->shelf >= 0)
+		lru.erase(g->lru);
+	return g;
+}
+
+void atlas::unpin(const glyph* pinned) {
+	glyph* g = (pinned->codepoint < 256) ? latin1[pinned->codepoint] : &glyphs.find(pinned->codepoint)->second;
+	if (--g->pins == 0 && g->shelf >= 0) {
+		lru.push_front(g->codepoint);
+		g->lru = lru.begin();
+	}
+}
+
+/* Render a glyph into the copy of the texture */
+glyph* atlas::add(uint32_t codepoint) {
+	/* The face is shared with the atlasses for other sizes */
+	if (face->size->metrics.y_ppem != height)
+		FT_Set_Pixel_Sizes(face, 0, height);
+
+	glyph n = glyph();
+	n.codepoint = codepoint;
+	n.shelf = -1;
+	n.last_used = frame;
+
+	FT_GlyphSlot g = face->glyph;
+	if (FT_Load_Char(face, codepoint, FT_LOAD_RENDER)) {
+		/* Cached without pixels, not to try again every frame */
+		fprintf(stderr, "Loading character U+%04X failed!\n", codepoint);
+	} else {
+		unsigned int bw = g->bitmap.width;
+		unsigned int bh = g->bitmap.rows;
+		if (bw > 0 && bh > 0) {
+			int shelf;
+			unsigned int x;
+			if (!make_room(bw + 1, bh + 1, &shelf, &x)) {
+				stats.dropped++;
+				return NULL;
+			}
+			atlas_shelf* s = &shelves[shelf];
+			/* The whole slot, so that the padding around the bitmap is empty */
+			clear(x, s->y, bw + 1, s->h);
+			for (unsigned int row = 0; row < bh; row++)
+				memcpy(&pixels[(s->y + row) * w + x], g->bitmap.buffer + row * g->bitmap.pitch, bw);
+			mark_dirty(s, x, x + bw + 1);
+			s->nb_glyphs++;
+
+			n.shelf = shelf;
+			n.x = x;
+			n.slot_w = bw + 1;
+			n.tx = x / (float)w;
+			n.ty = s->y / (float)h;
+		}
+		n.ax = g->advance.x >> 6;
+		n.ay = g->advance.y >> 6;
+
+		n.bw = bw;
+		n.bh = bh;
+
+		n.bl = g->bitmap_left;
+		n.bt = g->bitmap_top;
+	}
+
+	glyph* res = &glyphs.insert(std::make_pair(codepoint, n)).first->second;
+	if (res->shelf >= 0) {
+		lru.push_front(codepoint);
+		res->lru = lru.begin();
+	}
+	if (codepoint < 256)
+		latin1[codepoint] = res;
+	return res;
+}
+
+/* Evicting the least recently used glyphs until there is room */
+bool atlas::make_room(unsigned int slot_w, unsigned int slot_h, int* shelf, unsigned int* x) {
+	if (slot_w + BORDER > w || slot_h + BORDER > h)
+		return false;
+	while (!allocate(slot_w, slot_h, shelf, x))
+		if (!evict())
+			return false;
+	return true;
+}
+
+/* First fit, in a hole left by evicted glyphs or after the last slot */
+static bool take(atlas_shelf* s, unsigned int slot_w, unsigned int atlas_w, unsigned int* x) {
+	for (unsigned int i = 0; i < s->holes.size(); i++) {
+		std::pair<unsigned int, unsigned int>& hole = s->holes[i];
+		if (hole.second < slot_w)
+			continue;
+		*x = hole.first;
+		hole.first += slot_w;
+		hole.second -= slot_w;
+		if (hole.second == 0)
+			s->holes.erase(s->holes.begin() + i);
+		return true;
+	}
+	if (s->end + slot_w > atlas_w)
+		return false;
+	*x = s->end;
+	s->end += slot_w;
+	return true;
+}
+
+static void release(atlas_shelf* s, unsigned int x, unsigned int slot_w) {
+	std::vector<std::pair<unsigned int, unsigned int> >& holes = s->holes;
+	if (x + slot_w == s->end) {
+		s->end = x;
+		if (!holes.empty() && holes.back().first + holes.back().second == s->end) {
+			s->end = holes.back().first;
+			holes.pop_back();
+		}
+		return;
+	}
+	std::vector<std::pair<unsigned int, unsigned int> >::iterator next =
+		std::lower_bound(holes.begin(), holes.end(), std::make_pair(x, 0u));
+	if (next != holes.end() && x + slot_w == next->first) {
+		next->first = x;
+		next->second += slot_w;
+	} else {
+		next = holes.insert(next, std::make_pair(x, slot_w));
+	}
+	if (next != holes.begin()) {
+		std::vector<std::pair<unsigned int, unsigned int> >::iterator prev = next - 1;
+		if (prev->first + prev->second == next->first) {
+			prev->second += next->second;
+			holes.erase(next);
+		}
+	}
+}
+
+/* A little higher than the glyph, for the glyphs of about the same height */
+static unsigned int shelf_height(unsigned int slot_h) {
+	return (slot_h + 3) & ~3u;
+}
+
+bool atlas::allocate(unsigned int slot_w, unsigned int slot_h, int* shelf, unsigned int* x) {
+	/* A shelf of about that height, not to waste rows */
+	for (unsigned int i = 0; i < shelves.size(); i++) {
+		atlas_shelf* s = &shelves[i];
+		if (s->h >= slot_h && s->h <= shelf_height(slot_h) + slot_h / 4 && take(s, slot_w, w, x)) {
+			*shelf = i;
+			return true;
+		}
+	}
+
+	/* A new shelf */
+	unsigned int top = shelves.empty() ? BORDER : shelves.back().y + shelves.back().h;
+	if (top + slot_h <= h) {
+		atlas_shelf s;
+		s.y = top;
+		s.h = std::min(shelf_height(slot_h), h - top);
+		s.end = BORDER;
+		s.nb_glyphs = 0;
+		s.dirty_x0 = s.dirty_x1 = 0;
+		shelves.push_back(s);
+		/* Rows left by evicted shelves: nothing must bleed into the new glyphs */
+		if (top < high_water) {
+			clear(0, s.y, w, s.h);
+			mark_dirty(&shelves.back(), 0, w);
+		}
+		high_water = std::max(high_water, s.y + s.h);
+		*shelf = shelves.size() - 1;
+		return take(&shelves.back(), slot_w, w, x);
+	}
+
+	/* Any shelf high enough, rather than evicting */
+	for (unsigned int i = 0; i < shelves.size(); i++) {
+		atlas_shelf* s = &shelves[i];
+		if (s->h >= slot_h && take(s, slot_w, w, x)) {
+			*shelf = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* The least recently used glyph, unless it is used in this frame or pinned */
+bool atlas::evict() {
+	if (lru.empty())
+		return false;
+	uint32_t codepoint = lru.back();
+	std::unordered_map<uint32_t, glyph>::iterator it = glyphs.find(codepoint);
+	glyph* g = &it->second;
+	if (g->last_used == frame)
+		return false;
+
+	atlas_shelf* s = &shelves[g->shelf];
+	release(s, g->x, g->slot_w);
+	if (--s->nb_glyphs == 0) {
+		/* Emptied; the last shelves give their rows back, for glyphs of other heights */
+		s->end = BORDER;
+		s->holes.clear();
+		while (!shelves.empty() && shelves.back().nb_glyphs == 0)
+			shelves.pop_back();
+	}
+
+	lru.pop_back();
+	if (codepoint < 256)
+		latin1[codepoint] = NULL;
+	glyphs.erase(it);
+	stats.evictions++;
+	return true;
+}
+
+void atlas::clear(unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+	for (unsigned int row = y; row < y + h; row++)
+		memset(&pixels[row * this->w + x], 0, w);
+}
+
+void atlas::mark_dirty(atlas_shelf* s, unsigned int x0, unsigned int x1) {
+	if (s->dirty_x0 >= s->dirty_x1) {
+		s->dirty_x0 = x0;
+		s->dirty_x1 = x1;
+	} else {
+		s->dirty_x0 = std::min(s->dirty_x0, x0);
+		s->dirty_x1 = std::max(s->dirty_x1, x1);
+	}
+}
+
+/**
+ * Send the glyphs rendered since the last call to the texture: one
+ * sub-rectangle per shelf that changed, straight from the copy in
+ * memory.  Call it before drawing with the new glyphs.
+ */
+void atlas::upload() {
+	bool bound = false;
+	for (unsigned int i = 0; i < shelves.size(); i++) {
+		atlas_shelf* s = &shelves[i];
+		if (s->dirty_x0 >= s->dirty_x1)
+			continue;
+		if (!bound) {
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+			bound = true;
+		}
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, s->dirty_x0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, s->y);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, s->dirty_x0, s->y, s->dirty_x1 - s->dirty_x0, s->h,
+						GL_ALPHA, GL_UNSIGNED_BYTE, &pixels[0]);
+		stats.uploads++;
+		stats.uploaded_bytes += (s->dirty_x1 - s->dirty_x0) * s->h;
+		s->dirty_x0 = s->dirty_x1 = 0;
+	}
+	if (bound) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	}
+}
+
+/* The codepoint at *text, which moves past it; U+FFFD for what is not UTF-8 */
+uint32_t utf8_next(const char** text) {
+	const unsigned char* p = (const unsigned char*)*text;
+	uint32_t c = p[0];
+	int n = (c < 0x80) ? 0 : (c < 0xC2) ? -1 : (c < 0xE0) ? 1 : (c < 0xF0) ? 2 : (c < 0xF5) ? 3 : -1;
+	if (n <= 0) {
+		*text += 1;
+		return (n == 0) ? c : 0xFFFD;
+	}
+	c &= 0x3F >> n;
+	for (int i = 1; i <= n; i++) {
+		/* Also stops at the NUL */
+		if ((p[i] & 0xC0) != 0x80) {
+			*text += i;
+			return 0xFFFD;
+		}
+		c = (c << 6) | (p[i] & 0x3F);
+	}
+	*text += n + 1;
+	/* Overlong forms, UTF-16 surrogates, beyond Unicode */
+	if ((n == 2 && c < 0x800) || (n == 3 && (c < 0x10000 || c > 0x10FFFF)) || (c >= 0xD800 && c <= 0xDFFF))
+		return 0xFFFD;
+	return c;
+}
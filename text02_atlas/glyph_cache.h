@@ -0,0 +1,119 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _GLYPH_CACHE_H
+#define _GLYPH_CACHE_H
+#include <stdint.h>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <GL/glew.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/* A glyph in the atlas: what is needed to generate its vertex and texture coordinates */
+struct glyph {
+	float ax;	// advance.x
+	float ay;	// advance.y
+
+	float bw;	// bitmap.width;
+	float bh;	// bitmap.height;
+
+	float bl;	// bitmap_left;
+	float bt;	// bitmap_top;
+
+	float tx;	// x offset of glyph in texture coordinates
+	float ty;	// y offset of glyph in texture coordinates
+
+	/* Where it is in the texture, and when it was last used */
+	uint32_t codepoint;
+	int shelf;		// -1 for glyphs without pixels, such as spaces
+	unsigned int x;
+	unsigned int slot_w;	// bitmap width and a column of padding
+	unsigned int last_used;	// frame
+	unsigned int pins;	// never evicted while pinned, and then out of the LRU list
+	std::list<uint32_t>::iterator lru;
+};
+
+/*
+ * A row of the texture where glyphs of about the same height go, left
+ * to right.  The slots of evicted glyphs are reused by glyphs that fit.
+ */
+struct atlas_shelf {
+	unsigned int y, h;	// h: bitmap height and a row of padding, rounded up
+	unsigned int end;	// free from there to the right edge
+	std::vector<std::pair<unsigned int, unsigned int> > holes;	// (x, width) of freed slots, by x
+	unsigned int nb_glyphs;
+	unsigned int dirty_x0, dirty_x1;	// columns to upload, if x0 < x1
+};
+
+struct atlas_stats {
+	unsigned long hits;
+	unsigned long misses;		// glyphs rasterized
+	unsigned long evictions;
+	unsigned long dropped;		// no room, even after evicting
+	unsigned long uploads;		// glTexSubImage2D calls
+	unsigned long uploaded_bytes;
+};
+
+/**
+ * The atlas struct holds a texture with the glyphs of a font rendered
+ * with a certain character height.  Glyphs are rendered the first time
+ * they are asked for, for any Unicode codepoint the font has.  When the
+ * texture is full, the glyphs used least recently make room, except
+ * those already used in the current frame.
+ *
+ * Glyphs are rendered into a copy of the texture in memory; upload()
+ * sends what changed to the texture, once per frame rather than once
+ * per glyph.
+ */
+struct atlas {
+	GLuint tex;		// texture object
+
+	unsigned int w;			// width of texture in pixels
+	unsigned int h;			// height of texture in pixels
+
+	atlas_stats stats;
+
+	atlas(FT_Face face, int height, unsigned int w = 1024, unsigned int h = 1024);
+	~atlas();
+
+	/* NULL if there is no room for it in this frame */
+	const glyph* get(uint32_t codepoint);
+	/* For text laid out once and drawn for many frames: kept until unpinned as many times */
+	const glyph* pin(uint32_t codepoint);
+	void unpin(const glyph* g);
+	void upload();
+	/* Glyphs used before this may be evicted */
+	void next_frame() { frame++; }
+	size_t nb_glyphs() const { return glyphs.size(); }
+
+private:
+	FT_Face face;
+	int height;
+	unsigned int frame;
+	std::vector<unsigned char> pixels;	// w x h, as in the texture once uploaded
+	unsigned int high_water;	// rows below have been used, and may need clearing
+
+	std::unordered_map<uint32_t, glyph> glyphs;
+	glyph* latin1[256];		// cached glyphs, without hashing for the most common ones
+	std::list<uint32_t> lru;	// unpinned glyphs with pixels, most recently used first
+	std::vector<atlas_shelf> shelves;
+
+	glyph* lookup(uint32_t codepoint);
+	glyph* add(uint32_t codepoint);
+	bool make_room(unsigned int slot_w, unsigned int slot_h, int* shelf, unsigned int* x);
+	bool allocate(unsigned int slot_w, unsigned int slot_h, int* shelf, unsigned int* x);
+	bool evict();
+	void clear(unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+	void mark_dirty(atlas_shelf* s, unsigned int x0, unsigned int x1);
+
+	atlas(const atlas&) = delete;
+	atlas& operator=(const atlas&) = delete;
+};
+
+uint32_t utf8_next(const char** text);
+#endif
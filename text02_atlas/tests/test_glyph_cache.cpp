@@ -0,0 +1,158 @@
+/**
+ * This file is in the public domain.
+ *
+ * ../glyph_cache.cpp in a GLUT window: UTF-8 decoding, glyphs read back
+ * from the texture against FreeType's bitmaps, with empty padding, and
+ * a small atlas evicting the least recently used glyphs, never those of
+ * the current frame.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "../glyph_cache.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define HEIGHT 24
+
+static bool decodes_to(const char* text, const vector<uint32_t>& expected) {
+	vector<uint32_t> res;
+	for (const char* p = text; *p;)
+		res.push_back(utf8_next(&p));
+	return res == expected;
+}
+
+static void test_utf8() {
+	check("utf8: ASCII", decodes_to("Az", { 'A', 'z' }));
+	check("utf8: 2, 3 and 4 bytes", decodes_to("é€😀", { 0xE9, 0x20AC, 0x1F600 }));
+	check("utf8: stray continuation byte", decodes_to("a\x80z", { 'a', 0xFFFD, 'z' }));
+	check("utf8: truncated, then ASCII", decodes_to("\xE2\x82z", { 0xFFFD, 'z' }));
+	check("utf8: truncated at the end", decodes_to("\xF0\x9F", { 0xFFFD }));
+	check("utf8: overlong", decodes_to("\xC0\xAF\xE0\x80\xAF", { 0xFFFD, 0xFFFD, 0xFFFD }));
+	check("utf8: surrogate", decodes_to("\xED\xA0\x80", { 0xFFFD }));
+	check("utf8: beyond U+10FFFF", decodes_to("\xF4\x90\x80\x80", { 0xFFFD }));
+}
+
+/* The glyph as FreeType renders it, at its place in the texture, with empty padding right and below */
+static bool in_texture(FT_Face face, atlas& a, const glyph* g) {
+	if (g == NULL)
+		return false;
+	vector<unsigned char> texture(a.w * a.h);
+	glBindTexture(GL_TEXTURE_2D, a.tex);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_ALPHA, GL_UNSIGNED_BYTE, &texture[0]);
+
+	FT_Set_Pixel_Sizes(face, 0, HEIGHT);
+	if (FT_Load_Char(face, g->codepoint, FT_LOAD_RENDER))
+		return false;
+	FT_Bitmap& bitmap = face->glyph->bitmap;
+	if (bitmap.width != g->bw || bitmap.rows != g->bh)
+		return false;
+	unsigned int x = g->tx * a.w + 0.5, y = g->ty * a.h + 0.5;
+	for (unsigned int row = 0; row <= bitmap.rows; row++)
+		for (unsigned int col = 0; col <= bitmap.width; col++) {
+			unsigned char expected = (row < bitmap.rows && col < bitmap.width) ? bitmap.buffer[row * bitmap.pitch + col] : 0;
+			if (texture[(y + row) * a.w + x + col] != expected)
+				return false;
+		}
+	return true;
+}
+
+static void test_cache(FT_Face face) {
+	atlas a(face, HEIGHT, 256, 256);
+	const glyph* g = a.get('g');
+	const glyph* alpha = a.get(0x3B1);
+	const glyph* space = a.get(' ');
+	a.upload();
+	check("cache: rendered when first used", a.stats.misses == 3 && a.stats.hits == 0);
+	check("cache: ASCII in the texture", in_texture(face, a, g));
+	check("cache: Greek in the texture", in_texture(face, a, alpha));
+	check("cache: space, without pixels", space != NULL && space->shelf == -1 && space->ax > 0);
+	unsigned long uploads = a.stats.uploads;
+	a.next_frame();
+	check("cache: then hits", a.get('g') == g && a.get(0x3B1) == alpha && a.stats.misses == 3 && a.stats.hits == 2);
+	a.upload();
+	check("cache: nothing new, nothing uploaded", a.stats.uploads == uploads);
+}
+
+/* Room for about 30 glyphs */
+static void test_eviction(FT_Face face) {
+	atlas a(face, HEIGHT, 96, 96);
+	vector<uint32_t> cyrillic;
+	for (uint32_t c = 0x410; c < 0x450; c++)
+		cyrillic.push_back(c);
+
+	/* A frame with more glyphs than room */
+	unsigned int nb_drawn = 0;
+	for (unsigned int i = 0; i < cyrillic.size(); i++)
+		nb_drawn += a.get(cyrillic[i]) != NULL;
+	a.upload();
+	check("eviction: not the glyphs of the current frame", a.stats.evictions == 0 && a.stats.dropped > 0
+		  && nb_drawn + a.stats.dropped == cyrillic.size());
+	printf("  %u of %zu glyphs in the atlas\n", nb_drawn, cyrillic.size());
+
+	/* Then frames of a few glyphs each, going through them all */
+	bool all_there = true;
+	for (unsigned int i = 0; i < cyrillic.size(); i += 4) {
+		a.next_frame();
+		a.get('A');
+		for (unsigned int j = i; j < i + 4; j++)
+			all_there = all_there && a.get(cyrillic[j]) != NULL;
+		a.upload();
+	}
+	check("eviction: room made for a frame", all_there && a.stats.evictions > 0);
+
+	/* 'A' was used in every frame, the first Cyrillic letters long ago */
+	unsigned long misses = a.stats.misses;
+	a.next_frame();
+	a.get('A');
+	check("eviction: least recently used first", a.stats.misses == misses);
+	a.get(cyrillic[0]);
+	check("eviction: evicted glyph rendered again", a.stats.misses == misses + 1);
+
+	/* No stale pixels from evicted glyphs around the new ones */
+	a.next_frame();
+	for (unsigned int i = 0; i < 8; i++)
+		a.get(cyrillic[i * 7 % cyrillic.size()]);
+	a.upload();
+	bool ok = true;
+	for (unsigned int i = 0; i < 8; i++)
+		ok = ok && in_texture(face, a, a.get(cyrillic[i * 7 % cyrillic.size()]));
+	check("eviction: reused slots in the texture", ok);
+	printf("  %lu evicted, %lu uploads\n", a.stats.evictions, a.stats.uploads);
+}
+
+int main(int argc, char* argv[]) {
+	const char* fontfilename = (argc > 1) ? argv[1] : "FreeSans.ttf";
+	glutInit(&argc, argv);
+	glutInitContextVersion(2,0);
+	glutInitDisplayMode(GLUT_RGB);
+	glutInitWindowSize(64, 64);
+	glutCreateWindow("test_glyph_cache");
+	if (glewInit() != GLEW_OK || !GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error: no OpenGL 2.0\n");
+		return 1;
+	}
+	FT_Library ft;
+	FT_Face face;
+	if (FT_Init_FreeType(&ft) || FT_New_Face(ft, fontfilename, 0, &face)) {
+		fprintf(stderr, "Could not open font %s\n", fontfilename);
+		return 1;
+	}
+
+	test_utf8();
+	test_cache(face);
+	test_eviction(face);
+
+	FT_Done_Face(face);
+	FT_Done_FreeType(ft);
+	return check_summary();
+}
@@ -0,0 +1,175 @@
+/**
+ * This file is in the public domain.
+ *
+ * ../text_batch.cpp in a GLUT window, with the demo's shaders: one
+ * draw per atlas, frames that didn't change not uploaded again, text
+ * laid out once drawn the same as text laid out every frame, and its
+ * glyphs kept while others are evicted.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GL/freeglut.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "../../common/shader_utils.h"
+#include "../glyph_cache.h"
+#include "../text_batch.h"
+#include "../../common/test_check.h"
+
+using namespace std;
+
+#define W 256
+#define H 64
+
+static GLuint program;
+static GLint attribute_coord, attribute_color;
+static const float sx = 2.0 / W, sy = 2.0 / H;
+static const GLfloat black[4] = { 0, 0, 0, 1 };
+static const GLfloat red[4] = { 1, 0, 0, 1 };
+static const GLfloat green[4] = { 0, 1, 0, 1 };
+
+static void start_frame() {
+	glClearColor(1, 1, 1, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static vector<unsigned char> end_frame(text_batch& batch) {
+	batch.draw(attribute_coord, attribute_color);
+	vector<unsigned char> pixels(W * H * 4);
+	glReadPixels(0, 0, W, H, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	return pixels;
+}
+
+static bool has_text(const vector<unsigned char>& pixels) {
+	for (unsigned int i = 0; i < pixels.size(); i += 4)
+		if (pixels[i] < 128)
+			return true;
+	return false;
+}
+
+static void test_batch(FT_Face face) {
+	atlas a24(face, 24, 256, 256), a12(face, 12, 128, 128);
+	text_batch batch;
+	text_layout layout;
+
+	start_frame();
+	batch.add("Quick", &a24, -1 + 4 * sx, 1 - 24 * sy, sx, sy, black);
+	batch.add("Brown", &a12, -1 + 4 * sx, 1 - 40 * sy, sx, sy, red);
+	layout.set("Fox", &a24, -1 + 80 * sx, 1 - 24 * sy, sx, sy, green);
+	batch.add(&layout);
+	batch.add("Jumps", &a24, -1 + 4 * sx, 1 - 56 * sy, sx, sy, black);
+	vector<unsigned char> first = end_frame(batch);
+	check("batch: one draw per atlas", batch.stats.draws == 2 && batch.stats.uploads == 1 && has_text(first));
+
+	/* The same again: nothing laid out or uploaded, the same pixels */
+	unsigned long hits = a24.stats.hits + a12.stats.hits;
+	start_frame();
+	batch.add("Quick", &a24, -1 + 4 * sx, 1 - 24 * sy, sx, sy, black);
+	batch.add("Brown", &a12, -1 + 4 * sx, 1 - 40 * sy, sx, sy, red);
+	layout.set("Fox", &a24, -1 + 80 * sx, 1 - 24 * sy, sx, sy, green);
+	batch.add(&layout);
+	batch.add("Jumps", &a24, -1 + 4 * sx, 1 - 56 * sy, sx, sy, black);
+	check("batch: layout not done again", a24.stats.hits + a12.stats.hits == hits + 15);
+	check("batch: same frame not uploaded", end_frame(batch) == first && batch.stats.uploads == 1);
+
+	/* Laid out once or every frame: the same */
+	start_frame();
+	batch.add("Quick", &a24, -1 + 4 * sx, 1 - 24 * sy, sx, sy, black);
+	vector<unsigned char> immediate = end_frame(batch);
+	layout.set("Quick", &a24, -1 + 4 * sx, 1 - 24 * sy, sx, sy, black);
+	start_frame();
+	batch.add(&layout);
+	check("layout: drawn as laid out every frame", end_frame(batch) == immediate);
+
+	/* The strings of an atlas in the order they were added */
+	start_frame();
+	batch.add("||||", &a24, -1 + 4 * sx, 1 - 24 * sy, sx, sy, red);
+	batch.add("||||", &a24, -1 + 4 * sx, 1 - 24 * sy, sx, sy, green);
+	vector<unsigned char> pixels = end_frame(batch);
+	bool green_on_top = true, some = false;
+	for (unsigned int i = 0; i < pixels.size(); i += 4)
+		if (pixels[i + 2] < 128) {
+			some = true;
+			green_on_top = green_on_top && pixels[i + 1] >= pixels[i];
+		}
+	check("batch: in order", some && green_on_top);
+
+	start_frame();
+	check("batch: empty frame", !has_text(end_frame(batch)));
+}
+
+/* A layout's glyphs stay while the others are evicted, and drawn as they were */
+static void test_pinned(FT_Face face) {
+	atlas a(face, 24, 64, 64);
+	text_batch batch;
+	text_layout layout;
+	layout.set("Щука", &a, -1 + 4 * sx, 1 - 30 * sy, sx, sy, black);
+	start_frame();
+	batch.add(&layout);
+	vector<unsigned char> before = end_frame(batch);
+
+	for (uint32_t c = 0; c < 0x40; c += 4) {
+		start_frame();
+		for (uint32_t i = 0x430 + c % 0x20; i < 0x430 + c % 0x20 + 4; i++) {
+			char text[5] = { 0 };
+			text[0] = 0xC0 | (i >> 6);
+			text[1] = 0x80 | (i & 0x3F);
+			batch.add(text, &a, -1 + 4 * sx, 1 - 60 * sy, sx, sy, black);
+		}
+		end_frame(batch);
+	}
+	check("pinned: others evicted", a.stats.evictions > 0);
+	unsigned long misses = a.stats.misses;
+	const glyph* shch = a.get(0x429);
+	check("pinned: still there", shch != NULL && a.stats.misses == misses);
+	start_frame();
+	batch.add(&layout);
+	check("pinned: drawn the same", end_frame(batch) == before);
+
+	layout.clear();
+	start_frame();
+	batch.add(&layout);
+	check("pinned: cleared", !has_text(end_frame(batch)));
+}
+
+int main(int argc, char* argv[]) {
+	const char* fontfilename = (argc > 1) ? argv[1] : "FreeSans.ttf";
+	glutInit(&argc, argv);
+	glutInitContextVersion(2,0);
+	glutInitDisplayMode(GLUT_RGB);
+	glutInitWindowSize(W, H);
+	glutCreateWindow("test_text_batch");
+	if (glewInit() != GLEW_OK || !GLEW_VERSION_2_0) {
+		fprintf(stderr, "Error: no OpenGL 2.0\n");
+		return 1;
+	}
+	FT_Library ft;
+	FT_Face face;
+	if (FT_Init_FreeType(&ft) || FT_New_Face(ft, fontfilename, 0, &face)) {
+		fprintf(stderr, "Could not open font %s\n", fontfilename);
+		return 1;
+	}
+	program = create_program("text.v.glsl", "text.f.glsl");
+	if (program == 0)
+		return 1;
+	attribute_coord = get_attrib(program, "coord");
+	attribute_color = get_attrib(program, "color");
+	glUseProgram(program);
+	glUniform1i(get_uniform(program, "tex"), 0);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glViewport(0, 0, W, H);
+
+	test_batch(face);
+	test_pinned(face);
+
+	glDeleteProgram(program);
+	FT_Done_Face(face);
+	FT_Done_FreeType(ft);
+	return check_summary();
+}
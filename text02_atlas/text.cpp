@@ -15,153 +15,30 @@
 #include FT_FREETYPE_H
 
 #include "../common/shader_utils.h"
+#include "glyph_cache.h"
+#include "text_batch.h"
 
 GLuint program;
 GLint attribute_coord;
+GLint attribute_color;
 GLint uniform_tex;
-GLint uniform_color;
-
-struct point {
-	GLfloat x;
-	GLfloat y;
-	GLfloat s;
-	GLfloat t;
-};
-
-GLuint vbo;
 
 FT_Library ft;
 FT_Face face;
 
-// Maximum texture width
-#define MAXWIDTH 1024
-
 const char *fontfilename;
 
-/**
- * The atlas struct holds a texture that contains the visible US-ASCII characters
- * of a certain font rendered with a certain character height.
- * It also contains an array that contains all the information necessary to
- * generate the appropriate vertex and texture coordinates for each character.
- *
- * After the constructor is run, you don't need to use any FreeType functions anymore.
- */
-struct atlas {
-	GLuint tex;		// texture object
-
-	unsigned int w;			// width of texture in pixels
-	unsigned int h;			// height of texture in pixels
-
-	struct {
-		float ax;	// advance.x
-		float ay;	// advance.y
-
-		float bw;	// bitmap.width;
-		float bh;	// bitmap.height;
-
-		float bl;	// bitmap_left;
-		float bt;	// bitmap_top;
-
-		float tx;	// x offset of glyph in texture coordinates
-		float ty;	// y offset of glyph in texture coordinates
-	} c[128];		// character information
-
-	 atlas(FT_Face face, int height) {
-		FT_Set_Pixel_Sizes(face, 0, height);
-		FT_GlyphSlot g = face->glyph;
-
-		unsigned int roww = 0;
-		unsigned int rowh = 0;
-		 w = 0;
-		 h = 0;
-
-		 memset(c, 0, sizeof c);
-
-		/* Find minimum size for a texture holding all visible ASCII characters */
-		for (int i = 32; i < 128; i++) {
-			if (FT_Load_Char(face, i, FT_LOAD_RENDER)) {
-				fprintf(stderr, "Loading character %c failed!\n", i);
-				continue;
-			}
-			if (roww + g->bitmap.width + 1 >= MAXWIDTH) {
-				w = std::max(w, roww);
-				h += rowh;
-				roww = 0;
-				rowh = 0;
-			}
-			roww += g->bitmap.width + 1;
-			rowh = std::max(rowh, g->bitmap.rows);
-		}
-
-		w = std::max(w, roww);
-		h += rowh;
-
-		/* Create a texture that will be used to hold all ASCII glyphs */
-		glActiveTexture(GL_TEXTURE0);
-		glGenTextures(1, &tex);
-		glBindTexture(GL_TEXTURE_2D, tex);
-		glUniform1i(uniform_tex, 0);
-
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, w, h, 0, GL_ALPHA, GL_UNSIGNED_BYTE, 0);
-
-		/* We require 1 byte alignment when uploading texture data */
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-		/* Clamping to edges is important to prevent artifacts when scaling */
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-		/* Linear filtering usually looks best for text */
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		/* Paste all glyph bitmaps into the texture, remembering the offset */
-		int ox = 0;
-		int oy = 0;
-
-		rowh = 0;
-
-		for (int i = 32; i < 128; i++) {
-			if (FT_Load_Char(face, i, FT_LOAD_RENDER)) {
-				fprintf(stderr, "Loading character %c failed!\n", i);
-				continue;
-			}
-
-			if (ox + g->bitmap.width + 1 >= MAXWIDTH) {
-				oy += rowh;
-				rowh = 0;
-				ox = 0;
-			}
-
-			glTexSubImage2D(GL_TEXTURE_2D, 0, ox, oy, g->bitmap.width, g->bitmap.rows, GL_ALPHA, GL_UNSIGNED_BYTE, g->bitmap.buffer);
-			c[i].ax = g->advance.x >> 6;
-			c[i].ay = g->advance.y >> 6;
-
-			c[i].bw = g->bitmap.width;
-			c[i].bh = g->bitmap.rows;
-
-			c[i].bl = g->bitmap_left;
-			c[i].bt = g->bitmap_top;
-
-			c[i].tx = ox / (float)w;
-			c[i].ty = oy / (float)h;
-
-			rowh = std::max(rowh, g->bitmap.rows);
-			ox += g->bitmap.width + 1;
-		}
-
-		fprintf(stderr, "Generated a %d x %d (%d kb) texture atlas\n", w, h, w * h / 1024);
-	}
-
-	~atlas() {
-		glDeleteTextures(1, &tex);
-	}
-};
-
 atlas *a48;
 atlas *a24;
 atlas *a12;
 
+/* All the text of a frame, drawn at once */
+text_batch *batch;
+
+/* The strings that don't change, laid out once for a given window size */
+#define NB_LABELS 11
+text_layout *labels;
+
 int init_resources() {
 	/* Initialize the FreeType2 library */
 	if (FT_Init_FreeType(&ft)) {
@@ -180,78 +57,37 @@ int init_resources() {
 		return 0;
 
 	attribute_coord = get_attrib(program, "coord");
+	attribute_color = get_attrib(program, "color");
 	uniform_tex = get_uniform(program, "tex");
-	uniform_color = get_uniform(program, "color");
 
-	if(attribute_coord == -1 || uniform_tex == -1 || uniform_color == -1)
+	if(attribute_coord == -1 || attribute_color == -1 || uniform_tex == -1)
 		return 0;
 
-	// Create the vertex buffer object
-	glGenBuffers(1, &vbo);
-
 	/* Create texture atlasses for several font sizes */
-	a48 = new atlas(face, 48);
-	a24 = new atlas(face, 24);
-	a12 = new atlas(face, 12);
+	a48 = new atlas(face, 48, 1024, 512);
+	a24 = new atlas(face, 24, 512, 256);
+	a12 = new atlas(face, 12, 256, 128);
+
+	batch = new text_batch();
+	labels = new text_layout[NB_LABELS];
 
 	return 1;
 }
 
 /**
- * Render text using the currently loaded font and currently set font size.
+ * Render text using the given atlas and color, laid out now and drawn
+ * with the rest of the frame.
  * Rendering starts at coordinates (x, y), z is always 0.
  * The pixel coordinates that the FreeType2 library uses are scaled by (sx, sy).
  */
-void render_text(const char *text, atlas * a, float x, float y, float sx, float sy) {
-	const uint8_t *p;
-
-	/* Use the texture containing the atlas */
-	glBindTexture(GL_TEXTURE_2D, a->tex);
-	glUniform1i(uniform_tex, 0);
-
-	/* Set up the VBO for our vertex data */
-	glEnableVertexAttribArray(attribute_coord);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, 0, 0);
-
-	point coords[6 * strlen(text)];
-	int c = 0;
-
-	/* Loop through all characters */
-	for (p = (const uint8_t *)text; *p; p++) {
-		/* Calculate the vertex and texture coordinates */
-		float x2 = x + a->c[*p].bl * sx;
-		float y2 = -y - a->c[*p].bt * sy;
-		float w = a->c[*p].bw * sx;
-		float h = a->c[*p].bh * sy;
-
-		/* Advance the cursor to the start of the next character */
-		x += a->c[*p].ax * sx;
-		y += a->c[*p].ay * sy;
-
-		/* Skip glyphs that have no pixels */
-		if (!w || !h)
-			continue;
-
-		coords[c++] = (point) {
-		x2, -y2, a->c[*p].tx, a->c[*p].ty};
-		coords[c++] = (point) {
-		x2 + w, -y2, a->c[*p].tx + a->c[*p].bw / a->w, a->c[*p].ty};
-		coords[c++] = (point) {
-		x2, -y2 - h, a->c[*p].tx, a->c[*p].ty + a->c[*p].bh / a->h};
-		coords[c++] = (point) {
-		x2 + w, -y2, a->c[*p].tx + a->c[*p].bw / a->w, a->c[*p].ty};
-		coords[c++] = (point) {
-		x2, -y2 - h, a->c[*p].tx, a->c[*p].ty + a->c[*p].bh / a->h};
-		coords[c++] = (point) {
-		x2 + w, -y2 - h, a->c[*p].tx + a->c[*p].bw / a->w, a->c[*p].ty + a->c[*p].bh / a->h};
-	}
-
-	/* Draw all the character on the screen in one go */
-	glBufferData(GL_ARRAY_BUFFER, sizeof coords, coords, GL_DYNAMIC_DRAW);
-	glDrawArrays(GL_TRIANGLES, 0, c);
+void render_text(const char *text, atlas * a, float x, float y, float sx, float sy, const GLfloat color[4]) {
+	batch->add(text, a, x, y, sx, sy, color);
+}
 
-	glDisableVertexAttribArray(attribute_coord);
+/* The same for text that doesn't change: laid out again only when the window is resized */
+void render_label(int i, const char *text, atlas * a, float x, float y, float sx, float sy, const GLfloat color[4]) {
+	labels[i].set(text, a, x, y, sx, sy, color);
+	batch->add(&labels[i]);
 }
 
 void display() {
@@ -272,34 +108,42 @@ void display() {
 	GLfloat red[4] = { 1, 0, 0, 1 };
 	GLfloat transparent_green[4] = { 0, 1, 0, 0.5 };
 
-	/* Set color to black */
-	glUniform4fv(uniform_color, 1, black);
-
 	/* Effects of alignment */
-	render_text("The Quick Brown Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 50 * sy, sx, sy);
-	render_text("The Misaligned Fox Jumps Over The Lazy Dog", a48, -1 + 8.5 * sx, 1 - 100.5 * sy, sx, sy);
+	render_label(0, "The Quick Brown Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 50 * sy, sx, sy, black);
+	render_label(1, "The Misaligned Fox Jumps Over The Lazy Dog", a48, -1 + 8.5 * sx, 1 - 100.5 * sy, sx, sy, black);
 
 	/* Scaling the texture versus changing the font size */
-	render_text("The Small Texture Scaled Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 175 * sy, sx * 0.5, sy * 0.5);
-	render_text("The Small Font Sized Fox Jumps Over The Lazy Dog", a24, -1 + 8 * sx, 1 - 200 * sy, sx, sy);
-	render_text("The Tiny Texture Scaled Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 235 * sy, sx * 0.25, sy * 0.25);
-	render_text("The Tiny Font Sized Fox Jumps Over The Lazy Dog", a12, -1 + 8 * sx, 1 - 250 * sy, sx, sy);
+	render_label(2, "The Small Texture Scaled Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 175 * sy, sx * 0.5, sy * 0.5, black);
+	render_label(3, "The Small Font Sized Fox Jumps Over The Lazy Dog", a24, -1 + 8 * sx, 1 - 200 * sy, sx, sy, black);
+	render_label(4, "The Tiny Texture Scaled Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 235 * sy, sx * 0.25, sy * 0.25, black);
+	render_label(5, "The Tiny Font Sized Fox Jumps Over The Lazy Dog", a12, -1 + 8 * sx, 1 - 250 * sy, sx, sy, black);
+
+	/* Beyond ASCII: glyphs are rendered into the atlas when first used */
+	render_text("Ξεσκεπάζω τὴν ψυχοφθόρα βδελυγμία", a24, -1 + 8 * sx, 1 - 280 * sy, sx, sy, black);
+	render_text("Съешь же ещё этих мягких французских булок — Zwölf Boxkämpfer jagen Viktor", a12, -1 + 8 * sx, 1 - 292 * sy, sx, sy, black);
 
 	/* Colors and transparency */
-	render_text("The Solid Black Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 430 * sy, sx, sy);
+	render_label(6, "The Solid Black Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 430 * sy, sx, sy, black);
 
-	glUniform4fv(uniform_color, 1, red);
-	render_text("The Solid Red Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 330 * sy, sx, sy);
-	render_text("The Solid Red Fox Jumps Over The Lazy Dog", a48, -1 + 28 * sx, 1 - 450 * sy, sx, sy);
+	render_label(7, "The Solid Red Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 330 * sy, sx, sy, red);
+	render_label(8, "The Solid Red Fox Jumps Over The Lazy Dog", a48, -1 + 28 * sx, 1 - 450 * sy, sx, sy, red);
 
-	glUniform4fv(uniform_color, 1, transparent_green);
-	render_text("The Transparent Green Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 380 * sy, sx, sy);
-	render_text("The Transparent Green Fox Jumps Over The Lazy Dog", a48, -1 + 18 * sx, 1 - 440 * sy, sx, sy);
+	render_label(9, "The Transparent Green Fox Jumps Over The Lazy Dog", a48, -1 + 8 * sx, 1 - 380 * sy, sx, sy, transparent_green);
+	render_label(10, "The Transparent Green Fox Jumps Over The Lazy Dog", a48, -1 + 18 * sx, 1 - 440 * sy, sx, sy, transparent_green);
+
+	/* Draw all the text on the screen in one go per atlas */
+	glUniform1i(uniform_tex, 0);
+	batch->draw(attribute_coord, attribute_color);
 
 	glutSwapBuffers();
 }
 
 void free_resources() {
+	delete[] labels;
+	delete batch;
+	delete a48;
+	delete a24;
+	delete a12;
 	glDeleteProgram(program);
 }
 
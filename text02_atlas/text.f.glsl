@@ -1,7 +1,7 @@
 varying vec2 texpos;
+varying vec4 f_color;
 uniform sampler2D tex;
-uniform vec4 color;
 
 void main(void) {
-  gl_FragColor = vec4(1, 1, 1, texture2D(tex, texpos).a) * color;
+  gl_FragColor = vec4(1, 1, 1, texture2D(tex, texpos).a) * f_color;
 }
@@ -1,7 +1,10 @@
 attribute vec4 coord;
+attribute vec4 color;
 varying vec2 texpos;
+varying vec4 f_color;
 
 void main(void) {
   gl_Position = vec4(coord.xy, 0, 1);
   texpos = coord.zw;
+  f_color = color;
 }
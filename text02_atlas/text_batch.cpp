@@ -0,0 +1,228 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "text_batch.h"
+
+static unsigned int next_version = 1;
+
+static void to_bytes(const GLfloat color[4], GLubyte res[4]) {
+	for (int i = 0; i < 4; i++)
+		res[i] = std::min(std::max(color[i], 0.0f), 1.0f) * 255 + 0.5f;
+}
+
+/**
+ * Append the quads of the text to out: two triangles per glyph that has
+ * pixels.  With pinned, the glyphs are pinned in the atlas and listed
+ * there.  Returns false if some glyphs had no room in the atlas.
+ */
+static bool lay_out(const char* text, atlas* a, float x, float y, float sx, float sy, const GLfloat color[4],
+					std::vector<text_vertex>* out, std::vector<const glyph*>* pinned) {
+	text_vertex v;
+	to_bytes(color, v.color);
+	bool complete = true;
+
+	/* Loop through all characters */
+	for (const char* p = text; *p;) {
+		uint32_t codepoint = utf8_next(&p);
+		const glyph* g = (pinned != NULL) ? a->pin(codepoint) : a->get(codepoint);
+		if (g == NULL) {
+			complete = false;
+			continue;
+		}
+		if (pinned != NULL)
+			pinned->push_back(g);
+
+		/* Calculate the vertex and texture coordinates */
+		float x2 = x + g->bl * sx;
+		float y2 = -y - g->bt * sy;
+		float w = g->bw * sx;
+		float h = g->bh * sy;
+
+		/* Advance the cursor to the start of the next character */
+		x += g->ax * sx;
+		y += g->ay * sy;
+
+		/* Skip glyphs that have no pixels */
+		if (!w || !h)
+			continue;
+
+		float s0 = g->tx, s1 = g->tx + g->bw / a->w;
+		float t0 = g->ty, t1 = g->ty + g->bh / a->h;
+		const float corners[6][4] = {
+			{ x2, -y2, s0, t0 },
+			{ x2 + w, -y2, s1, t0 },
+			{ x2, -y2 - h, s0, t1 },
+			{ x2 + w, -y2, s1, t0 },
+			{ x2, -y2 - h, s0, t1 },
+			{ x2 + w, -y2 - h, s1, t1 },
+		};
+		for (int i = 0; i < 6; i++) {
+			v.x = corners[i][0];
+			v.y = corners[i][1];
+			v.s = corners[i][2];
+			v.t = corners[i][3];
+			out->push_back(v);
+		}
+	}
+	return complete;
+}
+
+text_layout::text_layout() : a(NULL), x(0), y(0), sx(0), sy(0), complete(false), version(0) {
+	memset(color, 0, sizeof(color));
+}
+
+text_layout::~text_layout() {
+	clear();
+}
+
+void text_layout::set(const char* text, atlas* a, float x, float y, float sx, float sy, const GLfloat color[4]) {
+	if (complete && a == this->a && x == this->x && y == this->y && sx == this->sx && sy == this->sy
+		&& memcmp(color, this->color, sizeof(this->color)) == 0 && this->text == text)
+		return;
+
+	/* Pinned again before being unpinned, not to evict and render again the glyphs still used */
+	std::vector<const glyph*> old_pinned;
+	old_pinned.swap(pinned);
+	vertices.clear();
+	complete = lay_out(text, a, x, y, sx, sy, color, &vertices, &pinned);
+	for (unsigned int i = 0; i < old_pinned.size(); i++)
+		this->a->unpin(old_pinned[i]);
+
+	this->text = text;
+	this->a = a;
+	this->x = x;
+	this->y = y;
+	this->sx = sx;
+	this->sy = sy;
+	memcpy(this->color, color, sizeof(this->color));
+	version = next_version++;
+}
+
+void text_layout::clear() {
+	for (unsigned int i = 0; i < pinned.size(); i++)
+		a->unpin(pinned[i]);
+	pinned.clear();
+	vertices.clear();
+	text.clear();
+	a = NULL;
+	complete = false;
+	version = next_version++;
+}
+
+text_batch::text_batch() : vbo(0) {
+	memset(&stats, 0, sizeof(stats));
+}
+
+text_batch::~text_batch() {
+	glDeleteBuffers(1, &vbo);
+}
+
+text_batch::atlas_pieces* text_batch::pieces_of(atlas* a) {
+	for (unsigned int i = 0; i < frame.size(); i++)
+		if (frame[i].a == a)
+			return &frame[i];
+	atlas_pieces p;
+	p.a = a;
+	p.first = 0;
+	p.count = 0;
+	frame.push_back(p);
+	return &frame.back();
+}
+
+void text_batch::add(const char* text, atlas* a, float x, float y, float sx, float sy, const GLfloat color[4]) {
+	piece p;
+	p.layout = NULL;
+	p.version = 0;
+	p.first = strings.size();
+	lay_out(text, a, x, y, sx, sy, color, &strings, NULL);
+	p.count = strings.size() - p.first;
+	if (p.count > 0)
+		pieces_of(a)->pieces.push_back(p);
+}
+
+void text_batch::add(const text_layout* layout) {
+	if (layout->vertices.empty())
+		return;
+	piece p;
+	p.layout = layout;
+	p.version = layout->version;
+	p.first = 0;
+	p.count = layout->vertices.size();
+	pieces_of(layout->a)->pieces.push_back(p);
+}
+
+bool text_batch::same_as_last_frame() const {
+	if (frame.size() != last_frame.size() || strings.size() != last_strings.size())
+		return false;
+	for (unsigned int i = 0; i < frame.size(); i++) {
+		const std::vector<piece>& pieces = frame[i].pieces;
+		const std::vector<piece>& last_pieces = last_frame[i].pieces;
+		if (frame[i].a != last_frame[i].a || pieces.size() != last_pieces.size())
+			return false;
+		for (unsigned int j = 0; j < pieces.size(); j++)
+			if (pieces[j].layout != last_pieces[j].layout || pieces[j].version != last_pieces[j].version
+				|| pieces[j].first != last_pieces[j].first || pieces[j].count != last_pieces[j].count)
+				return false;
+	}
+	return strings.empty() || memcmp(&strings[0], &last_strings[0], strings.size() * sizeof(text_vertex)) == 0;
+}
+
+/**
+ * Draw the text added since the last call, and start a new frame: the
+ * glyphs used in this one may be evicted from now on.
+ */
+void text_batch::draw(GLint attribute_coord, GLint attribute_color) {
+	stats.frames++;
+	if (vbo == 0)
+		glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	if (!same_as_last_frame()) {
+		/* The strings of each atlas together, in one buffer for all */
+		vertices.clear();
+		for (unsigned int i = 0; i < frame.size(); i++) {
+			atlas_pieces& ap = frame[i];
+			ap.first = vertices.size();
+			for (unsigned int j = 0; j < ap.pieces.size(); j++) {
+				const piece& p = ap.pieces[j];
+				const text_vertex* v = (p.layout != NULL) ? &p.layout->vertices[0] : &strings[p.first];
+				vertices.insert(vertices.end(), v, v + p.count);
+			}
+			ap.count = vertices.size() - ap.first;
+		}
+		/* A new buffer, rather than waiting for the GPU to be done with the last one */
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(text_vertex),
+					 vertices.empty() ? NULL : &vertices[0], GL_STREAM_DRAW);
+		stats.uploads++;
+		stats.uploaded_bytes += vertices.size() * sizeof(text_vertex);
+		frame.swap(last_frame);
+		strings.swap(last_strings);
+	}
+	frame.clear();
+	strings.clear();
+
+	glEnableVertexAttribArray(attribute_coord);
+	glEnableVertexAttribArray(attribute_color);
+	glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, sizeof(text_vertex), 0);
+	glVertexAttribPointer(attribute_color, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(text_vertex),
+						  (const GLvoid*)offsetof(text_vertex, color));
+
+	/* Use the texture containing each atlas, with the glyphs used for the first time */
+	glActiveTexture(GL_TEXTURE0);
+	for (unsigned int i = 0; i < last_frame.size(); i++) {
+		atlas_pieces& ap = last_frame[i];
+		ap.a->upload();
+		glBindTexture(GL_TEXTURE_2D, ap.a->tex);
+		glDrawArrays(GL_TRIANGLES, ap.first, ap.count);
+		stats.draws++;
+		ap.a->next_frame();
+	}
+
+	glDisableVertexAttribArray(attribute_coord);
+	glDisableVertexAttribArray(attribute_color);
+}
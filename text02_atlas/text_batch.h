@@ -0,0 +1,100 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Sylvain Beucler
+ */
+#ifndef _TEXT_BATCH_H
+#define _TEXT_BATCH_H
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include "glyph_cache.h"
+
+/* A corner of a glyph's quad */
+struct text_vertex {
+	GLfloat x, y;	// coord.xy: position
+	GLfloat s, t;	// coord.zw: texture coordinates in the atlas
+	GLubyte color[4];
+};
+
+/**
+ * Text laid out once, at a certain place, scale and color: its quads
+ * are kept, and its glyphs pinned in the atlas, until set() is given
+ * something else.  For the labels that don't change from one frame to
+ * the next.  To be cleared or destroyed before its atlas.
+ */
+class text_layout {
+public:
+	text_layout();
+	~text_layout();
+	/* Cheap when nothing changed since the last call */
+	void set(const char* text, atlas* a, float x, float y, float sx, float sy, const GLfloat color[4]);
+	void clear();
+private:
+	friend class text_batch;
+	std::string text;
+	atlas* a;
+	float x, y, sx, sy;
+	GLfloat color[4];
+	bool complete;		// false if some glyphs had no room in the atlas
+	unsigned int version;	// changes with every layout, of any text_layout
+	std::vector<text_vertex> vertices;
+	std::vector<const glyph*> pinned;
+
+	text_layout(const text_layout&) = delete;
+	text_layout& operator=(const text_layout&) = delete;
+};
+
+struct text_batch_stats {
+	unsigned long frames;
+	unsigned long draws;
+	unsigned long uploads;		// frames that were not the same as the one before
+	unsigned long uploaded_bytes;
+};
+
+/**
+ * All the text of a frame, drawn at once by draw(): one streaming
+ * vertex buffer, one glDrawArrays per atlas.  The strings of an atlas
+ * are drawn in the order they were added, the atlasses in the order of
+ * their first string.  A frame with the same text as the one before is
+ * not uploaded again.
+ */
+class text_batch {
+public:
+	text_batch();
+	~text_batch();
+	/* Laid out now, for this frame */
+	void add(const char* text, atlas* a, float x, float y, float sx, float sy, const GLfloat color[4]);
+	/* Copied as it is; it must not change until draw() */
+	void add(const text_layout* layout);
+	/* With a program that has these attributes, see text.v.glsl, and texture unit 0 for its sampler */
+	void draw(GLint attribute_coord, GLint attribute_color);
+
+	text_batch_stats stats;
+
+private:
+	/* A string added to the frame: in strings, or a text_layout */
+	struct piece {
+		const text_layout* layout;
+		unsigned int version;
+		size_t first, count;
+	};
+	struct atlas_pieces {
+		atlas* a;
+		std::vector<piece> pieces;
+		GLint first;		// in the vertex buffer
+		GLsizei count;
+	};
+	std::vector<atlas_pieces> frame, last_frame;
+	std::vector<text_vertex> strings, last_strings;
+	std::vector<text_vertex> vertices;	// what the vertex buffer gets
+	GLuint vbo;
+
+	atlas_pieces* pieces_of(atlas* a);
+	bool same_as_last_frame() const;
+
+	text_batch(const text_batch&) = delete;
+	text_batch& operator=(const text_batch&) = delete;
+};
+#endif
@@ -0,0 +1,31 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ * Contributors: Martin Kraus, Sylvain Beucler
+ */
+attribute vec4 v_coord;
+attribute vec3 v_normal;
+attribute vec2 v_texcoords;
+attribute vec3 v_tangent;
+attribute mat4 m_instance;                 // model matrix, per instance
+attribute mat3 m_3x3_inv_transp_instance;  // normal matrix, per instance
+uniform mat4 v, p;
+varying vec4 position;  // position of the vertex (and fragment) in world space
+varying vec2 texCoords;
+varying mat3 localSurface2World; // mapping from local surface coordinates to world coordinates
+
+void main()
+{
+  mat4 mvp = p*v*m_instance;
+  position = m_instance * v_coord;
+
+  // the signs and whether tangent is in localSurface2View[1] or
+  // localSurface2View[0] depends on the tangent attribute, texture
+  // coordinates, and the encoding of the normal map
+  localSurface2World[0] = normalize(vec3(m_instance * vec4(v_tangent, 0.0)));
+  localSurface2World[2] = normalize(m_3x3_inv_transp_instance * v_normal);
+  localSurface2World[1] = normalize(cross(localSurface2World[2], localSurface2World[0]));
+
+  texCoords = v_texcoords;
+  gl_Position = mvp * v_coord;
+}
@@ -5,6 +5,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <vector>
 /* Use glew.h instead of gl.h to get all the GL prototypes declared */
@@ -19,27 +20,50 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <SOIL/SOIL.h>
 #include "../common/shader_utils.h"
+#include "../common/geometry_pool.h"
+#include "../common/mesh_optimizer.h"
 
 #include <iostream>
 using namespace std;
 
 int screen_width=800, screen_height=600;
-GLuint program;
+GLuint program, program_instanced;
+bool instancing_supported = false;  // GL_ARB_instanced_arrays and GL_ARB_draw_instanced
 GLuint normalmap_id;
 GLuint sphere_vbo = -1;
 GLint attribute_v_coord = -1, attribute_v_normal = -1, attribute_v_texcoords = -1, attribute_v_tangent = 1;
 GLint uniform_m = -1, uniform_v = -1, uniform_p = -1,
     uniform_m_3x3_inv_transp = -1, uniform_v_inv = -1,
     uniform_normalmap = -1;
+GLint attribute_m_instance = -1, attribute_m_3x3_inv_transp_instance = -1;
+GLint uniform_instanced_v = -1, uniform_instanced_p = -1, uniform_instanced_v_inv = -1,
+    uniform_instanced_normalmap = -1;
+
+/*
+ * Stress scene ('s' key): STRESS_SIDE x STRESS_SIDE small cubes, drawn
+ * one Mesh::draw() at a time, or all at once by a MeshInstanceBatch
+ * ('i' key), to compare the CPU time spent submitting them.
+ */
+#define STRESS_SIDE 100
+static bool stress_scene = false, stress_instanced = true;
+static double submit_time_total = 0;  // ms, since fps_start
+static unsigned int fps_start = 0, fps_frames = 0;
+
+/* --bench: time the stress scene both ways, then quit */
+static bool bench_mode = false;
+static int bench_frame = 0;
+#define BENCH_WARMUP 20
+#define BENCH_FRAMES 200
 
 struct demo {
     const char* texture_filename;
     const char* vshader_filename;
     const char* fshader_filename;
+    const char* vshader_instanced_filename;  // same, with per-instance model matrices
 };
 struct demo demos[] = {
     // Lighting of Bumpy Surfaces
-    { "IntP_Brick_NormalMap.png", "cube.v.glsl", "cube.f.glsl" },
+    { "IntP_Brick_NormalMap.png", "cube.v.glsl", "cube.f.glsl", "cube-instanced.v.glsl" },
 };
 int cur_demo = 0;
 
@@ -48,6 +72,7 @@ int cur_demo = 0;
 class Mesh {
 private:
   GLuint vbo_vertices, vbo_normals, vbo_texcoords, vbo_tangents, ibo_elements;
+  GLsizei nb_elements;  // in ibo_elements, rather than asking GL at each draw
 public:
   vector<glm::vec4> vertices;
   vector<glm::vec3> normals;
@@ -57,7 +82,7 @@ public:
   glm::mat4 object2world;
 
   Mesh() : vbo_vertices(0), vbo_normals(0), vbo_texcoords(0), vbo_tangents(0),
-           ibo_elements(0), object2world(glm::mat4(1)) {}
+           ibo_elements(0), nb_elements(0), object2world(glm::mat4(1)) {}
   ~Mesh() {
     if (vbo_vertices != 0)
       glDeleteBuffers(1, &vbo_vertices);
@@ -104,51 +129,75 @@ public:
     }
   }
 
+  /**
+   * Reorder the triangles for the post-transform cache and overdraw,
+   * and the vertices in the order they are drawn, see
+   * ../common/mesh_optimizer.cpp
+   */
+  void optimize() {
+    mesh_stats before, after;
+    vector<unsigned int> int_elements(elements.begin(), elements.end()), remap;
+    mesh_optimize(int_elements, vertices, &remap, &before, &after);
+    elements.assign(int_elements.begin(), int_elements.end());
+    mesh_remap(vertices, remap);
+    mesh_remap(normals, remap);
+    mesh_remap(texcoords, remap);
+    mesh_remap(tangents, remap);
+    printf("%lu triangles: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", elements.size() / 3,
+	   before.acmr, after.acmr, before.atvr, after.atvr);
+  }
+
   /**
    * Store object vertices, normals and/or elements in graphic card
-   * buffers
+   * buffers, reusing the ones from a previous upload
    */
   void upload() {
     if (this->vertices.size() > 0) {
-      glGenBuffers(1, &this->vbo_vertices);
+      if (this->vbo_vertices == 0)
+	this->vbo_vertices = gen_buffer();
       glBindBuffer(GL_ARRAY_BUFFER, this->vbo_vertices);
       glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(this->vertices[0]),
 		   this->vertices.data(), GL_STATIC_DRAW);
     }
 
     if (this->normals.size() > 0) {
-      glGenBuffers(1, &this->vbo_normals);
+      if (this->vbo_normals == 0)
+	this->vbo_normals = gen_buffer();
       glBindBuffer(GL_ARRAY_BUFFER, this->vbo_normals);
       glBufferData(GL_ARRAY_BUFFER, this->normals.size() * sizeof(this->normals[0]),
 		   this->normals.data(), GL_STATIC_DRAW);
     }
 
     if (this->texcoords.size() > 0) {
-      glGenBuffers(1, &this->vbo_texcoords);
+      if (this->vbo_texcoords == 0)
+	this->vbo_texcoords = gen_buffer();
       glBindBuffer(GL_ARRAY_BUFFER, this->vbo_texcoords);
       glBufferData(GL_ARRAY_BUFFER, this->texcoords.size() * sizeof(this->texcoords[0]),
 		   this->texcoords.data(), GL_STATIC_DRAW);
     }
     
     if (this->tangents.size() > 0) {
-      glGenBuffers(1, &this->vbo_tangents);
+      if (this->vbo_tangents == 0)
+	this->vbo_tangents = gen_buffer();
       glBindBuffer(GL_ARRAY_BUFFER, this->vbo_tangents);
       glBufferData(GL_ARRAY_BUFFER, this->tangents.size() * sizeof(this->tangents[0]),
 		   this->tangents.data(), GL_STATIC_DRAW);
     }
     
     if (this->elements.size() > 0) {
-      glGenBuffers(1, &this->ibo_elements);
+      if (this->ibo_elements == 0)
+	this->ibo_elements = gen_buffer();
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
       glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->elements.size() * sizeof(this->elements[0]),
 		   this->elements.data(), GL_STATIC_DRAW);
+      this->nb_elements = this->elements.size();
     }
   }
 
   /**
-   * Draw the object
+   * Point the vertex attributes to the object's buffers
    */
-  void draw() {
+  void enable_attributes() const {
     if (this->vbo_vertices != 0) {
       glEnableVertexAttribArray(attribute_v_coord);
       glBindBuffer(GL_ARRAY_BUFFER, this->vbo_vertices);
@@ -200,23 +249,9 @@ public:
         0                    // offset of first element
       );
     }
-    
-    /* Apply object's transformation matrix */
-    glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(this->object2world));
-    /* Transform normal vectors with transpose of inverse of upper left
-       3x3 model matrix (ex-gl_NormalMatrix): */
-    glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(this->object2world)));
-    glUniformMatrix3fv(uniform_m_3x3_inv_transp, 1, GL_FALSE, glm::value_ptr(m_3x3_inv_transp));
-    
-    /* Push each element in buffer_vertices to the vertex shader */
-    if (this->ibo_elements != 0) {
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
-      int size;  glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-      glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
-    } else {
-      glDrawArrays(GL_TRIANGLES, 0, this->vertices.size());
-    }
+  }
 
+  void disable_attributes() const {
     if (this->vbo_tangents != 0)
       glDisableVertexAttribArray(attribute_v_tangent);
     if (this->vbo_texcoords != 0)
@@ -226,9 +261,134 @@ public:
     if (this->vbo_vertices != 0)
       glDisableVertexAttribArray(attribute_v_coord);
   }
+
+  /**
+   * Push each element in buffer_vertices to the vertex shader,
+   * instances times when there is more than one (GL_ARB_draw_instanced)
+   */
+  void draw_elements(GLsizei instances = 1) const {
+    if (this->ibo_elements != 0) {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
+      if (instances == 1)
+	glDrawElements(GL_TRIANGLES, this->nb_elements, GL_UNSIGNED_SHORT, 0);
+      else
+	glDrawElementsInstancedARB(GL_TRIANGLES, this->nb_elements, GL_UNSIGNED_SHORT, 0, instances);
+    } else {
+      if (instances == 1)
+	glDrawArrays(GL_TRIANGLES, 0, this->vertices.size());
+      else
+	glDrawArraysInstancedARB(GL_TRIANGLES, 0, this->vertices.size(), instances);
+    }
+  }
+
+  /**
+   * Draw the object
+   */
+  void draw() {
+    enable_attributes();
+
+    /* Apply object's transformation matrix */
+    glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(this->object2world));
+    /* Transform normal vectors with transpose of inverse of upper left
+       3x3 model matrix (ex-gl_NormalMatrix): */
+    glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(this->object2world)));
+    glUniformMatrix3fv(uniform_m_3x3_inv_transp, 1, GL_FALSE, glm::value_ptr(m_3x3_inv_transp));
+
+    draw_elements();
+    disable_attributes();
+  }
 };
 Mesh cube;
 
+/*
+ * Copies of a mesh drawn together: each copy has its model and normal
+ * matrices in an instance buffer, read by the per-instance attributes
+ * of cube-instanced.v.glsl, instead of uniforms set before each draw
+ * call.  One draw call for all of them with GL_ARB_instanced_arrays,
+ * otherwise one per copy, the matrices going in as constant attribute
+ * values.
+ */
+#define INSTANCE_FLOATS (16+9)  // mat4 model, mat3 normal matrix
+class MeshInstanceBatch {
+private:
+  GLuint vbo_instances;
+  vector<GLfloat> data;  // INSTANCE_FLOATS per instance, as in vbo_instances
+public:
+  const Mesh* mesh;
+  vector<glm::mat4> object2world;  // one per copy
+
+  MeshInstanceBatch() : vbo_instances(0), mesh(NULL) {}
+  ~MeshInstanceBatch() {
+    if (vbo_instances != 0)
+      glDeleteBuffers(1, &vbo_instances);
+  }
+
+  /**
+   * Compute the normal matrices and send both matrices of all the
+   * copies to the instance buffer, once per frame when they move
+   */
+  void upload() {
+    this->data.resize(this->object2world.size() * INSTANCE_FLOATS);
+    for (unsigned int i = 0; i < this->object2world.size(); i++) {
+      glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(this->object2world[i])));
+      memcpy(&this->data[i*INSTANCE_FLOATS], glm::value_ptr(this->object2world[i]), 16*sizeof(GLfloat));
+      memcpy(&this->data[i*INSTANCE_FLOATS + 16], glm::value_ptr(m_3x3_inv_transp), 9*sizeof(GLfloat));
+    }
+    if (!instancing_supported)
+      return;
+    if (this->vbo_instances == 0)
+      this->vbo_instances = gen_buffer();
+    glBindBuffer(GL_ARRAY_BUFFER, this->vbo_instances);
+    // a new buffer each time, rather than waiting for the previous frame to be done with it
+    glBufferData(GL_ARRAY_BUFFER, this->data.size() * sizeof(GLfloat), this->data.data(), GL_STREAM_DRAW);
+  }
+
+  /**
+   * Draw all the copies, with program_instanced in use
+   */
+  void draw() {
+    GLsizei nb_instances = this->object2world.size();
+    if (this->mesh == NULL || nb_instances == 0)
+      return;
+    this->mesh->enable_attributes();
+    if (instancing_supported) {
+      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_instances);
+      for (int k = 0; k < 4; k++) {
+	glEnableVertexAttribArray(attribute_m_instance + k);
+	glVertexAttribPointer(attribute_m_instance + k, 4, GL_FLOAT, GL_FALSE, INSTANCE_FLOATS*sizeof(GLfloat),
+			      (GLvoid*)(4*k*sizeof(GLfloat)));  // column k
+	glVertexAttribDivisorARB(attribute_m_instance + k, 1);
+      }
+      for (int k = 0; k < 3; k++) {
+	glEnableVertexAttribArray(attribute_m_3x3_inv_transp_instance + k);
+	glVertexAttribPointer(attribute_m_3x3_inv_transp_instance + k, 3, GL_FLOAT, GL_FALSE,
+			      INSTANCE_FLOATS*sizeof(GLfloat), (GLvoid*)((16 + 3*k)*sizeof(GLfloat)));
+	glVertexAttribDivisorARB(attribute_m_3x3_inv_transp_instance + k, 1);
+      }
+      this->mesh->draw_elements(nb_instances);
+      for (int k = 0; k < 4; k++) {
+	glVertexAttribDivisorARB(attribute_m_instance + k, 0);
+	glDisableVertexAttribArray(attribute_m_instance + k);
+      }
+      for (int k = 0; k < 3; k++) {
+	glVertexAttribDivisorARB(attribute_m_3x3_inv_transp_instance + k, 0);
+	glDisableVertexAttribArray(attribute_m_3x3_inv_transp_instance + k);
+      }
+    } else {
+      for (GLsizei i = 0; i < nb_instances; i++) {
+	const GLfloat* instance = &this->data[i*INSTANCE_FLOATS];
+	for (int k = 0; k < 4; k++)
+	  glVertexAttrib4fv(attribute_m_instance + k, instance + 4*k);
+	for (int k = 0; k < 3; k++)
+	  glVertexAttrib3fv(attribute_m_3x3_inv_transp_instance + k, instance + 16 + 3*k);
+	this->mesh->draw_elements();
+      }
+    }
+    this->mesh->disable_attributes();
+  }
+};
+MeshInstanceBatch cubes;
+
 int init_resources()
 {
   printf("init_resources: %s %s %s\n",
@@ -319,8 +479,48 @@ int init_resources()
     fprintf(stderr, "Warning: Could not bind uniform %s\n", uniform_name);
   }
 
+  // Same shading for MeshInstanceBatch, with the mesh attributes where
+  // Mesh puts them
+  GLuint vs_instanced;
+  if ((vs_instanced = create_shader(demos[cur_demo].vshader_instanced_filename, GL_VERTEX_SHADER)) == 0) return 0;
+  program_instanced = glCreateProgram();
+  glAttachShader(program_instanced, vs_instanced);
+  glAttachShader(program_instanced, fs);
+  glBindAttribLocation(program_instanced, attribute_v_coord, "v_coord");
+  if (attribute_v_normal != -1)
+    glBindAttribLocation(program_instanced, attribute_v_normal, "v_normal");
+  glBindAttribLocation(program_instanced, attribute_v_texcoords, "v_texcoords");
+  if (attribute_v_tangent != -1)
+    glBindAttribLocation(program_instanced, attribute_v_tangent, "v_tangent");
+  glLinkProgram(program_instanced);
+  // The programs keep them as long as they need them
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  glDeleteShader(vs_instanced);
+  glGetProgramiv(program_instanced, GL_LINK_STATUS, &link_ok);
+  if (!link_ok) {
+    fprintf(stderr, "glLinkProgram:");
+    print_log(program_instanced);
+    return 0;
+  }
+  // matrices take one location per column
+  attribute_m_instance = get_attrib(program_instanced, "m_instance");
+  attribute_m_3x3_inv_transp_instance = get_attrib(program_instanced, "m_3x3_inv_transp_instance");
+  uniform_instanced_v = get_uniform(program_instanced, "v");
+  uniform_instanced_p = get_uniform(program_instanced, "p");
+  uniform_instanced_v_inv = glGetUniformLocation(program_instanced, "v_inv");
+  uniform_instanced_normalmap = glGetUniformLocation(program_instanced, "normalmap");
+  if (attribute_m_instance == -1 || attribute_m_3x3_inv_transp_instance == -1
+      || uniform_instanced_v == -1 || uniform_instanced_p == -1)
+    return 0;
+
 
-  // Cube
+  // Cube, rebuilt when switching demos
+  cube.vertices.clear();
+  cube.normals.clear();
+  cube.texcoords.clear();
+  cube.tangents.clear();
+  cube.elements.clear();
 
   // front
   cube.vertices.push_back(glm::vec4(-1.0, -1.0,  1.0,  1.0));
@@ -393,8 +593,12 @@ int init_resources()
     cube.elements.push_back(cube_elements[i]);
 
   cube.compute_tangents();
+  cube.optimize();
 
   cube.upload();
+  cubes.mesh = &cube;
+  cubes.object2world.resize(STRESS_SIDE * STRESS_SIDE);
+  printf("%lu buffers created so far\n", gl_buffers_created);
  
   return 1;
 }
@@ -402,6 +606,7 @@ int init_resources()
 void free_resources()
 {
   glDeleteProgram(program);
+  glDeleteProgram(program_instanced);
   glDeleteTextures(1, &normalmap_id);
 }
 
@@ -426,6 +631,24 @@ void logic() {
 
   glUniformMatrix4fv(uniform_p, 1, GL_FALSE, glm::value_ptr(projection));
 
+  glUseProgram(program_instanced);
+  glUniformMatrix4fv(uniform_instanced_v, 1, GL_FALSE, glm::value_ptr(view));
+  glUniformMatrix4fv(uniform_instanced_v_inv, 1, GL_FALSE, glm::value_ptr(v_inv));
+  glUniformMatrix4fv(uniform_instanced_p, 1, GL_FALSE, glm::value_ptr(projection));
+
+  if (stress_scene) {
+    // A field of small cubes around the big one's place, each turning
+    // with its own phase
+    for (int z = 0; z < STRESS_SIDE; z++) {
+      for (int x = 0; x < STRESS_SIDE; x++) {
+	glm::vec3 position = object_position + glm::vec3(x - STRESS_SIDE/2, -1, z - STRESS_SIDE/2) * 0.04f;
+	cubes.object2world[z*STRESS_SIDE + x] =
+	  glm::rotate(glm::translate(glm::mat4(1.0f), position), angle*4.0f + x + z, glm::vec3(1, 1, 0))
+	  * glm::scale(glm::mat4(1.0f), glm::vec3(0.012f));
+      }
+    }
+  }
+
   glutPostRedisplay();
 }
 
@@ -440,13 +663,79 @@ void draw()
   glBindTexture(GL_TEXTURE_2D, normalmap_id);
   glUniform1i(uniform_normalmap, /*GL_TEXTURE*/0);
 
-  cube.draw();
+  if (!stress_scene) {
+    cube.draw();
+    return;
+  }
+
+  if (stress_instanced) {
+    glUseProgram(program_instanced);
+    glUniform1i(uniform_instanced_normalmap, /*GL_TEXTURE*/0);
+    cubes.upload();
+    cubes.draw();
+  } else {
+    glm::mat4 object2world = cube.object2world;
+    for (unsigned int i = 0; i < cubes.object2world.size(); i++) {
+      cube.object2world = cubes.object2world[i];
+      cube.draw();
+    }
+    cube.object2world = object2world;
+  }
+}
+
+/**
+ * Called after each frame in --bench mode: BENCH_FRAMES frames of the
+ * stress scene with Mesh::draw(), then with MeshInstanceBatch
+ */
+void bench_step(double submit_time, double frame_time) {
+  static double submit_total, frame_total;
+  bench_frame++;
+  if (bench_frame > BENCH_WARMUP) {
+    submit_total += submit_time;
+    frame_total += frame_time;
+  }
+  if (bench_frame < BENCH_WARMUP + BENCH_FRAMES)
+    return;
+
+  printf("%-28s %8.3f ms submit/frame  %8.3f ms/frame\n",
+	 stress_instanced ? (instancing_supported ? "MeshInstanceBatch" : "MeshInstanceBatch (no ARB)")
+	 : "Mesh::draw() per object", submit_total / BENCH_FRAMES, frame_total / BENCH_FRAMES);
+  if (stress_instanced) {
+    glutLeaveMainLoop();
+    return;
+  }
+  stress_instanced = true;
+  bench_frame = 0;
+  submit_total = frame_total = 0;
 }
 
 void onDisplay() {
   logic();
+  int start = glutGet(GLUT_ELAPSED_TIME);
   draw();
+  double submit_time = glutGet(GLUT_ELAPSED_TIME) - start;
+  if (bench_mode)
+    glFinish();  // include GPU time
+  double frame_time = glutGet(GLUT_ELAPSED_TIME) - start;
   glutSwapBuffers();
+
+  if (bench_mode) {
+    bench_step(submit_time, frame_time);
+    return;
+  }
+  if (!stress_scene)
+    return;
+  submit_time_total += submit_time;
+  fps_frames++;
+  int delta_t = glutGet(GLUT_ELAPSED_TIME) - fps_start;
+  if (delta_t > 1000) {
+    printf("%d cubes, %s: %.1f fps, %.3f ms submit/frame\n", STRESS_SIDE * STRESS_SIDE,
+	   stress_instanced ? "MeshInstanceBatch" : "Mesh::draw() per object",
+	   1000.0 * fps_frames / delta_t, submit_time_total / fps_frames);
+    fps_frames = 0;
+    fps_start = glutGet(GLUT_ELAPSED_TIME);
+    submit_time_total = 0;
+  }
 }
 
 void onReshape(int width, int height) {
@@ -455,6 +744,26 @@ void onReshape(int width, int height) {
   glViewport(0, 0, screen_width, screen_height);
 }
 
+void onKeyboard(unsigned char key, int x, int y) {
+  switch (key) {
+  case 's':
+    stress_scene = !stress_scene;
+    break;
+  case 'i':
+    stress_instanced = !stress_instanced;
+    break;
+  default:
+    return;
+  }
+  if (stress_scene)
+    glEnable(GL_DEPTH_TEST);
+  else
+    glDisable(GL_DEPTH_TEST);
+  fps_frames = 0;
+  fps_start = glutGet(GLUT_ELAPSED_TIME);
+  submit_time_total = 0;
+}
+
 void onMouse(int button, int state, int x, int y) {
   if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
       free_resources();
@@ -480,11 +789,23 @@ int main(int argc, char* argv[]) {
     fprintf(stderr, "Error: your graphic card does not support OpenGL 2.0\n");
     return EXIT_FAILURE;
   }
+  instancing_supported = GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced;
+  if (!instancing_supported)
+    fprintf(stderr, "No GL_ARB_instanced_arrays: MeshInstanceBatch draws one copy at a time\n");
+
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    bench_mode = true;
+    stress_scene = true;
+    stress_instanced = false;
+  }
 
   if (init_resources()) {
     glutDisplayFunc(onDisplay);
     glutReshapeFunc(onReshape);
+    glutKeyboardFunc(onKeyboard);
     glutMouseFunc(onMouse);
+    if (stress_scene)
+      glEnable(GL_DEPTH_TEST);
 
     // glEnable(GL_DEPTH_TEST);
 